@@ -31,6 +31,12 @@ const UINT NUM_PARTICLES_32K		 = 32 * 1024;
 const UINT NUM_PARTICLES_64K		 = 64 * 1024;
 const UINT NUM_PARTICLES_128K	 = 128 * 1024;
 const UINT NUM_PARTICLES_256K	 = 256 * 1024;
+const UINT NUM_PARTICLES_512K	 = 512 * 1024;
+const UINT NUM_PARTICLES_1M		 = 1024 * 1024;
+const UINT NUM_PARTICLES_2M		 = 2 * 1024 * 1024;
+const UINT NUM_PARTICLES_4M		 = 4 * 1024 * 1024;
+const UINT NUM_PARTICLES_8M		 = 8 * 1024 * 1024;
+const UINT NUM_PARTICLES_16M	 = 16 * 1024 * 1024;
 
 const UINT num_particles_list[] =
 {
@@ -39,7 +45,13 @@ const UINT num_particles_list[] =
 	NUM_PARTICLES_32K,	
 	NUM_PARTICLES_64K,	
 	NUM_PARTICLES_128K,
-	NUM_PARTICLES_256K
+	NUM_PARTICLES_256K,
+	NUM_PARTICLES_512K,
+	NUM_PARTICLES_1M,
+	NUM_PARTICLES_2M,
+	NUM_PARTICLES_4M,
+	NUM_PARTICLES_8M,
+	NUM_PARTICLES_16M
 };
 
 const WCHAR* num_particles_name_list[] =
@@ -49,15 +61,42 @@ const WCHAR* num_particles_name_list[] =
 	L"32K",	
 	L"64K",	
 	L"128K",
-	L"256K"
+	L"256K",
+	L"512K",
+	L"1M",
+	L"2M",
+	L"4M",
+	L"8M",
+	L"16M"
 };
 
-UINT g_iNumParticles = NUM_PARTICLES_16K;
+#define SIMULATION_BLOCK_SIZE 512
+#define BITONIC_BLOCK_SIZE 512
+#define TRANSPOSE_BLOCK_SIZE 16
 
-const UINT NUM_GRID_DIM_X = 32;
-const UINT NUM_GRID_DIM_Y = 32;
-const UINT NUM_GRID_DIM_Z = 32;
-const UINT NUM_GRID_INDICES = NUM_GRID_DIM_X * NUM_GRID_DIM_Y * NUM_GRID_DIM_Z;
+// Any count works: the last thread group of every pass skips the tail, so the
+// limit is the number of groups a single Dispatch can launch
+const UINT MAX_NUM_PARTICLES = D3D11_CS_DISPATCH_MAX_THREAD_GROUPS_PER_DIMENSION * SIMULATION_BLOCK_SIZE;
+// GPUSort needs a power of two that is a multiple of BITONIC_BLOCK_SIZE * TRANSPOSE_BLOCK_SIZE,
+// and at most as many elements as one Dispatch of BitonicSort covers
+const UINT MIN_BITONIC_ELEMENTS = BITONIC_BLOCK_SIZE * TRANSPOSE_BLOCK_SIZE;
+const UINT MAX_BITONIC_ELEMENTS = (D3D11_CS_DISPATCH_MAX_THREAD_GROUPS_PER_DIMENSION + 1) / 2 * BITONIC_BLOCK_SIZE;
+
+UINT g_iNumParticles = NUM_PARTICLES_16K;
+// Size of the grid buffers: g_iNumParticles padded for GPUSort, or g_iNumParticles if
+// only the counting sort can handle it
+UINT g_iGridSize = NUM_PARTICLES_16K;
+
+// The grid resolution follows the smoothing length (see UpdateGridDim) within these limits
+const UINT MAX_GRID_DIM = 1024;
+const UINT MAX_GRID_INDICES = 4 * 1024 * 1024;
+// Beyond this the dense cell table costs more to clear and scan than the finer cells save
+const UINT MAX_GRID_CELLS_PER_PARTICLE = 8;
+UINT g_iGridDim[3] = {32, 32, 32};
+// Number of cells g_pGridIndices has room for
+UINT g_iGridIndicesSize = 0;
+// Slots of the hashed grid, a power of two of at least twice the number of particles
+UINT g_iGridHashSize = 0;
 
 const UINT MY_TRAY_ICON_ID = 'M2CS';
 // The different meshes
@@ -107,9 +146,14 @@ ID3D11ComputeShader*		g_pSortBitonicUint = NULL;
 ID3D11ComputeShader*		g_pSortTransposeUint = NULL;
 ID3D11ComputeShader*		g_pBuildGridCS = NULL;
 ID3D11ComputeShader*		g_pBuildGridIndicesCS = NULL;
+ID3D11ComputeShader*		g_pBuildGridCountCS = NULL;
+ID3D11ComputeShader*		g_pGridPrefixSumCS = NULL;
+ID3D11ComputeShader*		g_pScatterGridCS = NULL;
+ID3D11ComputeShader*		g_pBuildGridHashCS = NULL;
 ID3D11ComputeShader*		g_pRearrangeParticlesCS = NULL;
 ID3D11ComputeShader*		g_pVelocityCS = NULL;
 ID3D11ComputeShader*		g_pDensityCS = NULL;
+ID3D11ComputeShader*		g_pVelocityDensityCS = NULL;
 ID3D11ComputeShader*		g_pArrayTo3DCS = NULL;
 
 // Resources
@@ -147,6 +191,10 @@ ID3D11Buffer*                       g_pGridIndices = NULL;
 ID3D11ShaderResourceView*           g_pGridIndicesSRV = NULL;
 ID3D11UnorderedAccessView*          g_pGridIndicesUAV = NULL;
 
+ID3D11Buffer*                       g_pGridHash = NULL;
+ID3D11ShaderResourceView*           g_pGridHashSRV = NULL;
+ID3D11UnorderedAccessView*          g_pGridHashUAV = NULL;
+
 // States
 ID3D11BlendState*					g_pBSAlpha = NULL;
 
@@ -250,6 +298,14 @@ BOOL g_bFieldUpdated = FALSE;
 BOOL g_bSavePoints = FALSE;
 BOOL g_bSaveSurfacePoints = FALSE;
 BOOL g_bNoSimulating = FALSE;
+// Bin the particles with a counting sort instead of GPUSort + BuildGridIndicesCS
+BOOL g_bCountingSort = TRUE;
+// Look the cells up in a hash table of the occupied cells instead of a dense table
+BOOL g_bHashedGrid = FALSE;
+// Key the cells by their Morton code instead of row-major (GRID_KEY_MORTON in the shader)
+BOOL g_bMortonGrid = FALSE;
+// Compute the velocity and the density in VelocityDensityCS instead of two passes
+BOOL g_bFusedVelocityDensity = TRUE;
 
 // Cmd line params
 typedef struct _CmdLineParams
@@ -302,6 +358,12 @@ static CmdLineParams g_CmdLineParams;
 #define IDC_STATIC_SURFACE_SCALER                   30
 #define IDC_SLIDER_SURFACE_SCALER                  31
 #define IDC_BUTTON_SAVE_SURFACE                 32
+#define IDC_CHECKBOX_COUNTING_SORT  33
+#define IDC_STATIC_EXACT_PARTICLE                  34
+#define IDC_EDITBOX_NUM_PARTICLE                  35
+#define IDC_CHECKBOX_HASHED_GRID  36
+#define IDC_CHECKBOX_MORTON_GRID  37
+#define IDC_CHECKBOX_FUSED_PASS  38
 
 
 //--------------------------------------------------------------------------------------
@@ -421,6 +483,10 @@ void InitApp()
 	for(int i = 0; i < ARRAYSIZE(num_particles_list); ++i)
 		g_SampleUI.GetComboBox( IDC_COMBO_NUM_PARTICLE )->AddItem( num_particles_name_list[i], (void*)&num_particles_list[i] );
 	g_SampleUI.GetComboBox( IDC_COMBO_NUM_PARTICLE )->SetSelectedByIndex(1);
+	// Any other count, applied with Enter
+	swprintf_s( szTemp, L"%u", g_iNumParticles );
+	g_SampleUI.AddStatic( IDC_STATIC_EXACT_PARTICLE, L"Exact Count: ", 20, iY += 25, 108, 24 );
+	g_SampleUI.AddEditBox( IDC_EDITBOX_NUM_PARTICLE, szTemp, -100, iY, 100, 24 );
 
     // Tess factor
     swprintf_s( szTemp, L"Tess Level: %d", g_uTessFactor );
@@ -441,6 +507,10 @@ void InitApp()
 	g_SampleUI.AddSlider(IDC_SLIDER_INIT_Z, -100, iY, 100, 24, -10000, 10000, 0 );
 
 	g_SampleUI.AddCheckBox (IDC_CHECKBOX_INVERT_NORMAL, L"Inverted Normal", -100, iY += 25, 228, 24 );
+	g_SampleUI.AddCheckBox (IDC_CHECKBOX_COUNTING_SORT, L"Counting Sort Grid", -100, iY += 25, 228, 24, g_bCountingSort != FALSE );
+	g_SampleUI.AddCheckBox (IDC_CHECKBOX_HASHED_GRID, L"Hashed Grid", -100, iY += 25, 228, 24, g_bHashedGrid != FALSE );
+	g_SampleUI.AddCheckBox (IDC_CHECKBOX_MORTON_GRID, L"Morton Grid Keys", -100, iY += 25, 228, 24, g_bMortonGrid != FALSE );
+	g_SampleUI.AddCheckBox (IDC_CHECKBOX_FUSED_PASS, L"Fused Velocity/Density", -100, iY += 25, 228, 24, g_bFusedVelocityDensity != FALSE );
 	g_SampleUI.AddButton(IDC_BUTTON_LOADOBJ, L"Load OBJ", -100, iY += 25, 228, 24 );
 	g_SampleUI.AddButton( IDC_BUTTON_RESET, L"Reset Particles", -100, iY += 25, 228, 24 );
 	g_SampleUI.AddButton( IDC_BUTTON_SAVE, L"Save Result", -100, iY += 25, 228, 24 );
@@ -565,17 +635,17 @@ float AvgDensity() {
 	DXUTGetD3D11DeviceContext()->Map(pStagDensity, 0, D3D11_MAP_READ_WRITE, 0, &ms1);
 
 	FLOAT* density = (FLOAT*)ms1.pData;
-	FLOAT sum = 0;
-	for(int i = 0; i < g_iNumParticles; i++)
+	double sum = 0;
+	for(UINT i = 0; i < g_iNumParticles; i++)
 	{
 		sum += density[i];
 	}
-	sum /= (FLOAT)g_iNumParticles;
+	sum /= (double)g_iNumParticles;
 
 	DXUTGetD3D11DeviceContext()->Unmap(pStagDensity, 0);
 	pStagDensity->Release();
 
-	return sum;
+	return (float)sum;
 }
 
 void SavePointsBuffer(bool bSaveSurface = false)
@@ -653,9 +723,25 @@ void CALLBACK OnGUIEvent( UINT nEvent, int nControlID, CDXUTControl* pControl, v
     {
 		case IDC_COMBO_NUM_PARTICLE:
 			g_iNumParticles = *((UINT*)((CDXUTComboBox*)pControl)->GetSelectedData());
+			swprintf_s( szTemp, L"%u", g_iNumParticles );
+			g_SampleUI.GetEditBox( IDC_EDITBOX_NUM_PARTICLE )->SetText( szTemp );
 			ResetGeometry();
 			break;
 
+		case IDC_EDITBOX_NUM_PARTICLE:
+			if( nEvent == EVENT_EDITBOX_STRING ) {
+				UINT iNum = (UINT)_wtoi( ((CDXUTEditBox*)pControl)->GetText() );
+				if( iNum > 0 && iNum <= MAX_NUM_PARTICLES ) {
+					g_iNumParticles = iNum;
+					ResetGeometry();
+				} else {
+					printf("The number of particles must be between 1 and %u\n", MAX_NUM_PARTICLES);
+				}
+				swprintf_s( szTemp, L"%u", g_iNumParticles );
+				((CDXUTEditBox*)pControl)->SetText( szTemp );
+			}
+			break;
+
         case IDC_TOGGLEFULLSCREEN:
             DXUTToggleFullScreen();
             break;
@@ -718,6 +804,18 @@ void CALLBACK OnGUIEvent( UINT nEvent, int nControlID, CDXUTControl* pControl, v
 			g_fNormalScalar = -g_fNormalScalar;
 			ResetParticles();
 			break;
+		case IDC_CHECKBOX_COUNTING_SORT:
+			g_bCountingSort = ((CDXUTCheckBox*)pControl)->GetChecked();
+			break;
+		case IDC_CHECKBOX_HASHED_GRID:
+			g_bHashedGrid = ((CDXUTCheckBox*)pControl)->GetChecked();
+			break;
+		case IDC_CHECKBOX_MORTON_GRID:
+			g_bMortonGrid = ((CDXUTCheckBox*)pControl)->GetChecked();
+			break;
+		case IDC_CHECKBOX_FUSED_PASS:
+			g_bFusedVelocityDensity = ((CDXUTCheckBox*)pControl)->GetChecked();
+			break;
 		case IDC_BUTTON_RESET:
 			ResetParticles();
 			break;
@@ -893,6 +991,92 @@ HRESULT CreateTypedBuffer(ID3D11Device* pd3dDevice, DXGI_FORMAT format, DXGI_FOR
     return hr;
 }
 
+//--------------------------------------------------------------------------------------
+// Spread the low 10 bits of v three bits apart, as MortonSpread in the shader
+//--------------------------------------------------------------------------------------
+inline UINT MortonSpread( UINT v )
+{
+	v &= 0x3FF;
+	v = (v | (v << 16)) & 0x030000FF;
+	v = (v | (v << 8)) & 0x0300F00F;
+	v = (v | (v << 4)) & 0x030C30C3;
+	v = (v | (v << 2)) & 0x09249249;
+	return v;
+}
+
+//--------------------------------------------------------------------------------------
+// Number of cell keys on the current grid, i.e. the size of the dense cell table. The
+// Morton keys of a grid that is not a power of two cube leave gaps, so there are more
+// keys than cells.
+//--------------------------------------------------------------------------------------
+UINT GridNumKeys()
+{
+	if( g_bMortonGrid )
+		return (MortonSpread(g_iGridDim[0] - 1) | (MortonSpread(g_iGridDim[1] - 1) << 1) | (MortonSpread(g_iGridDim[2] - 1) << 2)) + 1;
+	return g_iGridDim[0] * g_iGridDim[1] * g_iGridDim[2];
+}
+
+//--------------------------------------------------------------------------------------
+// Grid resolution: cells about one smoothing length wide along every axis, so the 27
+// cells VelocityCS and DensityCS walk just cover the kernel support. Cells are made
+// uniformly coarser if the grid would have more than nMaxCells cells. Returns the number
+// of keys, which the cell table must hold; the key order does not change the grid.
+//--------------------------------------------------------------------------------------
+UINT UpdateGridDim( const D3DXVECTOR3& vExt, FLOAT fSmoothlen, UINT nMaxCells )
+{
+	const FLOAT fExt[3] = { vExt.x, vExt.y, vExt.z };
+	FLOAT fCell = fSmoothlen;
+	for(;;) {
+		for(int i = 0; i < 3; i++)
+			g_iGridDim[i] = min(max((UINT)(fExt[i] * 2.0f / fCell), 1u), MAX_GRID_DIM);
+		if((UINT64)g_iGridDim[0] * g_iGridDim[1] * g_iGridDim[2] <= nMaxCells)
+			return GridNumKeys();
+		fCell *= 1.05f;	// about 14% fewer cells
+	}
+}
+
+HRESULT CreateGridIndicesBuffer( ID3D11Device* pd3dDevice, UINT nCells )
+{
+	HRESULT hr;
+
+    SAFE_RELEASE( g_pGridIndicesSRV );
+    SAFE_RELEASE( g_pGridIndicesUAV );
+    SAFE_RELEASE( g_pGridIndices );
+	g_iGridIndicesSize = 0;
+
+	V_RETURN( CreateStructuredBuffer< D3DXVECTOR2 >( pd3dDevice, nCells, &g_pGridIndices, &g_pGridIndicesSRV, &g_pGridIndicesUAV ) );
+	DXUT_SetDebugName( g_pGridIndices, "Indices" );
+	DXUT_SetDebugName( g_pGridIndicesSRV, "Indices SRV" );
+	DXUT_SetDebugName( g_pGridIndicesUAV, "Indices UAV" );
+	g_iGridIndicesSize = nCells;
+
+	return S_OK;
+}
+
+//--------------------------------------------------------------------------------------
+// Slots of the hashed grid, created when the Hashed Grid check box is first turned on
+//--------------------------------------------------------------------------------------
+HRESULT CreateGridHashBuffer( ID3D11Device* pd3dDevice )
+{
+	HRESULT hr;
+
+    SAFE_RELEASE( g_pGridHashSRV );
+    SAFE_RELEASE( g_pGridHashUAV );
+    SAFE_RELEASE( g_pGridHash );
+	g_iGridHashSize = 0;
+
+	// Half full at most, so the probe sequences stay short
+	UINT nSlots = 1;
+	while(nSlots < g_iNumParticles * 2) nSlots <<= 1;
+	V_RETURN( CreateTypedBuffer( pd3dDevice, DXGI_FORMAT_R32_UINT, DXGI_FORMAT_R32_UINT, sizeof(UINT), nSlots, nSlots, &g_pGridHash, &g_pGridHashSRV, &g_pGridHashUAV ) );
+    DXUT_SetDebugName( g_pGridHash, "Hash" );
+    DXUT_SetDebugName( g_pGridHashSRV, "Hash SRV" );
+    DXUT_SetDebugName( g_pGridHashUAV, "Hash UAV" );
+	g_iGridHashSize = nSlots;
+
+	return S_OK;
+}
+
 HRESULT CreateSimulationBuffers( ID3D11Device* pd3dDevice )
 {
 	HRESULT hr;
@@ -915,6 +1099,24 @@ HRESULT CreateSimulationBuffers( ID3D11Device* pd3dDevice )
     SAFE_RELEASE( g_pGridIndicesUAV );
     SAFE_RELEASE( g_pGridIndices );
 
+    SAFE_RELEASE( g_pGridHashSRV );
+    SAFE_RELEASE( g_pGridHashUAV );
+    SAFE_RELEASE( g_pGridHash );
+	g_iGridHashSize = 0;
+
+	if(g_iNumParticles == 0 || g_iNumParticles > MAX_NUM_PARTICLES) {
+		printf("The number of particles must be between 1 and %u\n", MAX_NUM_PARTICLES);
+		g_iNumParticles = min(max(g_iNumParticles, 1u), MAX_NUM_PARTICLES);
+	}
+
+	// Pad the grid for GPUSort when it can sort that many pairs at all
+	g_iGridSize = MIN_BITONIC_ELEMENTS;
+	while(g_iGridSize < g_iNumParticles) g_iGridSize <<= 1;
+	if(g_iGridSize > MAX_BITONIC_ELEMENTS) {
+		printf("%u particles are too many for the bitonic sort, using the counting sort\n", g_iNumParticles);
+		g_iGridSize = g_iNumParticles;
+	}
+
 	V_RETURN(ResetParticles());
 
     V_RETURN( CreateStructuredBuffer< FLOAT >( pd3dDevice, g_iNumParticles, &g_pParticleDensity, &g_pParticleDensitySRV, &g_pParticleDensityUAV ) );
@@ -922,20 +1124,19 @@ HRESULT CreateSimulationBuffers( ID3D11Device* pd3dDevice )
     DXUT_SetDebugName( g_pParticleDensitySRV, "Density SRV" );
     DXUT_SetDebugName( g_pParticleDensityUAV, "Density UAV" );
 
-	V_RETURN(CreateTypedBuffer( pd3dDevice, DXGI_FORMAT_R32G32_UINT, DXGI_FORMAT_R32_UINT, sizeof(UINT) * 2, g_iNumParticles, g_iNumParticles * 2, &g_pGrid, &g_pGridSRV, &g_pGridUAV));
+	V_RETURN(CreateTypedBuffer( pd3dDevice, DXGI_FORMAT_R32G32_UINT, DXGI_FORMAT_R32_UINT, sizeof(UINT) * 2, g_iGridSize, g_iGridSize * 2, &g_pGrid, &g_pGridSRV, &g_pGridUAV));
     DXUT_SetDebugName( g_pGrid, "Grid" );
     DXUT_SetDebugName( g_pGridSRV, "Grid SRV" );
     DXUT_SetDebugName( g_pGridUAV, "Grid UAV" );
 
-    V_RETURN( CreateTypedBuffer( pd3dDevice, DXGI_FORMAT_R32G32_UINT, DXGI_FORMAT_R32_UINT, sizeof(UINT) * 2, g_iNumParticles, g_iNumParticles * 2, &g_pGridPingPong, &g_pGridPingPongSRV, &g_pGridPingPongUAV ) );
+    V_RETURN( CreateTypedBuffer( pd3dDevice, DXGI_FORMAT_R32G32_UINT, DXGI_FORMAT_R32_UINT, sizeof(UINT) * 2, g_iGridSize, g_iGridSize * 2, &g_pGridPingPong, &g_pGridPingPongSRV, &g_pGridPingPongUAV ) );
     DXUT_SetDebugName( g_pGridPingPong, "PingPong" );
     DXUT_SetDebugName( g_pGridPingPongSRV, "PingPong SRV" );
     DXUT_SetDebugName( g_pGridPingPongUAV, "PingPong UAV" );
 
-	V_RETURN( CreateStructuredBuffer< D3DXVECTOR2 >( pd3dDevice, NUM_GRID_INDICES, &g_pGridIndices, &g_pGridIndicesSRV, &g_pGridIndicesUAV ) );
-	DXUT_SetDebugName( g_pGridIndices, "Indices" );
-	DXUT_SetDebugName( g_pGridIndicesSRV, "Indices SRV" );
-	DXUT_SetDebugName( g_pGridIndicesUAV, "Indices UAV" );
+	// The hash and the cell table it indexes are sized in OnD3D11FrameRender when the
+	// hashed grid is in use
+	V_RETURN( CreateGridIndicesBuffer( pd3dDevice, g_iGridDim[0] * g_iGridDim[1] * g_iGridDim[2] ) );
 
 	SAFE_RELEASE(g_pTexField);
 	SAFE_RELEASE(g_pSRVField);
@@ -1127,6 +1328,26 @@ HRESULT CALLBACK OnD3D11CreateDevice( ID3D11Device* pd3dDevice, const DXGI_SURFA
     SAFE_RELEASE( pBlob );
     DXUT_SetDebugName( g_pBuildGridIndicesCS, "BuildGridIndicesCS" );
 
+    V_RETURN( CompileShaderFromFile( L"Mesh2Points.hlsl", "BuildGridCountCS", "cs_5_0", &pBlob, NULL ) );
+    V_RETURN( pd3dDevice->CreateComputeShader( pBlob->GetBufferPointer(), pBlob->GetBufferSize(), NULL, &g_pBuildGridCountCS ) );
+    SAFE_RELEASE( pBlob );
+    DXUT_SetDebugName( g_pBuildGridCountCS, "BuildGridCountCS" );
+
+    V_RETURN( CompileShaderFromFile( L"Mesh2Points.hlsl", "GridPrefixSumCS", "cs_5_0", &pBlob, NULL ) );
+    V_RETURN( pd3dDevice->CreateComputeShader( pBlob->GetBufferPointer(), pBlob->GetBufferSize(), NULL, &g_pGridPrefixSumCS ) );
+    SAFE_RELEASE( pBlob );
+    DXUT_SetDebugName( g_pGridPrefixSumCS, "GridPrefixSumCS" );
+
+    V_RETURN( CompileShaderFromFile( L"Mesh2Points.hlsl", "ScatterGridCS", "cs_5_0", &pBlob, NULL ) );
+    V_RETURN( pd3dDevice->CreateComputeShader( pBlob->GetBufferPointer(), pBlob->GetBufferSize(), NULL, &g_pScatterGridCS ) );
+    SAFE_RELEASE( pBlob );
+    DXUT_SetDebugName( g_pScatterGridCS, "ScatterGridCS" );
+
+    V_RETURN( CompileShaderFromFile( L"Mesh2Points.hlsl", "BuildGridHashCS", "cs_5_0", &pBlob, NULL ) );
+    V_RETURN( pd3dDevice->CreateComputeShader( pBlob->GetBufferPointer(), pBlob->GetBufferSize(), NULL, &g_pBuildGridHashCS ) );
+    SAFE_RELEASE( pBlob );
+    DXUT_SetDebugName( g_pBuildGridHashCS, "BuildGridHashCS" );
+
     V_RETURN( CompileShaderFromFile( L"Mesh2Points.hlsl", "RearrangeParticlesCS", "cs_5_0", &pBlob, NULL ) );
     V_RETURN( pd3dDevice->CreateComputeShader( pBlob->GetBufferPointer(), pBlob->GetBufferSize(), NULL, &g_pRearrangeParticlesCS ) );
     SAFE_RELEASE( pBlob );
@@ -1142,6 +1363,11 @@ HRESULT CALLBACK OnD3D11CreateDevice( ID3D11Device* pd3dDevice, const DXGI_SURFA
     SAFE_RELEASE( pBlob );
     DXUT_SetDebugName( g_pDensityCS, "DensityCS" );
  
+    V_RETURN( CompileShaderFromFile( L"Mesh2Points.hlsl", "VelocityDensityCS", "cs_5_0", &pBlob, NULL ) );
+    V_RETURN( pd3dDevice->CreateComputeShader( pBlob->GetBufferPointer(), pBlob->GetBufferSize(), NULL, &g_pVelocityDensityCS ) );
+    SAFE_RELEASE( pBlob );
+    DXUT_SetDebugName( g_pVelocityDensityCS, "VelocityDensityCS" );
+ 
     V_RETURN( CompileShaderFromFile( L"Mesh2Points.hlsl", "ArrayTo3DCS", "cs_5_0", &pBlob, NULL ) );
     V_RETURN( pd3dDevice->CreateComputeShader( pBlob->GetBufferPointer(), pBlob->GetBufferSize(), NULL, &g_pArrayTo3DCS ) );
     SAFE_RELEASE( pBlob );
@@ -1346,9 +1572,23 @@ void VisualizeField( ID3D11DeviceContext* pd3dImmediateContext )
 	pd3dImmediateContext->PSSetShaderResources(2, 1, &g_pNullSRV);
 }
 
-#define SIMULATION_BLOCK_SIZE 512
-#define BITONIC_BLOCK_SIZE 512
-#define TRANSPOSE_BLOCK_SIZE 16
+//--------------------------------------------------------------------------------------
+// Thread groups to dispatch for n elements; the shaders return early past the end
+//--------------------------------------------------------------------------------------
+inline UINT SimulationGroups( UINT n )
+{
+	return (n + SIMULATION_BLOCK_SIZE - 1) / SIMULATION_BLOCK_SIZE;
+}
+
+//--------------------------------------------------------------------------------------
+// The hashed grid is built from the pairs GPUSort leaves sorted by cell, so it is only
+// used when GPUSort can take the number of particles
+//--------------------------------------------------------------------------------------
+inline BOOL UseHashedGrid()
+{
+	return g_bHashedGrid && g_iGridSize <= MAX_BITONIC_ELEMENTS;
+}
+
 //--------------------------------------------------------------------------------------
 // GPU Bitonic Sort
 // For more information, please see the ComputeShaderSort11 sample
@@ -1424,30 +1664,84 @@ HRESULT GPUSort(ID3D11DeviceContext* pd3dImmediateContext, UINT nElements, BOOL
 }
 
 
+//--------------------------------------------------------------------------------------
+// Counting sort binning: histogram, prefix sum and scatter. Leaves g_pGrid sorted by
+// cell and g_pGridIndices filled, like BuildGridCS + GPUSort + BuildGridIndicesCS.
+//--------------------------------------------------------------------------------------
+void CountingSortGrid( ID3D11DeviceContext* pd3dImmediateContext )
+{
+    UINT UAVInitialCounts[2] = {0, 0};
+	UINT pUINTClr[4] = {0};
+	ID3D11UnorderedAccessView* pUAVs[2] = { g_pGridPingPongUAV, g_pGridIndicesUAV };
+	ID3D11UnorderedAccessView* pNullUAVs[2] = { NULL, NULL };
+
+    pd3dImmediateContext->CSSetConstantBuffers( g_iPNTRIANGLESCBBind, 1, &g_pcbPNTriangles );
+	pd3dImmediateContext->ClearUnorderedAccessViewUint(g_pGridIndicesUAV, pUINTClr);
+
+    // Histogram: (rank, cell) per particle into the ping pong buffer, counts per cell
+    pd3dImmediateContext->CSSetUnorderedAccessViews( 0, 2, pUAVs, UAVInitialCounts );
+    pd3dImmediateContext->CSSetShaderResources( 3, 1, &g_pParticlesSRV );
+    pd3dImmediateContext->CSSetShader( g_pBuildGridCountCS, NULL, 0 );
+    pd3dImmediateContext->Dispatch( SimulationGroups( g_iNumParticles ), 1, 1 );
+
+    // Prefix sum: counts to [start, end) per cell
+    pd3dImmediateContext->CSSetShader( g_pGridPrefixSumCS, NULL, 0 );
+    pd3dImmediateContext->Dispatch( 1, 1, 1 );
+	pd3dImmediateContext->CSSetUnorderedAccessViews( 0, 2, pNullUAVs, UAVInitialCounts );
+
+    // Scatter the (particle id, cell) pairs to their sorted position
+    pd3dImmediateContext->CSSetUnorderedAccessViews( 0, 1, &g_pGridUAV, UAVInitialCounts );
+    pd3dImmediateContext->CSSetShaderResources( 5, 1, &g_pGridPingPongSRV );
+    pd3dImmediateContext->CSSetShaderResources( 6, 1, &g_pGridIndicesSRV );
+    pd3dImmediateContext->CSSetShader( g_pScatterGridCS, NULL, 0 );
+    pd3dImmediateContext->Dispatch( SimulationGroups( g_iNumParticles ), 1, 1 );
+//	CheckBuffer<LARGE_INTEGER>(g_pGrid);
+
+    pd3dImmediateContext->CSSetUnorderedAccessViews( 0, 1, &g_pNullUAV, UAVInitialCounts );
+    pd3dImmediateContext->CSSetShaderResources( 5, 1, &g_pNullSRV );
+    pd3dImmediateContext->CSSetShaderResources( 6, 1, &g_pNullSRV );
+}
+
 void SimulateFluid_Grid( ID3D11DeviceContext* pd3dImmediateContext )
 {
     UINT UAVInitialCounts = 0;
-    pd3dImmediateContext->CSSetUnorderedAccessViews( 0, 1, &g_pGridUAV, &UAVInitialCounts );
-    pd3dImmediateContext->CSSetShaderResources( 3, 1, &g_pParticlesSRV );
+	// GPUSort cannot take more than MAX_BITONIC_ELEMENTS, the counting sort has no such limit.
+	// The counting sort needs a dense cell table, so the hashed grid always uses GPUSort.
+	const BOOL bHashedGrid = UseHashedGrid();
+	if(!bHashedGrid && (g_bCountingSort || g_iGridSize > MAX_BITONIC_ELEMENTS)) {
+		CountingSortGrid(pd3dImmediateContext);
+	} else {
+        pd3dImmediateContext->CSSetUnorderedAccessViews( 0, 1, &g_pGridUAV, &UAVInitialCounts );
+        pd3dImmediateContext->CSSetShaderResources( 3, 1, &g_pParticlesSRV );
 //	CheckBuffer<D3DXVECTOR3>(g_pParticles);
 
-    // Build Grid
-    pd3dImmediateContext->CSSetShader( g_pBuildGridCS, NULL, 0 );
-    pd3dImmediateContext->Dispatch( g_iNumParticles / SIMULATION_BLOCK_SIZE, 1, 1 );
+        // Build Grid, including the pad up to the sort size
+        pd3dImmediateContext->CSSetShader( g_pBuildGridCS, NULL, 0 );
+        pd3dImmediateContext->Dispatch( SimulationGroups( g_iGridSize ), 1, 1 );
 //	CheckBuffer<LARGE_INTEGER>(g_pGrid);
 
-    GPUSort(pd3dImmediateContext, g_iNumParticles, TRUE, g_pGridUAV, g_pGridSRV, g_pGridPingPongUAV, g_pGridPingPongSRV);
+        GPUSort(pd3dImmediateContext, g_iGridSize, TRUE, g_pGridUAV, g_pGridSRV, g_pGridPingPongUAV, g_pGridPingPongSRV);
 //	CheckBuffer<LARGE_INTEGER>(g_pGrid); 
 
-    pd3dImmediateContext->CSSetConstantBuffers( g_iPNTRIANGLESCBBind, 1, &g_pcbPNTriangles );
-	pd3dImmediateContext->CSSetUnorderedAccessViews( 0, 1, &g_pGridIndicesUAV, &UAVInitialCounts );
-    pd3dImmediateContext->CSSetShaderResources( 5, 1, &g_pGridSRV );
-	UINT pUINTClr[4] = {0};
-
-	pd3dImmediateContext->ClearUnorderedAccessViewUint(g_pGridIndicesUAV, pUINTClr);
-    pd3dImmediateContext->CSSetShader( g_pBuildGridIndicesCS, NULL, 0 );
-    pd3dImmediateContext->Dispatch( g_iNumParticles / SIMULATION_BLOCK_SIZE, 1, 1 );
+        pd3dImmediateContext->CSSetConstantBuffers( g_iPNTRIANGLESCBBind, 1, &g_pcbPNTriangles );
+		pd3dImmediateContext->CSSetUnorderedAccessViews( 0, 1, &g_pGridIndicesUAV, &UAVInitialCounts );
+        pd3dImmediateContext->CSSetShaderResources( 5, 1, &g_pGridSRV );
+		UINT pUINTClr[4] = {0};
+
+		pd3dImmediateContext->ClearUnorderedAccessViewUint(g_pGridIndicesUAV, pUINTClr);
+		if(bHashedGrid) {
+			UINT pEmptyClr[4] = {0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF};
+			pd3dImmediateContext->ClearUnorderedAccessViewUint(g_pGridHashUAV, pEmptyClr);
+			pd3dImmediateContext->CSSetUnorderedAccessViews( 1, 1, &g_pGridHashUAV, &UAVInitialCounts );
+			pd3dImmediateContext->CSSetShader( g_pBuildGridHashCS, NULL, 0 );
+			pd3dImmediateContext->Dispatch( SimulationGroups( g_iNumParticles ), 1, 1 );
+			pd3dImmediateContext->CSSetUnorderedAccessViews( 1, 1, &g_pNullUAV, &UAVInitialCounts );
+		} else {
+			pd3dImmediateContext->CSSetShader( g_pBuildGridIndicesCS, NULL, 0 );
+			pd3dImmediateContext->Dispatch( SimulationGroups( g_iNumParticles ), 1, 1 );
+		}
 //	CheckBuffer<LARGE_INTEGER>(g_pGridIndices);
+	}
 
     // Setup
     // Rearrange
@@ -1455,7 +1749,7 @@ void SimulateFluid_Grid( ID3D11DeviceContext* pd3dImmediateContext )
     pd3dImmediateContext->CSSetShaderResources( 3, 1, &g_pParticlesSRV );
     pd3dImmediateContext->CSSetShaderResources( 5, 1, &g_pGridSRV );
 	pd3dImmediateContext->CSSetShader( g_pRearrangeParticlesCS, NULL, 0 );
-    pd3dImmediateContext->Dispatch( g_iNumParticles / SIMULATION_BLOCK_SIZE, 1, 1 );
+    pd3dImmediateContext->Dispatch( SimulationGroups( g_iNumParticles ), 1, 1 );
 //	CheckBuffer<D3DXVECTOR3>(g_pSortedParticles);
 
     // Setup
@@ -1464,14 +1758,25 @@ void SimulateFluid_Grid( ID3D11DeviceContext* pd3dImmediateContext )
     pd3dImmediateContext->CSSetShaderResources( 3, 1, &g_pSortedParticlesSRV );
     pd3dImmediateContext->CSSetShaderResources( 5, 1, &g_pGridSRV );
     pd3dImmediateContext->CSSetShaderResources( 6, 1, &g_pGridIndicesSRV );
+    pd3dImmediateContext->CSSetShaderResources( 7, 1, &g_pGridHashSRV );
+
+	if(g_bFusedVelocityDensity) {
+		// One neighbor walk for both; the density goes to u1
+		ID3D11UnorderedAccessView* pUAVs[2] = { g_pParticlesUAV, g_pParticleDensityUAV };
+		UINT UAVInitialCounts2[2] = { 0, 0 };
+		pd3dImmediateContext->CSSetUnorderedAccessViews( 0, 2, pUAVs, UAVInitialCounts2 );
+		pd3dImmediateContext->CSSetShader( g_pVelocityDensityCS, NULL, 0 );
+		pd3dImmediateContext->Dispatch( SimulationGroups( g_iNumParticles ), 1, 1 );
+		pd3dImmediateContext->CSSetUnorderedAccessViews( 1, 1, &g_pNullUAV, &UAVInitialCounts );
+	} else {
+		pd3dImmediateContext->CSSetUnorderedAccessViews( 0, 1, &g_pParticlesUAV, &UAVInitialCounts );
+		pd3dImmediateContext->CSSetShader( g_pVelocityCS, NULL, 0 );
+		pd3dImmediateContext->Dispatch( SimulationGroups( g_iNumParticles ), 1, 1 );
 
-	pd3dImmediateContext->CSSetUnorderedAccessViews( 0, 1, &g_pParticlesUAV, &UAVInitialCounts );
-	pd3dImmediateContext->CSSetShader( g_pVelocityCS, NULL, 0 );
-	pd3dImmediateContext->Dispatch( g_iNumParticles / SIMULATION_BLOCK_SIZE, 1, 1 );
-
-	pd3dImmediateContext->CSSetUnorderedAccessViews( 0, 1, &g_pParticleDensityUAV, &UAVInitialCounts );
-	pd3dImmediateContext->CSSetShader( g_pDensityCS, NULL, 0 );
-	pd3dImmediateContext->Dispatch( g_iNumParticles / SIMULATION_BLOCK_SIZE, 1, 1 );
+		pd3dImmediateContext->CSSetUnorderedAccessViews( 0, 1, &g_pParticleDensityUAV, &UAVInitialCounts );
+		pd3dImmediateContext->CSSetShader( g_pDensityCS, NULL, 0 );
+		pd3dImmediateContext->Dispatch( SimulationGroups( g_iNumParticles ), 1, 1 );
+	}
 
 	if(g_bSavePoints) {
 		SavePointsBuffer();
@@ -1489,6 +1794,7 @@ void SimulateFluid_Grid( ID3D11DeviceContext* pd3dImmediateContext )
 	pd3dImmediateContext->CSSetShaderResources( 3, 1, &g_pNullSRV );
     pd3dImmediateContext->CSSetShaderResources( 5, 1, &g_pNullSRV );
     pd3dImmediateContext->CSSetShaderResources( 6, 1, &g_pNullSRV );
+    pd3dImmediateContext->CSSetShaderResources( 7, 1, &g_pNullSRV );
 
 }
 //--------------------------------------------------------------------------------------
@@ -1541,6 +1847,31 @@ void CALLBACK OnD3D11FrameRender( ID3D11Device* pd3dDevice, ID3D11DeviceContext*
 
 	FLOAT fSmoothlen = g_fSmoothlen * mSize * g_fKScale;
 
+	// The kernel scale can change every frame; grow the cell table when needed. Both
+	// backends get the same cells, at most MAX_GRID_CELLS_PER_PARTICLE per particle, so
+	// the Hashed Grid check box changes the storage and not the samples.
+	HRESULT hr = S_OK;
+	BOOL bHashedGrid = UseHashedGrid();
+	UINT nCells = UpdateGridDim( g_SceneMesh[g_eMeshType].GetMeshBBoxExtents(), fSmoothlen,
+		(UINT)min( (UINT64)MAX_GRID_INDICES, (UINT64)g_iNumParticles * MAX_GRID_CELLS_PER_PARTICLE ) );
+	if( bHashedGrid ) {
+		// The cell table holds the range of every hash slot
+		if( !g_pGridHash )
+			V( CreateGridHashBuffer( pd3dDevice ) );
+		if( SUCCEEDED( hr ) && g_iGridHashSize > g_iGridIndicesSize )
+			V( CreateGridIndicesBuffer( pd3dDevice, g_iGridHashSize ) );
+		if( FAILED( hr ) ) {
+			// Fall back to the dense grid
+			g_bHashedGrid = FALSE;
+			g_SampleUI.GetCheckBox( IDC_CHECKBOX_HASHED_GRID )->SetChecked( false );
+			bHashedGrid = FALSE;
+		}
+	}
+	if( !bHashedGrid && nCells > g_iGridIndicesSize )
+		V( CreateGridIndicesBuffer( pd3dDevice, nCells ) );
+	// No simulation step without a cell table that holds every key or slot
+	const BOOL bGridReady = g_pGridIndices && g_iGridIndicesSize >= ( bHashedGrid ? g_iGridHashSize : nCells );
+
     // Setup the constant buffer for the scene vertex shader
     D3D11_MAPPED_SUBRESOURCE MappedResource;
     pd3dImmediateContext->Map( g_pcbPNTriangles, 0, D3D11_MAP_WRITE_DISCARD, 0, &MappedResource );
@@ -1567,7 +1898,8 @@ void CALLBACK OnD3D11FrameRender( ID3D11Device* pd3dDevice, ID3D11DeviceContext*
 	pPNTrianglesCB->fBoundSize[0] = (g_SceneMesh[g_eMeshType].GetMeshBBoxExtents().x);
 	pPNTrianglesCB->fBoundSize[1] = (g_SceneMesh[g_eMeshType].GetMeshBBoxExtents().y);
 	pPNTrianglesCB->fBoundSize[2] = (g_SceneMesh[g_eMeshType].GetMeshBBoxExtents().z * 2.0f) / (FLOAT) g_iFieldSize[2];
-	pPNTrianglesCB->fBoundSize[3] = 2.0f / (FLOAT)g_iFieldSize[2];
+	// Voxel size in clip space, averaged over the axes
+	pPNTrianglesCB->fBoundSize[3] = 2.0f / (FLOAT)pow((double)g_iFieldSize[0] * g_iFieldSize[1] * g_iFieldSize[2], 1.0 / 3.0);
 	pPNTrianglesCB->fInvBoundSize[0] = 1.0f / (g_SceneMesh[g_eMeshType].GetMeshBBoxExtents().x);
 	pPNTrianglesCB->fInvBoundSize[1] = 1.0f / (g_SceneMesh[g_eMeshType].GetMeshBBoxExtents().y);
 	pPNTrianglesCB->fInvBoundSize[2] = (FLOAT) g_iFieldSize[2] / (g_SceneMesh[g_eMeshType].GetMeshBBoxExtents().z * 2.0f);
@@ -1580,17 +1912,17 @@ void CALLBACK OnD3D11FrameRender( ID3D11Device* pd3dDevice, ID3D11DeviceContext*
 	pPNTrianglesCB->fParticleParameter[1] = g_fParticleAspectRatio;
 	pPNTrianglesCB->fParticleParameter[2] = g_fNormalScalar;
 	pPNTrianglesCB->fParticleParameter[3] = g_fSurface; 
-	pPNTrianglesCB->fGridDim[0] = NUM_GRID_DIM_X;
-	pPNTrianglesCB->fGridDim[1] = NUM_GRID_DIM_Y;
-	pPNTrianglesCB->fGridDim[2] = NUM_GRID_DIM_Z;
-	pPNTrianglesCB->fGridDim[3] = 0;
+	pPNTrianglesCB->fGridDim[0] = (FLOAT)g_iGridDim[0];
+	pPNTrianglesCB->fGridDim[1] = (FLOAT)g_iGridDim[1];
+	pPNTrianglesCB->fGridDim[2] = (FLOAT)g_iGridDim[2];
+	pPNTrianglesCB->fGridDim[3] = bHashedGrid ? (FLOAT)g_iGridHashSize : 0;
 	pPNTrianglesCB->fInvGridDim[0] = (float)1.0f / (g_SceneMesh[g_eMeshType].GetMeshBBoxExtents().x * 2.0f);
 	pPNTrianglesCB->fInvGridDim[1] = (float)1.0f / (g_SceneMesh[g_eMeshType].GetMeshBBoxExtents().y * 2.0f);
 	pPNTrianglesCB->fInvGridDim[2] = (float)1.0f / (g_SceneMesh[g_eMeshType].GetMeshBBoxExtents().z * 2.0f);
 	pPNTrianglesCB->fInvGridDim[3] = g_iNumParticles;
-	pPNTrianglesCB->iGridDot[0] = NUM_GRID_DIM_Z * NUM_GRID_DIM_X;
-	pPNTrianglesCB->iGridDot[1] = NUM_GRID_DIM_X;
-	pPNTrianglesCB->iGridDot[2] = 1;
+	pPNTrianglesCB->iGridDot[0] = g_iGridDim[2] * g_iGridDim[0];
+	pPNTrianglesCB->iGridDot[1] = g_iGridDim[0];
+	pPNTrianglesCB->iGridDot[2] = g_bMortonGrid ? 1 : 0;	// GRID_KEY_MORTON / GRID_KEY_ROW_MAJOR
 	pPNTrianglesCB->iGridDot[3] = g_iNumParticles;
 	pPNTrianglesCB->fKernel[0] = fSmoothlen * fSmoothlen;
 	pPNTrianglesCB->fKernel[1] = g_fSpeed;
@@ -1697,7 +2029,7 @@ void CALLBACK OnD3D11FrameRender( ID3D11Device* pd3dDevice, ID3D11DeviceContext*
 		g_bFieldUpdated = TRUE;
 	}
 
-	if(!g_bNoSimulating)
+	if(!g_bNoSimulating && bGridReady)
 		SimulateFluid_Grid( pd3dImmediateContext );
 	//VisualizeField( pd3dImmediateContext );
 	RenderFluid( pd3dImmediateContext );
@@ -1805,6 +2137,10 @@ void CALLBACK OnD3D11DestroyDevice( void* pUserContext )
     SAFE_RELEASE( g_pGridIndicesUAV );
     SAFE_RELEASE( g_pGridIndices );
 
+    SAFE_RELEASE( g_pGridHashSRV );
+    SAFE_RELEASE( g_pGridHashUAV );
+    SAFE_RELEASE( g_pGridHash );
+
 	SAFE_RELEASE( g_pParticleVS );
 	SAFE_RELEASE( g_pParticleGS );
 	SAFE_RELEASE( g_pParticlePS );
@@ -1818,9 +2154,14 @@ void CALLBACK OnD3D11DestroyDevice( void* pUserContext )
 
     SAFE_RELEASE( g_pBuildGridCS );
     SAFE_RELEASE( g_pBuildGridIndicesCS );
+    SAFE_RELEASE( g_pBuildGridCountCS );
+    SAFE_RELEASE( g_pGridPrefixSumCS );
+    SAFE_RELEASE( g_pScatterGridCS );
+    SAFE_RELEASE( g_pBuildGridHashCS );
     SAFE_RELEASE( g_pRearrangeParticlesCS );
     SAFE_RELEASE( g_pVelocityCS );
     SAFE_RELEASE( g_pDensityCS );
+    SAFE_RELEASE( g_pVelocityDensityCS );
 
 	SAFE_RELEASE( g_pArrayTo3DCS );
 }
@@ -2051,6 +2392,15 @@ void ParseCommandLine()
                 }
                 continue;
             }
+
+            if( IsNextArg( strCmdLine, L"particles" ) )
+            {
+                if( GetCmdParam( strCmdLine, strFlag ) )
+                {
+                   g_iNumParticles = (UINT)_wtoi(strFlag);
+                }
+                continue;
+            }
         }
     }
 }
@@ -46,6 +46,7 @@ RWTexture3D<float4> DensityFieldRW : register(u0);
 
 RWStructuredBuffer<float4> ParticlesRW : register( u0 );
 RWStructuredBuffer<float> ParticlesDensityRW : register( u0 );
+RWStructuredBuffer<float> ParticlesDensityFusedRW : register( u1 );	// VelocityDensityCS writes the positions to u0
 StructuredBuffer<float4> ParticlesRO : register( t3 );
 StructuredBuffer<float> ParticlesForceRO : register( t4 );
 
@@ -55,6 +56,11 @@ Buffer<uint2> GridRO : register( t5 );
 RWStructuredBuffer<uint2> GridIndicesRW : register( u0 );
 StructuredBuffer<uint2> GridIndicesRO : register( t6 );
 
+RWStructuredBuffer<uint2> GridCountRW : register( u1 );
+
+RWBuffer<uint> GridHashRW : register( u1 );
+Buffer<uint> GridHashRO : register( t7 );
+
 // Samplers
 SamplerState g_SamplePoint  : register( s0 );
 SamplerState g_SampleLinear : register( s1 );
@@ -319,11 +325,13 @@ void TriField3DGS (triangle DS_Output input[3], inout TriangleStream<SO_Output_P
 	int w, h, d;
 	DensityFieldRO.GetDimensions(w, h, d);
 	d--;
+	// Two voxels along x and y, which may have different sizes in clip space
+	float2 Scr_voxel = float2(2.0f / (float)w, 2.0f / (float)h);
 	
 	for(int i = -2; i <= 2; i++) {
 		for(int j = 0; j < 2; j++) {
 			for(int k = 0; k < 3; k++) {
-				float2 Scr_offset = QuadOffset[j * 3 + k] * g_fBoundSize.w * 2.0f;
+				float2 Scr_offset = QuadOffset[j * 3 + k] * Scr_voxel * 2.0f;
 				float3 vOffset = float3(Scr_offset, i) * g_fBoundSize.xyz;
 
 				O.f4Position.xy = Scr_pos + Scr_offset;
@@ -486,6 +494,10 @@ float4 ParticlePS(GSParticleOut In) : SV_Target
 
 #define SIMULATION_BLOCK_SIZE 512
 
+// Key of the pairs padding the grid to the size GPUSort needs. The bitonic sort compares
+// the pairs as doubles, so the pad is DBL_MAX rather than a NaN like 0xFFFFFFFF.
+#define GRID_PAD_KEY 0x7FEFFFFF
+
 float3 UnitPos(float3 position) 
 {
 	return (position - g_fBoundBoxMin.xyz) * g_fInvGridDim.xyz;
@@ -496,17 +508,44 @@ float3 GridCalculateCell(float3 position)
     return clamp(UnitPos(position) * g_fGridDim.xyz, float3(0, 0, 0), g_fGridDim.xyz - 1);
 }
 
+// Cell key layouts, selected by g_iGridDot.z
+#define GRID_KEY_ROW_MAJOR 0
+#define GRID_KEY_MORTON 1
+
+// Spread the low 10 bits of v three bits apart
+unsigned int MortonSpread(unsigned int v)
+{
+	v &= 0x3FF;
+	v = (v | (v << 16)) & 0x030000FF;
+	v = (v | (v << 8)) & 0x0300F00F;
+	v = (v | (v << 4)) & 0x030C30C3;
+	v = (v | (v << 2)) & 0x09249249;
+	return v;
+}
+
 unsigned int GridConstuctKey(uint3 xyz)
 {
-	// Bit pack [----Y---][----Z---][----X---]
-	//              8-bit		8-bit		8-bit
+	// Morton (Z-order) code: cells close in space stay close after RearrangeParticlesCS,
+	// so the 27 cells VelocityCS and DensityCS walk are read from fewer places
+	if (g_iGridDot.z == GRID_KEY_MORTON)
+		return MortonSpread(xyz.x) | (MortonSpread(xyz.y) << 1) | (MortonSpread(xyz.z) << 2);
+
+	// Pack [----Y---][----Z---][----X---] as y * (Z * X) + z * X + x, with the grid
+	// dimensions chosen on the CPU (up to MAX_GRID_INDICES cells)
     return dot(xyz.yzx, uint3(g_iGridDot.xy, 1));
 }
 
+// Number of keys GridConstuctKey produces; a Morton key grows with every coordinate, so
+// the far corner has the largest one
+unsigned int GridNumKeys()
+{
+	return GridConstuctKey((uint3)g_fGridDim.xyz - 1) + 1;
+}
+
 uint2 GridConstuctKeyValuePair(uint3 xyz, uint value)
 {
-    // Bit pack [----Z---][----Y---][----X---][-------------VALUE--------------]
-    //             8-bit		8-bit	   8-bit				   32-bit
+    // Pack [-------------KEY----------------][-------------VALUE--------------]
+    //                    32-bit                              32-bit
     return uint2(GridConstuctKey(xyz), value);
 }
 
@@ -519,6 +558,46 @@ uint GridGetValue(uint2 keyvaluepair)
 {
     return keyvaluepair.x;
 }
+
+//--------------------------------------------------------------------------------------
+// Hashed Grid
+// With g_fGridDim.w != 0 the cell ranges are kept in an open addressing hash table of
+// g_fGridDim.w (a power of two) slots instead of one GridIndices entry per cell:
+// GridHash holds the cell key of every slot, GridIndices the [start, end) of that cell.
+//--------------------------------------------------------------------------------------
+#define GRID_HASH_EMPTY 0xFFFFFFFF
+
+uint GridHash(uint key)
+{
+	key ^= key >> 16;
+	key *= 0x7feb352d;
+	key ^= key >> 15;
+	key *= 0x846ca68b;
+	key ^= key >> 16;
+	return key;
+}
+
+uint2 GridCellRange(uint cell)
+{
+	const unsigned int size = (uint)g_fGridDim.w;
+	if (size == 0)
+		return GridIndicesRO[cell];
+
+	const unsigned int mask = size - 1;
+	unsigned int slot = GridHash(cell) & mask;
+	[loop]
+	for (unsigned int i = 0 ; i < size ; i++)
+	{
+		unsigned int key = GridHashRO[slot];
+		if (key == cell)
+			return GridIndicesRO[slot];
+		if (key == GRID_HASH_EMPTY)
+			break;
+		slot = (slot + 1) & mask;
+	}
+	// Empty cell
+	return uint2(0, 0);
+}
 //--------------------------------------------------------------------------------------
 // Build Grid
 //--------------------------------------------------------------------------------------
@@ -526,6 +605,15 @@ uint GridGetValue(uint2 keyvaluepair)
 void BuildGridCS( uint3 Gid : SV_GroupID, uint3 DTid : SV_DispatchThreadID, uint3 GTid : SV_GroupThreadID, uint GI : SV_GroupIndex )
 {
     const unsigned int P_ID = DTid.x; // Particle ID to operate on
+	const unsigned int g_iNumParticles = g_iGridDot.w;
+
+	// Dispatched over the whole (padded) grid buffer; the pad sorts to the end
+	if (P_ID >= g_iNumParticles)
+	{
+		GridRW[P_ID * 2] = 0xFFFFFFFF;
+		GridRW[P_ID * 2 + 1] = GRID_PAD_KEY;
+		return;
+	}
     
     float3 position = ParticlesRO[P_ID].xyz;
 	
@@ -547,6 +635,8 @@ void BuildGridIndicesCS( uint3 Gid : SV_GroupID, uint3 DTid : SV_DispatchThreadI
 {
 	const unsigned int g_iNumParticles = g_iGridDot.w;
     const unsigned int G_ID = DTid.x; // Grid ID to operate on
+	if (G_ID >= g_iNumParticles) return;
+
     unsigned int G_ID_PREV = (G_ID == 0)? g_iNumParticles : G_ID; G_ID_PREV--;
     unsigned int G_ID_NEXT = G_ID + 1; if (G_ID_NEXT == g_iNumParticles) { G_ID_NEXT = 0; }
     
@@ -566,6 +656,132 @@ void BuildGridIndicesCS( uint3 Gid : SV_GroupID, uint3 DTid : SV_DispatchThreadI
 }
 
 
+//--------------------------------------------------------------------------------------
+// Build Grid Hash
+// BuildGridIndicesCS for the hashed grid: the first and the last pair of a cell both
+// find (or claim) the slot of the cell and fill in their end of the range
+//--------------------------------------------------------------------------------------
+
+uint GridHashInsert(uint cell)
+{
+	const unsigned int mask = (uint)g_fGridDim.w - 1;
+	unsigned int slot = GridHash(cell) & mask;
+	[allow_uav_condition]
+	for (;;)
+	{
+		unsigned int prev;
+		InterlockedCompareExchange(GridHashRW[slot], GRID_HASH_EMPTY, cell, prev);
+		if (prev == GRID_HASH_EMPTY || prev == cell)
+			return slot;
+		slot = (slot + 1) & mask;
+	}
+	return slot;
+}
+
+[numthreads(SIMULATION_BLOCK_SIZE, 1, 1)]
+void BuildGridHashCS( uint3 Gid : SV_GroupID, uint3 DTid : SV_DispatchThreadID, uint3 GTid : SV_GroupThreadID, uint GI : SV_GroupIndex )
+{
+	const unsigned int g_iNumParticles = g_iGridDot.w;
+    const unsigned int G_ID = DTid.x; // Grid ID to operate on
+	if (G_ID >= g_iNumParticles) return;
+
+    unsigned int cell = GridGetKey( GridRO[G_ID] );
+	bool bStart = (G_ID == 0) || (cell != GridGetKey( GridRO[G_ID - 1] ));
+	bool bEnd = (G_ID == g_iNumParticles - 1) || (cell != GridGetKey( GridRO[G_ID + 1] ));
+	if (!bStart && !bEnd) return;
+
+	unsigned int slot = GridHashInsert(cell);
+    if (bStart)
+    {
+        // I'm the start of a cell
+        GridIndicesRW[slot].x = G_ID;
+    }
+    if (bEnd)
+    {
+        // I'm the end of a cell
+        GridIndicesRW[slot].y = G_ID + 1;
+    }
+}
+
+
+//--------------------------------------------------------------------------------------
+// Counting Sort Grid
+// Replaces GPUSort + BuildGridIndicesCS: a histogram of the cell keys, a prefix sum over
+// the cells and a scatter. The order inside a cell follows the atomics and is not
+// deterministic, which does not matter to the neighbor sums.
+//--------------------------------------------------------------------------------------
+
+[numthreads(SIMULATION_BLOCK_SIZE, 1, 1)]
+void BuildGridCountCS( uint3 Gid : SV_GroupID, uint3 DTid : SV_DispatchThreadID, uint3 GTid : SV_GroupThreadID, uint GI : SV_GroupIndex )
+{
+    const unsigned int P_ID = DTid.x; // Particle ID to operate on
+	if (P_ID >= g_iGridDot.w) return;
+    
+    float3 position = ParticlesRO[P_ID].xyz;
+	
+    int3 grid_xyz = (int3) GridCalculateCell( position );
+    unsigned int cell = GridConstuctKey((uint3)grid_xyz);
+
+	// The count goes to .y, so the prefix sum can turn it into the end of the cell
+	unsigned int rank;
+	InterlockedAdd(GridCountRW[cell].y, 1, rank);
+
+	// (rank in the cell, cell) instead of (particle id, cell)
+	GridRW[P_ID * 2] = rank;
+	GridRW[P_ID * 2 + 1] = cell;
+}
+
+#define PREFIX_SUM_BLOCK_SIZE 1024
+groupshared unsigned int prefix_shared[PREFIX_SUM_BLOCK_SIZE];
+
+[numthreads(PREFIX_SUM_BLOCK_SIZE, 1, 1)]
+void GridPrefixSumCS( uint3 Gid : SV_GroupID, uint3 DTid : SV_DispatchThreadID, uint3 GTid : SV_GroupThreadID, uint GI : SV_GroupIndex )
+{
+	// A single group; every thread owns a contiguous run of cells
+	const unsigned int num_cells = GridNumKeys();
+	const unsigned int cells_per_thread = (num_cells + PREFIX_SUM_BLOCK_SIZE - 1) / PREFIX_SUM_BLOCK_SIZE;
+	const unsigned int first = min(GI * cells_per_thread, num_cells);
+	const unsigned int last = min(first + cells_per_thread, num_cells);
+
+	unsigned int sum = 0;
+	for (unsigned int c = first ; c < last ; c++)
+		sum += GridCountRW[c].y;
+	prefix_shared[GI] = sum;
+	GroupMemoryBarrierWithGroupSync();
+
+	// Inclusive scan of the per thread sums
+	for (unsigned int offset = 1 ; offset < PREFIX_SUM_BLOCK_SIZE ; offset <<= 1)
+	{
+		unsigned int v = (GI >= offset)? prefix_shared[GI - offset] : 0;
+		GroupMemoryBarrierWithGroupSync();
+		prefix_shared[GI] += v;
+		GroupMemoryBarrierWithGroupSync();
+	}
+
+	unsigned int start = prefix_shared[GI] - sum;
+	for (unsigned int c = first ; c < last ; c++)
+	{
+		unsigned int count = GridCountRW[c].y;
+		GridCountRW[c] = uint2(start, start + count);
+		start += count;
+	}
+}
+
+[numthreads(SIMULATION_BLOCK_SIZE, 1, 1)]
+void ScatterGridCS( uint3 Gid : SV_GroupID, uint3 DTid : SV_DispatchThreadID, uint3 GTid : SV_GroupThreadID, uint GI : SV_GroupIndex )
+{
+    const unsigned int P_ID = DTid.x; // Particle ID to operate on
+	if (P_ID >= g_iGridDot.w) return;
+
+	uint2 rank_cell = GridRO[P_ID];
+	unsigned int cell = GridGetKey( rank_cell );
+	unsigned int G_ID = GridIndicesRO[cell].x + GridGetValue( rank_cell );
+
+	GridRW[G_ID * 2] = P_ID;
+	GridRW[G_ID * 2 + 1] = cell;
+}
+
+
 //--------------------------------------------------------------------------------------
 // Rearrange Particles
 //--------------------------------------------------------------------------------------
@@ -574,6 +790,8 @@ void BuildGridIndicesCS( uint3 Gid : SV_GroupID, uint3 DTid : SV_DispatchThreadI
 void RearrangeParticlesCS( uint3 Gid : SV_GroupID, uint3 DTid : SV_DispatchThreadID, uint3 GTid : SV_GroupThreadID, uint GI : SV_GroupIndex )
 {
     const unsigned int ID = DTid.x; // Particle ID to operate on
+	if (ID >= g_iGridDot.w) return;
+
     const unsigned int G_ID = GridGetValue( GridRO[ ID ] );
     ParticlesRW[ID] = ParticlesRO[ G_ID ];
 }
@@ -585,10 +803,34 @@ float4 CalculateForce(float3 p)
 	return float4(-n, 1.0f) * exp(-r * r / g_fKernel.x);
 }
 
+// Normalize the summed forces, push the particle back from the boundary and move it
+float4 IntegrateParticle(float3 P_position, float4 velocity)
+{
+	if(velocity.w > 0)
+		velocity.xyz /= velocity.w;
+
+	float4 dist = DensityFieldRO.SampleLevel(g_SampleLinear, UnitPos(P_position), 0);
+	float3 norm = normalize(dist.xyz) * g_fParticleParameter.z;
+	float vn = dot(velocity.xyz, norm);
+	float dl = length(dist.xyz);
+	bool valid = dl > g_fParticleParameter.w && vn > 0;
+	if(valid) {
+		float3 proj = vn * norm;
+		float3 tang = velocity.xyz - proj;
+
+		float w = (exp(-dist.w * dist.w / g_fKernel.x) - 0.5f) * g_fKernel.z;
+		velocity.xyz = tang - norm * w;
+	} 
+
+	return float4(max(g_fBoundBoxMin, min(g_fBoundBoxMax, P_position + velocity.xyz * g_fKernel.y)), dl);
+}
+
 [numthreads(SIMULATION_BLOCK_SIZE, 1, 1)]
 void VelocityCS( uint3 Gid : SV_GroupID, uint3 DTid : SV_DispatchThreadID, uint3 GTid : SV_GroupThreadID, uint GI : SV_GroupIndex )
 {
     const unsigned int P_ID = DTid.x;
+	if (P_ID >= g_iGridDot.w) return;
+
     const float h_sq = g_fKernel.x;
     float3 P_position = ParticlesRO[P_ID];
 
@@ -604,7 +846,7 @@ void VelocityCS( uint3 Gid : SV_GroupID, uint3 DTid : SV_DispatchThreadID, uint3
 			for (int X = max(G_XY.x - 1, 0) ; X <= min(G_XY.x + 1, g_fGridDim.x-1) ; X++)
 			{
 				unsigned int G_CELL = GridConstuctKey(uint3(X, Y, Z));
-				uint2 G_START_END = GridIndicesRO[G_CELL];
+				uint2 G_START_END = GridCellRange(G_CELL);
 				for (unsigned int N_ID = G_START_END.x ; N_ID < G_START_END.y ; N_ID++)
 				{
 					float3 N_position = ParticlesRO[N_ID];
@@ -618,23 +860,7 @@ void VelocityCS( uint3 Gid : SV_GroupID, uint3 DTid : SV_DispatchThreadID, uint3
 		}
 	}
 
-	if(velocity.w > 0)
-		velocity.xyz /= velocity.w;
-
-	float4 dist = DensityFieldRO.SampleLevel(g_SampleLinear, UnitPos(P_position), 0);
-	float3 norm = normalize(dist.xyz) * g_fParticleParameter.z;
-	float vn = dot(velocity.xyz, norm);
-	float dl = length(dist.xyz);
-	bool valid = dl > g_fParticleParameter.w && vn > 0;
-	if(valid) {
-		float3 proj = vn * norm;
-		float3 tang = velocity.xyz - proj;
-
-		float w = (exp(-dist.w * dist.w / g_fKernel.x) - 0.5f) * g_fKernel.z;
-		velocity.xyz = tang - norm * w;
-	} 
-
-	ParticlesRW[P_ID] = float4(max(g_fBoundBoxMin, min(g_fBoundBoxMax, P_position + velocity.xyz * g_fKernel.y)), dl);
+	ParticlesRW[P_ID] = IntegrateParticle(P_position, velocity);
 }
 
 float CalculateDensity(float r_sq)
@@ -650,6 +876,8 @@ float CalculateDensity(float r_sq)
 void DensityCS( uint3 Gid : SV_GroupID, uint3 DTid : SV_DispatchThreadID, uint3 GTid : SV_GroupThreadID, uint GI : SV_GroupIndex )
 {
     const unsigned int P_ID = DTid.x;
+	if (P_ID >= g_iGridDot.w) return;
+
     const float h_sq = g_fKernel.x;
     float3 P_position = ParticlesRO[P_ID].xyz;
    
@@ -665,7 +893,7 @@ void DensityCS( uint3 Gid : SV_GroupID, uint3 DTid : SV_DispatchThreadID, uint3
 			for (int X = max(G_XY.x - 1, 0) ; X <= min(G_XY.x + 1, g_fGridDim.x-1) ; X++)
 			{
 				unsigned int G_CELL = GridConstuctKey(uint3(X, Y, Z));
-				uint2 G_START_END = GridIndicesRO[G_CELL];
+				uint2 G_START_END = GridCellRange(G_CELL);
 				for (unsigned int N_ID = G_START_END.x ; N_ID < G_START_END.y ; N_ID++)
 				{
 					float3 N_position = ParticlesRO[N_ID].xyz;
@@ -686,6 +914,56 @@ void DensityCS( uint3 Gid : SV_GroupID, uint3 DTid : SV_DispatchThreadID, uint3
 }
 
 
+//--------------------------------------------------------------------------------------
+// Velocity + Density
+//--------------------------------------------------------------------------------------
+
+// VelocityCS and DensityCS in a single walk over the neighbors: both read the sorted
+// positions, so every neighbor is loaded once for the force and the density
+[numthreads(SIMULATION_BLOCK_SIZE, 1, 1)]
+void VelocityDensityCS( uint3 Gid : SV_GroupID, uint3 DTid : SV_DispatchThreadID, uint3 GTid : SV_GroupThreadID, uint GI : SV_GroupIndex )
+{
+    const unsigned int P_ID = DTid.x;
+	if (P_ID >= g_iGridDot.w) return;
+
+    const float h_sq = g_fKernel.x;
+    float3 P_position = ParticlesRO[P_ID].xyz;
+
+	float4 velocity = 0;
+	float density = 0;
+
+    int3 G_XY = GridCalculateCell( P_position );
+
+	for (int Z = max(G_XY.z - 1, 0) ; Z <= min(G_XY.z + 1, g_fGridDim.z-1) ; Z++)
+	{
+		for (int Y = max(G_XY.y - 1, 0) ; Y <= min(G_XY.y + 1, g_fGridDim.y-1) ; Y++)
+		{
+			for (int X = max(G_XY.x - 1, 0) ; X <= min(G_XY.x + 1, g_fGridDim.x-1) ; X++)
+			{
+				unsigned int G_CELL = GridConstuctKey(uint3(X, Y, Z));
+				uint2 G_START_END = GridCellRange(G_CELL);
+				for (unsigned int N_ID = G_START_END.x ; N_ID < G_START_END.y ; N_ID++)
+				{
+					float3 N_position = ParticlesRO[N_ID].xyz;
+
+					float3 diff = N_position - P_position;
+					float r_sq = dot(diff, diff);
+
+					velocity += CalculateForce(diff);
+					if (r_sq < h_sq)
+					{
+						density += CalculateDensity(r_sq);
+					}
+				}
+			}
+		}
+	}
+
+	ParticlesRW[P_ID] = IntegrateParticle(P_position, velocity);
+	ParticlesDensityFusedRW[P_ID] = density;
+}
+
+
 [numthreads(16, 16, 1)]
 void ArrayTo3DCS( uint3 Gid : SV_GroupID, uint3 DTid : SV_DispatchThreadID, uint3 GTid : SV_GroupThreadID, uint GI : SV_GroupIndex )
 {
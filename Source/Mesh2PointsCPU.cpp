@@ -0,0 +1,1661 @@
+//--------------------------------------------------------------------------------------
+// File: Mesh2PointsCPU.cpp
+//
+// Headless command line driver: relaxes point samples inside an OBJ mesh with the CPU
+// implementation of SimulateFluid_Grid and saves them in the same COFF format as the
+// "Save Result" button of the interactive sample.
+//--------------------------------------------------------------------------------------
+
+#include "DXUT.h"
+#include <float.h>
+#include <atomic>
+#include <fstream>
+#include <new>
+#ifdef __APPLE__
+#include <malloc/malloc.h>
+#else
+#include <malloc.h>
+#endif
+#include <random>
+#include <set>
+#include <unordered_map>
+#include <vector>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#include "geometry/Tuple3.h"
+#include "geometry/TriangleMesh.h"
+#include "geometry/VertexNormals.h"
+#include "geometry/Adjacency.h"
+#include "TglMeshReader.h"
+#include "cpu/FluidGridCPU.h"
+#include "cpu/CacheCounterCPU.h"
+#include "cpu/PhongTessellatorCPU.h"
+#include "cpu/TriangleBVHCPU.h"
+#include "cpu/MappedFileCPU.h"
+#include "cpu/ObjParserCPU.h"
+#include "cpu/MeshCacheCPU.h"
+#include "cpu/StlReaderCPU.h"
+#include "cpu/PlyReaderCPU.h"
+
+// Cmd line params
+typedef struct _CmdLineParams
+{
+	const char* strMeshFilename;
+	const char* strOutputFilename;
+	const char* strSurfaceFilename;
+	int iIterations;
+	int iThreads;
+	int iSortBenchmark;
+	int iGridBenchmark;
+	int iLayoutBenchmark;
+	int iFusedBenchmark;
+	int iKernelBenchmark;
+	int iStorageBenchmark;
+	bool bFieldBenchmark;
+	int iSparseBenchmark;
+	int iPyramidBenchmark;
+	int iWindingBenchmark;
+	int iBVHBenchmark;
+	int iNormalBenchmark;
+	int iAdjacencyBenchmark;
+	bool bPhongBenchmark;
+	int iObjBenchmark;
+	bool bProfile;
+}CmdLineParams;
+static CmdLineParams g_CmdLineParams;
+
+static FluidGridCPU g_Simulator;
+
+//--------------------------------------------------------------------------------------
+// Helper function for command line retrieval
+//--------------------------------------------------------------------------------------
+bool IsNextArg( const char*& strCmdLine, const char* strArg )
+{
+	size_t nArgLen = strlen( strArg );
+	if( strncmp( strCmdLine, strArg, nArgLen ) != 0 )
+		return false;
+	if( strCmdLine[nArgLen] != '\0' && strCmdLine[nArgLen] != ':' )
+		return false;
+
+	strCmdLine += nArgLen;
+	return true;
+}
+
+//--------------------------------------------------------------------------------------
+// Helper function for command line retrieval.  Updates strCmdLine and returns the
+// parameter: if strCmdLine==":1024" then strFlag=="1024"
+//--------------------------------------------------------------------------------------
+bool GetCmdParam( const char*& strCmdLine, const char*& strFlag )
+{
+	if( *strCmdLine != ':' )
+		return false;
+
+	strFlag = strCmdLine + 1;
+	strCmdLine += strlen( strCmdLine );
+	return *strFlag != '\0';
+}
+
+void PrintUsage()
+{
+	printf( "Usage: Mesh2PointsCPU [options] <mesh.obj|.stl|.ply> [<samples.off>]\n"
+		"  -particles:N        number of samples (default 16384)\n"
+		"  -iterations:N       number of relaxation steps (default 500)\n"
+		"  -speed:F            simulation speed (default 1.0)\n"
+		"  -kscale:F           kernel scale (default 2.0)\n"
+		"  -surface:F          surface sample criterion (default 0.05)\n"
+		"  -tess:N             tessellation level for the boundary field (default 1)\n"
+		"  -fieldsize:N|X,Y,Z  boundary field resolution (default 128)\n"
+		"  -fieldvoxel:F       size the field per axis for voxels F mesh units wide\n"
+		"  -fieldvoxels:N      size the field per axis for about N voxels in total\n"
+		"  -field:BUILDER      boundary field, splat (as the GPU), exact or sweep (default splat)\n"
+		"  -phong:F            build the field from a Phong tessellation with chord error below F voxels\n"
+		"  -phongbench         compare exact fields of the mesh and its adaptive and uniform tessellations\n"
+		"  -objbench:N         read the mesh N times with every reader of its format and the cache\n"
+		"  -nomeshcache        neither load nor write the binary cache next to the mesh file\n"
+		"  -normalbench:N      generate the vertex normals of the mesh N times with one and all threads\n"
+		"  -adjbench:N         build the neighbor tables of the mesh N times as std::set and as CSR\n"
+		"  -fieldbench         build the field with every builder and compare them to exact\n"
+		"  -sparsefield        keep the boundary field in 8^3 bricks, dense only near the surface\n"
+		"  -fieldcache:DIR     save dense fields in DIR and map them instead of building them again\n"
+		"  -sparsebench:N      compare N lookups in the sparse and the dense field\n"
+		"  -fieldlevels:N      start on the coarsest of N field mip levels, finer as the samples settle\n"
+		"  -pyramidbench:N     time lookups on every field level, with -fieldlevels also N frames from the start\n"
+		"  -winding            sign and orient the field by the winding number, for open meshes\n"
+		"  -windingbench:N     time N winding number queries with the tree and by brute force\n"
+		"  -bvhbench:N         time N closest point, signed distance and ray queries with each BVH split\n"
+		"  -offset:X,Y,Z       initial offset, relative to the box extents (default 0,0,0)\n"
+		"  -invertnormal       use the inverted normal of the mesh\n"
+		"  -seed:N             random seed for the initial samples (default 0)\n"
+		"  -threads:N          number of worker threads (default: all cores)\n"
+		"  -sort:MODE          grid binning, counting, radix or bitonic (default counting)\n"
+		"  -sortbench:N        time N runs of every grid binning on the relaxed samples\n"
+		"  -griddim:N          N^3 grid cells (default: about one smoothing length per cell)\n"
+		"  -gridbench:N        time N frames with a 32^3 grid and with the automatic grid\n"
+		"  -hashgrid           store only the occupied grid cells, in a hash table\n"
+		"  -keys:LAYOUT        cell key order, rowmajor or morton (default rowmajor)\n"
+		"  -layoutbench:N      time N frames and count cache misses with each key order\n"
+		"  -separatepasses     run Velocity and Density as two passes instead of one\n"
+		"  -fusebench:N        time N frames with the separate and with the fused passes\n"
+		"  -kernel:ISA         force kernel, reference, avx2, avx512 or auto (default auto)\n"
+		"  -kernelbench:N      check the SIMD force kernels and time N frames with each\n"
+		"  -storage:LAYOUT     sorted particle storage, aos or soa (default aos)\n"
+		"  -storagebench:N     time the Velocity and Density passes for N frames with each storage\n"
+		"  -surfaceout:FILE    also save the samples classified as surface samples\n"
+		"  -profile            print the time spent in each pass\n" );
+}
+
+//--------------------------------------------------------------------------------------
+// Helper function to parse the command line
+//--------------------------------------------------------------------------------------
+bool ParseCommandLine( int argc, char** argv )
+{
+	// set some defaults
+	g_CmdLineParams.strMeshFilename = NULL;
+	g_CmdLineParams.strOutputFilename = "samples.off";
+	g_CmdLineParams.strSurfaceFilename = NULL;
+	g_CmdLineParams.iIterations = 500;
+	g_CmdLineParams.iThreads = 0;
+	g_CmdLineParams.iSortBenchmark = 0;
+	g_CmdLineParams.iGridBenchmark = 0;
+	g_CmdLineParams.iLayoutBenchmark = 0;
+	g_CmdLineParams.iFusedBenchmark = 0;
+	g_CmdLineParams.iKernelBenchmark = 0;
+	g_CmdLineParams.iStorageBenchmark = 0;
+	g_CmdLineParams.bFieldBenchmark = false;
+	g_CmdLineParams.iSparseBenchmark = 0;
+	g_CmdLineParams.iPyramidBenchmark = 0;
+	g_CmdLineParams.iWindingBenchmark = 0;
+	g_CmdLineParams.iBVHBenchmark = 0;
+	g_CmdLineParams.iNormalBenchmark = 0;
+	g_CmdLineParams.iAdjacencyBenchmark = 0;
+	g_CmdLineParams.bPhongBenchmark = false;
+	g_CmdLineParams.iObjBenchmark = 0;
+	g_CmdLineParams.bProfile = false;
+
+	FluidGridCPU::Settings& settings = g_Simulator.GetSettings();
+	int nPositional = 0;
+
+	for( int iArg = 1; iArg < argc; iArg++ )
+	{
+		const char* strCmdLine = argv[iArg];
+		const char* strFlag = NULL;
+
+		// Handle flag args
+		if( *strCmdLine == '-' )
+		{
+			strCmdLine++;
+
+			if( IsNextArg( strCmdLine, "particles" ) && GetCmdParam( strCmdLine, strFlag ) )
+			{
+				settings.iNumParticles = (UINT)strtoul( strFlag, NULL, 10 );
+				continue;
+			}
+			if( IsNextArg( strCmdLine, "iterations" ) && GetCmdParam( strCmdLine, strFlag ) )
+			{
+				g_CmdLineParams.iIterations = atoi( strFlag );
+				continue;
+			}
+			if( IsNextArg( strCmdLine, "speed" ) && GetCmdParam( strCmdLine, strFlag ) )
+			{
+				settings.fSpeed = (FLOAT)atof( strFlag );
+				continue;
+			}
+			if( IsNextArg( strCmdLine, "kscale" ) && GetCmdParam( strCmdLine, strFlag ) )
+			{
+				settings.fKScale = (FLOAT)atof( strFlag );
+				continue;
+			}
+			if( IsNextArg( strCmdLine, "surface" ) && GetCmdParam( strCmdLine, strFlag ) )
+			{
+				settings.fSurface = (FLOAT)atof( strFlag );
+				continue;
+			}
+			if( IsNextArg( strCmdLine, "tess" ) && GetCmdParam( strCmdLine, strFlag ) )
+			{
+				settings.uTessFactor = (UINT)max( atoi( strFlag ), 1 );
+				continue;
+			}
+			if( IsNextArg( strCmdLine, "fieldsize" ) && GetCmdParam( strCmdLine, strFlag ) )
+			{
+				int iSize[3];
+				if( sscanf( strFlag, "%d,%d,%d", &iSize[0], &iSize[1], &iSize[2] ) != 3 )
+					iSize[0] = iSize[1] = iSize[2] = atoi( strFlag );
+				for( int i = 0; i < 3; i++ )
+					settings.iFieldSize[i] = (UINT)max( iSize[i], 2 );
+				continue;
+			}
+			if( IsNextArg( strCmdLine, "fieldvoxels" ) && GetCmdParam( strCmdLine, strFlag ) )
+			{
+				settings.iFieldVoxels = (UINT)max( atoi( strFlag ), 1 );
+				continue;
+			}
+			if( IsNextArg( strCmdLine, "fieldvoxel" ) && GetCmdParam( strCmdLine, strFlag ) )
+			{
+				settings.fFieldVoxel = (FLOAT)atof( strFlag );
+				continue;
+			}
+			if( IsNextArg( strCmdLine, "field" ) && GetCmdParam( strCmdLine, strFlag ) )
+			{
+				if( strcmp( strFlag, "splat" ) == 0 )
+					settings.eFieldBuilder = FluidGridCPU::FIELD_BUILD_SPLAT;
+				else if( strcmp( strFlag, "exact" ) == 0 )
+					settings.eFieldBuilder = FluidGridCPU::FIELD_BUILD_EXACT;
+				else if( strcmp( strFlag, "sweep" ) == 0 )
+					settings.eFieldBuilder = FluidGridCPU::FIELD_BUILD_SWEEP;
+				else
+					return false;
+				continue;
+			}
+			if( IsNextArg( strCmdLine, "phong" ) && GetCmdParam( strCmdLine, strFlag ) )
+			{
+				settings.fPhongTolerance = (FLOAT)atof( strFlag );
+				continue;
+			}
+			if( IsNextArg( strCmdLine, "phongbench" ) )
+			{
+				g_CmdLineParams.bPhongBenchmark = true;
+				continue;
+			}
+			if( IsNextArg( strCmdLine, "objbench" ) && GetCmdParam( strCmdLine, strFlag ) )
+			{
+				g_CmdLineParams.iObjBenchmark = atoi( strFlag );
+				continue;
+			}
+			if( IsNextArg( strCmdLine, "normalbench" ) && GetCmdParam( strCmdLine, strFlag ) )
+			{
+				g_CmdLineParams.iNormalBenchmark = atoi( strFlag );
+				continue;
+			}
+			if( IsNextArg( strCmdLine, "adjbench" ) && GetCmdParam( strCmdLine, strFlag ) )
+			{
+				g_CmdLineParams.iAdjacencyBenchmark = atoi( strFlag );
+				continue;
+			}
+			if( IsNextArg( strCmdLine, "nomeshcache" ) )
+			{
+				MeshObjReader::enable_cache( false );
+				continue;
+			}
+			if( IsNextArg( strCmdLine, "fieldbench" ) )
+			{
+				g_CmdLineParams.bFieldBenchmark = true;
+				continue;
+			}
+			if( IsNextArg( strCmdLine, "sparsefield" ) )
+			{
+				settings.bSparseField = true;
+				continue;
+			}
+			if( IsNextArg( strCmdLine, "fieldcache" ) && GetCmdParam( strCmdLine, strFlag ) )
+			{
+				settings.strFieldCache = strFlag;
+				continue;
+			}
+			if( IsNextArg( strCmdLine, "sparsebench" ) && GetCmdParam( strCmdLine, strFlag ) )
+			{
+				g_CmdLineParams.iSparseBenchmark = atoi( strFlag );
+				continue;
+			}
+			if( IsNextArg( strCmdLine, "fieldlevels" ) && GetCmdParam( strCmdLine, strFlag ) )
+			{
+				settings.iFieldLevels = atoi( strFlag );
+				continue;
+			}
+			if( IsNextArg( strCmdLine, "pyramidbench" ) && GetCmdParam( strCmdLine, strFlag ) )
+			{
+				g_CmdLineParams.iPyramidBenchmark = atoi( strFlag );
+				continue;
+			}
+			if( IsNextArg( strCmdLine, "winding" ) )
+			{
+				settings.bWindingNumber = true;
+				continue;
+			}
+			if( IsNextArg( strCmdLine, "windingbench" ) && GetCmdParam( strCmdLine, strFlag ) )
+			{
+				g_CmdLineParams.iWindingBenchmark = atoi( strFlag );
+				continue;
+			}
+			if( IsNextArg( strCmdLine, "bvhbench" ) && GetCmdParam( strCmdLine, strFlag ) )
+			{
+				g_CmdLineParams.iBVHBenchmark = atoi( strFlag );
+				continue;
+			}
+			if( IsNextArg( strCmdLine, "offset" ) && GetCmdParam( strCmdLine, strFlag ) )
+			{
+				D3DXVECTOR3& v = settings.vInitOffset;
+				if( sscanf( strFlag, "%f,%f,%f", &v.x, &v.y, &v.z ) == 3 )
+					continue;
+			}
+			if( IsNextArg( strCmdLine, "invertnormal" ) )
+			{
+				settings.fNormalScalar = -settings.fNormalScalar;
+				continue;
+			}
+			if( IsNextArg( strCmdLine, "seed" ) && GetCmdParam( strCmdLine, strFlag ) )
+			{
+				settings.iSeed = (UINT)strtoul( strFlag, NULL, 10 );
+				continue;
+			}
+			if( IsNextArg( strCmdLine, "threads" ) && GetCmdParam( strCmdLine, strFlag ) )
+			{
+				g_CmdLineParams.iThreads = atoi( strFlag );
+				continue;
+			}
+			if( IsNextArg( strCmdLine, "sort" ) && GetCmdParam( strCmdLine, strFlag ) )
+			{
+				if( strcmp( strFlag, "counting" ) == 0 )
+				{
+					settings.eGridSort = FluidGridCPU::GRID_SORT_COUNTING;
+					continue;
+				}
+				if( strcmp( strFlag, "radix" ) == 0 )
+				{
+					settings.eGridSort = FluidGridCPU::GRID_SORT_RADIX;
+					continue;
+				}
+				if( strcmp( strFlag, "bitonic" ) == 0 )
+				{
+					settings.eGridSort = FluidGridCPU::GRID_SORT_BITONIC;
+					continue;
+				}
+			}
+			if( IsNextArg( strCmdLine, "sortbench" ) && GetCmdParam( strCmdLine, strFlag ) )
+			{
+				g_CmdLineParams.iSortBenchmark = atoi( strFlag );
+				continue;
+			}
+			if( IsNextArg( strCmdLine, "griddim" ) && GetCmdParam( strCmdLine, strFlag ) )
+			{
+				settings.iGridDim = (UINT)max( atoi( strFlag ), 0 );
+				continue;
+			}
+			if( IsNextArg( strCmdLine, "hashgrid" ) )
+			{
+				settings.bHashedGrid = true;
+				continue;
+			}
+			if( IsNextArg( strCmdLine, "keys" ) && GetCmdParam( strCmdLine, strFlag ) )
+			{
+				if( strcmp( strFlag, "rowmajor" ) == 0 )
+					settings.eGridKeys = FluidGridCPU::GRID_KEY_ROW_MAJOR;
+				else if( strcmp( strFlag, "morton" ) == 0 )
+					settings.eGridKeys = FluidGridCPU::GRID_KEY_MORTON;
+				else
+					return false;
+				continue;
+			}
+			if( IsNextArg( strCmdLine, "separatepasses" ) )
+			{
+				settings.bFusedVelocityDensity = false;
+				continue;
+			}
+			if( IsNextArg( strCmdLine, "kernel" ) && GetCmdParam( strCmdLine, strFlag ) )
+			{
+				if( strcmp( strFlag, "reference" ) == 0 )
+					settings.eForceKernel = FORCE_KERNEL_REFERENCE;
+				else if( strcmp( strFlag, "avx2" ) == 0 )
+					settings.eForceKernel = FORCE_KERNEL_AVX2;
+				else if( strcmp( strFlag, "avx512" ) == 0 )
+					settings.eForceKernel = FORCE_KERNEL_AVX512;
+				else if( strcmp( strFlag, "auto" ) == 0 )
+					settings.eForceKernel = FORCE_KERNEL_AUTO;
+				else
+					return false;
+				continue;
+			}
+			if( IsNextArg( strCmdLine, "kernelbench" ) && GetCmdParam( strCmdLine, strFlag ) )
+			{
+				g_CmdLineParams.iKernelBenchmark = atoi( strFlag );
+				continue;
+			}
+			if( IsNextArg( strCmdLine, "storage" ) && GetCmdParam( strCmdLine, strFlag ) )
+			{
+				if( strcmp( strFlag, "aos" ) == 0 )
+					settings.eParticleLayout = FluidGridCPU::PARTICLE_LAYOUT_AOS;
+				else if( strcmp( strFlag, "soa" ) == 0 )
+					settings.eParticleLayout = FluidGridCPU::PARTICLE_LAYOUT_SOA;
+				else
+					return false;
+				continue;
+			}
+			if( IsNextArg( strCmdLine, "storagebench" ) && GetCmdParam( strCmdLine, strFlag ) )
+			{
+				g_CmdLineParams.iStorageBenchmark = atoi( strFlag );
+				continue;
+			}
+			if( IsNextArg( strCmdLine, "fusebench" ) && GetCmdParam( strCmdLine, strFlag ) )
+			{
+				g_CmdLineParams.iFusedBenchmark = atoi( strFlag );
+				continue;
+			}
+			if( IsNextArg( strCmdLine, "layoutbench" ) && GetCmdParam( strCmdLine, strFlag ) )
+			{
+				g_CmdLineParams.iLayoutBenchmark = atoi( strFlag );
+				continue;
+			}
+			if( IsNextArg( strCmdLine, "gridbench" ) && GetCmdParam( strCmdLine, strFlag ) )
+			{
+				g_CmdLineParams.iGridBenchmark = atoi( strFlag );
+				continue;
+			}
+			if( IsNextArg( strCmdLine, "surfaceout" ) && GetCmdParam( strCmdLine, strFlag ) )
+			{
+				g_CmdLineParams.strSurfaceFilename = strFlag;
+				continue;
+			}
+			if( IsNextArg( strCmdLine, "profile" ) )
+			{
+				g_CmdLineParams.bProfile = true;
+				continue;
+			}
+
+			printf( "Unknown or malformed option: %s\n", argv[iArg] );
+			return false;
+		}
+
+		if( nPositional == 0 )
+			g_CmdLineParams.strMeshFilename = argv[iArg];
+		else if( nPositional == 1 )
+			g_CmdLineParams.strOutputFilename = argv[iArg];
+		else
+			return false;
+		nPositional++;
+	}
+
+	return g_CmdLineParams.strMeshFilename != NULL && settings.iNumParticles > 0;
+}
+
+//--------------------------------------------------------------------------------------
+// Save the samples; with bSaveSurface only the ones classified as surface samples
+//--------------------------------------------------------------------------------------
+HRESULT SavePoints( const char* strOff, bool bSaveSurface = false )
+{
+	std::ofstream InFile( strOff );
+	if( !InFile ) {
+		printf( "Cannot open %s for writing\n", strOff );
+		return E_FAIL;
+	}
+
+	const std::vector<D3DXVECTOR4>& pVert = g_Simulator.GetParticles();
+	const FLOAT fSurface = g_Simulator.GetSettings().fSurface;
+
+	size_t count = pVert.size();
+	if( bSaveSurface )
+	{
+		for( size_t i = 0; i < pVert.size(); i++ )
+			if( pVert[i].w < fSurface ) --count;
+	}
+
+	InFile << "COFF" << std::endl;
+	InFile << count << " " << 0 << " " << 0 << std::endl;
+
+	for( size_t i = 0; i < pVert.size(); i++ ) {
+		const D3DXVECTOR4& ivert = pVert[i];
+		if( bSaveSurface && ivert.w < fSurface ) continue;
+		InFile << ivert.x << " " << ivert.y << " " << ivert.z << "\n";
+	}
+	InFile.close();
+
+	return InFile.fail() ? E_FAIL : S_OK;
+}
+
+void PrintTimings()
+{
+	FluidGridCPU::PassTimings& t = g_Simulator.GetTimings();
+	const UINT iFrames = max( t.iFrames, 1u );
+	struct { const char* strName; double fTime; } passes[] =
+	{
+		{ "BuildGrid", t.fBuildGrid },
+		{ "SortGrid", t.fSortGrid },
+		{ "BuildGridIndices", t.fBuildGridIndices },
+		{ "RearrangeParticles", t.fRearrangeParticles },
+		{ "Velocity", t.fVelocity },
+		{ "Density", t.fDensity },
+		{ "VelocityDensity", t.fVelocityDensity },
+	};
+
+	double fTotal = 0;
+	for( size_t i = 0; i < ARRAYSIZE( passes ); i++ )
+		fTotal += passes[i].fTime;
+
+	printf( "Field construction: %.3f s\n", t.fBuildField );
+	printf( "%-20s %12s %12s %7s\n", "Pass", "Total (s)", "Frame (ms)", "%" );
+	for( size_t i = 0; i < ARRAYSIZE( passes ); i++ )
+	{
+		printf( "%-20s %12.4f %12.4f %6.1f%%\n", passes[i].strName, passes[i].fTime,
+			passes[i].fTime * 1000.0 / iFrames, fTotal > 0 ? passes[i].fTime * 100.0 / fTotal : 0.0 );
+	}
+	printf( "%-20s %12.4f %12.4f\n", "Total", fTotal, fTotal * 1000.0 / iFrames );
+	if( g_Simulator.IsGridHashed() )
+	{
+		const GridHashCPU& hash = g_Simulator.GetGridHash();
+		printf( "Hashed grid: %u occupied cells, %.1f KB\n", hash.GetNumCells(),
+			hash.GetMemorySize() / 1024.0 );
+	}
+	if( g_Simulator.IsFieldSparse() )
+	{
+		const SparseFieldCPU& field = g_Simulator.GetSparseField();
+		printf( "Sparse field: %u of %u bricks dense, %.1f MB (dense field %.1f MB)\n", field.GetNumDenseBricks(),
+			field.GetNumBricks(), field.GetMemorySize() / 1048576.0, field.GetDenseMemorySize() / 1048576.0 );
+	}
+}
+
+//--------------------------------------------------------------------------------------
+// Time the grid binnings against the bitonic sort GPUSort uses
+//--------------------------------------------------------------------------------------
+void BenchmarkGridSort( int iRepeats )
+{
+	struct { const char* strName; FluidGridCPU::GridSortMode eMode; } modes[] =
+	{
+		{ "bitonic", FluidGridCPU::GRID_SORT_BITONIC },
+		{ "radix", FluidGridCPU::GRID_SORT_RADIX },
+		{ "counting", FluidGridCPU::GRID_SORT_COUNTING },
+	};
+	const UINT n = g_Simulator.GetSettings().iNumParticles;
+
+	printf( "Grid binning of %u pairs, %d runs (sort + grid indices)\n", n, iRepeats );
+	printf( "%-20s %12s %12s %9s\n", "Method", "Time (ms)", "Mpairs/s", "Speedup" );
+	double fBitonic = 0;
+	for( size_t i = 0; i < ARRAYSIZE( modes ); i++ )
+	{
+		double fTime = g_Simulator.TimeGridSort( modes[i].eMode, iRepeats );
+		if( i == 0 )
+			fBitonic = fTime;
+		printf( "%-20s %12.4f %12.2f %8.2fx\n", modes[i].strName, fTime * 1000.0,
+			fTime > 0 ? n / fTime * 1e-6 : 0.0, fTime > 0 ? fBitonic / fTime : 0.0 );
+	}
+}
+
+//--------------------------------------------------------------------------------------
+// Read strFile iRepeats times: raw, through the mapping, with the line by line stream
+// reader, with the parallel parser alone, with MeshObjReader::read, which parses and
+// builds the mesh, and from the mesh cache. All of them must give the same mesh.
+//--------------------------------------------------------------------------------------
+void BenchmarkObjReader( const char* strFile, int iRepeats )
+{
+	MappedFileCPU mapping;
+	if( FAILED( mapping.Open( strFile ) ) )
+	{
+		printf( "Cannot map %s\n", strFile );
+		return;
+	}
+	const double fMB = mapping.GetSize() / 1048576.0;
+	double fTimes[6] = { 0, 0, 0, 0, 0, 0 };
+	UINT64 iCheck = 0;
+	TriangleMesh stream, parallel, cached;
+	const bool bCache = MeshObjReader::cache_enabled();
+	MeshObjReader::enable_cache( false );
+	ObjParserCPU parser;
+	std::vector<char> buffer( mapping.GetSize() );
+	for( int r = 0; r < iRepeats; r++ )
+	{
+		double fStart = omp_get_wtime();
+		FILE* pFile = fopen( strFile, "rb" );
+		if( pFile )
+		{
+			iCheck += fread( &buffer[0], 1, buffer.size(), pFile );
+			fclose( pFile );
+		}
+		fTimes[0] += omp_get_wtime() - fStart;
+
+		fStart = omp_get_wtime();
+		const BYTE* pData = mapping.GetData();
+		const INT64 n = (INT64)mapping.GetSize();
+		UINT64 iSum = 0;
+		#pragma omp parallel for schedule(static) reduction(+:iSum)
+		for( INT64 i = 0; i < n; i++ )
+			iSum += pData[i];
+		iCheck += iSum;
+		fTimes[1] += omp_get_wtime() - fStart;
+
+		fStart = omp_get_wtime();
+		std::ifstream fin( strFile );
+		stream.clear();
+		MeshObjReader::read( fin, stream, false, false );
+		fTimes[2] += omp_get_wtime() - fStart;
+
+		fStart = omp_get_wtime();
+		parser.Parse( strFile );
+		fTimes[3] += omp_get_wtime() - fStart;
+
+		fStart = omp_get_wtime();
+		parallel.clear();
+		MeshObjReader::read( strFile, parallel );
+		fTimes[4] += omp_get_wtime() - fStart;
+
+		// Saved once, on purpose apart from the cache next to the mesh
+		const std::string strCache = MeshCacheCPU::GetCachePath( strFile ) + ".bench";
+		if( r == 0 && FAILED( MeshCacheCPU::Save( strCache.c_str(), strFile, 0, parallel ) ) )
+			printf( "Cannot write %s\n", strCache.c_str() );
+		fStart = omp_get_wtime();
+		cached.clear();
+		MeshCacheCPU::Load( strCache.c_str(), strFile, 0, cached );
+		fTimes[5] += omp_get_wtime() - fStart;
+		if( r == iRepeats - 1 )
+			remove( strCache.c_str() );
+	}
+	MeshObjReader::enable_cache( bCache );
+
+	bool bSame = true;
+	const TriangleMesh* pMeshes[2] = { &parallel, &cached };
+	for( int m = 0; m < 2; m++ )
+		bSame = bSame && stream.num_vertices() == pMeshes[m]->num_vertices() &&
+			stream.num_triangles() == pMeshes[m]->num_triangles() &&
+			memcmp( &stream.vertices()[0], &pMeshes[m]->vertices()[0], stream.num_vertices() * sizeof( D3DXVECTOR3 ) ) == 0 &&
+			memcmp( &stream.normals()[0], &pMeshes[m]->normals()[0], stream.num_vertices() * sizeof( D3DXVECTOR3 ) ) == 0 &&
+			memcmp( &stream.triangles()[0], &pMeshes[m]->triangles()[0], stream.num_triangles() * sizeof( Tuple3ui ) ) == 0;
+
+	const char* strReaders[6] = { "fread", "Mapping", "Stream", "Parser", "Parser + mesh", "Mesh cache" };
+	printf( "%s, %.1f MB, %u lines in %u chunks, %d repeats\n", strFile, fMB, parser.GetNumLines(),
+		parser.GetNumChunks(), iRepeats );
+	printf( "%-14s %10s %10s %9s\n", "Reader", "Time (s)", "MB/s", "Speedup" );
+	for( int k = 0; k < 6; k++ )
+	{
+		const double fTime = fTimes[k] / iRepeats;
+		printf( "%-14s %10.4f %10.1f %8.2fx\n", strReaders[k], fTime, fTime > 0 ? fMB / fTime : 0.0,
+			fTime > 0 ? fTimes[2] / fTimes[k] : 0.0 );
+	}
+	printf( "The readers give %s meshes (checksum %llu)\n", bSame ? "identical" : "different", (unsigned long long)iCheck );
+}
+
+//--------------------------------------------------------------------------------------
+// Read an STL or PLY strFile iRepeats times: raw, with its streaming reader alone and
+// with MeshObjReader::read, which also builds the mesh
+//--------------------------------------------------------------------------------------
+void BenchmarkMeshReader( const char* strFile, int iRepeats, bool bStl )
+{
+	double fTimes[3] = { 0, 0, 0 };
+	UINT iCheck = 0;
+	UINT64 iSize = 0;
+	TriangleMesh mesh;
+	StlReaderCPU stl;
+	PlyReaderCPU ply;
+	std::vector<char> buffer( 1 << 20 );
+	const bool bCache = MeshObjReader::cache_enabled();
+	MeshObjReader::enable_cache( false );
+	for( int r = 0; r < iRepeats; r++ )
+	{
+		double fStart = omp_get_wtime();
+		FILE* pFile = fopen( strFile, "rb" );
+		if( pFile )
+		{
+			size_t n;
+			while( ( n = fread( &buffer[0], 1, buffer.size(), pFile ) ) > 0 )
+				iCheck += (UINT)n + (BYTE)buffer[n - 1];
+			fclose( pFile );
+		}
+		fTimes[0] += omp_get_wtime() - fStart;
+
+		fStart = omp_get_wtime();
+		if( bStl )
+			stl.Read( strFile );
+		else
+			ply.Read( strFile );
+		fTimes[1] += omp_get_wtime() - fStart;
+
+		fStart = omp_get_wtime();
+		mesh.clear();
+		MeshObjReader::read( strFile, mesh );
+		fTimes[2] += omp_get_wtime() - fStart;
+	}
+	MeshObjReader::enable_cache( bCache );
+
+	iSize = bStl ? stl.GetFileSize() : ply.GetFileSize();
+	const double fMB = iSize / 1048576.0;
+	if( bStl )
+		printf( "%s, %s STL, %.1f MB, %u corners welded to %u vertices, %u degenerate triangles, %d repeats\n",
+			strFile, stl.IsBinary() ? "binary" : "ASCII", fMB,
+			( (UINT)stl.GetTriangles().size() + stl.GetNumDegenerate() ) * 3, (UINT)stl.GetVertices().size(),
+			stl.GetNumDegenerate(), iRepeats );
+	else
+		printf( "%s, %s PLY, %.1f MB, %u vertices, %u triangles, %u degenerate, %d repeats\n", strFile,
+			ply.IsBinary() ? "binary" : "ASCII", fMB, (UINT)ply.GetVertices().size(),
+			(UINT)ply.GetTriangles().size(), ply.GetNumDegenerate(), iRepeats );
+	const char* strReaders[3] = { "fread", bStl ? "StlReader" : "PlyReader", "Reader + mesh" };
+	printf( "%-14s %10s %10s %9s\n", "Reader", "Time (s)", "MB/s", "Of fread" );
+	for( int k = 0; k < 3; k++ )
+	{
+		const double fTime = fTimes[k] / iRepeats;
+		printf( "%-14s %10.4f %10.1f %8.0f%%\n", strReaders[k], fTime, fTime > 0 ? fMB / fTime : 0.0,
+			fTimes[k] > 0 ? 100.0 * fTimes[0] / fTimes[k] : 0.0 );
+	}
+	printf( "%d vertices, %d triangles (checksum %u)\n", mesh.num_vertices(), mesh.num_triangles(), iCheck );
+}
+
+//--------------------------------------------------------------------------------------
+// Generate the area weighted vertex normals of mesh iRepeats times with one thread, which
+// scatters over the triangles, and with all of them, which gather over the corner index.
+// Both must give the same sums.
+//--------------------------------------------------------------------------------------
+void BenchmarkVertexNormals( const TriangleMesh& mesh, int iRepeats )
+{
+	const int nThreads = omp_get_max_threads();
+	std::vector<D3DXVECTOR3> normals[2];
+	double fIndex[2] = { 0, 0 }, fSum[2] = { 0, 0 };
+	for( int k = 0; k < 2; k++ )
+	{
+		omp_set_num_threads( k == 0 ? 1 : nThreads );
+		for( int r = 0; r < iRepeats; r++ )
+		{
+			double fStart = omp_get_wtime();
+			VertexNormals gen;
+			gen.build( mesh.triangles(), mesh.num_vertices() );
+			fIndex[k] += omp_get_wtime() - fStart;
+
+			fStart = omp_get_wtime();
+			gen.accumulate( mesh.vertices(), VertexNormals::AREA_WEIGHTED, normals[k] );
+			fSum[k] += omp_get_wtime() - fStart;
+		}
+	}
+	omp_set_num_threads( nThreads );
+
+	const bool bSame = normals[0].size() == normals[1].size() &&
+		memcmp( &normals[0][0], &normals[1][0], normals[0].size() * sizeof( D3DXVECTOR3 ) ) == 0;
+	printf( "%d vertices, %d triangles, %d repeats\n", mesh.num_vertices(), mesh.num_triangles(), iRepeats );
+	printf( "%-22s %10s %10s %10s\n", "Normals", "Index (ms)", "Sum (ms)", "Mtri/s" );
+	for( int k = 0; k < 2; k++ )
+	{
+		const double fTime = ( fIndex[k] + fSum[k] ) / iRepeats;
+		char strName[32];
+		snprintf( strName, sizeof( strName ), k == 0 ? "Scatter, 1 thread" : "Gather, %d threads", nThreads );
+		printf( "%-22s %10.2f %10.2f %10.1f\n", strName, fIndex[k] / iRepeats * 1e3, fSum[k] / iRepeats * 1e3,
+			fTime > 0 ? mesh.num_triangles() / fTime * 1e-6 : 0.0 );
+	}
+	printf( "The sums are %s\n", bSame ? "identical" : "different" );
+}
+
+//--------------------------------------------------------------------------------------
+// Heap bytes allocated while g_bCountHeap is set, less those freed, and their peak, for
+// the adjacency benchmark. Blocks count at their usable size, so allocator rounding is in.
+//--------------------------------------------------------------------------------------
+static volatile bool g_bCountHeap = false;
+static std::atomic<long long> g_iHeapBytes( 0 );
+static std::atomic<long long> g_iPeakHeapBytes( 0 );
+
+static size_t HeapBlockSize( void* p )
+{
+#ifdef __APPLE__
+	return malloc_size( p );
+#else
+	return malloc_usable_size( p );
+#endif
+}
+
+void* operator new( size_t n )
+{
+	void* p = malloc( n ? n : 1 );
+	if( !p )
+		throw std::bad_alloc();
+	if( g_bCountHeap )
+	{
+		long long iBytes = g_iHeapBytes += (long long)HeapBlockSize( p );
+		long long iPeak = g_iPeakHeapBytes;
+		while( iBytes > iPeak && !g_iPeakHeapBytes.compare_exchange_weak( iPeak, iBytes ) );
+	}
+	return p;
+}
+
+void operator delete( void* p ) noexcept
+{
+	if( p && g_bCountHeap )
+		g_iHeapBytes -= (long long)HeapBlockSize( p );
+	free( p );
+}
+
+//--------------------------------------------------------------------------------------
+// Times a build, or, for the untimed pass, counts the heap it holds when done and at its peak
+//--------------------------------------------------------------------------------------
+class BuildMeter
+{
+public:
+	BuildMeter( bool bHeap ) : m_bHeap( bHeap ), m_fStart( 0 ) {}
+
+	void Start()
+	{
+		if( m_bHeap )
+		{
+			g_iHeapBytes = g_iPeakHeapBytes = 0;
+			g_bCountHeap = true;
+		}
+		m_fStart = omp_get_wtime();
+	}
+
+	void Stop( double& fTime, size_t& iBytes, size_t& iPeak )
+	{
+		double fElapsed = omp_get_wtime() - m_fStart;
+		if( !m_bHeap )
+		{
+			fTime += fElapsed;
+			return;
+		}
+		g_bCountHeap = false;
+		iBytes = (size_t)max( g_iHeapBytes.load(), 0ll );
+		iPeak = (size_t)g_iPeakHeapBytes.load();
+	}
+
+private:
+	bool m_bHeap;
+	double m_fStart;
+};
+
+//--------------------------------------------------------------------------------------
+// Build the vertex triangles, the vertex neighbors and the face neighbors of mesh
+// iRepeats times as std::set and hash tables, as TriangleMesh did before the Adjacency
+// tables, and as those tables with one and all threads. Prints the time of each, the heap
+// its result holds and the peak heap while building, and checks that they list the same
+// neighbors.
+//--------------------------------------------------------------------------------------
+void BenchmarkAdjacency( const TriangleMesh& mesh, int iRepeats )
+{
+	const int nThreads = omp_get_max_threads();
+	const std::vector<Tuple3ui>& tgls = mesh.triangles();
+	const int nVertices = mesh.num_vertices();
+	double fTimes[3][3] = { { 0 } };
+	size_t iBytes[3][3] = { { 0 } }, iPeak[3][3] = { { 0 } };
+
+	std::vector<std::set<int> > setTgls, setNbrs;
+	std::vector<TriangleMesh::NeighborRec> hashFaces, faces[2];
+	Adjacency vtxTgls[2], vtxNbrs[2];
+	// Pass -1 counts the heap and is not timed
+	for( int r = -1; r < iRepeats; r++ )
+	{
+		BuildMeter meter( r < 0 );
+
+		// The old get_vtx_tgls, get_vtx_neighborship and get_face_neighborship
+		std::vector<std::set<int> >().swap( setTgls );
+		std::vector<std::set<int> >().swap( setNbrs );
+		std::vector<TriangleMesh::NeighborRec>().swap( hashFaces );
+		meter.Start();
+		setTgls.resize( nVertices );
+		for( size_t i = 0; i < tgls.size(); i++ )
+			for( int k = 0; k < 3; k++ )
+				setTgls[tgls[i][k]].insert( (int)i );
+		meter.Stop( fTimes[0][0], iBytes[0][0], iPeak[0][0] );
+
+		meter.Start();
+		setNbrs.resize( nVertices );
+		for( size_t i = 0; i < tgls.size(); i++ )
+			for( int k = 0; k < 3; k++ )
+			{
+				setNbrs[tgls[i][k]].insert( tgls[i][( k + 1 ) % 3] );
+				setNbrs[tgls[i][k]].insert( tgls[i][( k + 2 ) % 3] );
+			}
+		meter.Stop( fTimes[0][1], iBytes[0][1], iPeak[0][1] );
+
+		meter.Start();
+		{
+			std::unordered_map<int, std::unordered_map<int, int> > hash;
+			hashFaces.assign( tgls.size(), TriangleMesh::NeighborRec() );
+			for( size_t i = 0; i < tgls.size(); i++ )
+				for( int k = 0; k < 3; k++ )
+				{
+					int v0 = tgls[i][k], v1 = tgls[i][( k + 1 ) % 3];
+					if( v0 > v1 ) std::swap( v0, v1 );
+					if( hash.count( v0 ) && hash[v0].count( v1 ) )
+					{
+						// A non-manifold edge would overflow the records
+						int fid = hash[v0][v1];
+						if( hashFaces[i].num == 3 || hashFaces[fid].num == 3 )
+							continue;
+						hashFaces[i].id[hashFaces[i].num++] = fid;
+						hashFaces[fid].id[hashFaces[fid].num++] = (unsigned)i;
+					}
+					else
+						hash[v0][v1] = (int)i;
+				}
+		}
+		meter.Stop( fTimes[0][2], iBytes[0][2], iPeak[0][2] );
+
+		for( int k = 0; k < 2; k++ )
+		{
+			omp_set_num_threads( k == 0 ? 1 : nThreads );
+			meter.Start();
+			mesh.get_vtx_tgls( vtxTgls[k] );
+			meter.Stop( fTimes[k + 1][0], iBytes[k + 1][0], iPeak[k + 1][0] );
+
+			meter.Start();
+			mesh.get_vtx_neighborship( vtxNbrs[k] );
+			meter.Stop( fTimes[k + 1][1], iBytes[k + 1][1], iPeak[k + 1][1] );
+
+			// get_face_neighborship builds and frees its own vertex triangle table, which
+			// shows in the peak
+			meter.Start();
+			mesh.get_face_neighborship( faces[k] );
+			meter.Stop( fTimes[k + 1][2], iBytes[k + 1][2], iPeak[k + 1][2] );
+		}
+		omp_set_num_threads( nThreads );
+	}
+
+	// Same lists, and the same neighbor faces in whatever order
+	bool bSameTgls = true, bSameNbrs = true, bSameFaces = true;
+	for( int i = 0; i < nVertices; i++ )
+	{
+		bSameTgls = bSameTgls && vtxTgls[0].count( i ) == setTgls[i].size() &&
+			std::equal( setTgls[i].begin(), setTgls[i].end(), vtxTgls[0].begin( i ) ) &&
+			std::equal( vtxTgls[0].begin( i ), vtxTgls[0].end( i ), vtxTgls[1].begin( i ) );
+		bSameNbrs = bSameNbrs && vtxNbrs[0].count( i ) == setNbrs[i].size() &&
+			std::equal( setNbrs[i].begin(), setNbrs[i].end(), vtxNbrs[0].begin( i ) ) &&
+			std::equal( vtxNbrs[0].begin( i ), vtxNbrs[0].end( i ), vtxNbrs[1].begin( i ) );
+	}
+	for( size_t i = 0; i < tgls.size() && bSameFaces; i++ )
+	{
+		const TriangleMesh::NeighborRec& a = hashFaces[i];
+		const TriangleMesh::NeighborRec& b = faces[0][i];
+		const size_t num = min( b.num, (size_t)3 );
+		bSameFaces = a.num == b.num && faces[1][i].num == b.num &&
+			memcmp( faces[1][i].id, b.id, num * sizeof( b.id[0] ) ) == 0;
+		unsigned int aId[3], bId[3];
+		std::copy( a.id, a.id + num, aId );
+		std::copy( b.id, b.id + num, bId );
+		std::sort( aId, aId + num );
+		std::sort( bId, bId + num );
+		bSameFaces = bSameFaces && std::equal( aId, aId + num, bId );
+	}
+
+	printf( "%d vertices, %d triangles, %d repeats\n", nVertices, mesh.num_triangles(), iRepeats );
+	printf( "%-18s %29s %29s %29s\n", "", "Vertex triangles", "Vertex neighbors", "Face neighbors" );
+	printf( "%-18s", "Adjacency" );
+	for( int t = 0; t < 3; t++ )
+		printf( " %9s %9s %9s", "Time (ms)", "Size (MB)", "Peak (MB)" );
+	printf( "\n" );
+	for( int k = 0; k < 3; k++ )
+	{
+		char strName[32];
+		snprintf( strName, sizeof( strName ), k == 0 ? "std::set / hash" : ( k == 1 ? "CSR, 1 thread" :
+			"CSR, %d threads" ), nThreads );
+		printf( "%-18s", strName );
+		for( int t = 0; t < 3; t++ )
+			printf( " %9.2f %9.1f %9.1f", fTimes[k][t] / iRepeats * 1e3, iBytes[k][t] / 1048576.0,
+				iPeak[k][t] / 1048576.0 );
+		printf( "\n" );
+	}
+	printf( "Size: heap the result holds, Peak: heap while building, with the tables freed at the end\n" );
+	printf( "Vertex triangles %s, vertex neighbors %s, face neighbors %s\n", bSameTgls ? "identical" : "different",
+		bSameNbrs ? "identical" : "different", bSameFaces ? "identical" : "different" );
+}
+
+//--------------------------------------------------------------------------------------
+// Build the boundary field with every builder and compare the distances and the band of
+// voxels with a normal against the exact field
+//--------------------------------------------------------------------------------------
+void BenchmarkFieldBuilders( const TriangleMesh& mesh )
+{
+	const char* strNames[] = { "Exact", "Sweep", "Splat" };
+	const FluidGridCPU::FieldBuilder eBuilders[] = { FluidGridCPU::FIELD_BUILD_EXACT, FluidGridCPU::FIELD_BUILD_SWEEP,
+		FluidGridCPU::FIELD_BUILD_SPLAT };
+	const UINT* iSize = g_Simulator.GetFieldSize();
+
+	BoundaryFieldCPU exact;
+	double fExact = g_Simulator.TimeFieldBuild( mesh, eBuilders[0], exact );
+	const D3DXVECTOR4* ref = exact.GetData();
+
+	printf( "Boundary field, %ux%ux%u voxels, %d triangles\n", iSize[0], iSize[1], iSize[2], mesh.num_triangles() );
+	printf( "%-8s %10s %9s %12s %12s %12s\n", "Builder", "Time (s)", "Speedup", "Max |w| err", "Avg |w| err",
+		"Band diff" );
+	printf( "%-8s %10.3f %8.2fx %12g %12g %12d\n", strNames[0], fExact, 1.0, 0.0, 0.0, 0 );
+	for( size_t b = 1; b < ARRAYSIZE( eBuilders ); b++ )
+	{
+		BoundaryFieldCPU field;
+		double fTime = g_Simulator.TimeFieldBuild( mesh, eBuilders[b], field );
+		const D3DXVECTOR4* data = field.GetData();
+		const size_t nVoxels = field.GetNumVoxels();
+
+		// The splatted field is unsigned, so the magnitudes are compared
+		double fMaxError = 0, fSumError = 0;
+		int nBandDiff = 0;
+		for( size_t i = 0; i < nVoxels; i++ )
+		{
+			double e = fabs( fabs( data[i].w ) - fabs( ref[i].w ) );
+			fMaxError = max( fMaxError, e );
+			fSumError += e;
+			bool bBand = data[i].x != 0 || data[i].y != 0 || data[i].z != 0;
+			bool bRefBand = ref[i].x != 0 || ref[i].y != 0 || ref[i].z != 0;
+			if( bBand != bRefBand )
+				nBandDiff++;
+		}
+		printf( "%-8s %10.3f %8.2fx %12g %12g %12d\n", strNames[b], fTime, fTime > 0 ? fExact / fTime : 0.0,
+			fMaxError, nVoxels ? fSumError / nVoxels : 0.0, nBandDiff );
+	}
+}
+
+//--------------------------------------------------------------------------------------
+// Build exact fields from the input mesh, its adaptive Phong tessellation and the uniform
+// one with as many levels, and compare their distances in the band to the field of a
+// tessellation 16 times finer
+//--------------------------------------------------------------------------------------
+void BenchmarkPhongTessellation( const TriangleMesh& mesh )
+{
+	const FluidGridCPU::Settings& settings = g_Simulator.GetSettings();
+	const UINT* iSize = g_Simulator.GetFieldSize();
+	const D3DXVECTOR3 vExt( g_Simulator.GetConstants().fBoundBoxMax - g_Simulator.GetConstants().fBoundBoxMin );
+	const FLOAT fVoxel = (FLOAT)pow( (double)vExt.x * vExt.y * vExt.z / ( (double)iSize[0] * iSize[1] * iSize[2] ),
+		1.0 / 3.0 );
+	const FLOAT fTolerance = ( settings.fPhongTolerance > 0 ? settings.fPhongTolerance : 0.1f ) * fVoxel;
+
+	PhongTessellatorCPU tessellator;
+	TriangleMesh reference, adaptive, uniform;
+	tessellator.Tessellate( mesh, fTolerance / 16.0f, reference );
+	double fStart = omp_get_wtime();
+	tessellator.Tessellate( mesh, fTolerance, adaptive );
+	const double fAdaptive = omp_get_wtime() - fStart;
+	const UINT iLevels = tessellator.GetNumLevels();
+	tessellator.SetMaxLevels( iLevels );
+	fStart = omp_get_wtime();
+	tessellator.Tessellate( mesh, -1.0f, uniform );
+	const double fUniform = omp_get_wtime() - fStart;
+
+	BoundaryFieldCPU ref;
+	g_Simulator.TimeFieldBuild( reference, FluidGridCPU::FIELD_BUILD_EXACT, ref );
+
+	printf( "Phong tessellation, chord tolerance %g (%g voxels), %u levels\n", fTolerance, fTolerance / fVoxel,
+		iLevels );
+	printf( "%-9s %10s %10s %10s %14s %14s\n", "Mesh", "Triangles", "Tess (s)", "Field (s)", "Max err (vox)",
+		"Avg err (vox)" );
+	struct { const char* strName; const TriangleMesh* pMesh; double fTess; } meshes[] =
+	{
+		{ "Input", &mesh, 0.0 },
+		{ "Adaptive", &adaptive, fAdaptive },
+		{ "Uniform", &uniform, fUniform },
+	};
+	for( size_t m = 0; m < ARRAYSIZE( meshes ); m++ )
+	{
+		BoundaryFieldCPU field;
+		double fField = g_Simulator.TimeFieldBuild( *meshes[m].pMesh, FluidGridCPU::FIELD_BUILD_EXACT, field );
+		const D3DXVECTOR4* a = field.GetData();
+		const D3DXVECTOR4* b = ref.GetData();
+		double fMaxError = 0, fSumError = 0;
+		size_t nBand = 0;
+		for( size_t i = 0; i < ref.GetNumVoxels(); i++ )
+		{
+			if( b[i].x == 0 && b[i].y == 0 && b[i].z == 0 )
+				continue;
+			double e = fabs( a[i].w - b[i].w ) / fVoxel;
+			fMaxError = max( fMaxError, e );
+			fSumError += e;
+			nBand++;
+		}
+		printf( "%-9s %10d %10.3f %10.3f %14.4f %14.4f\n", meshes[m].strName, meshes[m].pMesh->num_triangles(),
+			meshes[m].fTess, fField, fMaxError, nBand ? fSumError / nBand : 0.0 );
+	}
+}
+
+//--------------------------------------------------------------------------------------
+// Build the field of the current builder densely and in bricks, and compare their size
+// and iLookups random trilinear lookups
+//--------------------------------------------------------------------------------------
+void BenchmarkSparseField( const TriangleMesh& mesh, int iLookups )
+{
+	const FluidGridCPU::Settings& settings = g_Simulator.GetSettings();
+	BoundaryFieldCPU dense;
+	SparseFieldCPU sparse;
+	double fDenseBuild = g_Simulator.TimeFieldBuild( mesh, settings.eFieldBuilder, dense );
+	double fSparseBuild = g_Simulator.TimeFieldBuild( mesh, settings.eFieldBuilder, sparse );
+
+	std::mt19937 rng( 1 );
+	std::uniform_real_distribution<FLOAT> uniform( 0.0f, 1.0f );
+	std::vector<D3DXVECTOR3> positions( iLookups );
+	for( int i = 0; i < iLookups; i++ )
+		positions[i] = D3DXVECTOR3( uniform( rng ), uniform( rng ), uniform( rng ) );
+
+	// Where VelocityCS would use the lookup, the two must agree
+	const FLOAT fSurface = g_Simulator.GetConstants().fParticleParameter.w;
+	double fMaxError = 0, fMaxBandError = 0;
+	int nBand = 0;
+	for( int i = 0; i < iLookups; i++ )
+	{
+		D3DXVECTOR4 a = dense.SampleLinear( positions[i] );
+		D3DXVECTOR4 b = sparse.SampleLinear( positions[i] );
+		double e = max( max( fabs( a.x - b.x ), fabs( a.y - b.y ) ), max( fabs( a.z - b.z ), fabs( a.w - b.w ) ) );
+		fMaxError = max( fMaxError, e );
+		if( sqrtf( a.x * a.x + a.y * a.y + a.z * a.z ) > fSurface )
+		{
+			fMaxBandError = max( fMaxBandError, e );
+			nBand++;
+		}
+	}
+
+	double fTimes[2];
+	FLOAT fCheck = 0;
+	for( int k = 0; k < 2; k++ )
+	{
+		double fStart = omp_get_wtime();
+		for( int i = 0; i < iLookups; i++ )
+			fCheck += k == 0 ? dense.SampleLinear( positions[i] ).w : sparse.SampleLinear( positions[i] ).w;
+		fTimes[k] = omp_get_wtime() - fStart;
+	}
+
+	const UINT* iSize = dense.GetSize();
+	printf( "Boundary field, %ux%ux%u voxels, %u of %u bricks dense\n", iSize[0], iSize[1], iSize[2],
+		sparse.GetNumDenseBricks(), sparse.GetNumBricks() );
+	printf( "%-8s %10s %12s %14s\n", "Storage", "Build (s)", "Memory (MB)", "Lookup (ns)" );
+	printf( "%-8s %10.3f %12.1f %14.2f\n", "Dense", fDenseBuild, sparse.GetDenseMemorySize() / 1048576.0,
+		fTimes[0] * 1e9 / iLookups );
+	printf( "%-8s %10.3f %12.1f %14.2f\n", "Sparse", fSparseBuild, sparse.GetMemorySize() / 1048576.0,
+		fTimes[1] * 1e9 / iLookups );
+	printf( "Max lookup difference %g, %g over the %d lookups with a surface normal (checksum %g)\n", fMaxError,
+		fMaxBandError, nBand, fCheck );
+}
+
+//--------------------------------------------------------------------------------------
+// Build a full pyramid over the boundary field and time iFrames lookups at random
+// positions on every level; with -fieldlevels, also run iFrames frames from the initial
+// sphere on the field alone and coarse to fine
+//--------------------------------------------------------------------------------------
+void BenchmarkFieldPyramid( int iFrames )
+{
+	FieldPyramidCPU pyramid;
+	double fStart = omp_get_wtime();
+	if( g_Simulator.IsFieldSparse() )
+		pyramid.Build( g_Simulator.GetSparseField(), FIELD_PYRAMID_MAX_LEVELS );
+	else
+		pyramid.Build( g_Simulator.GetField(), FIELD_PYRAMID_MAX_LEVELS );
+	double fBuild = omp_get_wtime() - fStart;
+
+	const int iLookups = 1 << 20;
+	std::mt19937 rng( 1 );
+	std::uniform_real_distribution<FLOAT> uniform( 0.0f, 1.0f );
+	std::vector<D3DXVECTOR3> positions( iLookups );
+	for( int i = 0; i < iLookups; i++ )
+		positions[i] = D3DXVECTOR3( uniform( rng ), uniform( rng ), uniform( rng ) );
+
+	printf( "Field pyramid, %u levels built in %.3f s (%.1f MB above the field)\n", pyramid.GetNumLevels(), fBuild,
+		pyramid.GetMemorySize() / 1048576.0 );
+	printf( "%-6s %14s %14s\n", "Level", "Size", "Lookup (ns)" );
+	FLOAT fCheck = 0;
+	for( UINT iLevel = 0; iLevel < pyramid.GetNumLevels(); iLevel++ )
+	{
+		fStart = omp_get_wtime();
+		for( int i = 0; i < iLookups; i++ )
+			fCheck += pyramid.SampleLinear( positions[i], iLevel ).w;
+		double fTime = omp_get_wtime() - fStart;
+		const UINT* iSize = pyramid.GetSize( iLevel );
+		char strSize[32];
+		snprintf( strSize, sizeof( strSize ), "%ux%ux%u", iSize[0], iSize[1], iSize[2] );
+		printf( "%-6u %14s %14.2f\n", iLevel, strSize, fTime * 1e9 / iLookups );
+	}
+	printf( "(checksum %g)\n", fCheck );
+
+	FluidGridCPU::Settings settings = g_Simulator.GetSettings();
+	const UINT nLevels = min( settings.iFieldLevels, g_Simulator.GetFieldPyramid().GetNumLevels() );
+	if( nLevels < 2 )
+	{
+		printf( "Run with -fieldlevels:N to compare the relaxation on the field alone and coarse to fine\n" );
+		return;
+	}
+	FluidGridCPU::PassTimings fine, coarse;
+	settings.iFieldLevels = 0;
+	double fFine = g_Simulator.TimeSimulation( settings, iFrames, &fine, true );
+	FLOAT fFineDensity = g_Simulator.AvgDensity();
+	settings.iFieldLevels = nLevels;
+	double fCoarse = g_Simulator.TimeSimulation( settings, iFrames, &coarse, true );
+	FLOAT fCoarseDensity = g_Simulator.AvgDensity();
+
+	const double fFinePass = ( fine.fVelocity + fine.fVelocityDensity ) * 1000.0 / max( fine.iFrames, 1u );
+	const double fCoarsePass = ( coarse.fVelocity + coarse.fVelocityDensity ) * 1000.0 / max( coarse.iFrames, 1u );
+	printf( "Relaxation of %u samples from the start, %d frames\n", settings.iNumParticles, iFrames );
+	printf( "%-20s %12s %14s %9s %10s\n", "Field", "Frame (ms)", "Velocity (ms)", "Speedup", "Density" );
+	printf( "%-20s %12.4f %14.4f %8.2fx %10.4f\n", "Level 0 only", fFine * 1000.0, fFinePass, 1.0, fFineDensity );
+	char strLevels[32];
+	snprintf( strLevels, sizeof( strLevels ), "Levels %u to 0", nLevels - 1 );
+	printf( "%-20s %12.4f %14.4f %8.2fx %10.4f\n", strLevels, fCoarse * 1000.0, fCoarsePass,
+		fCoarse > 0 ? fFine / fCoarse : 0.0, fCoarseDensity );
+}
+
+//--------------------------------------------------------------------------------------
+// Build the winding number tree and time iQueries points in (a slightly enlarged) box with
+// the dipole approximation and by summing every triangle
+//--------------------------------------------------------------------------------------
+void BenchmarkWindingNumber( const TriangleMesh& mesh, int iQueries )
+{
+	WindingNumberCPU winding;
+	double fStart = omp_get_wtime();
+	winding.Build( mesh );
+	double fBuild = omp_get_wtime() - fStart;
+
+	D3DXVECTOR3 bblow, bbhigh;
+	mesh.bounding_box( bblow, bbhigh );
+	const D3DXVECTOR3 vCenter = ( bblow + bbhigh ) * 0.5f;
+	const D3DXVECTOR3 vExt = ( bbhigh - bblow ) * 0.6f;
+	std::mt19937 rng( 1 );
+	std::uniform_real_distribution<FLOAT> uniform( -1.0f, 1.0f );
+	std::vector<D3DXVECTOR3> points( iQueries );
+	for( int i = 0; i < iQueries; i++ )
+		points[i] = vCenter + D3DXVECTOR3( uniform( rng ) * vExt.x, uniform( rng ) * vExt.y, uniform( rng ) * vExt.z );
+
+	std::vector<FLOAT> tree( iQueries ), exact( iQueries );
+	fStart = omp_get_wtime();
+	winding.Evaluate( &points[0], (UINT)iQueries, &tree[0] );
+	double fTree = omp_get_wtime() - fStart;
+	fStart = omp_get_wtime();
+	#pragma omp parallel for schedule(dynamic, 16)
+	for( int i = 0; i < iQueries; i++ )
+		exact[i] = winding.EvaluateExact( points[i] );
+	double fExact = omp_get_wtime() - fStart;
+
+	double fMaxError = 0;
+	int nInside = 0, nMismatch = 0;
+	for( int i = 0; i < iQueries; i++ )
+	{
+		fMaxError = max( fMaxError, (double)fabsf( tree[i] - exact[i] ) );
+		if( WindingNumberCPU::IsInside( exact[i] ) )
+			nInside++;
+		if( WindingNumberCPU::IsInside( tree[i] ) != WindingNumberCPU::IsInside( exact[i] ) )
+			nMismatch++;
+	}
+
+	printf( "Winding number, %d triangles, %u nodes, %.1f MB, built in %.3f s\n", mesh.num_triangles(),
+		winding.GetNumNodes(), winding.GetMemorySize() / 1048576.0, fBuild );
+	printf( "%-8s %10s %14s %9s\n", "Method", "Time (s)", "Query (us)", "Speedup" );
+	printf( "%-8s %10.3f %14.3f %8.2fx\n", "Exact", fExact, fExact * 1e6 / iQueries, 1.0 );
+	printf( "%-8s %10.3f %14.3f %8.2fx\n", "Tree", fTree, fTree * 1e6 / iQueries, fTree > 0 ? fExact / fTree : 0.0 );
+	printf( "%d of %d points inside, max error %g, %d classified differently\n", nInside, iQueries, fMaxError,
+		nMismatch );
+}
+
+//--------------------------------------------------------------------------------------
+// Build the triangle BVH with every split and time iQueries closest point, signed distance
+// and ray queries from random points in (a slightly enlarged) box. The single leaf of
+// BVH_SPLIT_NONE is the brute force reference; it only answers the first queries.
+//--------------------------------------------------------------------------------------
+void BenchmarkTriangleBVH( const TriangleMesh& mesh, int iQueries )
+{
+	D3DXVECTOR3 bblow, bbhigh;
+	mesh.bounding_box( bblow, bbhigh );
+	const D3DXVECTOR3 vCenter = ( bblow + bbhigh ) * 0.5f;
+	const D3DXVECTOR3 vExt = ( bbhigh - bblow ) * 0.6f;
+	std::mt19937 rng( 1 );
+	std::uniform_real_distribution<FLOAT> uniform( -1.0f, 1.0f );
+	std::vector<D3DXVECTOR3> points( iQueries ), dirs( iQueries );
+	for( int i = 0; i < iQueries; i++ )
+	{
+		points[i] = vCenter + D3DXVECTOR3( uniform( rng ) * vExt.x, uniform( rng ) * vExt.y, uniform( rng ) * vExt.z );
+		D3DXVECTOR3 d( uniform( rng ), uniform( rng ), uniform( rng ) );
+		D3DXVec3Normalize( &dirs[i], &d );
+	}
+
+	const char* strSplits[3] = { "None", "Median", "SAH" };
+	const TriangleBVHSplit eSplits[3] = { BVH_SPLIT_NONE, BVH_SPLIT_MEDIAN, BVH_SPLIT_SAH };
+	const int iBrute = min( iQueries, 1000 );
+	std::vector<TriangleBVHHit> hits[3];
+	std::vector<TriangleBVHRayHit> rayHits[3];
+	std::vector<FLOAT> dists[3];
+	double fTimes[3][3];
+	printf( "Triangle BVH, %d triangles, %d queries (%d by brute force)\n", mesh.num_triangles(), iQueries, iBrute );
+	printf( "%-8s %10s %8s %6s %9s %12s %14s %14s %10s\n", "Split", "Build (s)", "Nodes", "Depth", "SAH cost",
+		"Memory (MB)", "Closest (ns)", "Distance (ns)", "Ray (ns)" );
+	for( int k = 0; k < 3; k++ )
+	{
+		TriangleBVHCPU bvh;
+		double fStart = omp_get_wtime();
+		bvh.Build( mesh, eSplits[k] );
+		double fBuild = omp_get_wtime() - fStart;
+
+		const UINT n = k == 0 ? iBrute : iQueries;
+		hits[k].resize( n );
+		rayHits[k].resize( n );
+		dists[k].resize( n );
+		fStart = omp_get_wtime();
+		bvh.ClosestPoints( &points[0], n, FLT_MAX, &hits[k][0] );
+		fTimes[k][0] = omp_get_wtime() - fStart;
+		fStart = omp_get_wtime();
+		bvh.SignedDistances( &points[0], n, &dists[k][0] );
+		fTimes[k][1] = omp_get_wtime() - fStart;
+		fStart = omp_get_wtime();
+		bvh.Raycasts( &points[0], &dirs[0], n, FLT_MAX, &rayHits[k][0] );
+		fTimes[k][2] = omp_get_wtime() - fStart;
+
+		printf( "%-8s %10.3f %8u %6u %9.1f %12.1f %14.1f %14.1f %10.1f\n", strSplits[k], fBuild, bvh.GetNumNodes(),
+			bvh.GetDepth(), bvh.GetSAHCost(), bvh.GetMemorySize() / 1048576.0, fTimes[k][0] * 1e9 / n,
+			fTimes[k][1] * 1e9 / n, fTimes[k][2] * 1e9 / n );
+	}
+
+	// Every split must find the same distances and ray hits as the brute force
+	for( int k = 1; k < 3; k++ )
+	{
+		double fMaxError = 0;
+		int nRayMismatch = 0, nRayHits = 0;
+		for( int i = 0; i < iBrute; i++ )
+		{
+			fMaxError = max( fMaxError, (double)fabsf( dists[k][i] - dists[0][i] ) );
+			const bool bHit = rayHits[k][i].iTriangle != BVH_NO_HIT;
+			if( bHit != ( rayHits[0][i].iTriangle != BVH_NO_HIT ) || ( bHit && rayHits[k][i].fT != rayHits[0][i].fT ) )
+				nRayMismatch++;
+			if( bHit )
+				nRayHits++;
+		}
+		printf( "%s: max distance error %g, %d of %d rays hit, %d differ from brute force, %.0fx faster closest points\n",
+			strSplits[k], fMaxError, nRayHits, iBrute, nRayMismatch,
+			fTimes[k][0] > 0 ? ( fTimes[0][0] / iBrute ) / ( fTimes[k][0] / iQueries ) : 0.0 );
+	}
+}
+
+//--------------------------------------------------------------------------------------
+// Time whole frames with the old fixed 32^3 grid and with the automatic resolution
+//--------------------------------------------------------------------------------------
+void BenchmarkGridDim( int iFrames )
+{
+	const UINT iFixed = 32;
+	FluidGridCPU::Settings settings = g_Simulator.GetSettings();
+	settings.iGridDim = iFixed;
+	double fFixed = g_Simulator.TimeSimulation( settings, iFrames );
+	settings.iGridDim = 0;
+	double fAuto = g_Simulator.TimeSimulation( settings, iFrames );
+	const UINT* iDim = g_Simulator.GetGridDim();
+
+	printf( "Simulation of %u samples, %d frames\n", g_Simulator.GetSettings().iNumParticles, iFrames );
+	printf( "%-20s %12s %12s %9s\n", "Grid", "Cells", "Frame (ms)", "Speedup" );
+	printf( "%-20s %12u %12.4f %8.2fx\n", "32x32x32", iFixed * iFixed * iFixed, fFixed * 1000.0, 1.0 );
+
+	char strDim[32];
+	snprintf( strDim, sizeof( strDim ), "%ux%ux%u (auto)", iDim[0], iDim[1], iDim[2] );
+	printf( "%-20s %12u %12.4f %8.2fx\n", strDim, iDim[0] * iDim[1] * iDim[2], fAuto * 1000.0,
+		fAuto > 0 ? fFixed / fAuto : 0.0 );
+}
+
+//--------------------------------------------------------------------------------------
+// Compare Velocity + Density against the fused VelocityDensity
+//--------------------------------------------------------------------------------------
+void BenchmarkFusedPass( int iFrames )
+{
+	FluidGridCPU::Settings settings = g_Simulator.GetSettings();
+	FluidGridCPU::PassTimings separate, fused;
+	settings.bFusedVelocityDensity = false;
+	g_Simulator.TimeSimulation( settings, iFrames, &separate );
+	settings.bFusedVelocityDensity = true;
+	g_Simulator.TimeSimulation( settings, iFrames, &fused );
+
+	const double fSeparate = ( separate.fVelocity + separate.fDensity ) * 1000.0 / max( separate.iFrames, 1u );
+	const double fFused = fused.fVelocityDensity * 1000.0 / max( fused.iFrames, 1u );
+	printf( "Neighbor passes, %u samples, %d frames\n", g_Simulator.GetSettings().iNumParticles, iFrames );
+	printf( "%-20s %12s %9s\n", "Passes", "Frame (ms)", "Speedup" );
+	printf( "%-20s %12.4f %8.2fx\n", "Velocity + Density", fSeparate, 1.0 );
+	printf( "%-20s %12.4f %8.2fx\n", "VelocityDensity", fFused, fFused > 0 ? fSeparate / fFused : 0.0 );
+}
+
+//--------------------------------------------------------------------------------------
+// Check the SIMD force kernels against the reference one, then time the neighbor passes
+// with every kernel the CPU supports
+//--------------------------------------------------------------------------------------
+void BenchmarkForceKernel( int iFrames )
+{
+	// The polynomial exp over the arguments the kernel produces
+	double fMaxExpError = 0;
+	for( int i = 0; i <= 1000000; i++ )
+	{
+		FLOAT x = -87.0f * (FLOAT)i / 1000000.0f;
+		double e = exp( (double)x );
+		fMaxExpError = max( fMaxExpError, fabs( FastExpReference( x ) - e ) / e );
+	}
+	printf( "Fast exp: max relative error %.3g (bound %.3g)\n", fMaxExpError, (double)FAST_EXP_MAX_REL_ERROR );
+
+	// Random blocks of neighbors around a particle, sizes 0..63 to cover the tails
+	std::mt19937 rng( 1 );
+	std::uniform_real_distribution<FLOAT> uniform( -2.0f, 2.0f );
+	const UINT nMaxBlock = 64;
+	std::vector<FLOAT> x( nMaxBlock ), y( nMaxBlock ), z( nMaxBlock );
+	const ForceKernelISA eISAs[] = { FORCE_KERNEL_REFERENCE, FORCE_KERNEL_AVX2, FORCE_KERNEL_AVX512 };
+	for( size_t k = 1; k < ARRAYSIZE( eISAs ); k++ )
+	{
+		if( !IsForceKernelSupported( eISAs[k] ) )
+		{
+			printf( "%-10s not supported\n", GetForceKernelName( eISAs[k] ) );
+			continue;
+		}
+		ForceKernelFn pfnReference = GetForceKernel( FORCE_KERNEL_REFERENCE );
+		ForceKernelFn pfnKernel = GetForceKernel( eISAs[k] );
+		double fMaxError = 0;
+		for( int t = 0; t < 10000; t++ )
+		{
+			UINT count = t % nMaxBlock;
+			for( UINT i = 0; i < count; i++ )
+			{
+				x[i] = uniform( rng );
+				y[i] = uniform( rng );
+				z[i] = uniform( rng );
+			}
+			ForceKernelParams params = { { uniform( rng ), uniform( rng ), uniform( rng ) }, 1.0f, 1.0f };
+			FLOAT ref[5] = { 0 }, sums[5] = { 0 };
+			pfnReference( &x[0], &y[0], &z[0], count, params, ref );
+			pfnKernel( &x[0], &y[0], &z[0], count, params, sums );
+
+			// Relative to the magnitude of the terms, as the force sums can cancel out
+			double fScale = 1.0 + fabs( ref[3] ) + fabs( ref[4] );
+			for( int c = 0; c < 5; c++ )
+				fMaxError = max( fMaxError, fabs( (double)sums[c] - ref[c] ) / fScale );
+		}
+		printf( "%-10s max error of the block sums %.3g\n", GetForceKernelName( eISAs[k] ), fMaxError );
+	}
+
+	FluidGridCPU::Settings settings = g_Simulator.GetSettings();
+	printf( "Neighbor passes, %u samples, %d frames\n", settings.iNumParticles, iFrames );
+	printf( "%-10s %12s %9s %14s\n", "Kernel", "Frame (ms)", "Speedup", "Avg density" );
+	double fReference = 0;
+	for( size_t k = 0; k < ARRAYSIZE( eISAs ); k++ )
+	{
+		if( !IsForceKernelSupported( eISAs[k] ) )
+			continue;
+		FluidGridCPU::PassTimings timings;
+		settings.eForceKernel = eISAs[k];
+		g_Simulator.TimeSimulation( settings, iFrames, &timings );
+		double fTime = ( timings.fVelocity + timings.fDensity + timings.fVelocityDensity ) * 1000.0 / max( timings.iFrames, 1u );
+		if( k == 0 )
+			fReference = fTime;
+		printf( "%-10s %12.4f %8.2fx %14f\n", GetForceKernelName( eISAs[k] ), fTime,
+			fTime > 0 ? fReference / fTime : 0.0, g_Simulator.AvgDensity() );
+	}
+}
+
+//--------------------------------------------------------------------------------------
+// Time the separate Velocity and Density passes on the AoS and the SoA particles, with
+// the reference kernel and with the SIMD one picked for this CPU
+//--------------------------------------------------------------------------------------
+void BenchmarkParticleStorage( int iFrames )
+{
+	const char* strNames[] = { "AoS", "SoA" };
+	const FluidGridCPU::ParticleLayout eLayouts[] = { FluidGridCPU::PARTICLE_LAYOUT_AOS, FluidGridCPU::PARTICLE_LAYOUT_SOA };
+	const ForceKernelISA eISAs[] = { FORCE_KERNEL_REFERENCE, ResolveForceKernel( FORCE_KERNEL_AUTO ) };
+
+	FluidGridCPU::Settings settings = g_Simulator.GetSettings();
+	settings.bFusedVelocityDensity = false;
+	printf( "Particle storage, %u samples, %d frames\n", settings.iNumParticles, iFrames );
+	printf( "%-16s %12s %12s %12s %9s %14s\n", "Storage", "Rearrange", "Velocity", "Density", "Speedup",
+		"Avg density" );
+	for( size_t k = 0; k < ARRAYSIZE( eISAs ); k++ )
+	{
+		if( k > 0 && eISAs[k] == eISAs[0] )
+			break;
+		double fAoS = 0;
+		for( size_t l = 0; l < ARRAYSIZE( eLayouts ); l++ )
+		{
+			FluidGridCPU::PassTimings timings;
+			settings.eForceKernel = eISAs[k];
+			settings.eParticleLayout = eLayouts[l];
+			g_Simulator.TimeSimulation( settings, iFrames, &timings );
+			const double fScale = 1000.0 / max( timings.iFrames, 1u );
+			const double fPasses = ( timings.fVelocity + timings.fDensity ) * fScale;
+			if( l == 0 )
+				fAoS = fPasses;
+
+			char strName[32];
+			snprintf( strName, sizeof( strName ), "%s, %s", strNames[l], GetForceKernelName( eISAs[k] ) );
+			printf( "%-16s %12.4f %12.4f %12.4f %8.2fx %14f\n", strName, timings.fRearrangeParticles * fScale,
+				timings.fVelocity * fScale, timings.fDensity * fScale, fPasses > 0 ? fAoS / fPasses : 0.0,
+				g_Simulator.AvgDensity() );
+		}
+	}
+}
+
+//--------------------------------------------------------------------------------------
+// Compare the row-major and the Morton cell keys: time per pass, hardware cache misses
+// (when the kernel exposes them) and how scattered the 27 neighbor cells are in memory
+//--------------------------------------------------------------------------------------
+void BenchmarkKeyLayout( int iFrames )
+{
+	const char* strNames[] = { "Row-major", "Morton" };
+	const FluidGridCPU::GridKeyLayout eLayouts[] = { FluidGridCPU::GRID_KEY_ROW_MAJOR, FluidGridCPU::GRID_KEY_MORTON };
+	FluidGridCPU::PassTimings timings[2];
+	double fFrame[2], fRuns[2], fSpan[2];
+	UINT iDims[2][3];
+	CacheCounterCPU counters[2];
+
+	for( int l = 0; l < 2; l++ )
+	{
+		FluidGridCPU::Settings settings = g_Simulator.GetSettings();
+		settings.eGridKeys = eLayouts[l];
+
+		const FluidGridCPU::GridKeyLayout eOld = g_Simulator.GetSettings().eGridKeys;
+		g_Simulator.GetSettings().eGridKeys = eLayouts[l];
+		g_Simulator.StencilLocality( fRuns[l], fSpan[l] );
+		// The grid of this layout's run; TimeSimulation restores the current one
+		memcpy( iDims[l], g_Simulator.GetGridDim(), sizeof( iDims[l] ) );
+		g_Simulator.GetSettings().eGridKeys = eOld;
+
+		counters[l].Start();
+		fFrame[l] = g_Simulator.TimeSimulation( settings, iFrames, &timings[l] );
+		counters[l].Stop();
+	}
+
+	printf( "Key layouts, %u samples, %d frames\n", g_Simulator.GetSettings().iNumParticles, iFrames );
+	printf( "%-20s %12s %12s\n", "Pass (ms/frame)", strNames[0], strNames[1] );
+	char strDims[2][32];
+	for( int l = 0; l < 2; l++ )
+		snprintf( strDims[l], sizeof( strDims[l] ), "%ux%ux%u", iDims[l][0], iDims[l][1], iDims[l][2] );
+	printf( "%-20s %12s %12s\n", "Grid", strDims[0], strDims[1] );
+	struct { const char* strName; double FluidGridCPU::PassTimings::*pTime; } passes[] =
+	{
+		{ "BuildGrid", &FluidGridCPU::PassTimings::fBuildGrid },
+		{ "SortGrid", &FluidGridCPU::PassTimings::fSortGrid },
+		{ "BuildGridIndices", &FluidGridCPU::PassTimings::fBuildGridIndices },
+		{ "RearrangeParticles", &FluidGridCPU::PassTimings::fRearrangeParticles },
+		{ "Velocity", &FluidGridCPU::PassTimings::fVelocity },
+		{ "Density", &FluidGridCPU::PassTimings::fDensity },
+		{ "VelocityDensity", &FluidGridCPU::PassTimings::fVelocityDensity },
+	};
+	for( size_t i = 0; i < ARRAYSIZE( passes ); i++ )
+	{
+		printf( "%-20s %12.4f %12.4f\n", passes[i].strName,
+			timings[0].*passes[i].pTime * 1000.0 / max( timings[0].iFrames, 1u ),
+			timings[1].*passes[i].pTime * 1000.0 / max( timings[1].iFrames, 1u ) );
+	}
+	printf( "%-20s %12.4f %12.4f\n", "Frame", fFrame[0] * 1000.0, fFrame[1] * 1000.0 );
+	printf( "%-20s %12.2f %12.2f\n", "Stencil runs", fRuns[0], fRuns[1] );
+	printf( "%-20s %12.1f %12.1f\n", "Stencil span (KB)", fSpan[0] / 1024.0, fSpan[1] / 1024.0 );
+	if( counters[0].IsAvailable() && counters[1].IsAvailable() )
+	{
+		printf( "%-20s %12.0f %12.0f\n", "Cache misses/frame", (double)counters[0].GetMisses() / iFrames,
+			(double)counters[1].GetMisses() / iFrames );
+		printf( "%-20s %11.2f%% %11.2f%%\n", "Cache miss rate",
+			counters[0].GetReferences() ? counters[0].GetMisses() * 100.0 / counters[0].GetReferences() : 0.0,
+			counters[1].GetReferences() ? counters[1].GetMisses() * 100.0 / counters[1].GetReferences() : 0.0 );
+	}
+	else
+	{
+		printf( "%-20s %12s %12s\n", "Cache misses/frame", "n/a", "n/a" );
+	}
+}
+
+//--------------------------------------------------------------------------------------
+// Entry point to the program
+//--------------------------------------------------------------------------------------
+int main( int argc, char** argv )
+{
+	HRESULT hr;
+
+	if( !ParseCommandLine( argc, argv ) )
+	{
+		PrintUsage();
+		return 1;
+	}
+
+#ifdef _OPENMP
+	if( g_CmdLineParams.iThreads > 0 )
+		omp_set_num_threads( g_CmdLineParams.iThreads );
+	printf( "Using %d threads\n", omp_get_max_threads() );
+#endif
+
+	printf( "Creating Geometries...\n" );
+	TriangleMesh mesh;
+	if( MeshObjReader::read( g_CmdLineParams.strMeshFilename, mesh ) != 0 || mesh.num_triangles() == 0 )
+	{
+		printf( "Cannot load %s\n", g_CmdLineParams.strMeshFilename );
+		return 1;
+	}
+	printf( "%d vertices, %d triangles\n", mesh.num_vertices(), mesh.num_triangles() );
+
+	FluidGridCPU::Settings& settings = g_Simulator.GetSettings();
+	D3DXVECTOR3 bblow, bbhigh;
+	mesh.bounding_box( bblow, bbhigh );
+	D3DXVECTOR3 vExt = ( bbhigh - bblow ) * 0.5f;
+	settings.vInitOffset.x *= vExt.x;
+	settings.vInitOffset.y *= vExt.y;
+	settings.vInitOffset.z *= vExt.z;
+
+	hr = g_Simulator.ResetGeometry( mesh );
+	if( FAILED( hr ) )
+	{
+		printf( "Cannot set up the simulation\n" );
+		return 1;
+	}
+
+	printf( "Using the %s force kernel\n", GetForceKernelName( g_Simulator.GetForceKernelISA() ) );
+	const UINT* iGridDim = g_Simulator.GetGridDim();
+	printf( "Relaxing %u samples for %d iterations on a %ux%ux%u grid...\n", settings.iNumParticles,
+		g_CmdLineParams.iIterations, iGridDim[0], iGridDim[1], iGridDim[2] );
+	for( int i = 0; i < g_CmdLineParams.iIterations; i++ )
+		g_Simulator.SimulateFluid_Grid();
+	printf( "Average density: %f\n", g_Simulator.AvgDensity() );
+	if( settings.bWindingNumber )
+		printf( "%u of %u samples inside the mesh\n", g_Simulator.CountInsideParticles(), settings.iNumParticles );
+
+	if( g_CmdLineParams.bProfile )
+		PrintTimings();
+	if( g_CmdLineParams.iObjBenchmark > 0 )
+	{
+		const char* strDot = strrchr( g_CmdLineParams.strMeshFilename, '.' );
+		char strExt[8] = "";
+		for( int i = 0; strDot && strDot[i] && i < 7; i++ )
+			strExt[i] = (char)tolower( (unsigned char)strDot[i] );
+		if( strcmp( strExt, ".stl" ) == 0 || strcmp( strExt, ".ply" ) == 0 )
+			BenchmarkMeshReader( g_CmdLineParams.strMeshFilename, g_CmdLineParams.iObjBenchmark,
+				strcmp( strExt, ".stl" ) == 0 );
+		else
+			BenchmarkObjReader( g_CmdLineParams.strMeshFilename, g_CmdLineParams.iObjBenchmark );
+	}
+	if( g_CmdLineParams.iNormalBenchmark > 0 )
+		BenchmarkVertexNormals( mesh, g_CmdLineParams.iNormalBenchmark );
+	if( g_CmdLineParams.iAdjacencyBenchmark > 0 )
+		BenchmarkAdjacency( mesh, g_CmdLineParams.iAdjacencyBenchmark );
+	if( g_CmdLineParams.bFieldBenchmark )
+		BenchmarkFieldBuilders( g_Simulator.GetSurface( mesh ) );
+	if( g_CmdLineParams.iSparseBenchmark > 0 )
+		BenchmarkSparseField( g_Simulator.GetSurface( mesh ), g_CmdLineParams.iSparseBenchmark );
+	if( g_CmdLineParams.iPyramidBenchmark > 0 )
+		BenchmarkFieldPyramid( g_CmdLineParams.iPyramidBenchmark );
+	if( g_CmdLineParams.iWindingBenchmark > 0 )
+		BenchmarkWindingNumber( g_Simulator.GetSurface( mesh ), g_CmdLineParams.iWindingBenchmark );
+	if( g_CmdLineParams.iBVHBenchmark > 0 )
+		BenchmarkTriangleBVH( g_Simulator.GetSurface( mesh ), g_CmdLineParams.iBVHBenchmark );
+	if( g_CmdLineParams.bPhongBenchmark )
+		BenchmarkPhongTessellation( mesh );
+	if( g_CmdLineParams.iSortBenchmark > 0 )
+		BenchmarkGridSort( g_CmdLineParams.iSortBenchmark );
+	if( g_CmdLineParams.iGridBenchmark > 0 )
+		BenchmarkGridDim( g_CmdLineParams.iGridBenchmark );
+	if( g_CmdLineParams.iKernelBenchmark > 0 )
+		BenchmarkForceKernel( g_CmdLineParams.iKernelBenchmark );
+	if( g_CmdLineParams.iStorageBenchmark > 0 )
+		BenchmarkParticleStorage( g_CmdLineParams.iStorageBenchmark );
+	if( g_CmdLineParams.iFusedBenchmark > 0 )
+		BenchmarkFusedPass( g_CmdLineParams.iFusedBenchmark );
+	if( g_CmdLineParams.iLayoutBenchmark > 0 )
+		BenchmarkKeyLayout( g_CmdLineParams.iLayoutBenchmark );
+
+	if( FAILED( SavePoints( g_CmdLineParams.strOutputFilename ) ) )
+		return 1;
+	if( g_CmdLineParams.strSurfaceFilename && FAILED( SavePoints( g_CmdLineParams.strSurfaceFilename, true ) ) )
+		return 1;
+
+	return 0;
+}
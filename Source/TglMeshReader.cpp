@@ -4,17 +4,107 @@
 #include <vector>
 #include "geometry/Tuple3.h"
 #include "geometry/TriangleMesh.h"
+#include "geometry/VertexNormals.h"
 #include "geometry/splooshstrings.h"
 #include "TglMeshReader.h"
+#ifdef MESH2POINTS_HEADLESS
+#include "cpu/ObjParserCPU.h"
+#include "cpu/MeshCacheCPU.h"
+#include "cpu/StlReaderCPU.h"
+#include "cpu/PlyReaderCPU.h"
 
+bool MeshObjReader::cache_ = true;
+
+namespace
+{
+    //! Whether file ends with ext, in any case
+    bool has_extension(const char* file, const char* ext)
+    {
+        const size_t n = strlen(file), m = strlen(ext);
+        if ( n < m ) return false;
+        for(size_t i = 0;i < m;++ i)
+            if ( tolower((unsigned char)file[n - m + i]) != ext[i] ) return false;
+        return true;
+    }
+}
+#endif
+
+#ifndef MESH2POINTS_HEADLESS
 int MeshObjReader::read(const wchar_t* file, TriangleMesh& mesh, 
                 bool centerize, bool reversetglrot)
 {
-    using namespace std;
+    std::ifstream fin(file);
+    if ( fin.fail() ) return E_FAIL;
+    return read(fin, mesh, centerize, reversetglrot);
+}
+#endif
 
-    ifstream fin(file);
+int MeshObjReader::read(const char* file, TriangleMesh& mesh, 
+                bool centerize, bool reversetglrot)
+{
+#ifdef MESH2POINTS_HEADLESS
+    // A cache is only a copy of the whole mesh, so it cannot be appended to another one
+    const bool cache = cache_ && mesh.empty();
+    const UINT flags = (centerize ? 1 : 0) | (reversetglrot ? 2 : 0);
+    const std::string cacheFile = MeshCacheCPU::GetCachePath(file);
+    if ( cache && SUCCEEDED(MeshCacheCPU::Load(cacheFile.c_str(), file, flags, mesh)) )
+    {
+        printf("Read the mesh from %s\n", cacheFile.c_str());
+        return 0;
+    }
+
+    int ret = E_FAIL;
+    HRESULT hr;
+    if ( has_extension(file, ".stl") )
+    {
+        // No normals; fill_mesh generates them from the welded triangles
+        StlReaderCPU reader;
+        hr = reader.Read(file);
+        if ( hr == E_INVALIDARG ) exit(1);
+        if ( FAILED(hr) ) return E_FAIL;
+        std::vector<D3DXVECTOR3> nml;
+        ret = fill_mesh(reader.GetVertices(), nml, reader.GetTriangles(), reader.GetTriangles(),
+                mesh, centerize, reversetglrot);
+    }
+    else if ( has_extension(file, ".ply") )
+    {
+        // The normals, if any, are per vertex, so they share the indices of the positions
+        PlyReaderCPU reader;
+        hr = reader.Read(file);
+        if ( hr == E_INVALIDARG ) exit(1);
+        if ( FAILED(hr) ) return E_FAIL;
+        ret = fill_mesh(reader.GetVertices(), reader.GetNormals(), reader.GetTriangles(),
+                reader.GetTriangles(), mesh, centerize, reversetglrot);
+    }
+    else
+    {
+        // Parse the mapped file in parallel; the stream is left for files that cannot be
+        // mapped, like empty ones
+        ObjParserCPU parser;
+        hr = parser.Parse(file);
+        if ( hr == E_INVALIDARG ) exit(1);
+        if ( SUCCEEDED(hr) )
+            ret = fill_mesh(parser.GetVertices(), parser.GetNormals(), parser.GetTriangles(),
+                    parser.GetNormalIndices(), mesh, centerize, reversetglrot);
+    }
+    if ( SUCCEEDED(hr) )
+    {
+        // A directory that cannot be written to just means no cache
+        if ( ret == 0 && cache )
+            MeshCacheCPU::Save(cacheFile.c_str(), file, flags, mesh);
+        return ret;
+    }
+#endif
+    std::ifstream fin(file);
     if ( fin.fail() ) return E_FAIL;
-    
+    return read(fin, mesh, centerize, reversetglrot);
+}
+
+int MeshObjReader::read(std::istream& fin, TriangleMesh& mesh, 
+                bool centerize, bool reversetglrot)
+{
+    using namespace std;
+
     char text[1024];
     vector<D3DXVECTOR3>     vtx;    // temporary space to put the vertex
     vector<D3DXVECTOR3>    nml;
@@ -87,7 +177,14 @@ int MeshObjReader::read(const wchar_t* file, TriangleMesh& mesh,
         ++ l;
     }
 
-    fin.close();
+    return fill_mesh(vtx, nml, tgl, tNml, mesh, centerize, reversetglrot);
+}
+
+int MeshObjReader::fill_mesh(std::vector<D3DXVECTOR3>& vtx, std::vector<D3DXVECTOR3>& nml,
+                const std::vector<Tuple3ui>& tgl, const std::vector<Tuple3ui>& tNml,
+                TriangleMesh& mesh, bool centerize, bool reversetglrot)
+{
+    using namespace std;
 
     /* No triangles at all */
     if ( tgl.empty() ) printf("THERE IS NO TRIANGLE MESHS AT ALL!\n");
@@ -121,46 +218,42 @@ int MeshObjReader::read(const wchar_t* file, TriangleMesh& mesh,
 
     if ( nml.empty() )
     {
-		nml.resize(vtx.size());
-        for(size_t i = 0;i < tgl.size();++ i)
-        {
-			D3DXVECTOR3 v0 = vtx[tgl[i][0]];
-			D3DXVECTOR3 v1 = vtx[tgl[i][1]];
-			D3DXVECTOR3 v2 = vtx[tgl[i][2]];
-
-			D3DXVECTOR3 e0 = v1 - v0;
-			D3DXVECTOR3 e1 = v2 - v0;
-			D3DXVECTOR3 norm;
-			D3DXVec3Cross(&norm, &e0, &e1);
-			nml[tgl[i][0]] += norm;
-			nml[tgl[i][1]] += norm;
-			nml[tgl[i][2]] += norm;
-		}
-
-        for(size_t i = 0;i < nml.size();++ i)
+        // Area weighted, gathered per vertex in parallel; the halved cross products
+        // of VertexNormals normalize to the same directions
+        VertexNormals gen;
+        gen.build(tgl, vtx.size());
+        gen.accumulate(vtx, VertexNormals::AREA_WEIGHTED, nml);
+
+#ifdef USE_OPENMP
+        #pragma omp parallel for schedule(static)
+#endif
+        for(int i = 0;i < (int)nml.size();++ i)
         {
 			if(D3DXVec3LengthSq(&nml[i]) == 0) nml[i] = D3DXVECTOR3(0, 1, 0);
 			D3DXVec3Normalize(&nml[i], &nml[i]);
 		}
 
-        for(size_t i = 0;i < vtx.size();++ i)
-            mesh.add_vertex_normal(vtx[i], nml[i]);
+        mesh.vertices().insert(mesh.vertices().end(), vtx.begin(), vtx.end());
+        mesh.normals().insert(mesh.normals().end(), nml.begin(), nml.end());
     }
     else
     {
-		vector<D3DXVECTOR3> nmlmap(vtx.size(), D3DXVECTOR3(0,0,0));
-
-        for(size_t i = 0;i < tgl.size();++ i)
-        {
-			nmlmap[tgl[i][0]] += nml[tNml[i][0]];
-			nmlmap[tgl[i][1]] += nml[tNml[i][1]];
-			nmlmap[tgl[i][2]] += nml[tNml[i][2]];
-        }
-
-        for(size_t i = 0;i < vtx.size();++ i) {
+        // The vn of each corner, gathered per vertex like the generated normals
+        VertexNormals gen;
+        gen.build(tgl, vtx.size());
+		vector<D3DXVECTOR3> nmlmap(vtx.size());
+        if ( !vtx.empty() )
+            gen.gather([&nml, &tNml](unsigned int c) { return nml[tNml[c / 3][c % 3]]; },
+                    D3DXVECTOR3(0, 0, 0), &nmlmap[0]);
+
+#ifdef USE_OPENMP
+        #pragma omp parallel for schedule(static)
+#endif
+        for(int i = 0;i < (int)vtx.size();++ i)
 			D3DXVec3Normalize(&nmlmap[i], &nmlmap[i]);
-            mesh.add_vertex_normal(vtx[i], nmlmap[i]);
-		}
+
+        mesh.vertices().insert(mesh.vertices().end(), vtx.begin(), vtx.end());
+        mesh.normals().insert(mesh.normals().end(), nmlmap.begin(), nmlmap.end());
     }
 
     if ( reversetglrot )
@@ -173,6 +266,7 @@ int MeshObjReader::read(const wchar_t* file, TriangleMesh& mesh,
     return 0;
 }
 
+#ifndef MESH2POINTS_HEADLESS
 const std::vector<MeshObj::VERTEX>& MeshObj::GetStoredVertices() const
 {
 	return m_vertices;
@@ -276,4 +370,5 @@ D3DXVECTOR3 MeshObj::GetMeshBBoxExtents()
 D3DXVECTOR3 MeshObj::GetMeshBBoxCenter()
 {
 	return m_bbox_center;
-}
\ No newline at end of file
+}
+#endif
\ No newline at end of file
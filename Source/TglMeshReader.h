@@ -2,6 +2,8 @@
 #define TGL_MESH_READER
 
 #include <vector>
+#include <istream>
+#include "geometry/Tuple3.h"
 
 class TriangleMesh;
 
@@ -13,11 +15,45 @@ class MeshObjReader
          * at each vertex. In other words, the same vertex at different faces should
          * be specified with the same normal.
          */
+#ifndef MESH2POINTS_HEADLESS
 		static int read(const wchar_t* file, TriangleMesh& mesh, 
                 bool centerize = false, bool reversetglrot = false);
+#endif
+		static int read(const char* file, TriangleMesh& mesh, 
+                bool centerize = false, bool reversetglrot = false);
+
+#ifdef MESH2POINTS_HEADLESS
+        // The headless build also reads .stl and .ply files with StlReaderCPU and
+        // PlyReaderCPU, by their extension
+
+        /*!
+         * Keep a MeshCacheCPU copy next to each obj file read into an empty mesh and
+         * load it instead while the file is unchanged (on by default)
+         */
+		static void enable_cache(bool enable) { cache_ = enable; }
+		static bool cache_enabled() { return cache_; }
+#endif
 
+        /*!
+         * Read the obj text line by line from a stream. The headless build reads
+         * files with ObjParserCPU instead and only falls back to this.
+         */
+		static int read(std::istream& fin, TriangleMesh& mesh, 
+                bool centerize, bool reversetglrot);
+
+    private:
+        //! Build the mesh from the parsed vertices, normals and triangles
+		static int fill_mesh(std::vector<D3DXVECTOR3>& vtx, std::vector<D3DXVECTOR3>& nml,
+                const std::vector<Tuple3ui>& tgl, const std::vector<Tuple3ui>& tNml,
+                TriangleMesh& mesh, bool centerize, bool reversetglrot);
+
+#ifdef MESH2POINTS_HEADLESS
+		static bool cache_;
+#endif
 };
 
+#ifndef MESH2POINTS_HEADLESS
+
 class MeshObj
 {
 	ID3D11Buffer* m_pVertexBuffer;
@@ -47,5 +83,6 @@ public:
 	D3DXVECTOR3 GetMeshBBoxExtents();
 	D3DXVECTOR3 GetMeshBBoxCenter();
 };
+#endif
 
 #endif
\ No newline at end of file
@@ -0,0 +1,691 @@
+#include "DXUT.h"
+#include <float.h>
+#include "../geometry/Tuple3.h"
+#include "../geometry/TriangleMesh.h"
+#include "TriangleBVHCPU.h"
+#include "WindingNumberCPU.h"
+#include "BoundaryFieldCPU.h"
+
+// Matches [maxtessfactor(9)] on HS_PNTriangles
+#define MAX_TESS_FACTOR 9
+
+// Winding numbers strictly between these are taken to be near a hole rather than on
+// either side of a surface, where they are within the error of the dipoles of 0 or 1
+#define WINDING_FILL_MIN 0.1f
+#define WINDING_FILL_MAX 0.9f
+
+#define FIELD_FILE_MAGIC "M2PFIELD"
+#define FIELD_FILE_VERSION 1
+
+namespace
+{
+	// Header of a saved field, followed by the voxels in memory order. The size keeps the
+	// voxels aligned to a cache line in the mapping.
+	struct FieldFileHeader
+	{
+		char	strMagic[8];	// FIELD_FILE_MAGIC
+		UINT	iVersion;
+		UINT	iSize[3];
+		UINT64	iKey;
+		UINT64	iDataBytes;
+		BYTE	reserved[24];
+	};
+
+	struct SurfaceSplat
+	{
+		D3DXVECTOR3 vCenter;
+		D3DXVECTOR3 vNormal;
+	};
+
+	inline int WrapIndex(int i, int n)
+	{
+		i %= n;
+		return i < 0 ? i + n : i;
+	}
+
+	inline D3DXVECTOR4 Lerp(const D3DXVECTOR4& a, const D3DXVECTOR4& b, FLOAT t)
+	{
+		return a + (b - a) * t;
+	}
+
+	inline D3DXVECTOR3 NormalizedNormal(const D3DXVECTOR3& n)
+	{
+		D3DXVECTOR3 r;
+		D3DXVec3Normalize(&r, &n);
+		return r;
+	}
+
+	// Closest point of a voxel in the seeded band, which the sweeps hand on
+	struct SweepSeed
+	{
+		D3DXVECTOR3	vPseudoNormal;
+		D3DXVECTOR4	vValue;		// of the band voxel the seed belongs to
+	};
+
+	const UINT SWEEP_NONE = 0xFFFFFFFF;
+	// Closest point of the voxels the sweeps have not reached yet
+	const FLOAT SWEEP_FAR = 1e18f;
+	// Rounds of the 8 sweeps at most; the second one usually finds nothing to update
+	const int MAX_SWEEP_ROUNDS = 4;
+	// Tiles the sweeps run in parallel are SWEEP_TILE x rows high and deep
+	const int SWEEP_TILE = 16;
+}
+
+D3DXVECTOR4 BoundaryFieldCPU::ClosestPointValue(const TriangleMesh& mesh, const TriangleBVHCPU& bvh, const D3DXVECTOR3& p,
+	const TriangleBVHHit& hit, const D3DXVECTOR3& vVoxel)
+{
+	const FLOAT fDist = sqrtf(hit.fDistSq);
+	const D3DXVECTOR3 vDiff = p - hit.vPoint;
+	const D3DXVECTOR3 vPseudoNormal = bvh.PseudoNormal(hit);
+
+	// A splat reaches the voxels within FIELD_BAND_VOXELS along every axis. With the
+	// surface locally flat, its closest point in that metric is dist / |n|_1 voxels
+	// away, n being the unit direction to the closest point scaled by the voxel size.
+	D3DXVECTOR3 vNormal(0, 0, 0);
+	if(fDist <= FIELD_BAND_VOXELS * (fabsf(vDiff.x) * vVoxel.x + fabsf(vDiff.y) * vVoxel.y +
+		fabsf(vDiff.z) * vVoxel.z) / max(fDist, FLT_MIN))
+	{
+		const Tuple3ui& tri = mesh.triangle_ids(hit.iTriangle);
+		vNormal = NormalizedNormal(hit.fBary[0] * mesh.normal(tri.x) + hit.fBary[1] * mesh.normal(tri.y) +
+			hit.fBary[2] * mesh.normal(tri.z));
+	}
+	return D3DXVECTOR4(vNormal, D3DXVec3Dot(&vDiff, &vPseudoNormal) < 0 ? -fDist : fDist);
+}
+
+BoundaryFieldCPU::BoundaryFieldCPU() :
+	m_pData(NULL)
+{
+	m_iSize[0] = m_iSize[1] = m_iSize[2] = 0;
+}
+
+void BoundaryFieldCPU::Create(const UINT iFieldSize[3])
+{
+	m_Mapping.Close();
+	m_iSize[0] = iFieldSize[0];
+	m_iSize[1] = iFieldSize[1];
+	m_iSize[2] = iFieldSize[2];
+	m_Data.assign((size_t)m_iSize[0] * m_iSize[1] * m_iSize[2], D3DXVECTOR4(0, 0, 0, 0));
+	m_pData = m_Data.empty() ? NULL : &m_Data[0];
+}
+
+void BoundaryFieldCPU::Clear()
+{
+	m_Mapping.Close();
+	std::vector<D3DXVECTOR4>().swap(m_Data);
+	m_pData = NULL;
+	m_iSize[0] = m_iSize[1] = m_iSize[2] = 0;
+}
+
+HRESULT BoundaryFieldCPU::Save(const char* strFile, UINT64 iKey) const
+{
+	FieldFileHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.strMagic, FIELD_FILE_MAGIC, sizeof(header.strMagic));
+	header.iVersion = FIELD_FILE_VERSION;
+	header.iSize[0] = m_iSize[0];
+	header.iSize[1] = m_iSize[1];
+	header.iSize[2] = m_iSize[2];
+	header.iKey = iKey;
+	header.iDataBytes = GetNumVoxels() * sizeof(D3DXVECTOR4);
+
+	// Written under a temporary name and renamed, so a concurrent Map never sees half a file
+	char strTemp[MAX_PATH + 16];
+	snprintf(strTemp, sizeof(strTemp), "%s.tmp", strFile);
+	FILE* fp = fopen(strTemp, "wb");
+	if(!fp)
+		return E_FAIL;
+	bool bOk = fwrite(&header, sizeof(header), 1, fp) == 1 &&
+		(header.iDataBytes == 0 || fwrite(m_pData, (size_t)header.iDataBytes, 1, fp) == 1);
+	bOk = fclose(fp) == 0 && bOk;
+#ifdef _WIN32
+	bOk = bOk && MoveFileExA(strTemp, strFile, MOVEFILE_REPLACE_EXISTING);
+#else
+	bOk = bOk && rename(strTemp, strFile) == 0;
+#endif
+	if(!bOk)
+	{
+		remove(strTemp);
+		return E_FAIL;
+	}
+	return S_OK;
+}
+
+HRESULT BoundaryFieldCPU::Map(const char* strFile, const UINT iFieldSize[3], UINT64 iKey)
+{
+	Clear();
+	if(FAILED(m_Mapping.Open(strFile)))
+		return E_FAIL;
+
+	const size_t nVoxels = (size_t)iFieldSize[0] * iFieldSize[1] * iFieldSize[2];
+	const FieldFileHeader* pHeader = (const FieldFileHeader*)m_Mapping.GetData();
+	if(m_Mapping.GetSize() != sizeof(FieldFileHeader) + nVoxels * sizeof(D3DXVECTOR4) ||
+		memcmp(pHeader->strMagic, FIELD_FILE_MAGIC, sizeof(pHeader->strMagic)) != 0 ||
+		pHeader->iVersion != FIELD_FILE_VERSION || pHeader->iKey != iKey ||
+		pHeader->iSize[0] != iFieldSize[0] || pHeader->iSize[1] != iFieldSize[1] ||
+		pHeader->iSize[2] != iFieldSize[2] || pHeader->iDataBytes != nVoxels * sizeof(D3DXVECTOR4))
+	{
+		m_Mapping.Close();
+		return E_FAIL;
+	}
+
+	m_iSize[0] = iFieldSize[0];
+	m_iSize[1] = iFieldSize[1];
+	m_iSize[2] = iFieldSize[2];
+	m_pData = (const D3DXVECTOR4*)(m_Mapping.GetData() + sizeof(FieldFileHeader));
+	return S_OK;
+}
+
+void BoundaryFieldCPU::BuildSplat(const TriangleMesh& mesh, const D3DXVECTOR3& vBoxMin,
+	const D3DXVECTOR3& vBoxMax, UINT uTessFactor)
+{
+	const D3DXVECTOR3 vExt = (vBoxMax - vBoxMin) * 0.5f;
+	const FLOAT mSize = powf(vExt.x * vExt.y * vExt.z, 0.3333333f);
+	const int NX = (int)m_iSize[0];
+	const int NY = (int)m_iSize[1];
+	const int NZ = (int)m_iSize[2];
+
+	// Same quantities the frame setup puts in fBoundSize/fInvBoundSize; fBoundSize.w is
+	// the voxel size in clip space, averaged over the axes
+	const FLOAT fBoundSizeW = 2.0f / (FLOAT)pow((double)NX * NY * NZ, 1.0 / 3.0);
+	const FLOAT fInvBoundSizeW = 0.5f / mSize;
+	const D3DXVECTOR3 vVoxel(vExt.x * 2.0f / NX, vExt.y * 2.0f / NY, vExt.z * 2.0f / NZ);
+
+	// Clear to the values used for g_pRTVFieldProxy and g_pDSVField
+	const size_t nVoxels = m_Data.size();
+	std::vector<FLOAT> depth(nVoxels, 1.0f);
+	#pragma omp parallel for schedule(static)
+	for(int i = 0; i < (int)nVoxels; i++)
+		m_Data[i] = D3DXVECTOR4(0.0f, 0.0f, 0.0f, mSize);
+
+	// Tessellate: edge factors as in HS_PNTrianglesConstant, one uniform level per
+	// triangle. Subdivision is flat; the GPU path additionally applies PhongGeometry.
+	const int nTris = mesh.num_triangles();
+	const FLOAT fEdgeScale = fInvBoundSizeW / fBoundSizeW * 3.0f * (FLOAT)uTessFactor;
+	std::vector<int> tessLevel(nTris);
+	std::vector<size_t> splatOffset(nTris + 1, 0);
+
+	#pragma omp parallel for schedule(static)
+	for(int t = 0; t < nTris; t++)
+	{
+		const Tuple3ui& tri = mesh.triangle_ids(t);
+		D3DXVECTOR3 e0 = mesh.vertex(tri.x) - mesh.vertex(tri.y);
+		D3DXVECTOR3 e1 = mesh.vertex(tri.z) - mesh.vertex(tri.y);
+		D3DXVECTOR3 e2 = mesh.vertex(tri.x) - mesh.vertex(tri.z);
+		FLOAT ls = max(D3DXVec3Length(&e0), max(D3DXVec3Length(&e1), D3DXVec3Length(&e2))) * fEdgeScale;
+		int k = (int)ceilf(max(1.0f, ls));
+		if((k & 1) == 0) k++;	// fractional_odd partitioning
+		tessLevel[t] = min(k, MAX_TESS_FACTOR);
+	}
+	for(int t = 0; t < nTris; t++)
+		splatOffset[t + 1] = splatOffset[t] + (size_t)tessLevel[t] * tessLevel[t];
+
+	const size_t nSplats = splatOffset[nTris];
+	std::vector<SurfaceSplat> splats(nSplats);
+
+	#pragma omp parallel for schedule(dynamic, 256)
+	for(int t = 0; t < nTris; t++)
+	{
+		const Tuple3ui& tri = mesh.triangle_ids(t);
+		const D3DXVECTOR3& p0 = mesh.vertex(tri.x);
+		const D3DXVECTOR3& p1 = mesh.vertex(tri.y);
+		const D3DXVECTOR3& p2 = mesh.vertex(tri.z);
+		const D3DXVECTOR3& n0 = mesh.normal(tri.x);
+		const D3DXVECTOR3& n1 = mesh.normal(tri.y);
+		const D3DXVECTOR3& n2 = mesh.normal(tri.z);
+		const int k = tessLevel[t];
+		const FLOAT fInvK = 1.0f / (FLOAT)k;
+		SurfaceSplat* pOut = &splats[splatOffset[t]];
+
+		for(int i = 0; i < k; i++)
+		{
+			for(int j = 0; j + i < k; j++)
+			{
+				// Up to two sub-triangles per lattice cell, given as barycentric (u, v)
+				// of their corners; the third weight is 1 - u - v
+				const int nSub = (i + j + 1 < k) ? 2 : 1;
+				const int corners[2][3][2] = {
+					{ {i, j}, {i + 1, j}, {i, j + 1} },
+					{ {i + 1, j}, {i + 1, j + 1}, {i, j + 1} }
+				};
+				for(int s = 0; s < nSub; s++)
+				{
+					D3DXVECTOR3 vCenter(0, 0, 0);
+					D3DXVECTOR3 vNormal(0, 0, 0);
+					for(int c = 0; c < 3; c++)
+					{
+						FLOAT u = corners[s][c][0] * fInvK;
+						FLOAT v = corners[s][c][1] * fInvK;
+						FLOAT w = 1.0f - u - v;
+						vCenter += w * p0 + u * p1 + v * p2;
+						vNormal += NormalizedNormal(w * n0 + u * n1 + v * n2);
+					}
+					pOut->vCenter = vCenter * 0.33333333f;
+					pOut->vNormal = vNormal * 0.33333333f;
+					++pOut;
+				}
+			}
+		}
+	}
+
+	// Bin the splats by their base slice (iZBase in TriField3DGS) so each slice can be
+	// written by a single thread
+	std::vector<int> splatSlice(nSplats);
+	std::vector<size_t> sliceStart(NZ + 2, 0);
+	for(size_t s = 0; s < nSplats; s++)
+	{
+		FLOAT z_pos = (splats[s].vCenter.z - vBoxMin.z) / vVoxel.z;
+		int iZBase = min(max((int)(z_pos + 0.5f), 0), NZ);
+		splatSlice[s] = iZBase;
+		sliceStart[iZBase + 1]++;
+	}
+	for(int z = 0; z <= NZ; z++)
+		sliceStart[z + 1] += sliceStart[z];
+	std::vector<size_t> sliceOrder(nSplats);
+	{
+		std::vector<size_t> cursor(sliceStart.begin(), sliceStart.end() - 1);
+		for(size_t s = 0; s < nSplats; s++)
+			sliceOrder[cursor[splatSlice[s]]++] = s;
+	}
+
+	// Each splat covers a quad of +-2 voxels along x and y and slices iZBase-2..iZBase+2.
+	// Writes that the GS clamps onto the border slices always lose the depth test against
+	// the unclamped one, so they are skipped.
+	const FLOAT fHalfX = FIELD_BAND_VOXELS;
+	const FLOAT fHalfY = FIELD_BAND_VOXELS;
+
+	#pragma omp parallel for schedule(dynamic, 1)
+	for(int z = 0; z < NZ; z++)
+	{
+		for(int zb = max(z - 2, 0); zb <= min(z + 2, NZ); zb++)
+		{
+			const FLOAT fOffsetZ = (FLOAT)(z - zb) * vVoxel.z;
+			for(size_t o = sliceStart[zb]; o < sliceStart[zb + 1]; o++)
+			{
+				const SurfaceSplat& sp = splats[sliceOrder[o]];
+				FLOAT fx = (sp.vCenter.x - vBoxMin.x) / vVoxel.x;
+				FLOAT fy = (sp.vCenter.y - vBoxMin.y) / vVoxel.y;
+				int x0 = max((int)ceilf(fx - fHalfX - 0.5f), 0);
+				int x1 = min((int)floorf(fx + fHalfX - 0.5f), NX - 1);
+				int y0 = max((int)ceilf(fy - fHalfY - 0.5f), 0);
+				int y1 = min((int)floorf(fy + fHalfY - 0.5f), NY - 1);
+
+				for(int y = y0; y <= y1; y++)
+				{
+					FLOAT dy = vBoxMin.y + (y + 0.5f) * vVoxel.y - sp.vCenter.y;
+					for(int x = x0; x <= x1; x++)
+					{
+						FLOAT dx = vBoxMin.x + (x + 0.5f) * vVoxel.x - sp.vCenter.x;
+						FLOAT dist = sqrtf(dx * dx + dy * dy + fOffsetZ * fOffsetZ);
+						FLOAT d = dist * fInvBoundSizeW;
+						UINT idx = Index(x, y, z);
+						if(d < depth[idx])
+						{
+							depth[idx] = d;
+							m_Data[idx] = D3DXVECTOR4(sp.vNormal, dist);
+						}
+					}
+				}
+			}
+		}
+	}
+}
+
+void BoundaryFieldCPU::BuildExact(const TriangleMesh& mesh, const D3DXVECTOR3& vBoxMin,
+	const D3DXVECTOR3& vBoxMax)
+{
+	const int NX = (int)m_iSize[0];
+	const int NY = (int)m_iSize[1];
+	const int NZ = (int)m_iSize[2];
+	const D3DXVECTOR3 vVoxel((vBoxMax.x - vBoxMin.x) / NX, (vBoxMax.y - vBoxMin.y) / NY,
+		(vBoxMax.z - vBoxMin.z) / NZ);
+
+	TriangleBVHCPU bvh;
+	bvh.Build(mesh);
+	if(bvh.IsEmpty())
+		return;
+
+	#pragma omp parallel for schedule(dynamic, 1)
+	for(int row = 0; row < NY * NZ; row++)
+	{
+		const int y = row % NY;
+		const int z = row / NY;
+		D3DXVECTOR3 p(vBoxMin.x + 0.5f * vVoxel.x, vBoxMin.y + (y + 0.5f) * vVoxel.y, vBoxMin.z + (z + 0.5f) * vVoxel.z);
+
+		// The distance changes by at most a voxel along the row, which bounds the search
+		FLOAT fPrevDist = FLT_MAX;
+		for(int x = 0; x < NX; x++, p.x += vVoxel.x)
+		{
+			TriangleBVHHit hit;
+			FLOAT fBound = fPrevDist < FLT_MAX ? (fPrevDist + vVoxel.x) * 1.001f + 1e-6f : FLT_MAX;
+			if(!bvh.ClosestPoint(p, fBound < FLT_MAX ? fBound * fBound : FLT_MAX, hit))
+				bvh.ClosestPoint(p, FLT_MAX, hit);
+
+			fPrevDist = sqrtf(hit.fDistSq);
+			m_Data[Index(x, y, z)] = ClosestPointValue(mesh, bvh, p, hit, vVoxel);
+		}
+	}
+}
+
+void BoundaryFieldCPU::BuildSweep(const TriangleMesh& mesh, const D3DXVECTOR3& vBoxMin,
+	const D3DXVECTOR3& vBoxMax)
+{
+	const int NX = (int)m_iSize[0];
+	const int NY = (int)m_iSize[1];
+	const int NZ = (int)m_iSize[2];
+	const int N[3] = { NX, NY, NZ };
+	const D3DXVECTOR3 vVoxel((vBoxMax.x - vBoxMin.x) / NX, (vBoxMax.y - vBoxMin.y) / NY,
+		(vBoxMax.z - vBoxMin.z) / NZ);
+	const size_t nVoxels = m_Data.size();
+
+	TriangleBVHCPU bvh;
+	bvh.Build(mesh);
+	if(bvh.IsEmpty())
+		return;
+
+	// The band covers every voxel that can get a normal (at most FIELD_BAND_VOXELS voxel
+	// diagonals from the surface), so the sweeps only have to hand on distances
+	const FLOAT fSeedRadius = FIELD_BAND_VOXELS * D3DXVec3Length(&vVoxel) * 1.01f;
+
+	// Voxel box of every triangle grown by the band, binned by slice
+	const int nTris = mesh.num_triangles();
+	std::vector<int> triBox((size_t)nTris * 6);
+	#pragma omp parallel for schedule(static)
+	for(int t = 0; t < nTris; t++)
+	{
+		const Tuple3ui& tri = mesh.triangle_ids(t);
+		D3DXVECTOR3 vMin = mesh.vertex(tri.x), vMax = mesh.vertex(tri.x);
+		D3DXVec3Minimize(&vMin, &vMin, &mesh.vertex(tri.y));
+		D3DXVec3Maximize(&vMax, &vMax, &mesh.vertex(tri.y));
+		D3DXVec3Minimize(&vMin, &vMin, &mesh.vertex(tri.z));
+		D3DXVec3Maximize(&vMax, &vMax, &mesh.vertex(tri.z));
+		for(int c = 0; c < 3; c++)
+		{
+			triBox[t * 6 + c * 2] = max((int)ceilf((vMin[c] - fSeedRadius - vBoxMin[c]) / vVoxel[c] - 0.5f), 0);
+			triBox[t * 6 + c * 2 + 1] = min((int)floorf((vMax[c] + fSeedRadius - vBoxMin[c]) / vVoxel[c] - 0.5f), N[c] - 1);
+		}
+	}
+	std::vector<size_t> sliceStart(NZ + 1, 0);
+	for(int t = 0; t < nTris; t++)
+		for(int z = triBox[t * 6 + 4]; z <= triBox[t * 6 + 5]; z++)
+			sliceStart[z + 1]++;
+	for(int z = 0; z < NZ; z++)
+		sliceStart[z + 1] += sliceStart[z];
+	std::vector<int> sliceTris(sliceStart[NZ]);
+	{
+		std::vector<size_t> cursor(sliceStart.begin(), sliceStart.end() - 1);
+		for(int t = 0; t < nTris; t++)
+			for(int z = triBox[t * 6 + 4]; z <= triBox[t * 6 + 5]; z++)
+				sliceTris[cursor[z]++] = t;
+	}
+
+	// Mark the band, then number its voxels slice by slice
+	std::vector<BYTE> band(nVoxels, 0);
+	std::vector<UINT> sliceSeeds(NZ + 1, 0);
+	#pragma omp parallel for schedule(dynamic, 1)
+	for(int z = 0; z < NZ; z++)
+	{
+		for(size_t i = sliceStart[z]; i < sliceStart[z + 1]; i++)
+		{
+			const int* box = &triBox[sliceTris[i] * 6];
+			for(int y = box[2]; y <= box[3]; y++)
+				for(int x = box[0]; x <= box[1]; x++)
+					band[Index(x, y, z)] = 1;
+		}
+		UINT count = 0;
+		for(UINT idx = Index(0, 0, z); idx < Index(0, 0, z) + (UINT)(NX * NY); idx++)
+			count += band[idx];
+		sliceSeeds[z + 1] = count;
+	}
+	for(int z = 0; z < NZ; z++)
+		sliceSeeds[z + 1] += sliceSeeds[z];
+
+	// Exact closest points in the band. Until the end m_Data holds the closest point of
+	// every voxel and the squared distance to it, so the sweeps read it from the neighbors.
+	#pragma omp parallel for schedule(static)
+	for(int i = 0; i < (int)nVoxels; i++)
+		m_Data[i] = D3DXVECTOR4(SWEEP_FAR, SWEEP_FAR, SWEEP_FAR, FLT_MAX);
+	std::vector<SweepSeed> seeds(sliceSeeds[NZ]);
+	std::vector<UINT> nearest(nVoxels, SWEEP_NONE);
+	#pragma omp parallel for schedule(dynamic, 1)
+	for(int z = 0; z < NZ; z++)
+	{
+		UINT iSeed = sliceSeeds[z];
+		for(int y = 0; y < NY; y++)
+		{
+			// As in BuildExact, the previous voxel of the row bounds the search
+			FLOAT fPrevDist = FLT_MAX;
+			for(int x = 0; x < NX; x++)
+			{
+				const UINT idx = Index(x, y, z);
+				if(!band[idx])
+				{
+					fPrevDist = FLT_MAX;
+					continue;
+				}
+				const D3DXVECTOR3 p(vBoxMin.x + (x + 0.5f) * vVoxel.x, vBoxMin.y + (y + 0.5f) * vVoxel.y,
+					vBoxMin.z + (z + 0.5f) * vVoxel.z);
+				const FLOAT fBound = min((fPrevDist + vVoxel.x) * 1.001f + 1e-6f, fSeedRadius);
+				TriangleBVHHit hit;
+				if(bvh.ClosestPoint(p, fBound * fBound, hit))
+				{
+					seeds[iSeed].vValue = ClosestPointValue(mesh, bvh, p, hit, vVoxel);
+					seeds[iSeed].vPseudoNormal = bvh.PseudoNormal(hit);
+					nearest[idx] = iSeed;
+					m_Data[idx] = D3DXVECTOR4(hit.vPoint, hit.fDistSq);
+					fPrevDist = sqrtf(hit.fDistSq);
+				}
+				else
+				{
+					band[idx] = 0;	// the corners of the grown boxes
+					fPrevDist = FLT_MAX;
+				}
+				iSeed++;
+			}
+		}
+	}
+
+	// Fast sweeping in the 8 diagonal directions: every voxel takes the closest point of
+	// its upwind neighbors along x, y and z if that is closer than its own. The grid is
+	// swept in tiles of whole x rows; the tiles on a diagonal ty + tz = k only depend on
+	// the diagonal before, so each diagonal runs in parallel and the rows stream.
+	const int nTiles[3] = { 1, (NY + SWEEP_TILE - 1) / SWEEP_TILE, (NZ + SWEEP_TILE - 1) / SWEEP_TILE };
+	const BYTE* pBand = &band[0];
+	UINT* pNearest = &nearest[0];
+	D3DXVECTOR4* pData = &m_Data[0];
+	for(int iRound = 0; iRound < MAX_SWEEP_ROUNDS; iRound++)
+	{
+		int nUpdates = 0;
+		for(int sweep = 0; sweep < 8; sweep++)
+		{
+			const int dir[3] = { (sweep & 1) ? -1 : 1, (sweep & 2) ? -1 : 1, (sweep & 4) ? -1 : 1 };
+			const int step[3] = { dir[0], dir[1] * NX, dir[2] * NX * NY };
+
+			for(int k = 0; k <= nTiles[1] + nTiles[2] - 2; k++)
+			{
+				const int tz0 = max(0, k - (nTiles[1] - 1));
+				const int tz1 = min(nTiles[2] - 1, k);
+
+				#pragma omp parallel for schedule(dynamic, 1) reduction(+:nUpdates)
+				for(int tz = tz0; tz <= tz1; tz++)
+				{
+					// Voxel ranges of the tile in sweep order, where 0 is the upwind end
+					const int t[3] = { 0, k - tz, tz };
+					int lo[3], hi[3];
+					lo[0] = 0;
+					hi[0] = NX;
+					for(int a = 1; a < 3; a++)
+					{
+						lo[a] = t[a] * SWEEP_TILE;
+						hi[a] = min(lo[a] + SWEEP_TILE, N[a]);
+					}
+					for(int zs = lo[2]; zs < hi[2]; zs++)
+						for(int ys = lo[1]; ys < hi[1]; ys++)
+						{
+							const int y = dir[1] > 0 ? ys : NY - 1 - ys;
+							const int z = dir[2] > 0 ? zs : NZ - 1 - zs;
+							int x = dir[0] > 0 ? lo[0] : NX - 1 - lo[0];
+							UINT idx = Index(x, y, z);
+							D3DXVECTOR3 p(vBoxMin.x + (x + 0.5f) * vVoxel.x, vBoxMin.y + (y + 0.5f) * vVoxel.y,
+								vBoxMin.z + (z + 0.5f) * vVoxel.z);
+							for(int xs = lo[0]; xs < hi[0]; xs++, idx += step[0], p.x += dir[0] * vVoxel.x)
+							{
+								if(pBand[idx])
+									continue;
+
+								// Upwind neighbors; at the border the voxel itself. The selection is
+								// branch free, as which candidate wins is close to random.
+								const UINT back[3] = { xs > 0 ? idx - step[0] : idx, ys > 0 ? idx - step[1] : idx,
+									zs > 0 ? idx - step[2] : idx };
+								UINT iBest = idx;
+								FLOAT fBestSq = pData[idx].w;
+								for(int c = 0; c < 3; c++)
+								{
+									const D3DXVECTOR4& q = pData[back[c]];
+									const FLOAT dx = p.x - q.x, dy = p.y - q.y, dz = p.z - q.z;
+									const FLOAT fDistSq = dx * dx + dy * dy + dz * dz;
+									const bool bCloser = fDistSq < fBestSq;
+									iBest = bCloser ? back[c] : iBest;
+									fBestSq = bCloser ? fDistSq : fBestSq;
+								}
+								if(iBest != idx)
+								{
+									const D3DXVECTOR4& q = pData[iBest];
+									pData[idx] = D3DXVECTOR4(q.x, q.y, q.z, fBestSq);
+									pNearest[idx] = pNearest[iBest];
+									nUpdates++;
+								}
+							}
+						}
+				}
+			}
+		}
+		if(nUpdates == 0)
+			break;
+	}
+
+	// Outside the band the voxels only need the signed distance
+	const FLOAT mSize = powf((vBoxMax.x - vBoxMin.x) * (vBoxMax.y - vBoxMin.y) * (vBoxMax.z - vBoxMin.z) * 0.125f, 0.3333333f);
+	#pragma omp parallel for schedule(static)
+	for(int z = 0; z < NZ; z++)
+		for(int y = 0; y < NY; y++)
+			for(int x = 0; x < NX; x++)
+			{
+				const UINT idx = Index(x, y, z);
+				const UINT s = nearest[idx];
+				if(band[idx])
+				{
+					m_Data[idx] = seeds[s].vValue;
+					continue;
+				}
+				if(s == SWEEP_NONE)
+				{
+					m_Data[idx] = D3DXVECTOR4(0, 0, 0, mSize);
+					continue;
+				}
+				const D3DXVECTOR3 p(vBoxMin.x + (x + 0.5f) * vVoxel.x, vBoxMin.y + (y + 0.5f) * vVoxel.y,
+					vBoxMin.z + (z + 0.5f) * vVoxel.z);
+				const D3DXVECTOR3 vDiff(p.x - m_Data[idx].x, p.y - m_Data[idx].y, p.z - m_Data[idx].z);
+				const FLOAT fDist = D3DXVec3Length(&vDiff);
+				m_Data[idx] = D3DXVECTOR4(0, 0, 0, D3DXVec3Dot(&vDiff, &seeds[s].vPseudoNormal) < 0 ? -fDist : fDist);
+			}
+}
+
+void BoundaryFieldCPU::Classify(const WindingNumberCPU& winding, const D3DXVECTOR3& vBoxMin,
+	const D3DXVECTOR3& vBoxMax)
+{
+	if(IsMapped() || m_Data.empty())
+		return;
+
+	const int NX = (int)m_iSize[0];
+	const int NY = (int)m_iSize[1];
+	const int NZ = (int)m_iSize[2];
+	const D3DXVECTOR3 vVoxel((vBoxMax.x - vBoxMin.x) / NX, (vBoxMax.y - vBoxMin.y) / NY,
+		(vBoxMax.z - vBoxMin.z) / NZ);
+	const FLOAT fVoxel = max(vVoxel.x, max(vVoxel.y, vVoxel.z));
+
+	std::vector<FLOAT> wn(m_Data.size());
+	#pragma omp parallel for schedule(dynamic, 1)
+	for(int row = 0; row < NY * NZ; row++)
+	{
+		const int y = row % NY, z = row / NY;
+		for(int x = 0; x < NX; x++)
+		{
+			const D3DXVECTOR3 p(vBoxMin.x + (x + 0.5f) * vVoxel.x, vBoxMin.y + (y + 0.5f) * vVoxel.y,
+				vBoxMin.z + (z + 0.5f) * vVoxel.z);
+			wn[Index(x, y, z)] = fabsf(winding.Evaluate(p));
+		}
+	}
+
+	// The band voxels cost two more queries, so rows are handed out dynamically
+	#pragma omp parallel for schedule(dynamic, 1)
+	for(int row = 0; row < NY * NZ; row++)
+	{
+		const int y = row % NY, z = row / NY;
+		for(int x = 0; x < NX; x++)
+		{
+			const D3DXVECTOR3 p(vBoxMin.x + (x + 0.5f) * vVoxel.x, vBoxMin.y + (y + 0.5f) * vVoxel.y,
+				vBoxMin.z + (z + 0.5f) * vVoxel.z);
+			const UINT idx = Index(x, y, z);
+			D3DXVECTOR4& v = m_Data[idx];
+			if(v.x != 0 || v.y != 0 || v.z != 0 || wn[idx] <= WINDING_FILL_MIN || wn[idx] >= WINDING_FILL_MAX)
+			{
+				v = winding.ClassifyValue(p, wn[idx], v, fVoxel);
+				continue;
+			}
+
+			// Winding number between the inside and the outside value with no triangle near:
+			// a hole. The 0.5 level set closes it; the voxels within the band of it get its
+			// outward normal and the distance to it, estimated from the gradient.
+			const D3DXVECTOR3 vGrad(
+				(wn[Index(min(x + 1, NX - 1), y, z)] - wn[Index(max(x - 1, 0), y, z)]) /
+					((min(x + 1, NX - 1) - max(x - 1, 0)) * vVoxel.x),
+				(wn[Index(x, min(y + 1, NY - 1), z)] - wn[Index(x, max(y - 1, 0), z)]) /
+					((min(y + 1, NY - 1) - max(y - 1, 0)) * vVoxel.y),
+				(wn[Index(x, y, min(z + 1, NZ - 1))] - wn[Index(x, y, max(z - 1, 0))]) /
+					((min(z + 1, NZ - 1) - max(z - 1, 0)) * vVoxel.z));
+			const FLOAT fGrad = D3DXVec3Length(&vGrad);
+			if(fGrad > 0)
+			{
+				const D3DXVECTOR3 vNormal = vGrad * (-1.0f / fGrad);
+				const FLOAT fDist = (0.5f - wn[idx]) / fGrad;
+				if(fabsf(fDist) <= FIELD_BAND_VOXELS * (fabsf(vNormal.x) * vVoxel.x + fabsf(vNormal.y) * vVoxel.y +
+					fabsf(vNormal.z) * vVoxel.z))
+				{
+					v = D3DXVECTOR4(vNormal, fDist);
+					continue;
+				}
+			}
+			v.w = WindingNumberCPU::IsInside(wn[idx]) ? -fabsf(v.w) : fabsf(v.w);
+		}
+	}
+}
+
+D3DXVECTOR4 BoundaryFieldCPU::SampleLinear(const D3DXVECTOR3& vUnitPos) const
+{
+	return SampleLinear(m_pData, m_iSize, vUnitPos);
+}
+
+D3DXVECTOR4 BoundaryFieldCPU::SampleLinear(const D3DXVECTOR4* pData, const UINT iSize[3], const D3DXVECTOR3& vUnitPos)
+{
+	const int NX = (int)iSize[0];
+	const int NY = (int)iSize[1];
+	const int NZ = (int)iSize[2];
+
+	FLOAT fx = vUnitPos.x * NX - 0.5f;
+	FLOAT fy = vUnitPos.y * NY - 0.5f;
+	FLOAT fz = vUnitPos.z * NZ - 0.5f;
+	FLOAT flx = floorf(fx), fly = floorf(fy), flz = floorf(fz);
+	FLOAT tx = fx - flx, ty = fy - fly, tz = fz - flz;
+
+	int x0 = WrapIndex((int)flx, NX), x1 = WrapIndex((int)flx + 1, NX);
+	int y0 = WrapIndex((int)fly, NY), y1 = WrapIndex((int)fly + 1, NY);
+	int z0 = WrapIndex((int)flz, NZ), z1 = WrapIndex((int)flz + 1, NZ);
+
+	const size_t sy = (size_t)NX, sz = (size_t)NX * NY;
+	D3DXVECTOR4 c00 = Lerp(pData[z0 * sz + y0 * sy + x0], pData[z0 * sz + y0 * sy + x1], tx);
+	D3DXVECTOR4 c10 = Lerp(pData[z0 * sz + y1 * sy + x0], pData[z0 * sz + y1 * sy + x1], tx);
+	D3DXVECTOR4 c01 = Lerp(pData[z1 * sz + y0 * sy + x0], pData[z1 * sz + y0 * sy + x1], tx);
+	D3DXVECTOR4 c11 = Lerp(pData[z1 * sz + y1 * sy + x0], pData[z1 * sz + y1 * sy + x1], tx);
+
+	return Lerp(Lerp(c00, c10, ty), Lerp(c01, c11, ty), tz);
+}
@@ -0,0 +1,105 @@
+//--------------------------------------------------------------------------------------
+// File: BoundaryFieldCPU.h
+//
+// CPU counterpart of g_pTexField: a volume over the mesh bounding box storing the
+// surface normal in xyz and the distance to the surface in w. The normal is only set
+// near the surface; VelocityCS treats voxels with a short normal as free space.
+//--------------------------------------------------------------------------------------
+#ifndef CPU_BOUNDARY_FIELD_H
+#define CPU_BOUNDARY_FIELD_H
+
+#include <vector>
+#include "MappedFileCPU.h"
+
+// Half width of the band with normals, in voxels per axis; the footprint of a splat
+#define FIELD_BAND_VOXELS 2.0f
+
+class TriangleMesh;
+class TriangleBVHCPU;
+class WindingNumberCPU;
+struct TriangleBVHHit;
+
+class BoundaryFieldCPU
+{
+public:
+	BoundaryFieldCPU();
+
+	//! Allocate a field of the given size, cleared to "far from any surface"
+	void Create(const UINT iFieldSize[3]);
+	//! Release the voxels or the mapping
+	void Clear();
+
+	//! Write the voxels to strFile with a header holding the size and iKey, which
+	//! identifies what the field was built from
+	HRESULT Save(const char* strFile, UINT64 iKey) const;
+	/*!
+	 * Use the voxels of a file Save wrote, mapped read-only instead of read. Fails and
+	 * leaves the field empty unless the file has iFieldSize voxels and the same iKey.
+	 */
+	HRESULT Map(const char* strFile, const UINT iFieldSize[3], UINT64 iKey);
+	bool IsMapped() const { return m_Mapping.IsOpen(); }
+
+	/*!
+	 * Port of the GPU field construction (TriField3DGS/TriField3DPS followed by
+	 * ArrayTo3DCS): every tessellated triangle writes its centroid normal and distance
+	 * into the voxels within two cells of its centroid, keeping the closest one.
+	 */
+	void BuildSplat(const TriangleMesh& mesh, const D3DXVECTOR3& vBoxMin,
+		const D3DXVECTOR3& vBoxMax, UINT uTessFactor);
+
+	/*!
+	 * Exact field: the distance from every voxel center to the closest point of the mesh,
+	 * negative inside, found with a TriangleBVHCPU. Voxels the splats would reach (the
+	 * surface within FIELD_BAND_VOXELS voxels along every axis) get the vertex normal
+	 * interpolated at the closest point, the others a zero normal.
+	 */
+	void BuildExact(const TriangleMesh& mesh, const D3DXVECTOR3& vBoxMin, const D3DXVECTOR3& vBoxMax);
+
+	/*!
+	 * BuildExact in a narrow band around the triangles only; the closest points found there
+	 * are then swept through the rest of the grid in the 8 diagonal directions until no voxel
+	 * finds a closer one. The values in the band are the exact ones, the distances outside
+	 * are those to a surface point, which is the closest one in all but rare cases.
+	 */
+	void BuildSweep(const TriangleMesh& mesh, const D3DXVECTOR3& vBoxMin, const D3DXVECTOR3& vBoxMax);
+
+	/*!
+	 * Sign the distances by the winding number of every voxel center (negative inside)
+	 * and orient the normals of the band with WindingNumberCPU::ClassifyValue. Where the
+	 * winding number passes one half away from the triangles, over a hole, the voxels in
+	 * the band of that level set get its normal so the boundary holds there too. A mapped
+	 * field is left alone.
+	 */
+	void Classify(const WindingNumberCPU& winding, const D3DXVECTOR3& vBoxMin, const D3DXVECTOR3& vBoxMax);
+
+	/*!
+	 * Trilinear lookup at a position given in [0,1]^3 over the bounding box; matches
+	 * DensityFieldRO.SampleLevel(g_SampleLinear, UnitPos(p), 0), including the wrap
+	 * addressing of g_SampleLinear.
+	 */
+	D3DXVECTOR4 SampleLinear(const D3DXVECTOR3& vUnitPos) const;
+	//! The same lookup in any volume laid out like m_Data
+	static D3DXVECTOR4 SampleLinear(const D3DXVECTOR4* pData, const UINT iSize[3], const D3DXVECTOR3& vUnitPos);
+
+	//! Field value at p from its closest point hit: the signed distance in w and, in the
+	//! band a splat would cover, the vertex normal interpolated at the closest point
+	static D3DXVECTOR4 ClosestPointValue(const TriangleMesh& mesh, const TriangleBVHCPU& bvh,
+		const D3DXVECTOR3& p, const TriangleBVHHit& hit, const D3DXVECTOR3& vVoxel);
+
+	const UINT* GetSize() const { return m_iSize; }
+	const D3DXVECTOR4* GetData() const { return m_pData; }
+	size_t GetNumVoxels() const { return (size_t)m_iSize[0] * m_iSize[1] * m_iSize[2]; }
+
+private:
+	UINT Index(UINT x, UINT y, UINT z) const
+	{
+		return (z * m_iSize[1] + y) * m_iSize[0] + x;
+	}
+
+	UINT						m_iSize[3];
+	std::vector<D3DXVECTOR4>	m_Data;		// x fastest, then y, then z like a Texture3D
+	MappedFileCPU				m_Mapping;	// holds the voxels instead of m_Data after Map
+	const D3DXVECTOR4*			m_pData;	// into m_Data or m_Mapping
+};
+
+#endif
@@ -0,0 +1,148 @@
+#include "DXUT.h"
+#include <string.h>
+#include "BufferedFileCPU.h"
+
+namespace
+{
+	inline bool IsSpace(BYTE c)
+	{
+		return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+	}
+}
+
+BufferedFileCPU::BufferedFileCPU() :
+	m_pFile(NULL),
+	m_iPos(0),
+	m_nEnd(0),
+	m_iOffset(0),
+	m_iSize(0),
+	m_iLine(1),
+	m_iItemLine(1),
+	m_bEnd(true)
+{
+}
+
+BufferedFileCPU::~BufferedFileCPU()
+{
+	Close();
+}
+
+HRESULT BufferedFileCPU::Open(const char* strFile)
+{
+	Close();
+
+	m_pFile = fopen(strFile, "rb");
+	if(!m_pFile)
+		return E_FAIL;
+#ifdef _WIN32
+	_fseeki64(m_pFile, 0, SEEK_END);
+	m_iSize = (UINT64)_ftelli64(m_pFile);
+#else
+	fseeko(m_pFile, 0, SEEK_END);
+	m_iSize = (UINT64)ftello(m_pFile);
+#endif
+	rewind(m_pFile);
+	// The buffer stands in for the one of the stream
+	setvbuf(m_pFile, NULL, _IONBF, 0);
+	m_Buffer.resize(BUFFERED_FILE_SIZE);
+	m_bEnd = false;
+	return S_OK;
+}
+
+void BufferedFileCPU::Close()
+{
+	if(m_pFile)
+		fclose(m_pFile);
+	m_pFile = NULL;
+	m_iPos = m_nEnd = 0;
+	m_iOffset = m_iSize = 0;
+	m_iLine = m_iItemLine = 1;
+	m_bEnd = true;
+}
+
+bool BufferedFileCPU::Fill(size_t n)
+{
+	if(n > m_Buffer.size())
+		return false;
+	const size_t nLeft = m_nEnd - m_iPos;
+	if(m_iPos > 0)
+	{
+		memmove(&m_Buffer[0], &m_Buffer[m_iPos], nLeft);
+		m_iOffset += m_iPos;
+		m_iPos = 0;
+		m_nEnd = nLeft;
+	}
+	while(m_nEnd < n && !m_bEnd)
+	{
+		const size_t nRead = fread(&m_Buffer[m_nEnd], 1, m_Buffer.size() - m_nEnd, m_pFile);
+		m_nEnd += nRead;
+		m_bEnd = nRead == 0;
+	}
+	return m_nEnd >= n;
+}
+
+bool BufferedFileCPU::ReadToken(const char*& pBegin, const char*& pEnd)
+{
+	for(;;)
+	{
+		for(; m_iPos < m_nEnd && IsSpace(m_Buffer[m_iPos]); m_iPos++)
+			if(m_Buffer[m_iPos] == '\n')
+				m_iLine++;
+		if(m_iPos < m_nEnd)
+			break;
+		if(!Fill(1))
+			return false;
+	}
+	m_iItemLine = m_iLine;
+
+	// A token cut by the end of the buffer is read again after the refill
+	size_t i = m_iPos;
+	for(;;)
+	{
+		while(i < m_nEnd && !IsSpace(m_Buffer[i]))
+			i++;
+		if(i < m_nEnd || m_bEnd)
+			break;
+		const size_t nLength = i - m_iPos;
+		const bool bFilled = Fill(nLength + 1);
+		i = m_iPos + nLength;
+		if(!bFilled)
+			break;
+	}
+	pBegin = (const char*)&m_Buffer[m_iPos];
+	pEnd = (const char*)&m_Buffer[0] + i;
+	m_iPos = i;
+	return true;
+}
+
+bool BufferedFileCPU::ReadLine(const char*& pBegin, const char*& pEnd)
+{
+	if(m_iPos == m_nEnd && !Fill(1))
+		return false;
+	m_iItemLine = m_iLine;
+
+	size_t i = m_iPos;
+	for(;;)
+	{
+		while(i < m_nEnd && m_Buffer[i] != '\n')
+			i++;
+		if(i < m_nEnd || m_bEnd)
+			break;
+		const size_t nLength = i - m_iPos;
+		const bool bFilled = Fill(nLength + 1);
+		i = m_iPos + nLength;
+		if(!bFilled)
+			break;
+	}
+	pBegin = (const char*)&m_Buffer[m_iPos];
+	pEnd = (const char*)&m_Buffer[0] + i;
+	if(pEnd > pBegin && pEnd[-1] == '\r')
+		pEnd--;
+	if(i < m_nEnd)
+	{
+		i++;
+		m_iLine++;
+	}
+	m_iPos = i;
+	return true;
+}
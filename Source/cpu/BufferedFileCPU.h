@@ -0,0 +1,67 @@
+//--------------------------------------------------------------------------------------
+// File: BufferedFileCPU.h
+//
+// Sequential reader of a file through one fixed buffer, for the formats that are read
+// front to back in a single pass. Records and tokens are handed out as pointers into the
+// buffer, which is refilled as they are consumed, so a file of any size is read without
+// a copy of it in memory and without an allocation after Open.
+//--------------------------------------------------------------------------------------
+#ifndef CPU_BUFFERED_FILE_H
+#define CPU_BUFFERED_FILE_H
+
+#include <stdio.h>
+#include <vector>
+
+// Bytes of the buffer; also the longest record, token or line
+#define BUFFERED_FILE_SIZE (1 << 20)
+
+class BufferedFileCPU
+{
+public:
+	BufferedFileCPU();
+	~BufferedFileCPU();
+
+	//! Open strFile for reading; fails on missing files
+	HRESULT Open(const char* strFile);
+	void Close();
+
+	UINT64 GetSize() const { return m_iSize; }
+	//! Bytes handed out so far
+	UINT64 GetPosition() const { return m_iOffset + m_iPos; }
+	//! Line of the last token or line, from 1
+	UINT GetLine() const { return m_iItemLine; }
+
+	//! The next n bytes, NULL if the file ends before them
+	const BYTE* Read(size_t n)
+	{
+		if(m_nEnd - m_iPos < n && !Fill(n))
+			return NULL;
+		const BYTE* p = &m_Buffer[m_iPos];
+		m_iPos += n;
+		return p;
+	}
+
+	//! The next run of characters between white space as [pBegin, pEnd); false at the end
+	bool ReadToken(const char*& pBegin, const char*& pEnd);
+	//! The rest of the current line without its "\n" or "\r\n"; false at the end
+	bool ReadLine(const char*& pBegin, const char*& pEnd);
+
+private:
+	BufferedFileCPU(const BufferedFileCPU&);
+	BufferedFileCPU& operator=(const BufferedFileCPU&);
+
+	//! Move the unread bytes to the front and read until n of them are there
+	bool Fill(size_t n);
+
+	FILE*				m_pFile;
+	std::vector<BYTE>	m_Buffer;
+	size_t				m_iPos;		// of the next byte in the buffer
+	size_t				m_nEnd;		// valid bytes in the buffer
+	UINT64				m_iOffset;	// of the buffer in the file
+	UINT64				m_iSize;
+	UINT				m_iLine;		// at m_iPos
+	UINT				m_iItemLine;	// of the last token or line
+	bool				m_bEnd;		// nothing left to read from the file
+};
+
+#endif
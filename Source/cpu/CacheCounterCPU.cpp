@@ -0,0 +1,112 @@
+#include "DXUT.h"
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+#include "CacheCounterCPU.h"
+
+namespace
+{
+#ifdef __linux__
+	//! Counter of the calling thread, disabled until PERF_EVENT_IOC_ENABLE
+	int OpenCounter(UINT64 config)
+	{
+		struct perf_event_attr attr;
+		memset(&attr, 0, sizeof(attr));
+		attr.size = sizeof(attr);
+		attr.type = PERF_TYPE_HARDWARE;
+		attr.config = config;
+		attr.disabled = 1;
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+		return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+	}
+#endif
+}
+
+CacheCounterCPU::CacheCounterCPU() :
+	m_bAvailable(false),
+	m_iReferences(0),
+	m_iMisses(0)
+{
+}
+
+CacheCounterCPU::~CacheCounterCPU()
+{
+	Close();
+}
+
+void CacheCounterCPU::Start()
+{
+	Close();
+	m_iReferences = m_iMisses = 0;
+
+#ifdef __linux__
+	// perf counts per thread; the OpenMP team is kept alive between parallel regions, so
+	// every worker opens its own pair here and reads it back in Stop
+#ifdef _OPENMP
+	m_Fds.assign(omp_get_max_threads() * 2, -1);
+#else
+	m_Fds.assign(2, -1);
+#endif
+	#pragma omp parallel
+	{
+#ifdef _OPENMP
+		const int iThread = omp_get_thread_num();
+#else
+		const int iThread = 0;
+#endif
+		int* pFds = &m_Fds[iThread * 2];
+		pFds[0] = OpenCounter(PERF_COUNT_HW_CACHE_REFERENCES);
+		pFds[1] = OpenCounter(PERF_COUNT_HW_CACHE_MISSES);
+		for(int i = 0; i < 2; i++)
+		{
+			if(pFds[i] >= 0)
+			{
+				ioctl(pFds[i], PERF_EVENT_IOC_RESET, 0);
+				ioctl(pFds[i], PERF_EVENT_IOC_ENABLE, 0);
+			}
+		}
+	}
+#endif
+}
+
+bool CacheCounterCPU::Stop()
+{
+	m_bAvailable = !m_Fds.empty();
+
+#ifdef __linux__
+	for(size_t i = 0; i < m_Fds.size(); i++)
+	{
+		UINT64 count = 0;
+		if(m_Fds[i] < 0 || ioctl(m_Fds[i], PERF_EVENT_IOC_DISABLE, 0) != 0 ||
+			read(m_Fds[i], &count, sizeof(count)) != (ssize_t)sizeof(count))
+		{
+			m_bAvailable = false;
+			continue;
+		}
+		if(i & 1)
+			m_iMisses += count;
+		else
+			m_iReferences += count;
+	}
+#endif
+
+	Close();
+	return m_bAvailable;
+}
+
+void CacheCounterCPU::Close()
+{
+#ifdef __linux__
+	for(size_t i = 0; i < m_Fds.size(); i++)
+		if(m_Fds[i] >= 0)
+			close(m_Fds[i]);
+#endif
+	m_Fds.clear();
+}
@@ -0,0 +1,37 @@
+//--------------------------------------------------------------------------------------
+// File: CacheCounterCPU.h
+//
+// Hardware cache reference and miss counts of the OpenMP worker threads, read with
+// perf_event_open on Linux. Elsewhere, or when the kernel does not expose the counters
+// (virtual machines, perf_event_paranoid), IsAvailable() is false.
+//--------------------------------------------------------------------------------------
+#ifndef CPU_CACHE_COUNTER_H
+#define CPU_CACHE_COUNTER_H
+
+#include <vector>
+
+class CacheCounterCPU
+{
+public:
+	CacheCounterCPU();
+	~CacheCounterCPU();
+
+	//! Open and start the counters on every thread of the OpenMP team
+	void Start();
+	//! Stop the counters and add them up; false if they could not be read
+	bool Stop();
+
+	bool IsAvailable() const { return m_bAvailable; }
+	UINT64 GetReferences() const { return m_iReferences; }
+	UINT64 GetMisses() const { return m_iMisses; }
+
+private:
+	void Close();
+
+	std::vector<int>	m_Fds;		// (references, misses) per thread
+	bool				m_bAvailable;
+	UINT64				m_iReferences;
+	UINT64				m_iMisses;
+};
+
+#endif
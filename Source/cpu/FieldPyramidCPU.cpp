@@ -0,0 +1,121 @@
+#include "DXUT.h"
+#include "BoundaryFieldCPU.h"
+#include "SparseFieldCPU.h"
+#include "FieldPyramidCPU.h"
+
+FieldPyramidCPU::FieldPyramidCPU() :
+	m_pField(NULL),
+	m_pSparseField(NULL)
+{
+}
+
+void FieldPyramidCPU::Clear()
+{
+	m_pField = NULL;
+	m_pSparseField = NULL;
+	std::vector<Level>().swap(m_Levels);
+}
+
+void FieldPyramidCPU::Build(const BoundaryFieldCPU& field, UINT nLevels)
+{
+	Clear();
+	m_pField = &field;
+	const UINT* iSize = field.GetSize();
+	const D3DXVECTOR4* pData = field.GetData();
+	BuildLevels(iSize, nLevels, [pData, iSize](UINT x, UINT y, UINT z)
+	{
+		return pData[((size_t)z * iSize[1] + y) * iSize[0] + x];
+	});
+}
+
+void FieldPyramidCPU::Build(const SparseFieldCPU& field, UINT nLevels)
+{
+	Clear();
+	m_pSparseField = &field;
+	BuildLevels(field.GetSize(), nLevels, [&field](UINT x, UINT y, UINT z) { return field.Voxel(x, y, z); });
+}
+
+template<class Fetch>
+void FieldPyramidCPU::BuildLevels(const UINT iSize[3], UINT nLevels, const Fetch& fetch)
+{
+	nLevels = min(nLevels, (UINT)FIELD_PYRAMID_MAX_LEVELS);
+	UINT iBelow[3] = { iSize[0], iSize[1], iSize[2] };
+	for(UINT iLevel = 1; iLevel < nLevels; iLevel++)
+	{
+		if(iBelow[0] < 2 || iBelow[1] < 2 || iBelow[2] < 2)
+			break;
+		m_Levels.push_back(Level());
+		Level& level = m_Levels.back();
+		for(int i = 0; i < 3; i++)
+			level.iSize[i] = (iBelow[i] + 1) / 2;
+		const int NX = (int)level.iSize[0];
+		const int NY = (int)level.iSize[1];
+		const int NZ = (int)level.iSize[2];
+		level.data.resize((size_t)NX * NY * NZ);
+
+		// An odd size repeats its last voxel, so every voxel averages eight
+		const D3DXVECTOR4* pBelow = iLevel > 1 ? &m_Levels[iLevel - 2].data[0] : NULL;
+		const UINT BX = iBelow[0], BY = iBelow[1], BZ = iBelow[2];
+		#pragma omp parallel for schedule(dynamic, 1)
+		for(int z = 0; z < NZ; z++)
+		{
+			const UINT z0 = 2 * z, z1 = min(z0 + 1, BZ - 1);
+			for(int y = 0; y < NY; y++)
+			{
+				const UINT y0 = 2 * y, y1 = min(y0 + 1, BY - 1);
+				for(int x = 0; x < NX; x++)
+				{
+					const UINT x0 = 2 * x, x1 = min(x0 + 1, BX - 1);
+					D3DXVECTOR4 sum(0, 0, 0, 0);
+					if(pBelow)
+					{
+						const UINT xs[2] = { x0, x1 }, ys[2] = { y0, y1 }, zs[2] = { z0, z1 };
+						for(int k = 0; k < 8; k++)
+							sum += pBelow[((size_t)zs[k >> 2] * BY + ys[(k >> 1) & 1]) * BX + xs[k & 1]];
+					}
+					else
+					{
+						sum = fetch(x0, y0, z0) + fetch(x1, y0, z0) + fetch(x0, y1, z0) + fetch(x1, y1, z0) +
+							fetch(x0, y0, z1) + fetch(x1, y0, z1) + fetch(x0, y1, z1) + fetch(x1, y1, z1);
+					}
+					level.data[((size_t)z * NY + y) * NX + x] = sum * 0.125f;
+				}
+			}
+		}
+		for(int i = 0; i < 3; i++)
+			iBelow[i] = level.iSize[i];
+	}
+}
+
+D3DXVECTOR4 FieldPyramidCPU::SampleLinear(const D3DXVECTOR3& vUnitPos, UINT iLevel) const
+{
+	iLevel = min(iLevel, (UINT)m_Levels.size());
+	if(iLevel > 0)
+	{
+		const Level& level = m_Levels[iLevel - 1];
+		return BoundaryFieldCPU::SampleLinear(&level.data[0], level.iSize, vUnitPos);
+	}
+	return m_pSparseField ? m_pSparseField->SampleLinear(vUnitPos) : m_pField->SampleLinear(vUnitPos);
+}
+
+UINT FieldPyramidCPU::GetNumLevels() const
+{
+	if(!m_pField && !m_pSparseField)
+		return 0;
+	return (UINT)m_Levels.size() + 1;
+}
+
+const UINT* FieldPyramidCPU::GetSize(UINT iLevel) const
+{
+	if(iLevel == 0 || m_Levels.empty())
+		return m_pSparseField ? m_pSparseField->GetSize() : m_pField->GetSize();
+	return m_Levels[min(iLevel, (UINT)m_Levels.size()) - 1].iSize;
+}
+
+size_t FieldPyramidCPU::GetMemorySize() const
+{
+	size_t iBytes = 0;
+	for(size_t i = 0; i < m_Levels.size(); i++)
+		iBytes += m_Levels[i].data.size() * sizeof(D3DXVECTOR4);
+	return iBytes;
+}
@@ -0,0 +1,58 @@
+//--------------------------------------------------------------------------------------
+// File: FieldPyramidCPU.h
+//
+// Mip pyramid of a boundary field: level 0 is the field itself, every further level
+// halves the size per axis and holds the 2x2x2 box filtered normals and distances of the
+// level below. A coarse level is one eighth of the voxels of the one below and fits
+// higher in the cache; its band of normals is as many voxels wide, so the boundary
+// pushes from twice as far out.
+//--------------------------------------------------------------------------------------
+#ifndef CPU_FIELD_PYRAMID_H
+#define CPU_FIELD_PYRAMID_H
+
+#include <vector>
+
+// Levels including the field; a 512^3 field ends at 4^3
+#define FIELD_PYRAMID_MAX_LEVELS 8
+
+class BoundaryFieldCPU;
+class SparseFieldCPU;
+
+class FieldPyramidCPU
+{
+public:
+	FieldPyramidCPU();
+
+	/*!
+	 * Build up to nLevels levels over field, which stays level 0 and must outlive the
+	 * pyramid; stops early once a level is a single voxel along some axis.
+	 */
+	void Build(const BoundaryFieldCPU& field, UINT nLevels);
+	void Build(const SparseFieldCPU& field, UINT nLevels);
+	void Clear();
+
+	//! SampleLinear of the field at iLevel (clamped to the coarsest level)
+	D3DXVECTOR4 SampleLinear(const D3DXVECTOR3& vUnitPos, UINT iLevel) const;
+
+	//! Levels including the field, 0 before Build
+	UINT GetNumLevels() const;
+	const UINT* GetSize(UINT iLevel) const;
+	//! Memory of the levels above the field
+	size_t GetMemorySize() const;
+
+private:
+	struct Level
+	{
+		UINT						iSize[3];
+		std::vector<D3DXVECTOR4>	data;	// laid out like BoundaryFieldCPU
+	};
+
+	//! Levels 1 and up from the level 0 voxels fetch(x, y, z) returns
+	template<class Fetch> void BuildLevels(const UINT iSize[3], UINT nLevels, const Fetch& fetch);
+
+	const BoundaryFieldCPU*		m_pField;
+	const SparseFieldCPU*		m_pSparseField;
+	std::vector<Level>			m_Levels;	// from level 1
+};
+
+#endif
@@ -0,0 +1,1103 @@
+#include "DXUT.h"
+#include <chrono>
+#include <float.h>
+#include <random>
+#include "../geometry/Tuple3.h"
+#include "../geometry/TriangleMesh.h"
+#include "GridSortCPU.h"
+#include "PhongTessellatorCPU.h"
+#include "FluidGridCPU.h"
+
+#define SIMULATION_BLOCK_SIZE 512
+#define FIELD_SIZE 128
+#define FIELD_DIM_ALIGN 16
+#define MAX_FIELD_DIM 2048
+
+// Same limits as the interactive sample puts on UpdateGridDim
+const UINT MAX_GRID_DIM = 1024;
+const UINT MAX_GRID_INDICES = 4 * 1024 * 1024;
+// Beyond this the dense cell table costs more to clear and scan than the finer cells save
+const UINT MAX_GRID_CELLS_PER_PARTICLE = 8;
+// CountingSortCPU scans a histogram bin per cell, which costs more than radix sorting
+// the pairs once there are more cells than this per particle
+const UINT MAX_COUNTING_CELLS_PER_PARTICLE = 2;
+// Pyramid level L is used while the cloud grows by more than 2^L / FIELD_LEVEL_GROWTH
+// voxels per frame
+const FLOAT FIELD_LEVEL_GROWTH = 16.0f;
+
+namespace
+{
+	//! Adds the lifetime of the object to a pass timing
+	class PassTimer
+	{
+	public:
+		explicit PassTimer(double& fAccum) : m_fAccum(fAccum),
+			m_Start(std::chrono::high_resolution_clock::now()) {}
+		~PassTimer()
+		{
+			m_fAccum += std::chrono::duration<double>(
+				std::chrono::high_resolution_clock::now() - m_Start).count();
+		}
+	private:
+		double& m_fAccum;
+		std::chrono::high_resolution_clock::time_point m_Start;
+	};
+
+	//! FNV-1a over n bytes, continuing from h
+	UINT64 HashBytes(const void* p, size_t n, UINT64 h = 14695981039346656037ULL)
+	{
+		const BYTE* b = (const BYTE*)p;
+		for(size_t i = 0; i < n; i++)
+			h = (h ^ b[i]) * 1099511628211ULL;
+		return h;
+	}
+
+	//! Identifies a field: the vertices, normals and triangles of the mesh (which also fix
+	//! the bounding box) and the settings the builders read
+	UINT64 FieldCacheKey(const TriangleMesh& mesh, const UINT iFieldSize[3], const FluidGridCPU::Settings& settings)
+	{
+		const std::vector<D3DXVECTOR3>& vertices = mesh.vertices();
+		const std::vector<D3DXVECTOR3>& normals = mesh.normals();
+		const std::vector<Tuple3ui>& triangles = mesh.triangles();
+		const UINT params[6] = { iFieldSize[0], iFieldSize[1], iFieldSize[2], settings.uTessFactor,
+			(UINT)settings.eFieldBuilder, settings.bWindingNumber ? 1u : 0u };
+
+		UINT64 h = HashBytes(params, sizeof(params));
+		h = HashBytes(vertices.empty() ? NULL : &vertices[0], vertices.size() * sizeof(D3DXVECTOR3), h);
+		h = HashBytes(normals.empty() ? NULL : &normals[0], normals.size() * sizeof(D3DXVECTOR3), h);
+		return HashBytes(triangles.empty() ? NULL : &triangles[0], triangles.size() * sizeof(Tuple3ui), h);
+	}
+
+	inline FLOAT Dot(const D3DXVECTOR3& a, const D3DXVECTOR3& b)
+	{
+		return a.x * b.x + a.y * b.y + a.z * b.z;
+	}
+
+	inline D3DXVECTOR3 XYZ(const D3DXVECTOR4& v)
+	{
+		return D3DXVECTOR3(v.x, v.y, v.z);
+	}
+}
+
+FluidGridCPU::Settings::Settings() :
+	iNumParticles(16 * 1024),
+	fSpeed(1.0f),
+	fKScale(2.0f),
+	fSurface(0.05f),
+	fSmoothlen(0.012f),
+	fParticleMass(0.0002f),
+	fNormalScalar(1.0f),
+	fFieldVoxel(0),
+	iFieldVoxels(0),
+	uTessFactor(1),
+	fPhongTolerance(0),
+	eFieldBuilder(FIELD_BUILD_SPLAT),
+	bSparseField(false),
+	iFieldLevels(0),
+	bWindingNumber(false),
+	vInitOffset(0, 0, 0),
+	iSeed(0),
+	eGridSort(GRID_SORT_COUNTING),
+	iGridDim(0),
+	bHashedGrid(false),
+	eGridKeys(GRID_KEY_ROW_MAJOR),
+	bFusedVelocityDensity(true),
+	eForceKernel(FORCE_KERNEL_AUTO),
+	eParticleLayout(PARTICLE_LAYOUT_AOS)
+{
+	iFieldSize[0] = iFieldSize[1] = iFieldSize[2] = FIELD_SIZE;
+}
+
+void FluidGridCPU::PassTimings::Reset()
+{
+	fBuildField = 0;
+	fBuildGrid = 0;
+	fSortGrid = 0;
+	fBuildGridIndices = 0;
+	fRearrangeParticles = 0;
+	fVelocity = 0;
+	fDensity = 0;
+	fVelocityDensity = 0;
+	iFrames = 0;
+}
+
+FluidGridCPU::FluidGridCPU() :
+	m_vBBoxCenter(0, 0, 0),
+	m_vBBoxExtent(1, 1, 1)
+{
+	m_CB = CB_SIMULATION();
+	m_iGridDim[0] = m_iGridDim[1] = m_iGridDim[2] = 1;
+	m_nGridCells = 1;
+	m_bHashedGrid = false;
+	m_bSparseField = false;
+	m_iFieldSize[0] = m_iFieldSize[1] = m_iFieldSize[2] = FIELD_SIZE;
+	m_iFieldLevel = 0;
+	m_fFieldSpread = 0;
+	m_eForceKernel = FORCE_KERNEL_REFERENCE;
+	m_pfnForceKernel = GetForceKernel(m_eForceKernel);
+	m_eParticleLayout = PARTICLE_LAYOUT_AOS;
+}
+
+HRESULT FluidGridCPU::ResetGeometry(const TriangleMesh& mesh)
+{
+	HRESULT hr;
+
+	if(mesh.num_triangles() == 0 || !mesh.has_normals())
+		return E_INVALIDARG;
+
+	D3DXVECTOR3 bblow, bbhigh;
+	mesh.bounding_box(bblow, bbhigh);
+	m_vBBoxCenter = (bblow + bbhigh) * 0.5f;
+	m_vBBoxExtent = (bbhigh - bblow) * 0.5f;
+	UpdateFieldSize();
+
+	if(m_Settings.fPhongTolerance > 0)
+	{
+		// The tolerance is in voxels of the field of the input box; the Phong surface bulges
+		// out of the input vertices, so the box grows to hold it
+		const FLOAT fVoxel = (FLOAT)pow(8.0 * m_vBBoxExtent.x * m_vBBoxExtent.y * m_vBBoxExtent.z /
+			((double)m_iFieldSize[0] * m_iFieldSize[1] * m_iFieldSize[2]), 1.0 / 3.0);
+		PhongTessellatorCPU tessellator;
+		{
+			PassTimer timer(m_Timings.fBuildField);
+			tessellator.Tessellate(mesh, m_Settings.fPhongTolerance * fVoxel, m_PhongMesh);
+		}
+		printf("Phong tessellation: %d to %d triangles in %u levels\n", mesh.num_triangles(),
+			m_PhongMesh.num_triangles(), tessellator.GetNumLevels());
+
+		D3DXVECTOR3 vLow, vHigh;
+		m_PhongMesh.bounding_box(vLow, vHigh);
+		D3DXVec3Minimize(&bblow, &bblow, &vLow);
+		D3DXVec3Maximize(&bbhigh, &bbhigh, &vHigh);
+		m_vBBoxCenter = (bblow + bbhigh) * 0.5f;
+		m_vBBoxExtent = (bbhigh - bblow) * 0.5f;
+		UpdateFieldSize();
+	}
+	else
+	{
+		m_PhongMesh.clear();
+	}
+	const TriangleMesh& surface = GetSurface(mesh);
+	UpdateConstants();
+
+	if(m_Settings.bWindingNumber)
+	{
+		PassTimer timer(m_Timings.fBuildField);
+		m_Winding.Build(surface);
+	}
+	else
+	{
+		m_Winding.Clear();
+	}
+
+	printf("Creating Field (%ux%ux%u)...\n", m_iFieldSize[0], m_iFieldSize[1], m_iFieldSize[2]);
+	m_bSparseField = m_Settings.bSparseField;
+	if(m_bSparseField)
+	{
+		m_Field.Clear();
+		m_Timings.fBuildField += TimeFieldBuild(surface, m_Settings.eFieldBuilder, m_SparseField);
+	}
+	else if(!m_Settings.strFieldCache.empty())
+	{
+		m_SparseField.Clear();
+		const UINT64 iKey = FieldCacheKey(surface, m_iFieldSize, m_Settings);
+		char strFile[32];
+		snprintf(strFile, sizeof(strFile), "/field_%016llx.bin", iKey);
+		const std::string strPath = m_Settings.strFieldCache + strFile;
+
+		HRESULT hrMap;
+		{
+			PassTimer timer(m_Timings.fBuildField);
+			hrMap = m_Field.Map(strPath.c_str(), m_iFieldSize, iKey);
+		}
+		if(SUCCEEDED(hrMap))
+		{
+			printf("Mapped the field from %s\n", strPath.c_str());
+		}
+		else
+		{
+			m_Timings.fBuildField += TimeFieldBuild(surface, m_Settings.eFieldBuilder, m_Field);
+			if(FAILED(m_Field.Save(strPath.c_str(), iKey)))
+				printf("Cannot write the field cache %s\n", strPath.c_str());
+		}
+	}
+	else
+	{
+		m_SparseField.Clear();
+		m_Timings.fBuildField += TimeFieldBuild(surface, m_Settings.eFieldBuilder, m_Field);
+	}
+
+	if(m_Settings.iFieldLevels > 1)
+	{
+		PassTimer timer(m_Timings.fBuildField);
+		if(m_bSparseField)
+			m_Pyramid.Build(m_SparseField, m_Settings.iFieldLevels);
+		else
+			m_Pyramid.Build(m_Field, m_Settings.iFieldLevels);
+	}
+	else
+	{
+		m_Pyramid.Clear();
+	}
+
+	V_RETURN(ResetParticles());
+	return S_OK;
+}
+
+HRESULT FluidGridCPU::ResetParticles()
+{
+	printf("Creating Particles...\n");
+
+	const UINT n = m_Settings.iNumParticles;
+	if(n == 0)
+		return E_INVALIDARG;
+
+	UpdateConstants();
+
+	FLOAT Rb = powf(m_vBBoxExtent.x * m_vBBoxExtent.y * m_vBBoxExtent.z, 0.3333333f) * 0.01f;
+	const D3DXVECTOR3 vCenter = InitCenter();
+	std::mt19937 rng(m_Settings.iSeed);
+	std::uniform_real_distribution<FLOAT> uniform(0.0f, 1.0f);
+
+	m_Particles.resize(n);
+	for(UINT i = 0; i < n; i++)
+	{
+		FLOAT r = uniform(rng) * Rb;
+		FLOAT theta = uniform(rng) * D3DX_PI;
+		FLOAT phi = uniform(rng) * D3DX_PI * 2.0f;
+		FLOAT st = sinf(theta);
+		FLOAT ct = cosf(theta);
+		FLOAT sp = sinf(phi);
+		FLOAT cp = cosf(phi);
+
+		m_Particles[i].x = r * st * cp + vCenter.x;
+		m_Particles[i].y = r * st * sp + vCenter.y;
+		m_Particles[i].z = r * ct + vCenter.z;
+		m_Particles[i].w = 0;
+	}
+	m_SortedParticles = m_Particles;
+	m_SortedSoA.Resize(n);
+	for(UINT i = 0; i < n; i++)
+		m_SortedSoA.Set(i, m_Particles[i]);
+	m_Density.assign(n, 0.0f);
+	m_iFieldLevel = m_Settings.iFieldLevels && m_Pyramid.GetNumLevels() ?
+		min(m_Settings.iFieldLevels, m_Pyramid.GetNumLevels()) - 1 : 0;
+	m_fFieldSpread = 0;
+
+	// Only the bitonic network needs the grid padded to a power of two
+	m_Grid.assign(m_Settings.eGridSort == GRID_SORT_BITONIC ? NextPowerOfTwo(n) : n, ~0ull);
+	m_GridPingPong.assign(m_Grid.size(), ~0ull);
+	if(!m_bHashedGrid)
+		m_GridIndices.assign((size_t)m_nGridCells * 2, 0);
+
+	return S_OK;
+}
+
+D3DXVECTOR3 FluidGridCPU::InitCenter() const
+{
+	const D3DXVECTOR3 vCenter = m_vBBoxCenter + m_Settings.vInitOffset;
+	if(m_Winding.IsEmpty() || m_Winding.IsInside(vCenter))
+		return vCenter;
+
+	// The closest voxel the classified field puts inside, preferring the ones off the band
+	// so the sphere does not start on the wall
+	const int NX = (int)m_iFieldSize[0];
+	const int NY = (int)m_iFieldSize[1];
+	const int NZ = (int)m_iFieldSize[2];
+	const D3DXVECTOR3 vBoxMin = m_vBBoxCenter - m_vBBoxExtent;
+	const D3DXVECTOR3 vVoxel(m_vBBoxExtent.x * 2.0f / NX, m_vBBoxExtent.y * 2.0f / NY, m_vBBoxExtent.z * 2.0f / NZ);
+	FLOAT fBest[2] = { FLT_MAX, FLT_MAX };
+	D3DXVECTOR3 vBest[2] = { vCenter, vCenter };
+	for(int z = 0; z < NZ; z++)
+		for(int y = 0; y < NY; y++)
+			for(int x = 0; x < NX; x++)
+			{
+				const D3DXVECTOR4 v = m_bSparseField ? m_SparseField.Voxel(x, y, z) :
+					m_Field.GetData()[((size_t)z * NY + y) * NX + x];
+				if(v.w >= 0)
+					continue;
+				const D3DXVECTOR3 p(vBoxMin.x + (x + 0.5f) * vVoxel.x, vBoxMin.y + (y + 0.5f) * vVoxel.y,
+					vBoxMin.z + (z + 0.5f) * vVoxel.z);
+				const D3DXVECTOR3 d = p - vCenter;
+				const int k = (v.x != 0 || v.y != 0 || v.z != 0) ? 1 : 0;
+				if(Dot(d, d) < fBest[k])
+				{
+					fBest[k] = Dot(d, d);
+					vBest[k] = p;
+				}
+			}
+	const D3DXVECTOR3& vInside = fBest[0] < FLT_MAX ? vBest[0] : vBest[1];
+	printf("The initial position is outside the mesh, starting at (%g, %g, %g)\n", vInside.x, vInside.y, vInside.z);
+	return vInside;
+}
+
+void FluidGridCPU::UpdateConstants()
+{
+	const D3DXVECTOR3& vExt = m_vBBoxExtent;
+	const UINT* iFieldSize = m_iFieldSize;
+	FLOAT mSize = powf(vExt.x * vExt.y * vExt.z, 0.3333333f);
+	FLOAT fSmoothlen = m_Settings.fSmoothlen * mSize * m_Settings.fKScale;
+
+	UpdateGridDim(fSmoothlen);
+	m_eForceKernel = ResolveForceKernel(m_Settings.eForceKernel);
+	m_pfnForceKernel = GetForceKernel(m_eForceKernel);
+	m_eParticleLayout = m_Settings.eParticleLayout;
+
+	m_CB.fBoundBoxMin = D3DXVECTOR4(m_vBBoxCenter - vExt, 0);
+	m_CB.fBoundBoxMax = D3DXVECTOR4(m_vBBoxCenter + vExt, 0);
+	// x and y only size the rendered sprites
+	m_CB.fParticleParameter = D3DXVECTOR4(0, 0, m_Settings.fNormalScalar, m_Settings.fSurface);
+	m_CB.fGridDim = D3DXVECTOR4((FLOAT)m_iGridDim[0], (FLOAT)m_iGridDim[1], (FLOAT)m_iGridDim[2], 0);
+	m_CB.fInvGridDim = D3DXVECTOR4(1.0f / (vExt.x * 2.0f), 1.0f / (vExt.y * 2.0f), 1.0f / (vExt.z * 2.0f),
+		(FLOAT)m_Settings.iNumParticles);
+	m_CB.iGridDot[0] = m_iGridDim[2] * m_iGridDim[0];
+	m_CB.iGridDot[1] = m_iGridDim[0];
+	m_CB.iGridDot[2] = 1;
+	m_CB.iGridDot[3] = m_Settings.iNumParticles;
+	m_CB.fKernel.x = fSmoothlen * fSmoothlen;
+	m_CB.fKernel.y = m_Settings.fSpeed;
+	m_CB.fKernel.z = mSize / powf((FLOAT)iFieldSize[0] * iFieldSize[1] * iFieldSize[2], 0.333333f);
+	m_CB.fKernel.w = m_Settings.fParticleMass * 315.0f / (64.0f * D3DX_PI * powf(fSmoothlen, 9));
+}
+
+void FluidGridCPU::FieldSizeForVoxel(const D3DXVECTOR3& vExtent, FLOAT fVoxel, UINT iFieldSize[3])
+{
+	const FLOAT fExt[3] = { vExtent.x, vExtent.y, vExtent.z };
+	for(int i = 0; i < 3; i++)
+	{
+		UINT n = (UINT)(fExt[i] * 2.0f / fVoxel / FIELD_DIM_ALIGN + 0.5f) * FIELD_DIM_ALIGN;
+		iFieldSize[i] = min(max(n, (UINT)FIELD_DIM_ALIGN), (UINT)MAX_FIELD_DIM);
+	}
+}
+
+void FluidGridCPU::FieldSizeForBudget(const D3DXVECTOR3& vExtent, UINT iVoxels, UINT iFieldSize[3])
+{
+	// Cubic voxels filling the box
+	FLOAT fVoxel = powf(vExtent.x * vExtent.y * vExtent.z * 8.0f / (FLOAT)max(iVoxels, 1u), 0.3333333f);
+	FieldSizeForVoxel(vExtent, fVoxel, iFieldSize);
+}
+
+void FluidGridCPU::UpdateFieldSize()
+{
+	if(m_Settings.fFieldVoxel > 0)
+	{
+		FieldSizeForVoxel(m_vBBoxExtent, m_Settings.fFieldVoxel, m_iFieldSize);
+	}
+	else if(m_Settings.iFieldVoxels > 0)
+	{
+		FieldSizeForBudget(m_vBBoxExtent, m_Settings.iFieldVoxels, m_iFieldSize);
+	}
+	else
+	{
+		m_iFieldSize[0] = m_Settings.iFieldSize[0];
+		m_iFieldSize[1] = m_Settings.iFieldSize[1];
+		m_iFieldSize[2] = m_Settings.iFieldSize[2];
+	}
+}
+
+void FluidGridCPU::UpdateGridDim(FLOAT fSmoothlen)
+{
+	const FLOAT fExt[3] = { m_vBBoxExtent.x, m_vBBoxExtent.y, m_vBBoxExtent.z };
+
+	// Both backends get the same automatic cells, so the hash changes the storage and
+	// not the samples; only an explicit iGridDim makes use of its finer cells
+	m_bHashedGrid = m_Settings.bHashedGrid;
+	const UINT nMaxCells = (UINT)min((UINT64)MAX_GRID_INDICES,
+		max((UINT64)m_Settings.iNumParticles * MAX_GRID_CELLS_PER_PARTICLE, 1ull));
+
+	if(m_Settings.iGridDim)
+	{
+		m_iGridDim[0] = m_iGridDim[1] = m_iGridDim[2] = min(m_Settings.iGridDim, MAX_GRID_DIM);
+	}
+	else
+	{
+		// Cells about one smoothing length wide, uniformly coarser if there would be
+		// more than nMaxCells cells, i.e. more than a few cells per particle. The cells
+		// are counted, not the keys, so the key order does not change the grid.
+		FLOAT fCell = fSmoothlen;
+		for(;;)
+		{
+			for(int i = 0; i < 3; i++)
+				m_iGridDim[i] = min(max((UINT)(fExt[i] * 2.0f / fCell), 1u), MAX_GRID_DIM);
+			if((UINT64)m_iGridDim[0] * m_iGridDim[1] * m_iGridDim[2] <= nMaxCells)
+				break;
+			fCell *= 1.05f;	// about 14% fewer cells
+		}
+	}
+	m_nGridCells = GridNumKeys();
+
+	if(m_bHashedGrid)
+		std::vector<UINT>().swap(m_GridIndices);
+	else if(m_GridIndices.size() != (size_t)m_nGridCells * 2)
+		m_GridIndices.assign((size_t)m_nGridCells * 2, 0);
+}
+
+D3DXVECTOR3 FluidGridCPU::UnitPos(const D3DXVECTOR3& position) const
+{
+	return D3DXVECTOR3((position.x - m_CB.fBoundBoxMin.x) * m_CB.fInvGridDim.x,
+		(position.y - m_CB.fBoundBoxMin.y) * m_CB.fInvGridDim.y,
+		(position.z - m_CB.fBoundBoxMin.z) * m_CB.fInvGridDim.z);
+}
+
+void FluidGridCPU::GridCalculateCell(const D3DXVECTOR3& position, int xyz[3]) const
+{
+	D3DXVECTOR3 u = UnitPos(position);
+	xyz[0] = (int)min(max(u.x * m_CB.fGridDim.x, 0.0f), m_CB.fGridDim.x - 1);
+	xyz[1] = (int)min(max(u.y * m_CB.fGridDim.y, 0.0f), m_CB.fGridDim.y - 1);
+	xyz[2] = (int)min(max(u.z * m_CB.fGridDim.z, 0.0f), m_CB.fGridDim.z - 1);
+}
+
+UINT FluidGridCPU::GridConstuctKey(UINT x, UINT y, UINT z) const
+{
+	if(m_Settings.eGridKeys == GRID_KEY_MORTON)
+		return GridMortonKey(x, y, z);
+
+	// Bit pack [----Y---][----Z---][----X---]
+	return y * m_CB.iGridDot[0] + z * m_CB.iGridDot[1] + x;
+}
+
+UINT FluidGridCPU::GridNumKeys() const
+{
+	// A Morton key grows with every coordinate, so the far corner has the largest one
+	if(m_Settings.eGridKeys == GRID_KEY_MORTON)
+		return GridMortonKey(m_iGridDim[0] - 1, m_iGridDim[1] - 1, m_iGridDim[2] - 1) + 1;
+
+	return m_iGridDim[0] * m_iGridDim[1] * m_iGridDim[2];
+}
+
+void FluidGridCPU::SimulateFluid_Grid()
+{
+	UpdateConstants();
+
+	{ PassTimer timer(m_Timings.fBuildGrid);          BuildGrid(); }
+	{ PassTimer timer(m_Timings.fSortGrid);           SortGrid(); }
+	{ PassTimer timer(m_Timings.fBuildGridIndices);   BuildGridIndices(); }
+	{ PassTimer timer(m_Timings.fRearrangeParticles); RearrangeParticles(); }
+	if(m_Settings.bFusedVelocityDensity)
+	{
+		PassTimer timer(m_Timings.fVelocityDensity);
+		VelocityDensity();
+	}
+	else
+	{
+		{ PassTimer timer(m_Timings.fVelocity); Velocity(); }
+		{ PassTimer timer(m_Timings.fDensity);  Density(); }
+	}
+	if(m_iFieldLevel)
+		UpdateFieldLevel();
+
+	m_Timings.iFrames++;
+}
+
+void FluidGridCPU::UpdateFieldLevel()
+{
+	const int n = (int)m_Settings.iNumParticles;
+	if(n == 0)
+		return;
+
+	// The particles move back and forth by a fraction of a voxel for as long as the
+	// relaxation runs; what settles is the spread of the cloud, which the order the
+	// passes leave the particles in does not change
+	double fSum[3] = { 0, 0, 0 };
+	#pragma omp parallel for schedule(static, SIMULATION_BLOCK_SIZE) reduction(+:fSum[:3])
+	for(int P_ID = 0; P_ID < n; P_ID++)
+	{
+		fSum[0] += m_Particles[P_ID].x;
+		fSum[1] += m_Particles[P_ID].y;
+		fSum[2] += m_Particles[P_ID].z;
+	}
+	const D3DXVECTOR3 vMean((FLOAT)(fSum[0] / n), (FLOAT)(fSum[1] / n), (FLOAT)(fSum[2] / n));
+	double fSumSq = 0;
+	#pragma omp parallel for schedule(static, SIMULATION_BLOCK_SIZE) reduction(+:fSumSq)
+	for(int P_ID = 0; P_ID < n; P_ID++)
+	{
+		D3DXVECTOR3 d = XYZ(m_Particles[P_ID]) - vMean;
+		fSumSq += Dot(d, d);
+	}
+	const FLOAT fSpread = sqrtf((FLOAT)(fSumSq / n));
+	const FLOAT fGrowth = fSpread - m_fFieldSpread;
+	m_fFieldSpread = fSpread;
+
+	const FLOAT fVoxel = 2.0f * powf(m_vBBoxExtent.x * m_vBBoxExtent.y * m_vBBoxExtent.z /
+		((FLOAT)m_iFieldSize[0] * m_iFieldSize[1] * m_iFieldSize[2]), 1.0f / 3.0f);
+	const FLOAT fLevel = fGrowth > 0 ? floorf(log2f(fGrowth * FIELD_LEVEL_GROWTH / fVoxel)) : 0;
+	m_iFieldLevel = min(m_iFieldLevel, (UINT)max(fLevel, 0.0f));
+}
+
+//--------------------------------------------------------------------------------------
+// Build Grid
+//--------------------------------------------------------------------------------------
+void FluidGridCPU::BuildGrid()
+{
+	const int n = (int)m_Settings.iNumParticles;
+
+	#pragma omp parallel for schedule(static, SIMULATION_BLOCK_SIZE)
+	for(int P_ID = 0; P_ID < n; P_ID++)
+	{
+		int grid_xyz[3];
+		GridCalculateCell(XYZ(m_Particles[P_ID]), grid_xyz);
+		m_Grid[P_ID] = GridConstuctKeyValuePair(GridConstuctKey(grid_xyz[0], grid_xyz[1], grid_xyz[2]), P_ID);
+	}
+}
+
+bool FluidGridCPU::UseCountingSort() const
+{
+	// The counting sort needs a histogram bin per cell, so a hashed grid is radix sorted
+	return m_Settings.eGridSort == GRID_SORT_COUNTING && !m_bHashedGrid &&
+		m_nGridCells <= (UINT64)m_Settings.iNumParticles * MAX_COUNTING_CELLS_PER_PARTICLE;
+}
+
+void FluidGridCPU::SortGrid()
+{
+	if(UseCountingSort())
+	{
+		CountingSortCPU(m_Grid, m_Settings.iNumParticles, m_nGridCells, m_GridPingPong, m_GridIndices, m_GridHistogram);
+		m_Grid.swap(m_GridPingPong);
+	}
+	else if(m_Settings.eGridSort == GRID_SORT_RADIX || m_Settings.eGridSort == GRID_SORT_COUNTING)
+	{
+		RadixSortCPU(m_Grid, m_Settings.iNumParticles, KeyBits(m_nGridCells), m_GridPingPong);
+	}
+	else
+	{
+		// The padding sorts to the tail. It is (re)added here since the other modes
+		// swap in the unpadded ping pong buffer.
+		const size_t nPadded = NextPowerOfTwo(m_Settings.iNumParticles);
+		if(m_Grid.size() != nPadded)
+			m_Grid.resize(nPadded);
+		std::fill(m_Grid.begin() + m_Settings.iNumParticles, m_Grid.end(), ~0ull);
+		BitonicSortCPU(m_Grid);
+	}
+}
+
+//--------------------------------------------------------------------------------------
+// Build Grid Indices
+//--------------------------------------------------------------------------------------
+void FluidGridCPU::BuildGridIndices()
+{
+	const int n = (int)m_Settings.iNumParticles;
+
+	if(m_bHashedGrid)
+	{
+		m_GridHash.Build(m_Grid, n);
+		return;
+	}
+
+	// CountingSortCPU already produced the ranges
+	if(UseCountingSort())
+		return;
+
+	std::fill(m_GridIndices.begin(), m_GridIndices.end(), 0);
+
+	// Unlike BuildGridIndicesCS the first and last entries do not wrap around, so a
+	// grid with every particle in one cell still gets its range
+	#pragma omp parallel for schedule(static, SIMULATION_BLOCK_SIZE)
+	for(int G_ID = 0; G_ID < n; G_ID++)
+	{
+		UINT cell = GridGetKey(m_Grid[G_ID]);
+		if(G_ID == 0 || cell != GridGetKey(m_Grid[G_ID - 1]))
+		{
+			// I'm the start of a cell
+			m_GridIndices[cell * 2] = G_ID;
+		}
+		if(G_ID == n - 1 || cell != GridGetKey(m_Grid[G_ID + 1]))
+		{
+			// I'm the end of a cell
+			m_GridIndices[cell * 2 + 1] = G_ID + 1;
+		}
+	}
+}
+
+//--------------------------------------------------------------------------------------
+// Rearrange Particles
+//--------------------------------------------------------------------------------------
+void FluidGridCPU::RearrangeParticles()
+{
+	const int n = (int)m_Settings.iNumParticles;
+
+	if(m_SortedSoA.Size() != (UINT)n)
+		m_SortedSoA.Resize(n);
+
+	if(m_eParticleLayout == PARTICLE_LAYOUT_SOA)
+	{
+		#pragma omp parallel for schedule(static, SIMULATION_BLOCK_SIZE)
+		for(int ID = 0; ID < n; ID++)
+			m_SortedSoA.Set(ID, m_Particles[GridGetValue(m_Grid[ID])]);
+		return;
+	}
+
+	#pragma omp parallel for schedule(static, SIMULATION_BLOCK_SIZE)
+	for(int ID = 0; ID < n; ID++)
+		m_SortedParticles[ID] = m_Particles[GridGetValue(m_Grid[ID])];
+
+	// The SIMD kernels read the positions as SoA in either layout
+	if(m_eForceKernel != FORCE_KERNEL_REFERENCE)
+	{
+		#pragma omp parallel for schedule(static, SIMULATION_BLOCK_SIZE)
+		for(int ID = 0; ID < n; ID++)
+			m_SortedSoA.Set(ID, m_SortedParticles[ID]);
+	}
+}
+
+void FluidGridCPU::SumNeighbors(const D3DXVECTOR3& P_position, FLOAT sums[5]) const
+{
+	const int iGridMax[3] = { (int)m_CB.fGridDim.x - 1, (int)m_CB.fGridDim.y - 1, (int)m_CB.fGridDim.z - 1 };
+	ForceKernelParams params = { { P_position.x, P_position.y, P_position.z }, m_CB.fKernel.x, m_CB.fKernel.w };
+	sums[0] = sums[1] = sums[2] = sums[3] = sums[4] = 0;
+
+	const FLOAT* pX = m_SortedSoA.X();
+	const FLOAT* pY = m_SortedSoA.Y();
+	const FLOAT* pZ = m_SortedSoA.Z();
+
+	int G_XY[3];
+	GridCalculateCell(P_position, G_XY);
+
+	// With row-major keys the X neighbors are one block; the others often are as well
+	UINT iBlockStart = 0, iBlockEnd = 0;
+	for(int Z = max(G_XY[2] - 1, 0) ; Z <= min(G_XY[2] + 1, iGridMax[2]) ; Z++)
+	{
+		for(int Y = max(G_XY[1] - 1, 0) ; Y <= min(G_XY[1] + 1, iGridMax[1]) ; Y++)
+		{
+			for(int X = max(G_XY[0] - 1, 0) ; X <= min(G_XY[0] + 1, iGridMax[0]) ; X++)
+			{
+				UINT G_START, G_END;
+				GridCellRange(GridConstuctKey(X, Y, Z), G_START, G_END);
+				if(G_START == G_END)
+					continue;
+				if(G_START == iBlockEnd)
+				{
+					iBlockEnd = G_END;
+					continue;
+				}
+				if(iBlockEnd > iBlockStart)
+					m_pfnForceKernel(pX + iBlockStart, pY + iBlockStart, pZ + iBlockStart,
+						iBlockEnd - iBlockStart, params, sums);
+				iBlockStart = G_START;
+				iBlockEnd = G_END;
+			}
+		}
+	}
+	if(iBlockEnd > iBlockStart)
+		m_pfnForceKernel(pX + iBlockStart, pY + iBlockStart, pZ + iBlockStart,
+			iBlockEnd - iBlockStart, params, sums);
+}
+
+//--------------------------------------------------------------------------------------
+// Velocity
+//--------------------------------------------------------------------------------------
+D3DXVECTOR4 FluidGridCPU::IntegrateParticle(const D3DXVECTOR3& P_position, D3DXVECTOR4 velocity) const
+{
+	const FLOAT h_sq = m_CB.fKernel.x;
+
+	if(velocity.w > 0)
+	{
+		velocity.x /= velocity.w;
+		velocity.y /= velocity.w;
+		velocity.z /= velocity.w;
+	}
+	D3DXVECTOR3 vel = XYZ(velocity);
+
+	D3DXVECTOR3 vUnitPos = UnitPos(P_position);
+	D3DXVECTOR4 dist = m_iFieldLevel ? m_Pyramid.SampleLinear(vUnitPos, m_iFieldLevel) :
+		(m_bSparseField ? m_SparseField.SampleLinear(vUnitPos) : m_Field.SampleLinear(vUnitPos));
+	D3DXVECTOR3 distxyz = XYZ(dist);
+	FLOAT dl = sqrtf(Dot(distxyz, distxyz));
+	if(dl > m_CB.fParticleParameter.w)
+	{
+		D3DXVECTOR3 norm = distxyz * (m_CB.fParticleParameter.z / dl);
+		FLOAT vn = Dot(vel, norm);
+		if(vn > 0)
+		{
+			D3DXVECTOR3 proj = vn * norm;
+			D3DXVECTOR3 tang = vel - proj;
+
+			FLOAT w = (expf(-dist.w * dist.w / h_sq) - 0.5f) * m_CB.fKernel.z;
+			vel = tang - norm * w;
+		}
+	}
+
+	D3DXVECTOR3 p = P_position + vel * m_CB.fKernel.y;
+	return D3DXVECTOR4(
+		max(m_CB.fBoundBoxMin.x, min(m_CB.fBoundBoxMax.x, p.x)),
+		max(m_CB.fBoundBoxMin.y, min(m_CB.fBoundBoxMax.y, p.y)),
+		max(m_CB.fBoundBoxMin.z, min(m_CB.fBoundBoxMax.z, p.z)),
+		dl);
+}
+
+void FluidGridCPU::Velocity()
+{
+	if(m_eParticleLayout == PARTICLE_LAYOUT_SOA)
+		VelocityT(m_SortedSoA);
+	else
+		VelocityT(ParticleViewAoS(m_SortedParticles));
+}
+
+template<class Particles>
+void FluidGridCPU::VelocityT(const Particles& sorted)
+{
+	const int n = (int)m_Settings.iNumParticles;
+	const FLOAT h_sq = m_CB.fKernel.x;
+	const int iGridMax[3] = { (int)m_CB.fGridDim.x - 1, (int)m_CB.fGridDim.y - 1, (int)m_CB.fGridDim.z - 1 };
+
+	#pragma omp parallel for schedule(dynamic, SIMULATION_BLOCK_SIZE)
+	for(int P_ID = 0; P_ID < n; P_ID++)
+	{
+		const D3DXVECTOR3 P_position = sorted.Position(P_ID);
+
+		D3DXVECTOR4 velocity(0, 0, 0, 0);
+
+		if(m_eForceKernel != FORCE_KERNEL_REFERENCE)
+		{
+			// The SIMD kernels always sum the density as well; it is dropped here
+			FLOAT sums[5];
+			SumNeighbors(P_position, sums);
+			m_Particles[P_ID] = IntegrateParticle(P_position, D3DXVECTOR4(sums[0], sums[1], sums[2], sums[3]));
+			continue;
+		}
+
+		// Calculate the displacement based on neighbors from the 26 adjacent cells + current cell
+		int G_XY[3];
+		GridCalculateCell(P_position, G_XY);
+
+		for(int Z = max(G_XY[2] - 1, 0) ; Z <= min(G_XY[2] + 1, iGridMax[2]) ; Z++)
+		{
+			for(int Y = max(G_XY[1] - 1, 0) ; Y <= min(G_XY[1] + 1, iGridMax[1]) ; Y++)
+			{
+				for(int X = max(G_XY[0] - 1, 0) ; X <= min(G_XY[0] + 1, iGridMax[0]) ; X++)
+				{
+					UINT G_CELL = GridConstuctKey(X, Y, Z);
+					UINT G_START, G_END;
+					GridCellRange(G_CELL, G_START, G_END);
+					for(UINT N_ID = G_START ; N_ID < G_END ; N_ID++)
+					{
+						D3DXVECTOR3 diff = sorted.Position(N_ID) - P_position;
+						FLOAT r_sq = Dot(diff, diff);
+
+						// CalculateForce
+						velocity += D3DXVECTOR4(-diff, 1.0f) * expf(-r_sq / h_sq);
+					}
+				}
+			}
+		}
+
+		m_Particles[P_ID] = IntegrateParticle(P_position, velocity);
+	}
+}
+
+//--------------------------------------------------------------------------------------
+// Density
+//--------------------------------------------------------------------------------------
+void FluidGridCPU::Density()
+{
+	if(m_eParticleLayout == PARTICLE_LAYOUT_SOA)
+		DensityT(m_SortedSoA);
+	else
+		DensityT(ParticleViewAoS(m_SortedParticles));
+}
+
+template<class Particles>
+void FluidGridCPU::DensityT(const Particles& sorted)
+{
+	const int n = (int)m_Settings.iNumParticles;
+	const FLOAT h_sq = m_CB.fKernel.x;
+	const int iGridMax[3] = { (int)m_CB.fGridDim.x - 1, (int)m_CB.fGridDim.y - 1, (int)m_CB.fGridDim.z - 1 };
+
+	#pragma omp parallel for schedule(dynamic, SIMULATION_BLOCK_SIZE)
+	for(int P_ID = 0; P_ID < n; P_ID++)
+	{
+		const D3DXVECTOR3 P_position = sorted.Position(P_ID);
+
+		FLOAT density = 0;
+
+		// Calculate the density based on neighbors from the 26 adjacent cells + current cell
+		int G_XY[3];
+		GridCalculateCell(P_position, G_XY);
+
+		for(int Z = max(G_XY[2] - 1, 0) ; Z <= min(G_XY[2] + 1, iGridMax[2]) ; Z++)
+		{
+			for(int Y = max(G_XY[1] - 1, 0) ; Y <= min(G_XY[1] + 1, iGridMax[1]) ; Y++)
+			{
+				for(int X = max(G_XY[0] - 1, 0) ; X <= min(G_XY[0] + 1, iGridMax[0]) ; X++)
+				{
+					UINT G_CELL = GridConstuctKey(X, Y, Z);
+					UINT G_START, G_END;
+					GridCellRange(G_CELL, G_START, G_END);
+					for(UINT N_ID = G_START ; N_ID < G_END ; N_ID++)
+					{
+						D3DXVECTOR3 diff = sorted.Position(N_ID) - P_position;
+						FLOAT r_sq = Dot(diff, diff);
+
+						if(r_sq < h_sq)
+						{
+							// CalculateDensity: W_poly6(r, h) = 315 / (64 * pi * h^9) * (h^2 - r^2)^3
+							FLOAT d = h_sq - r_sq;
+							density += m_CB.fKernel.w * d * d * d;
+						}
+					}
+				}
+			}
+		}
+
+		m_Density[P_ID] = density;
+	}
+}
+
+//--------------------------------------------------------------------------------------
+// Velocity + Density
+//--------------------------------------------------------------------------------------
+void FluidGridCPU::VelocityDensity()
+{
+	if(m_eParticleLayout == PARTICLE_LAYOUT_SOA)
+		VelocityDensityT(m_SortedSoA);
+	else
+		VelocityDensityT(ParticleViewAoS(m_SortedParticles));
+}
+
+template<class Particles>
+void FluidGridCPU::VelocityDensityT(const Particles& sorted)
+{
+	const int n = (int)m_Settings.iNumParticles;
+	const FLOAT h_sq = m_CB.fKernel.x;
+	const int iGridMax[3] = { (int)m_CB.fGridDim.x - 1, (int)m_CB.fGridDim.y - 1, (int)m_CB.fGridDim.z - 1 };
+
+	#pragma omp parallel for schedule(dynamic, SIMULATION_BLOCK_SIZE)
+	for(int P_ID = 0; P_ID < n; P_ID++)
+	{
+		const D3DXVECTOR3 P_position = sorted.Position(P_ID);
+
+		if(m_eForceKernel != FORCE_KERNEL_REFERENCE)
+		{
+			FLOAT sums[5];
+			SumNeighbors(P_position, sums);
+			m_Particles[P_ID] = IntegrateParticle(P_position, D3DXVECTOR4(sums[0], sums[1], sums[2], sums[3]));
+			m_Density[P_ID] = sums[4];
+			continue;
+		}
+
+		D3DXVECTOR4 velocity(0, 0, 0, 0);
+		FLOAT density = 0;
+
+		int G_XY[3];
+		GridCalculateCell(P_position, G_XY);
+
+		for(int Z = max(G_XY[2] - 1, 0) ; Z <= min(G_XY[2] + 1, iGridMax[2]) ; Z++)
+		{
+			for(int Y = max(G_XY[1] - 1, 0) ; Y <= min(G_XY[1] + 1, iGridMax[1]) ; Y++)
+			{
+				for(int X = max(G_XY[0] - 1, 0) ; X <= min(G_XY[0] + 1, iGridMax[0]) ; X++)
+				{
+					UINT G_CELL = GridConstuctKey(X, Y, Z);
+					UINT G_START, G_END;
+					GridCellRange(G_CELL, G_START, G_END);
+					for(UINT N_ID = G_START ; N_ID < G_END ; N_ID++)
+					{
+						D3DXVECTOR3 diff = sorted.Position(N_ID) - P_position;
+						FLOAT r_sq = Dot(diff, diff);
+
+						// CalculateForce
+						velocity += D3DXVECTOR4(-diff, 1.0f) * expf(-r_sq / h_sq);
+
+						if(r_sq < h_sq)
+						{
+							// CalculateDensity
+							FLOAT d = h_sq - r_sq;
+							density += m_CB.fKernel.w * d * d * d;
+						}
+					}
+				}
+			}
+		}
+
+		m_Particles[P_ID] = IntegrateParticle(P_position, velocity);
+		m_Density[P_ID] = density;
+	}
+}
+
+FLOAT FluidGridCPU::AvgDensity() const
+{
+	const int n = (int)m_Density.size();
+	double sum = 0;
+
+	#pragma omp parallel for reduction(+:sum)
+	for(int i = 0; i < n; i++)
+		sum += m_Density[i];
+
+	return n ? (FLOAT)(sum / n) : 0.0f;
+}
+
+UINT FluidGridCPU::CountInsideParticles() const
+{
+	const int n = (int)m_Particles.size();
+	UINT nInside = 0;
+
+	#pragma omp parallel for schedule(dynamic, 256) reduction(+:nInside)
+	for(int i = 0; i < n; i++)
+	{
+		const D3DXVECTOR4& p = m_Particles[i];
+		if(m_Winding.IsInside(D3DXVECTOR3(p.x, p.y, p.z)))
+			nInside++;
+	}
+	return nInside;
+}
+
+void FluidGridCPU::StencilLocality(double& fRuns, double& fSpanBytes)
+{
+	UpdateConstants();
+	BuildGrid();
+	SortGrid();
+	BuildGridIndices();
+	RearrangeParticles();
+
+	const int n = (int)m_Settings.iNumParticles;
+	const int iGridMax[3] = { (int)m_CB.fGridDim.x - 1, (int)m_CB.fGridDim.y - 1, (int)m_CB.fGridDim.z - 1 };
+	// The SoA layout reads x, y and z from three arrays with the same span
+	const size_t iParticleBytes = m_eParticleLayout == PARTICLE_LAYOUT_SOA ? 3 * sizeof(FLOAT) : sizeof(D3DXVECTOR4);
+	double runs = 0, span = 0;
+
+	#pragma omp parallel for schedule(static, SIMULATION_BLOCK_SIZE) reduction(+:runs, span)
+	for(int P_ID = 0; P_ID < n; P_ID++)
+	{
+		int G_XY[3];
+		GridCalculateCell(SortedPosition(P_ID), G_XY);
+
+		// Non-empty ranges of the stencil, ordered by start
+		UINT ranges[27][2];
+		int nRanges = 0;
+		for(int Z = max(G_XY[2] - 1, 0) ; Z <= min(G_XY[2] + 1, iGridMax[2]) ; Z++)
+			for(int Y = max(G_XY[1] - 1, 0) ; Y <= min(G_XY[1] + 1, iGridMax[1]) ; Y++)
+				for(int X = max(G_XY[0] - 1, 0) ; X <= min(G_XY[0] + 1, iGridMax[0]) ; X++)
+				{
+					UINT G_START, G_END;
+					GridCellRange(GridConstuctKey(X, Y, Z), G_START, G_END);
+					if(G_START == G_END)
+						continue;
+					int i = nRanges++;
+					for(; i > 0 && ranges[i - 1][0] > G_START; i--)
+					{
+						ranges[i][0] = ranges[i - 1][0];
+						ranges[i][1] = ranges[i - 1][1];
+					}
+					ranges[i][0] = G_START;
+					ranges[i][1] = G_END;
+				}
+
+		int nRuns = nRanges ? 1 : 0;
+		for(int i = 1; i < nRanges; i++)
+			if(ranges[i][0] != ranges[i - 1][1])
+				nRuns++;
+		runs += nRuns;
+		if(nRanges)
+			span += (double)(ranges[nRanges - 1][1] - ranges[0][0]) * iParticleBytes;
+	}
+
+	fRuns = n ? runs / n : 0.0;
+	fSpanBytes = n ? span / n : 0.0;
+}
+
+double FluidGridCPU::TimeFieldBuild(const TriangleMesh& mesh, FieldBuilder eBuilder, BoundaryFieldCPU& field) const
+{
+	const D3DXVECTOR3 bblow = m_vBBoxCenter - m_vBBoxExtent;
+	const D3DXVECTOR3 bbhigh = m_vBBoxCenter + m_vBBoxExtent;
+
+	double fTime = 0;
+	{
+		PassTimer timer(fTime);
+		field.Create(m_iFieldSize);
+		switch(eBuilder)
+		{
+		case FIELD_BUILD_EXACT:
+			field.BuildExact(mesh, bblow, bbhigh);
+			break;
+		case FIELD_BUILD_SWEEP:
+			field.BuildSweep(mesh, bblow, bbhigh);
+			break;
+		default:
+			field.BuildSplat(mesh, bblow, bbhigh, m_Settings.uTessFactor);
+			break;
+		}
+		if(!m_Winding.IsEmpty())
+			field.Classify(m_Winding, bblow, bbhigh);
+	}
+	return fTime;
+}
+
+double FluidGridCPU::TimeFieldBuild(const TriangleMesh& mesh, FieldBuilder eBuilder, SparseFieldCPU& field) const
+{
+	// The classification needs the whole grid
+	if(eBuilder != FIELD_BUILD_EXACT || !m_Winding.IsEmpty())
+	{
+		BoundaryFieldCPU dense;
+		double fTime = TimeFieldBuild(mesh, eBuilder, dense);
+		{
+			PassTimer timer(fTime);
+			field.Compress(dense);
+		}
+		return fTime;
+	}
+
+	double fTime = 0;
+	{
+		PassTimer timer(fTime);
+		field.BuildExact(mesh, m_vBBoxCenter - m_vBBoxExtent, m_vBBoxCenter + m_vBBoxExtent, m_iFieldSize);
+	}
+	return fTime;
+}
+
+double FluidGridCPU::TimeGridSort(GridSortMode eMode, UINT iRepeats)
+{
+	const GridSortMode eOldMode = m_Settings.eGridSort;
+	m_Settings.eGridSort = eMode;
+
+	UpdateConstants();
+	BuildGrid();
+	const std::vector<UINT64> unsorted(m_Grid.begin(), m_Grid.begin() + m_Settings.iNumParticles);
+
+	double fTime = 0;
+	for(UINT i = 0; i < iRepeats; i++)
+	{
+		std::copy(unsorted.begin(), unsorted.end(), m_Grid.begin());
+		PassTimer timer(fTime);
+		SortGrid();
+		BuildGridIndices();
+	}
+
+	m_Settings.eGridSort = eOldMode;
+	return iRepeats ? fTime / iRepeats : 0.0;
+}
+
+double FluidGridCPU::TimeSimulation(const Settings& settings, UINT iFrames, PassTimings* pTimings, bool bFromStart)
+{
+	const Settings oldSettings = m_Settings;
+	const PassTimings oldTimings = m_Timings;
+	const std::vector<D3DXVECTOR4> particles(m_Particles);
+	const UINT iOldFieldLevel = m_iFieldLevel;
+	const FLOAT fOldFieldSpread = m_fFieldSpread;
+
+	m_Settings.eGridSort = settings.eGridSort;
+	m_Settings.iGridDim = settings.iGridDim;
+	m_Settings.bHashedGrid = settings.bHashedGrid;
+	m_Settings.eGridKeys = settings.eGridKeys;
+	m_Settings.bFusedVelocityDensity = settings.bFusedVelocityDensity;
+	m_Settings.eForceKernel = settings.eForceKernel;
+	m_Settings.eParticleLayout = settings.eParticleLayout;
+	m_Settings.iFieldLevels = settings.iFieldLevels;
+	if(bFromStart)
+		ResetParticles();
+	m_Timings.Reset();
+	double fTime = 0;
+	{
+		PassTimer timer(fTime);
+		for(UINT i = 0; i < iFrames; i++)
+			SimulateFluid_Grid();
+	}
+	if(pTimings)
+		*pTimings = m_Timings;
+
+	m_Settings = oldSettings;
+	m_Timings = oldTimings;
+	m_Particles = particles;
+	m_iFieldLevel = iOldFieldLevel;
+	m_fFieldSpread = fOldFieldSpread;
+	UpdateConstants();
+	return iFrames ? fTime / iFrames : 0.0;
+}
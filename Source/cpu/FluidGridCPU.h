@@ -0,0 +1,279 @@
+//--------------------------------------------------------------------------------------
+// File: FluidGridCPU.h
+//
+// Multi-threaded CPU execution of SimulateFluid_Grid. Each pass is a port of the
+// compute shader with the same name in Mesh2Points.hlsl, with the GPU thread groups
+// replaced by OpenMP loops over SIMULATION_BLOCK_SIZE sized chunks.
+//--------------------------------------------------------------------------------------
+#ifndef CPU_FLUID_GRID_H
+#define CPU_FLUID_GRID_H
+
+#include <vector>
+#include <string>
+#include "BoundaryFieldCPU.h"
+#include "SparseFieldCPU.h"
+#include "FieldPyramidCPU.h"
+#include "WindingNumberCPU.h"
+#include "GridHashCPU.h"
+#include "ForceKernelCPU.h"
+#include "ParticleStoreCPU.h"
+#include "../geometry/TriangleMesh.h"
+
+// Simulation part of cbPNTriangles
+struct CB_SIMULATION
+{
+	D3DXVECTOR4	fBoundBoxMin;
+	D3DXVECTOR4	fBoundBoxMax;
+	D3DXVECTOR4	fParticleParameter;
+	D3DXVECTOR4	fGridDim;
+	D3DXVECTOR4	fInvGridDim;
+	UINT		iGridDot[4];
+	D3DXVECTOR4	fKernel;
+};
+
+class FluidGridCPU
+{
+public:
+	// How the (cell, particle) pairs are sorted
+	enum GridSortMode
+	{
+		GRID_SORT_BITONIC,		// BitonicSortCPU + BuildGridIndices, as GPUSort
+		GRID_SORT_COUNTING,		// CountingSortCPU, also fills the grid indices; radix on sparse grids
+		GRID_SORT_RADIX,		// RadixSortCPU on the key bits + BuildGridIndices
+	};
+
+	// How a cell is turned into its key, which is also the order of the cells in memory
+	enum GridKeyLayout
+	{
+		GRID_KEY_ROW_MAJOR,		// y * (Z * X) + z * X + x, as GridConstuctKey in the shader
+		GRID_KEY_MORTON,		// GridMortonKey, cells close in space get close keys
+	};
+
+	// How the boundary field is built
+	enum FieldBuilder
+	{
+		FIELD_BUILD_SPLAT,		// BuildSplat, as the GPU field passes
+		FIELD_BUILD_EXACT,		// BuildExact, closest points from a triangle BVH
+		FIELD_BUILD_SWEEP,		// BuildSweep, exact in a narrow band and swept outside
+	};
+
+	// Storage of the sorted particles the neighbor passes read
+	enum ParticleLayout
+	{
+		PARTICLE_LAYOUT_AOS,	// D3DXVECTOR4 per particle, as the GPU buffers
+		PARTICLE_LAYOUT_SOA,	// ParticleStoreSoA, aligned x/y/z/w arrays
+	};
+
+	// User settings; the defaults are the ones of the interactive sample
+	struct Settings
+	{
+		UINT		iNumParticles;
+		FLOAT		fSpeed;
+		FLOAT		fKScale;
+		FLOAT		fSurface;
+		FLOAT		fSmoothlen;
+		FLOAT		fParticleMass;
+		FLOAT		fNormalScalar;
+		UINT		iFieldSize[3];	// used unless fFieldVoxel or iFieldVoxels is set
+		FLOAT		fFieldVoxel;	// voxel edge in mesh units, the size per axis follows the box
+		UINT		iFieldVoxels;	// total voxel budget, the size per axis follows the box
+		UINT		uTessFactor;
+		FLOAT		fPhongTolerance;	// chord error in voxels to Phong tessellate the mesh to, 0 not to
+		FieldBuilder	eFieldBuilder;
+		bool		bSparseField;	// keep the field in a SparseFieldCPU
+		UINT		iFieldLevels;	// levels of the FieldPyramidCPU to start the relaxation on, 0 or 1 for the field only
+		std::string	strFieldCache;	// directory of saved dense fields, empty to always build
+		bool		bWindingNumber;	// sign and orient the field by the winding number of the mesh
+		D3DXVECTOR3	vInitOffset;
+		UINT		iSeed;
+		GridSortMode	eGridSort;
+		UINT		iGridDim;	// cells per axis, 0 sizes them by the smoothing length
+		bool		bHashedGrid;	// keep only the occupied cells, in a GridHashCPU
+		GridKeyLayout	eGridKeys;
+		bool		bFusedVelocityDensity;	// VelocityDensity instead of Velocity + Density
+		ForceKernelISA	eForceKernel;	// inner neighbor loop of Velocity/VelocityDensity
+		ParticleLayout	eParticleLayout;
+
+		Settings();
+	};
+
+	// Accumulated wall clock time per pass, in seconds
+	struct PassTimings
+	{
+		double	fBuildField;	// including the tessellation, the compression into bricks, the classification and the pyramid
+		double	fBuildGrid;
+		double	fSortGrid;
+		double	fBuildGridIndices;
+		double	fRearrangeParticles;
+		double	fVelocity;
+		double	fDensity;
+		double	fVelocityDensity;
+		UINT	iFrames;
+
+		PassTimings() { Reset(); }
+		void Reset();
+	};
+
+	FluidGridCPU();
+
+	//! Take the bounding box of mesh, build the boundary field and reset the particles; with
+	//! fPhongTolerance the field is built from the Phong tessellation of mesh
+	HRESULT ResetGeometry(const TriangleMesh& mesh);
+	//! Scatter the particles in a small sphere around the box center + vInitOffset; with
+	//! bWindingNumber, around the closest voxel inside the mesh if that point is outside
+	HRESULT ResetParticles();
+
+	//! Advance the relaxation by one frame
+	void SimulateFluid_Grid();
+
+	// Individual passes, in the order SimulateFluid_Grid runs them
+	void BuildGrid();
+	void SortGrid();
+	void BuildGridIndices();
+	//! Whether SortGrid bins with CountingSortCPU, which also fills the grid indices;
+	//! GRID_SORT_COUNTING radix sorts hashed and sparse grids
+	bool UseCountingSort() const;
+	void RearrangeParticles();
+	void Velocity();
+	void Density();
+	//! Velocity and Density in one walk over the neighbors
+	void VelocityDensity();
+
+	FLOAT AvgDensity() const;
+	//! Number of particles the winding number puts inside the mesh; needs bWindingNumber
+	UINT CountInsideParticles() const;
+	//! Sort the current particles into the grid and measure the locality of the neighbor
+	//! walk: the average number of contiguous runs the 27 cells of a sample make up, and
+	//! the average distance in bytes from the first to the last particle read
+	void StencilLocality(double& fRuns, double& fSpanBytes);
+
+	//! Field size for the box of extent vExtent with voxels about fVoxel wide; every axis
+	//! is a multiple of FIELD_DIM_ALIGN, as the GPU field passes run 16x16 thread groups
+	static void FieldSizeForVoxel(const D3DXVECTOR3& vExtent, FLOAT fVoxel, UINT iFieldSize[3]);
+	//! Same with about iVoxels voxels in total
+	static void FieldSizeForBudget(const D3DXVECTOR3& vExtent, UINT iVoxels, UINT iFieldSize[3]);
+
+	//! Seconds eBuilder takes to build field at the current field size over the box of
+	//! mesh, which must be the one of the last ResetGeometry
+	double TimeFieldBuild(const TriangleMesh& mesh, FieldBuilder eBuilder, BoundaryFieldCPU& field) const;
+	//! Same for the sparse field; exact fields are built brick by brick, the others and
+	//! all fields classified by the winding number densely and then compressed
+	double TimeFieldBuild(const TriangleMesh& mesh, FieldBuilder eBuilder, SparseFieldCPU& field) const;
+	//! Average seconds SortGrid + BuildGridIndices take with eMode on the current particles
+	double TimeGridSort(GridSortMode eMode, UINT iRepeats);
+	//! Average seconds per frame with the grid settings of settings (the particle count
+	//! must not change); the particles and the settings are restored. The pass timings of
+	//! the run are returned in pTimings. With bFromStart the frames start from
+	//! ResetParticles instead of the current particles, and iFieldLevels applies too.
+	double TimeSimulation(const Settings& settings, UINT iFrames, PassTimings* pTimings = NULL,
+		bool bFromStart = false);
+
+	Settings& GetSettings() { return m_Settings; }
+	const CB_SIMULATION& GetConstants() const { return m_CB; }
+	const UINT* GetGridDim() const { return m_iGridDim; }
+	//! Mesh the field of the last ResetGeometry(mesh) was built from
+	const TriangleMesh& GetSurface(const TriangleMesh& mesh) const
+	{
+		return m_PhongMesh.num_triangles() ? m_PhongMesh : mesh;
+	}
+	//! Field size as of the last ResetGeometry
+	const UINT* GetFieldSize() const { return m_iFieldSize; }
+	const GridHashCPU& GetGridHash() const { return m_GridHash; }
+	ForceKernelISA GetForceKernelISA() const { return m_eForceKernel; }
+	ParticleLayout GetParticleLayout() const { return m_eParticleLayout; }
+	bool IsGridHashed() const { return m_bHashedGrid; }
+	const std::vector<D3DXVECTOR4>& GetParticles() const { return m_Particles; }
+	const AlignedFloatVector& GetDensity() const { return m_Density; }
+	const BoundaryFieldCPU& GetField() const { return m_Field; }
+	const SparseFieldCPU& GetSparseField() const { return m_SparseField; }
+	bool IsFieldSparse() const { return m_bSparseField; }
+	const FieldPyramidCPU& GetFieldPyramid() const { return m_Pyramid; }
+	//! Pyramid level IntegrateParticle samples in the next frame
+	UINT GetFieldLevel() const { return m_iFieldLevel; }
+	//! Empty unless bWindingNumber was set at the last ResetGeometry
+	const WindingNumberCPU& GetWindingNumber() const { return m_Winding; }
+	PassTimings& GetTimings() { return m_Timings; }
+
+private:
+	//! Recompute the constants the frame setup writes into cbPNTriangles
+	void UpdateConstants();
+	//! Resolve the field size of the settings for the current box
+	void UpdateFieldSize();
+	//! Move to the finer pyramid level the growth of the particle cloud in the last frame
+	//! calls for
+	void UpdateFieldLevel();
+	//! Center of the initial sphere of particles
+	D3DXVECTOR3 InitCenter() const;
+	//! Pick the grid resolution and size the cell table for it
+	void UpdateGridDim(FLOAT fSmoothlen);
+
+	//! The end of VelocityCS: normalize the summed forces, apply the boundary and move
+	D3DXVECTOR4 IntegrateParticle(const D3DXVECTOR3& P_position, D3DXVECTOR4 velocity) const;
+	//! Force and density sums of the 27 cells around P_position with the SIMD kernel;
+	//! ranges that follow each other in memory are passed to it as one block
+	void SumNeighbors(const D3DXVECTOR3& P_position, FLOAT sums[5]) const;
+	// Reference neighbor loops over either layout of the sorted particles
+	template<class Particles> void VelocityT(const Particles& sorted);
+	template<class Particles> void DensityT(const Particles& sorted);
+	template<class Particles> void VelocityDensityT(const Particles& sorted);
+	//! Position of the i-th sorted particle in the current layout
+	D3DXVECTOR3 SortedPosition(UINT i) const
+	{
+		if(m_eParticleLayout == PARTICLE_LAYOUT_SOA)
+			return m_SortedSoA.Position(i);
+		const D3DXVECTOR4& p = m_SortedParticles[i];
+		return D3DXVECTOR3(p.x, p.y, p.z);
+	}
+	D3DXVECTOR3 UnitPos(const D3DXVECTOR3& position) const;
+	void GridCalculateCell(const D3DXVECTOR3& position, int xyz[3]) const;
+	UINT GridConstuctKey(UINT x, UINT y, UINT z) const;
+	//! Number of keys GridConstuctKey produces on the current grid
+	UINT GridNumKeys() const;
+	//! [start, end) of cell in the sorted pairs, from the dense table or the hash
+	void GridCellRange(UINT cell, UINT& start, UINT& end) const
+	{
+		if(m_bHashedGrid)
+		{
+			m_GridHash.Find(cell, start, end);
+		}
+		else
+		{
+			start = m_GridIndices[cell * 2];
+			end = m_GridIndices[cell * 2 + 1];
+		}
+	}
+
+	Settings					m_Settings;
+	CB_SIMULATION				m_CB;
+	PassTimings					m_Timings;
+
+	D3DXVECTOR3					m_vBBoxCenter;
+	D3DXVECTOR3					m_vBBoxExtent;
+	BoundaryFieldCPU			m_Field;		// empty with a sparse field
+	SparseFieldCPU				m_SparseField;
+	bool						m_bSparseField;	// bSparseField as of the last ResetGeometry
+	UINT						m_iFieldSize[3];	// of m_Field/m_SparseField
+	FieldPyramidCPU				m_Pyramid;	// over m_Field/m_SparseField, empty unless iFieldLevels > 1
+	UINT						m_iFieldLevel;	// of m_Pyramid, only ever decreases after ResetParticles
+	FLOAT						m_fFieldSpread;	// RMS distance of the particles to their mean, last frame
+	WindingNumberCPU			m_Winding;
+	TriangleMesh				m_PhongMesh;	// empty unless fPhongTolerance is set
+
+	std::vector<D3DXVECTOR4>	m_Particles;
+	std::vector<D3DXVECTOR4>	m_SortedParticles;	// AoS layout
+	ParticleStoreSoA			m_SortedSoA;	// SoA layout; with AoS a copy for the SIMD kernels
+	AlignedFloatVector			m_Density;
+	ParticleLayout				m_eParticleLayout;	// eParticleLayout as of the last UpdateConstants
+	ForceKernelISA				m_eForceKernel;	// eForceKernel resolved for this CPU
+	ForceKernelFn				m_pfnForceKernel;
+	UINT						m_iGridDim[3];
+	UINT						m_nGridCells;	// number of cell keys; more than the cells with Morton keys
+	bool						m_bHashedGrid;	// bHashedGrid as of the last UpdateGridDim
+	std::vector<UINT64>			m_Grid;
+	std::vector<UINT64>			m_GridPingPong;
+	std::vector<UINT>			m_GridIndices;	// (start, end) pairs per cell
+	std::vector<UINT>			m_GridHistogram;	// per thread cell counts of CountingSortCPU
+	GridHashCPU					m_GridHash;
+};
+
+#endif
@@ -0,0 +1,281 @@
+#include "DXUT.h"
+#include <math.h>
+#include "ForceKernelCPU.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define FORCE_KERNEL_X86
+#include <immintrin.h>
+#define TARGET_AVX2 __attribute__((target("avx2,fma")))
+#define TARGET_AVX512 __attribute__((target("avx512f")))
+#endif
+
+// Cody-Waite reduction x = n * ln(2) + r and the minimax polynomial of exp(r) on
+// [-ln(2) / 2, ln(2) / 2] from Cephes expf
+#define EXP_LOG2E		1.44269504088896341f
+#define EXP_LN2_HI		0.693359375f
+#define EXP_LN2_LO		-2.12194440e-4f
+#define EXP_MIN_ARG		-87.0f
+#define EXP_P0			1.9875691500e-4f
+#define EXP_P1			1.3981999507e-3f
+#define EXP_P2			8.3334519073e-3f
+#define EXP_P3			4.1665795894e-2f
+#define EXP_P4			1.6666665459e-1f
+#define EXP_P5			5.0000001201e-1f
+
+namespace
+{
+	void ForceKernelReference(const FLOAT* x, const FLOAT* y, const FLOAT* z, UINT count,
+		const ForceKernelParams& params, FLOAT sums[5])
+	{
+		const FLOAT h_sq = params.fHSq;
+		for(UINT i = 0; i < count; i++)
+		{
+			FLOAT dx = x[i] - params.fPosition[0];
+			FLOAT dy = y[i] - params.fPosition[1];
+			FLOAT dz = z[i] - params.fPosition[2];
+			FLOAT r_sq = dx * dx + dy * dy + dz * dz;
+
+			// CalculateForce
+			FLOAT w = expf(-r_sq / h_sq);
+			sums[0] -= dx * w;
+			sums[1] -= dy * w;
+			sums[2] -= dz * w;
+			sums[3] += w;
+
+			if(r_sq < h_sq)
+			{
+				// CalculateDensity
+				FLOAT d = h_sq - r_sq;
+				sums[4] += params.fDensityCoef * d * d * d;
+			}
+		}
+	}
+
+#ifdef FORCE_KERNEL_X86
+	//----------------------------------------------------------------------------------
+	// AVX2
+	//----------------------------------------------------------------------------------
+	TARGET_AVX2 inline __m256 FastExpAVX2(__m256 x)
+	{
+		x = _mm256_max_ps(x, _mm256_set1_ps(EXP_MIN_ARG));
+		__m256 n = _mm256_round_ps(_mm256_mul_ps(x, _mm256_set1_ps(EXP_LOG2E)),
+			_MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+		__m256 r = _mm256_fnmadd_ps(n, _mm256_set1_ps(EXP_LN2_HI), x);
+		r = _mm256_fnmadd_ps(n, _mm256_set1_ps(EXP_LN2_LO), r);
+
+		__m256 p = _mm256_set1_ps(EXP_P0);
+		p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(EXP_P1));
+		p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(EXP_P2));
+		p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(EXP_P3));
+		p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(EXP_P4));
+		p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(EXP_P5));
+		p = _mm256_fmadd_ps(p, _mm256_mul_ps(r, r), _mm256_add_ps(r, _mm256_set1_ps(1.0f)));
+
+		// 2^n straight into the exponent bits; n >= -126 after the clamp
+		__m256i e = _mm256_slli_epi32(_mm256_add_epi32(_mm256_cvtps_epi32(n), _mm256_set1_epi32(127)), 23);
+		return _mm256_mul_ps(p, _mm256_castsi256_ps(e));
+	}
+
+	TARGET_AVX2 inline FLOAT HorizontalSumAVX2(__m256 v)
+	{
+		__m128 s = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+		s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+		s = _mm_add_ss(s, _mm_shuffle_ps(s, s, 1));
+		return _mm_cvtss_f32(s);
+	}
+
+	TARGET_AVX2 void ForceKernelAVX2(const FLOAT* x, const FLOAT* y, const FLOAT* z, UINT count,
+		const ForceKernelParams& params, FLOAT sums[5])
+	{
+		const __m256 px = _mm256_set1_ps(params.fPosition[0]);
+		const __m256 py = _mm256_set1_ps(params.fPosition[1]);
+		const __m256 pz = _mm256_set1_ps(params.fPosition[2]);
+		const __m256 h_sq = _mm256_set1_ps(params.fHSq);
+		const __m256 neg_inv_h_sq = _mm256_set1_ps(-1.0f / params.fHSq);
+		const __m256 coef = _mm256_set1_ps(params.fDensityCoef);
+		const __m256i lane = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+
+		__m256 vx = _mm256_setzero_ps(), vy = _mm256_setzero_ps(), vz = _mm256_setzero_ps();
+		__m256 vw = _mm256_setzero_ps(), density = _mm256_setzero_ps();
+
+		for(UINT i = 0; i < count; i += 8)
+		{
+			// Lanes past count load 0 and are masked out of the sums
+			__m256i mask = _mm256_cmpgt_epi32(_mm256_set1_epi32((int)(count - i)), lane);
+			__m256 dx = _mm256_sub_ps(_mm256_maskload_ps(x + i, mask), px);
+			__m256 dy = _mm256_sub_ps(_mm256_maskload_ps(y + i, mask), py);
+			__m256 dz = _mm256_sub_ps(_mm256_maskload_ps(z + i, mask), pz);
+			__m256 r_sq = _mm256_fmadd_ps(dz, dz, _mm256_fmadd_ps(dy, dy, _mm256_mul_ps(dx, dx)));
+
+			__m256 w = _mm256_and_ps(FastExpAVX2(_mm256_mul_ps(r_sq, neg_inv_h_sq)), _mm256_castsi256_ps(mask));
+			vx = _mm256_fnmadd_ps(dx, w, vx);
+			vy = _mm256_fnmadd_ps(dy, w, vy);
+			vz = _mm256_fnmadd_ps(dz, w, vz);
+			vw = _mm256_add_ps(vw, w);
+
+			__m256 d = _mm256_sub_ps(h_sq, r_sq);
+			__m256 inside = _mm256_and_ps(_mm256_cmp_ps(r_sq, h_sq, _CMP_LT_OQ), _mm256_castsi256_ps(mask));
+			density = _mm256_add_ps(density, _mm256_and_ps(_mm256_mul_ps(_mm256_mul_ps(coef, d), _mm256_mul_ps(d, d)), inside));
+		}
+
+		sums[0] += HorizontalSumAVX2(vx);
+		sums[1] += HorizontalSumAVX2(vy);
+		sums[2] += HorizontalSumAVX2(vz);
+		sums[3] += HorizontalSumAVX2(vw);
+		sums[4] += HorizontalSumAVX2(density);
+	}
+
+	//----------------------------------------------------------------------------------
+	// AVX-512
+	//
+	// The unmasked forms of max, roundscale, scalef and extractf64x4 expand in GCC 12 to
+	// a read of an undefined register (-Wmaybe-uninitialized), so the zero-masked forms
+	// are used with every lane selected; they compile to the same instructions
+	//----------------------------------------------------------------------------------
+	const __mmask16 ALL_LANES = 0xFFFF;
+
+	TARGET_AVX512 inline __m512 FastExpAVX512(__m512 x)
+	{
+		x = _mm512_maskz_max_ps(ALL_LANES, x, _mm512_set1_ps(EXP_MIN_ARG));
+		__m512 n = _mm512_maskz_roundscale_ps(ALL_LANES, _mm512_mul_ps(x, _mm512_set1_ps(EXP_LOG2E)),
+			_MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+		__m512 r = _mm512_fnmadd_ps(n, _mm512_set1_ps(EXP_LN2_HI), x);
+		r = _mm512_fnmadd_ps(n, _mm512_set1_ps(EXP_LN2_LO), r);
+
+		__m512 p = _mm512_set1_ps(EXP_P0);
+		p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(EXP_P1));
+		p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(EXP_P2));
+		p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(EXP_P3));
+		p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(EXP_P4));
+		p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(EXP_P5));
+		p = _mm512_fmadd_ps(p, _mm512_mul_ps(r, r), _mm512_add_ps(r, _mm512_set1_ps(1.0f)));
+
+		return _mm512_maskz_scalef_ps(ALL_LANES, p, n);
+	}
+
+	//! The two 256-bit halves added, then as HorizontalSumAVX2; _mm512_reduce_add_ps
+	//! extracts them unmasked
+	TARGET_AVX512 inline FLOAT HorizontalSumAVX512(__m512 v)
+	{
+		const __m512d d = _mm512_castps_pd(v);
+		__m256 h = _mm256_add_ps(_mm256_castpd_ps(_mm512_maskz_extractf64x4_pd((__mmask8)ALL_LANES, d, 0)),
+			_mm256_castpd_ps(_mm512_maskz_extractf64x4_pd((__mmask8)ALL_LANES, d, 1)));
+		__m128 s = _mm_add_ps(_mm256_castps256_ps128(h), _mm256_extractf128_ps(h, 1));
+		s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+		s = _mm_add_ss(s, _mm_shuffle_ps(s, s, 1));
+		return _mm_cvtss_f32(s);
+	}
+
+	TARGET_AVX512 void ForceKernelAVX512(const FLOAT* x, const FLOAT* y, const FLOAT* z, UINT count,
+		const ForceKernelParams& params, FLOAT sums[5])
+	{
+		const __m512 px = _mm512_set1_ps(params.fPosition[0]);
+		const __m512 py = _mm512_set1_ps(params.fPosition[1]);
+		const __m512 pz = _mm512_set1_ps(params.fPosition[2]);
+		const __m512 h_sq = _mm512_set1_ps(params.fHSq);
+		const __m512 neg_inv_h_sq = _mm512_set1_ps(-1.0f / params.fHSq);
+		const __m512 coef = _mm512_set1_ps(params.fDensityCoef);
+
+		__m512 vx = _mm512_setzero_ps(), vy = _mm512_setzero_ps(), vz = _mm512_setzero_ps();
+		__m512 vw = _mm512_setzero_ps(), density = _mm512_setzero_ps();
+
+		for(UINT i = 0; i < count; i += 16)
+		{
+			const UINT left = count - i;
+			const __mmask16 mask = left >= 16 ? (__mmask16)0xFFFF : (__mmask16)((1u << left) - 1);
+			__m512 dx = _mm512_sub_ps(_mm512_maskz_loadu_ps(mask, x + i), px);
+			__m512 dy = _mm512_sub_ps(_mm512_maskz_loadu_ps(mask, y + i), py);
+			__m512 dz = _mm512_sub_ps(_mm512_maskz_loadu_ps(mask, z + i), pz);
+			__m512 r_sq = _mm512_fmadd_ps(dz, dz, _mm512_fmadd_ps(dy, dy, _mm512_mul_ps(dx, dx)));
+
+			__m512 w = _mm512_maskz_mov_ps(mask, FastExpAVX512(_mm512_mul_ps(r_sq, neg_inv_h_sq)));
+			vx = _mm512_fnmadd_ps(dx, w, vx);
+			vy = _mm512_fnmadd_ps(dy, w, vy);
+			vz = _mm512_fnmadd_ps(dz, w, vz);
+			vw = _mm512_add_ps(vw, w);
+
+			__m512 d = _mm512_sub_ps(h_sq, r_sq);
+			__mmask16 inside = _mm512_mask_cmp_ps_mask(mask, r_sq, h_sq, _CMP_LT_OQ);
+			density = _mm512_mask_add_ps(density, inside, density, _mm512_mul_ps(_mm512_mul_ps(coef, d), _mm512_mul_ps(d, d)));
+		}
+
+		sums[0] += HorizontalSumAVX512(vx);
+		sums[1] += HorizontalSumAVX512(vy);
+		sums[2] += HorizontalSumAVX512(vz);
+		sums[3] += HorizontalSumAVX512(vw);
+		sums[4] += HorizontalSumAVX512(density);
+	}
+#endif
+}
+
+bool IsForceKernelSupported(ForceKernelISA eISA)
+{
+	switch(eISA)
+	{
+	case FORCE_KERNEL_REFERENCE:
+		return true;
+#ifdef FORCE_KERNEL_X86
+	case FORCE_KERNEL_AVX2:
+		return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+	case FORCE_KERNEL_AVX512:
+		return __builtin_cpu_supports("avx512f");
+#endif
+	default:
+		return false;
+	}
+}
+
+ForceKernelISA ResolveForceKernel(ForceKernelISA eISA)
+{
+	if(eISA == FORCE_KERNEL_AUTO)
+		eISA = FORCE_KERNEL_AVX512;
+	if(eISA == FORCE_KERNEL_AVX512 && !IsForceKernelSupported(FORCE_KERNEL_AVX512))
+		eISA = FORCE_KERNEL_AVX2;
+	if(eISA == FORCE_KERNEL_AVX2 && !IsForceKernelSupported(FORCE_KERNEL_AVX2))
+		eISA = FORCE_KERNEL_REFERENCE;
+	return eISA;
+}
+
+ForceKernelFn GetForceKernel(ForceKernelISA eISA)
+{
+	switch(eISA)
+	{
+#ifdef FORCE_KERNEL_X86
+	case FORCE_KERNEL_AVX2:
+		return ForceKernelAVX2;
+	case FORCE_KERNEL_AVX512:
+		return ForceKernelAVX512;
+#endif
+	default:
+		return ForceKernelReference;
+	}
+}
+
+const char* GetForceKernelName(ForceKernelISA eISA)
+{
+	switch(eISA)
+	{
+	case FORCE_KERNEL_REFERENCE:	return "reference";
+	case FORCE_KERNEL_AVX2:			return "avx2";
+	case FORCE_KERNEL_AVX512:		return "avx512";
+	default:						return "auto";
+	}
+}
+
+FLOAT FastExpReference(FLOAT x)
+{
+	x = max(x, EXP_MIN_ARG);
+	// Rounded half to even in the default rounding mode, as _MM_FROUND_TO_NEAREST_INT
+	FLOAT n = nearbyintf(x * EXP_LOG2E);
+	FLOAT r = x - n * EXP_LN2_HI;
+	r = r - n * EXP_LN2_LO;
+
+	FLOAT p = EXP_P0;
+	p = p * r + EXP_P1;
+	p = p * r + EXP_P2;
+	p = p * r + EXP_P3;
+	p = p * r + EXP_P4;
+	p = p * r + EXP_P5;
+	p = p * r * r + r + 1.0f;
+	return ldexpf(p, (int)n);
+}
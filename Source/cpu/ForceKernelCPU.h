@@ -0,0 +1,52 @@
+//--------------------------------------------------------------------------------------
+// File: ForceKernelCPU.h
+//
+// Inner loop of VelocityCS/DensityCS over a contiguous block of neighbors: the Gaussian
+// displacement of CalculateForce and the poly6 density of CalculateDensity. The neighbor
+// positions are read as SoA arrays so the SIMD versions can load 8 (AVX2) or 16
+// (AVX-512) neighbors at once; they replace expf by a polynomial approximation whose
+// relative error stays below FAST_EXP_MAX_REL_ERROR for the arguments the kernel
+// produces. The instruction set is picked at runtime from what the CPU supports.
+//--------------------------------------------------------------------------------------
+#ifndef CPU_FORCE_KERNEL_H
+#define CPU_FORCE_KERNEL_H
+
+// Bound on |FastExp(x) - expf(x)| / expf(x) for -87 <= x <= 0
+#define FAST_EXP_MAX_REL_ERROR 4e-7f
+
+enum ForceKernelISA
+{
+	FORCE_KERNEL_REFERENCE,		// expf, one neighbor at a time
+	FORCE_KERNEL_AVX2,			// 8 neighbors per step, AVX2 + FMA
+	FORCE_KERNEL_AVX512,		// 16 neighbors per step, AVX-512F
+	FORCE_KERNEL_AUTO,			// the widest one the CPU supports
+};
+
+// Constants the block kernels need, from cbPNTriangles
+struct ForceKernelParams
+{
+	FLOAT	fPosition[3];	// the particle the neighbors act on
+	FLOAT	fHSq;			// g_fKernel.x
+	FLOAT	fDensityCoef;	// g_fKernel.w
+};
+
+/*!
+ * Adds the neighbors x/y/z[0..count) to sums: the xyz of sum(-diff * w), sum(w) with
+ * w = exp(-|diff|^2 / h^2) (the velocity of VelocityCS before the division) and the poly6
+ * density of the neighbors with |diff| < h in sums[4].
+ */
+typedef void (*ForceKernelFn)(const FLOAT* x, const FLOAT* y, const FLOAT* z, UINT count,
+	const ForceKernelParams& params, FLOAT sums[5]);
+
+//! True if the CPU and the OS support eISA
+bool IsForceKernelSupported(ForceKernelISA eISA);
+//! eISA with FORCE_KERNEL_AUTO and unsupported sets resolved to a supported one
+ForceKernelISA ResolveForceKernel(ForceKernelISA eISA);
+//! Block kernel for eISA, which must be resolved
+ForceKernelFn GetForceKernel(ForceKernelISA eISA);
+const char* GetForceKernelName(ForceKernelISA eISA);
+
+//! Scalar version of the polynomial the SIMD kernels evaluate, for validation
+FLOAT FastExpReference(FLOAT x);
+
+#endif
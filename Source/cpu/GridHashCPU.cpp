@@ -0,0 +1,77 @@
+#include "DXUT.h"
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#include "GridSortCPU.h"
+#include "GridHashCPU.h"
+
+GridHashCPU::GridHashCPU() :
+	m_iMask(0),
+	m_nCells(0)
+{
+	// A valid (empty) table before the first Build
+	Slot empty = { GRID_HASH_EMPTY, 0, 0 };
+	m_Slots.assign(1, empty);
+}
+
+void GridHashCPU::Build(const std::vector<UINT64>& grid, UINT n)
+{
+	const UINT64* pGrid = n ? &grid[0] : NULL;
+
+	// Compact the first pair of every cell, in order: count per thread, scan, write
+	#pragma omp parallel
+	{
+#ifdef _OPENMP
+		const int nThreads = omp_get_num_threads();
+		const int iThread = omp_get_thread_num();
+#else
+		const int nThreads = 1;
+		const int iThread = 0;
+#endif
+		#pragma omp single
+		m_ThreadCounts.assign(nThreads + 1, 0);
+
+		const int first = (int)((UINT64)n * iThread / nThreads);
+		const int last = (int)((UINT64)n * (iThread + 1) / nThreads);
+
+		UINT count = 0;
+		for( int i = first ; i < last ; i++ )
+			if( i == 0 || GridGetKey(pGrid[i]) != GridGetKey(pGrid[i - 1]) )
+				count++;
+		m_ThreadCounts[iThread + 1] = count;
+
+		#pragma omp barrier
+		#pragma omp single
+		{
+			for( int t = 0 ; t < nThreads ; t++ )
+				m_ThreadCounts[t + 1] += m_ThreadCounts[t];
+			m_nCells = m_ThreadCounts[nThreads];
+			m_CellStarts.resize(m_nCells + 1);
+			m_CellStarts[m_nCells] = n;
+		}
+
+		UINT o = m_ThreadCounts[iThread];
+		for( int i = first ; i < last ; i++ )
+			if( i == 0 || GridGetKey(pGrid[i]) != GridGetKey(pGrid[i - 1]) )
+				m_CellStarts[o++] = i;
+	}
+
+	// At most half full, so the probe sequences stay short
+	const UINT nSlots = NextPowerOfTwo(max(m_nCells * 2, 2u));
+	Slot empty = { GRID_HASH_EMPTY, 0, 0 };
+	m_Slots.assign(nSlots, empty);
+	m_iMask = nSlots - 1;
+
+	// Linear probing; the inserts are cheap next to the neighbor passes, so they are
+	// done serially rather than with atomics as in BuildGridHashCS
+	for( UINT c = 0 ; c < m_nCells ; c++ )
+	{
+		const UINT cell = GridGetKey(pGrid[m_CellStarts[c]]);
+		UINT slot = GridHash(cell) & m_iMask;
+		while( m_Slots[slot].key != GRID_HASH_EMPTY )
+			slot = (slot + 1) & m_iMask;
+		m_Slots[slot].key = cell;
+		m_Slots[slot].start = m_CellStarts[c];
+		m_Slots[slot].end = m_CellStarts[c + 1];
+	}
+}
@@ -0,0 +1,75 @@
+//--------------------------------------------------------------------------------------
+// File: GridHashCPU.h
+//
+// Hashed grid: the [start, end) ranges of the occupied cells only, in an open addressing
+// hash table keyed by the cell key. Used instead of the dense per-cell table when most
+// of the cells over the bounding box are empty (thin shells, long parts) or the grid is
+// too fine for a dense table. Same layout and hash as BuildGridHashCS/GridCellRange in
+// Mesh2Points.hlsl.
+//--------------------------------------------------------------------------------------
+#ifndef CPU_GRID_HASH_H
+#define CPU_GRID_HASH_H
+
+#include <vector>
+
+#define GRID_HASH_EMPTY 0xFFFFFFFF
+
+inline UINT GridHash(UINT key)
+{
+	key ^= key >> 16;
+	key *= 0x7feb352d;
+	key ^= key >> 15;
+	key *= 0x846ca68b;
+	key ^= key >> 16;
+	return key;
+}
+
+class GridHashCPU
+{
+public:
+	GridHashCPU();
+
+	//! Collect the occupied cells of the first n pairs of grid, which are sorted by cell
+	void Build(const std::vector<UINT64>& grid, UINT n);
+
+	//! [start, end) of cell in the sorted pairs; empty if no particle is in it
+	void Find(UINT cell, UINT& start, UINT& end) const
+	{
+		UINT slot = GridHash(cell) & m_iMask;
+		for(;;)
+		{
+			const Slot& s = m_Slots[slot];
+			if(s.key == cell)
+			{
+				start = s.start;
+				end = s.end;
+				return;
+			}
+			if(s.key == GRID_HASH_EMPTY)
+			{
+				start = end = 0;
+				return;
+			}
+			slot = (slot + 1) & m_iMask;
+		}
+	}
+
+	UINT GetNumCells() const { return m_nCells; }
+	size_t GetMemorySize() const { return m_Slots.size() * sizeof(Slot) + m_CellStarts.size() * sizeof(UINT); }
+
+private:
+	struct Slot
+	{
+		UINT key;
+		UINT start;
+		UINT end;
+	};
+
+	std::vector<Slot>	m_Slots;
+	UINT				m_iMask;
+	UINT				m_nCells;
+	std::vector<UINT>	m_CellStarts;	// index of the first pair of every occupied cell
+	std::vector<UINT>	m_ThreadCounts;
+};
+
+#endif
@@ -0,0 +1,186 @@
+#include "DXUT.h"
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#include "GridSortCPU.h"
+
+void BitonicSortCPU(std::vector<UINT64>& data)
+{
+	const int NUM_ELEMENTS = (int)data.size();
+	assert((NUM_ELEMENTS & (NUM_ELEMENTS - 1)) == 0);
+	UINT64* pData = NUM_ELEMENTS ? &data[0] : NULL;
+
+	#pragma omp parallel
+	{
+		for( int level = 2 ; level <= NUM_ELEMENTS ; level <<= 1 )
+		{
+			for( int step = level >> 1 ; step > 0 ; step >>= 1 )
+			{
+				// Every (level, step) pair is one dispatch on the GPU; the implicit
+				// barrier at the end of the omp for plays the role of the dispatch boundary
+				#pragma omp for schedule(static)
+				for( int i = 0 ; i < NUM_ELEMENTS ; i++ )
+				{
+					int partner = i ^ step;
+					if( partner <= i ) continue;
+
+					bool bAscending = (i & level) == 0;
+					UINT64 a = pData[i];
+					UINT64 b = pData[partner];
+					if( (a > b) == bAscending )
+					{
+						pData[i] = b;
+						pData[partner] = a;
+					}
+				}
+			}
+		}
+	}
+}
+
+void CountingSortCPU(const std::vector<UINT64>& in, UINT n, UINT nCells,
+	std::vector<UINT64>& out, std::vector<UINT>& cellRanges, std::vector<UINT>& histogram)
+{
+	assert(in.size() >= n && out.size() >= n && cellRanges.size() >= (size_t)nCells * 2);
+	const UINT64* pIn = n ? &in[0] : NULL;
+	UINT64* pOut = n ? &out[0] : NULL;
+	UINT* pRanges = &cellRanges[0];
+	std::vector<UINT> blockBase;
+
+	#pragma omp parallel
+	{
+#ifdef _OPENMP
+		const int nThreads = omp_get_num_threads();
+		const int iThread = omp_get_thread_num();
+#else
+		const int nThreads = 1;
+		const int iThread = 0;
+#endif
+		// Only grown, never shrunk; each thread clears its own histogram
+		#pragma omp single
+		{
+			if(histogram.size() < (size_t)nThreads * nCells)
+				histogram.resize((size_t)nThreads * nCells);
+			blockBase.assign(nThreads + 1, 0);
+		}
+
+		// The same static partition of the pairs is used for the histogram and the scatter
+		const int first = (int)((UINT64)n * iThread / nThreads);
+		const int last = (int)((UINT64)n * (iThread + 1) / nThreads);
+		UINT* pCount = &histogram[(size_t)iThread * nCells];
+		memset(pCount, 0, nCells * sizeof(UINT));
+
+		for( int i = first ; i < last ; i++ )
+			pCount[GridGetKey(pIn[i])]++;
+
+		#pragma omp barrier
+
+		// Prefix sum over (cell, thread): every thread owns a block of cells, sums it,
+		// and after the block bases are known turns its counts into scatter offsets
+		const UINT c0 = (UINT)((UINT64)nCells * iThread / nThreads);
+		const UINT c1 = (UINT)((UINT64)nCells * (iThread + 1) / nThreads);
+		UINT sum = 0;
+		for( UINT c = c0 ; c < c1 ; c++ )
+			for( int t = 0 ; t < nThreads ; t++ )
+				sum += histogram[(size_t)t * nCells + c];
+		blockBase[iThread + 1] = sum;
+
+		#pragma omp barrier
+		#pragma omp single
+		for( int t = 0 ; t < nThreads ; t++ )
+			blockBase[t + 1] += blockBase[t];
+
+		UINT start = blockBase[iThread];
+		for( UINT c = c0 ; c < c1 ; c++ )
+		{
+			pRanges[c * 2] = start;
+			for( int t = 0 ; t < nThreads ; t++ )
+			{
+				UINT& count = histogram[(size_t)t * nCells + c];
+				UINT offset = start;
+				start += count;
+				count = offset;
+			}
+			pRanges[c * 2 + 1] = start;
+		}
+
+		#pragma omp barrier
+
+		for( int i = first ; i < last ; i++ )
+			pOut[pCount[GridGetKey(pIn[i])]++] = pIn[i];
+	}
+}
+
+#define RADIX_SORT_BITS 8
+#define RADIX_SORT_BUCKETS (1 << RADIX_SORT_BITS)
+
+void RadixSortCPU(std::vector<UINT64>& data, UINT n, UINT nKeyBits, std::vector<UINT64>& temp)
+{
+	assert(data.size() >= n && temp.size() >= n && nKeyBits <= 32);
+	const int nPasses = (int)(nKeyBits + RADIX_SORT_BITS - 1) / RADIX_SORT_BITS;
+	if(n == 0 || nPasses == 0)
+		return;
+
+	UINT64* pSrc = &data[0];
+	UINT64* pDst = &temp[0];
+	std::vector<UINT> histogram;
+
+	#pragma omp parallel
+	{
+#ifdef _OPENMP
+		const int nThreads = omp_get_num_threads();
+		const int iThread = omp_get_thread_num();
+#else
+		const int nThreads = 1;
+		const int iThread = 0;
+#endif
+		#pragma omp single
+		histogram.assign((size_t)nThreads * RADIX_SORT_BUCKETS, 0);
+
+		const int first = (int)((UINT64)n * iThread / nThreads);
+		const int last = (int)((UINT64)n * (iThread + 1) / nThreads);
+		UINT* pCount = &histogram[(size_t)iThread * RADIX_SORT_BUCKETS];
+
+		for( int pass = 0 ; pass < nPasses ; pass++ )
+		{
+			// The key is in the high word of the pair
+			const UINT shift = 32 + pass * RADIX_SORT_BITS;
+
+			memset(pCount, 0, sizeof(UINT) * RADIX_SORT_BUCKETS);
+			for( int i = first ; i < last ; i++ )
+				pCount[(pSrc[i] >> shift) & (RADIX_SORT_BUCKETS - 1)]++;
+
+			#pragma omp barrier
+
+			// Offsets in (digit, thread) order keep every pass stable
+			#pragma omp single
+			{
+				UINT start = 0;
+				for( int d = 0 ; d < RADIX_SORT_BUCKETS ; d++ )
+				{
+					for( int t = 0 ; t < nThreads ; t++ )
+					{
+						UINT& count = histogram[(size_t)t * RADIX_SORT_BUCKETS + d];
+						UINT offset = start;
+						start += count;
+						count = offset;
+					}
+				}
+			}
+
+			for( int i = first ; i < last ; i++ )
+			{
+				UINT64 pair = pSrc[i];
+				pDst[pCount[(pair >> shift) & (RADIX_SORT_BUCKETS - 1)]++] = pair;
+			}
+
+			// Everybody has to be done reading pSrc before it becomes the destination
+			#pragma omp barrier
+			#pragma omp single
+			std::swap(pSrc, pDst);
+		}
+	}
+
+	if(nPasses & 1)
+		data.swap(temp);
+}
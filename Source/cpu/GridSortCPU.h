@@ -0,0 +1,91 @@
+//--------------------------------------------------------------------------------------
+// File: GridSortCPU.h
+//
+// CPU sorting of the (cell key, particle id) pairs produced by BuildGridCS.
+//
+// A pair is packed the same way the GPU grid buffer is laid out: the particle id in the
+// low 32 bits and the cell key in the high 32 bits, so ordering the 64-bit values orders
+// the particles by cell and then by id.
+//--------------------------------------------------------------------------------------
+#ifndef CPU_GRID_SORT_H
+#define CPU_GRID_SORT_H
+
+#include <vector>
+
+inline UINT64 GridConstuctKeyValuePair(UINT key, UINT value)
+{
+	return ((UINT64)key << 32) | (UINT64)value;
+}
+
+inline UINT GridGetKey(UINT64 keyvaluepair)
+{
+	return (UINT)(keyvaluepair >> 32);
+}
+
+inline UINT GridGetValue(UINT64 keyvaluepair)
+{
+	return (UINT)(keyvaluepair & 0xFFFFFFFFull);
+}
+
+//! Spread the low 10 bits of v three bits apart: ---------------------9--8--7--6--5--4--3--2--1--0
+inline UINT MortonSpread(UINT v)
+{
+	v &= 0x3FF;
+	v = (v | (v << 16)) & 0x030000FF;
+	v = (v | (v << 8)) & 0x0300F00F;
+	v = (v | (v << 4)) & 0x030C30C3;
+	v = (v | (v << 2)) & 0x09249249;
+	return v;
+}
+
+//! 30-bit Morton (Z-order) code of a cell with coordinates below 1024
+inline UINT GridMortonKey(UINT x, UINT y, UINT z)
+{
+	return MortonSpread(x) | (MortonSpread(y) << 1) | (MortonSpread(z) << 2);
+}
+
+//! Smallest power of two that is >= n
+inline UINT NextPowerOfTwo(UINT n)
+{
+	UINT p = 1;
+	while(p < n) p <<= 1;
+	return p;
+}
+
+//! Number of bits needed to hold the keys 0..nKeys-1
+inline UINT KeyBits(UINT nKeys)
+{
+	UINT bits = 0;
+	while(bits < 32 && (1ull << bits) < nKeys) bits++;
+	return bits;
+}
+
+/*!
+ * CPU port of the bitonic network GPUSort runs with ComputeShaderSort11.hlsl.
+ * The size of data must be a power of two; callers pad the tail with ~0 so the
+ * padding sorts to the end.
+ */
+void BitonicSortCPU(std::vector<UINT64>& data);
+
+/*!
+ * Counting sort binning, the CPU counterpart of BuildGridCountCS + GridPrefixSumCS +
+ * ScatterGridCS. Sorts the first n pairs of in by their cell key (keys must be below
+ * nCells) into out and writes the [start, end) range of every cell to cellRanges
+ * (2 * nCells entries), so BuildGridIndices is not needed afterwards.
+ * Every thread builds a histogram of its own contiguous range of pairs; scattering the
+ * ranges in thread order keeps the sort stable. histogram is scratch space that is
+ * kept by the caller between frames.
+ */
+void CountingSortCPU(const std::vector<UINT64>& in, UINT n, UINT nCells,
+	std::vector<UINT64>& out, std::vector<UINT>& cellRanges, std::vector<UINT>& histogram);
+
+/*!
+ * Multi-threaded LSD radix sort of the first n pairs of data by the low nKeyBits bits of
+ * their cell key, RADIX_SORT_BITS per pass. Works for any n; the pairs past n are left
+ * alone. Each pass is stable, so the particle ids stay in order within a cell just like
+ * with a full 64-bit sort. temp must hold at least n pairs; after an odd number of
+ * passes the two vectors are swapped so the result always ends up in data.
+ */
+void RadixSortCPU(std::vector<UINT64>& data, UINT n, UINT nKeyBits, std::vector<UINT64>& temp);
+
+#endif
@@ -0,0 +1,90 @@
+#include "DXUT.h"
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+#include "MappedFileCPU.h"
+
+MappedFileCPU::MappedFileCPU() :
+	m_pData(NULL),
+	m_nSize(0)
+#ifdef _WIN32
+	, m_hFile(INVALID_HANDLE_VALUE),
+	m_hMapping(NULL)
+#endif
+{
+}
+
+MappedFileCPU::~MappedFileCPU()
+{
+	Close();
+}
+
+HRESULT MappedFileCPU::Open(const char* strFile)
+{
+	Close();
+
+#ifdef _WIN32
+	m_hFile = CreateFileA(strFile, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+		FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if(m_hFile == INVALID_HANDLE_VALUE)
+		return E_FAIL;
+	LARGE_INTEGER size;
+	if(!GetFileSizeEx(m_hFile, &size) || size.QuadPart == 0)
+	{
+		Close();
+		return E_FAIL;
+	}
+	m_hMapping = CreateFileMappingA(m_hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+	if(!m_hMapping)
+	{
+		Close();
+		return E_FAIL;
+	}
+	m_pData = (const BYTE*)MapViewOfFile(m_hMapping, FILE_MAP_READ, 0, 0, 0);
+	if(!m_pData)
+	{
+		Close();
+		return E_FAIL;
+	}
+	m_nSize = (size_t)size.QuadPart;
+#else
+	int fd = open(strFile, O_RDONLY);
+	if(fd < 0)
+		return E_FAIL;
+	struct stat st;
+	if(fstat(fd, &st) != 0 || st.st_size == 0)
+	{
+		close(fd);
+		return E_FAIL;
+	}
+	void* p = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);	// the mapping keeps the file open
+	if(p == MAP_FAILED)
+		return E_FAIL;
+	m_pData = (const BYTE*)p;
+	m_nSize = (size_t)st.st_size;
+#endif
+	return S_OK;
+}
+
+void MappedFileCPU::Close()
+{
+#ifdef _WIN32
+	if(m_pData)
+		UnmapViewOfFile(m_pData);
+	if(m_hMapping)
+		CloseHandle(m_hMapping);
+	if(m_hFile != INVALID_HANDLE_VALUE)
+		CloseHandle(m_hFile);
+	m_hMapping = NULL;
+	m_hFile = INVALID_HANDLE_VALUE;
+#else
+	if(m_pData)
+		munmap((void*)m_pData, m_nSize);
+#endif
+	m_pData = NULL;
+	m_nSize = 0;
+}
@@ -0,0 +1,37 @@
+//--------------------------------------------------------------------------------------
+// File: MappedFileCPU.h
+//
+// Read-only memory mapping of a whole file (mmap, or MapViewOfFile on Windows). The
+// pages are only read from disk when they are touched, and stay shared with the page
+// cache, so a large file costs neither a copy nor a parse up front.
+//--------------------------------------------------------------------------------------
+#ifndef CPU_MAPPED_FILE_H
+#define CPU_MAPPED_FILE_H
+
+class MappedFileCPU
+{
+public:
+	MappedFileCPU();
+	~MappedFileCPU();
+
+	//! Map strFile; fails on missing and on empty files
+	HRESULT Open(const char* strFile);
+	void Close();
+
+	bool IsOpen() const { return m_pData != NULL; }
+	const BYTE* GetData() const { return m_pData; }
+	size_t GetSize() const { return m_nSize; }
+
+private:
+	MappedFileCPU(const MappedFileCPU&);
+	MappedFileCPU& operator=(const MappedFileCPU&);
+
+	const BYTE*	m_pData;
+	size_t		m_nSize;
+#ifdef _WIN32
+	HANDLE		m_hFile;
+	HANDLE		m_hMapping;
+#endif
+};
+
+#endif
@@ -0,0 +1,152 @@
+#include "DXUT.h"
+#ifndef _WIN32
+#include <sys/stat.h>
+#endif
+#include "../geometry/Tuple3.h"
+#include "../geometry/TriangleMesh.h"
+#include "MappedFileCPU.h"
+#include "MeshCacheCPU.h"
+
+#define MESH_FILE_MAGIC "M2PMESH"
+// 2: nanosecond source times on POSIX
+#define MESH_FILE_VERSION 2
+// Alignment of the blocks in the file, one cache line
+#define MESH_FILE_ALIGN 64
+
+namespace
+{
+	// Header of a cached mesh; the blocks follow at the given offsets
+	struct MeshFileHeader
+	{
+		char	strMagic[8];	// MESH_FILE_MAGIC
+		UINT	iVersion;
+		UINT	iFlags;			// the read flags of the source
+		UINT64	iSourceSize;
+		INT64	iSourceTime;	// modification time of the source, in the finest unit of the OS
+		UINT	nVertices;		// also the number of normals
+		UINT	nTriangles;
+		UINT64	iVertexOffset;
+		UINT64	iNormalOffset;
+		UINT64	iTriangleOffset;
+	};
+
+	inline UINT64 AlignUp(UINT64 n)
+	{
+		return (n + MESH_FILE_ALIGN - 1) & ~(UINT64)(MESH_FILE_ALIGN - 1);
+	}
+
+	bool GetFileStamp(const char* strFile, UINT64& iSize, INT64& iTime)
+	{
+#ifdef _WIN32
+		WIN32_FILE_ATTRIBUTE_DATA data;
+		if(!GetFileAttributesExA(strFile, GetFileExInfoStandard, &data))
+			return false;
+		iSize = ((UINT64)data.nFileSizeHigh << 32) | data.nFileSizeLow;
+		iTime = (INT64)(((UINT64)data.ftLastWriteTime.dwHighDateTime << 32) | data.ftLastWriteTime.dwLowDateTime);
+#else
+		struct stat st;
+		if(stat(strFile, &st) != 0)
+			return false;
+		iSize = (UINT64)st.st_size;
+		// Whole seconds would miss an edit in the same second as the cache was written
+#ifdef __APPLE__
+		iTime = (INT64)st.st_mtimespec.tv_sec * 1000000000 + st.st_mtimespec.tv_nsec;
+#else
+		iTime = (INT64)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+#endif
+#endif
+		return true;
+	}
+
+	bool WriteBlock(FILE* fp, UINT64& iPos, UINT64 iOffset, const void* pData, size_t nBytes)
+	{
+		static const BYTE s_Zeros[MESH_FILE_ALIGN] = { 0 };
+		if(iOffset > iPos && fwrite(s_Zeros, (size_t)(iOffset - iPos), 1, fp) != 1)
+			return false;
+		iPos = iOffset + nBytes;
+		return nBytes == 0 || fwrite(pData, nBytes, 1, fp) == 1;
+	}
+}
+
+std::string MeshCacheCPU::GetCachePath(const char* strSource)
+{
+	return std::string(strSource) + MESH_CACHE_SUFFIX;
+}
+
+HRESULT MeshCacheCPU::Save(const char* strFile, const char* strSource, UINT iFlags, const TriangleMesh& mesh)
+{
+	if(!mesh.has_normals())
+		return E_INVALIDARG;
+
+	MeshFileHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.strMagic, MESH_FILE_MAGIC, sizeof(header.strMagic));
+	header.iVersion = MESH_FILE_VERSION;
+	header.iFlags = iFlags;
+	if(!GetFileStamp(strSource, header.iSourceSize, header.iSourceTime))
+		return E_FAIL;
+	header.nVertices = (UINT)mesh.num_vertices();
+	header.nTriangles = (UINT)mesh.num_triangles();
+	const size_t nVertexBytes = header.nVertices * sizeof(D3DXVECTOR3);
+	const size_t nTriangleBytes = header.nTriangles * sizeof(Tuple3ui);
+	header.iVertexOffset = AlignUp(sizeof(header));
+	header.iNormalOffset = AlignUp(header.iVertexOffset + nVertexBytes);
+	header.iTriangleOffset = AlignUp(header.iNormalOffset + nVertexBytes);
+
+	// Written under a temporary name and renamed, so a concurrent Load never sees half a file
+	char strTemp[MAX_PATH + 16];
+	snprintf(strTemp, sizeof(strTemp), "%s.tmp", strFile);
+	FILE* fp = fopen(strTemp, "wb");
+	if(!fp)
+		return E_FAIL;
+	UINT64 iPos = 0;
+	bool bOk = WriteBlock(fp, iPos, 0, &header, sizeof(header)) &&
+		WriteBlock(fp, iPos, header.iVertexOffset, nVertexBytes ? &mesh.vertices()[0] : NULL, nVertexBytes) &&
+		WriteBlock(fp, iPos, header.iNormalOffset, nVertexBytes ? &mesh.normals()[0] : NULL, nVertexBytes) &&
+		WriteBlock(fp, iPos, header.iTriangleOffset, nTriangleBytes ? &mesh.triangles()[0] : NULL, nTriangleBytes);
+	bOk = fclose(fp) == 0 && bOk;
+#ifdef _WIN32
+	bOk = bOk && MoveFileExA(strTemp, strFile, MOVEFILE_REPLACE_EXISTING);
+#else
+	bOk = bOk && rename(strTemp, strFile) == 0;
+#endif
+	if(!bOk)
+	{
+		remove(strTemp);
+		return E_FAIL;
+	}
+	return S_OK;
+}
+
+HRESULT MeshCacheCPU::Load(const char* strFile, const char* strSource, UINT iFlags, TriangleMesh& mesh)
+{
+	UINT64 iSourceSize;
+	INT64 iSourceTime;
+	if(!GetFileStamp(strSource, iSourceSize, iSourceTime))
+		return E_FAIL;
+
+	MappedFileCPU mapping;
+	if(FAILED(mapping.Open(strFile)) || mapping.GetSize() < sizeof(MeshFileHeader))
+		return E_FAIL;
+	const MeshFileHeader* pHeader = (const MeshFileHeader*)mapping.GetData();
+	const size_t nVertexBytes = pHeader->nVertices * sizeof(D3DXVECTOR3);
+	const size_t nTriangleBytes = pHeader->nTriangles * sizeof(Tuple3ui);
+	if(memcmp(pHeader->strMagic, MESH_FILE_MAGIC, sizeof(pHeader->strMagic)) != 0 ||
+		pHeader->iVersion != MESH_FILE_VERSION || pHeader->iFlags != iFlags ||
+		pHeader->iSourceSize != iSourceSize || pHeader->iSourceTime != iSourceTime ||
+		pHeader->iVertexOffset != AlignUp(sizeof(MeshFileHeader)) ||
+		pHeader->iNormalOffset != AlignUp(pHeader->iVertexOffset + nVertexBytes) ||
+		pHeader->iTriangleOffset != AlignUp(pHeader->iNormalOffset + nVertexBytes) ||
+		mapping.GetSize() != pHeader->iTriangleOffset + nTriangleBytes)
+		return E_FAIL;
+
+	const BYTE* pData = mapping.GetData();
+	const D3DXVECTOR3* pVertices = (const D3DXVECTOR3*)(pData + pHeader->iVertexOffset);
+	const D3DXVECTOR3* pNormals = (const D3DXVECTOR3*)(pData + pHeader->iNormalOffset);
+	const Tuple3ui* pTriangles = (const Tuple3ui*)(pData + pHeader->iTriangleOffset);
+	mesh.clear();
+	mesh.vertices().assign(pVertices, pVertices + pHeader->nVertices);
+	mesh.normals().assign(pNormals, pNormals + pHeader->nVertices);
+	mesh.triangles().assign(pTriangles, pTriangles + pHeader->nTriangles);
+	return S_OK;
+}
@@ -0,0 +1,35 @@
+//--------------------------------------------------------------------------------------
+// File: MeshCacheCPU.h
+//
+// Binary copy of a mesh read from a text file: a header, then the vertex, normal and
+// triangle blocks as TriangleMesh stores them, each starting on a cache line. The header
+// records the size and modification time of the source file and the read flags, so a
+// stale cache is rebuilt rather than loaded. Loading maps the file and copies each block
+// into the mesh in one go, with nothing to parse or to recompute.
+//--------------------------------------------------------------------------------------
+#ifndef CPU_MESH_CACHE_H
+#define CPU_MESH_CACHE_H
+
+#include <string>
+
+// Appended to the name of the source file
+#define MESH_CACHE_SUFFIX ".meshcache"
+
+class TriangleMesh;
+
+class MeshCacheCPU
+{
+public:
+	//! Cache file of strSource, next to it
+	static std::string GetCachePath(const char* strSource);
+
+	//! Write mesh, read from strSource with iFlags, to strFile
+	static HRESULT Save(const char* strFile, const char* strSource, UINT iFlags, const TriangleMesh& mesh);
+	/*!
+	 * Replace mesh with the one in strFile. Fails and leaves mesh alone unless the file
+	 * is intact and was saved from strSource as it is now, with the same iFlags.
+	 */
+	static HRESULT Load(const char* strFile, const char* strSource, UINT iFlags, TriangleMesh& mesh);
+};
+
+#endif
@@ -0,0 +1,377 @@
+#include "DXUT.h"
+#include <algorithm>
+#include <stdlib.h>
+#include <string.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#include "MappedFileCPU.h"
+#include "ObjParserCPU.h"
+
+// Bytes per chunk; enough chunks for every thread even on small files
+#define OBJ_CHUNK_SIZE (1 << 20)
+#define OBJ_CHUNKS_PER_THREAD 4
+#define OBJ_MIN_CHUNK_SIZE 4096
+
+namespace
+{
+	struct Token
+	{
+		const char*	pBegin;
+		const char*	pEnd;
+	};
+
+	struct Chunk
+	{
+		const char*					pBegin;
+		const char*					pEnd;
+		std::vector<D3DXVECTOR3>	vtx;
+		std::vector<D3DXVECTOR3>	nml;
+		std::vector<Tuple3ui>		tgl;
+		std::vector<Tuple3ui>		tNml;
+		UINT						nLines;
+		UINT						iErrorLine;	// within the chunk, from 1
+		char						cError;		// the letter of the MeshObjReader message, 0 if none
+	};
+
+	inline bool IsSpace(char c)
+	{
+		// sploosh::tokenize splits at " \t\n"; a '\r' of a CRLF file is a space too
+		return c == ' ' || c == '\t' || c == '\r';
+	}
+
+	inline bool IsDigit(char c)
+	{
+		return c >= '0' && c <= '9';
+	}
+
+	/*!
+	 * The number at the start of [s, end), as std::istream >> double reads it. Up to 19
+	 * significant digits and a power of ten up to 22 the result is one exact multiply or
+	 * divide of two doubles, which rounds correctly (Clinger's fast path); anything else
+	 * goes to strtod on a copy of the token.
+	 */
+	double ParseDouble(const char* s, const char* end)
+	{
+		static const double s_Powers[23] =
+		{
+			1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+			1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+		};
+
+		const char* p = s;
+		bool bNegative = false;
+		if(p < end && (*p == '-' || *p == '+'))
+			bNegative = *p++ == '-';
+
+		UINT64 iMantissa = 0;
+		int nDigits = 0, iExp = 0;
+		bool bAny = false;
+		while(p < end && *p == '0')
+		{
+			p++;
+			bAny = true;
+		}
+		for(; p < end && IsDigit(*p); p++, bAny = true)
+		{
+			if(nDigits < 19)
+				iMantissa = iMantissa * 10 + (*p - '0');
+			else
+				iExp++;
+			nDigits++;
+		}
+		if(p < end && *p == '.')
+		{
+			p++;
+			if(nDigits == 0)
+				for(; p < end && *p == '0'; p++, bAny = true)
+					iExp--;
+			for(; p < end && IsDigit(*p); p++, bAny = true)
+			{
+				if(nDigits < 19)
+				{
+					iMantissa = iMantissa * 10 + (*p - '0');
+					iExp--;
+				}
+				nDigits++;
+			}
+		}
+		if(bAny && p < end && (*p == 'e' || *p == 'E'))
+		{
+			const char* q = p + 1;
+			bool bExpNegative = false;
+			if(q < end && (*q == '-' || *q == '+'))
+				bExpNegative = *q++ == '-';
+			if(q < end && IsDigit(*q))
+			{
+				int iValue = 0;
+				for(; q < end && IsDigit(*q); q++)
+					iValue = min(iValue * 10 + (*q - '0'), 100000);
+				iExp += bExpNegative ? -iValue : iValue;
+				p = q;
+			}
+		}
+
+		if(bAny && nDigits <= 19 && iMantissa <= (1ull << 53) && iExp >= -22 && iExp <= 22)
+		{
+			double r = (double)iMantissa;
+			r = iExp < 0 ? r / s_Powers[-iExp] : r * s_Powers[iExp];
+			return bNegative ? -r : r;
+		}
+
+		char strCopy[128];
+		const size_t n = min((size_t)(end - s), sizeof(strCopy) - 1);
+		memcpy(strCopy, s, n);
+		strCopy[n] = 0;
+		return strtod(strCopy, NULL);
+	}
+
+	//! The integer at the start of [s, end), as std::istream >> int reads it
+	int ParseInt(const char* s, const char* end)
+	{
+		bool bNegative = false;
+		if(s < end && (*s == '-' || *s == '+'))
+			bNegative = *s++ == '-';
+		int r = 0;
+		for(; s < end && IsDigit(*s); s++)
+			r = r * 10 + (*s - '0');
+		return bNegative ? -r : r;
+	}
+
+	inline bool TokenIs(const Token& t, const char* str)
+	{
+		const size_t n = strlen(str);
+		return (size_t)(t.pEnd - t.pBegin) == n && memcmp(t.pBegin, str, n) == 0;
+	}
+
+	/*!
+	 * Split a face corner like sploosh::split(corner, '/'): returns the number of fields
+	 * (a single trailing empty field is dropped) and the first and third one
+	 */
+	int SplitCorner(const Token& t, Token& first, Token& third)
+	{
+		int nFields = 0;
+		const char* b = t.pBegin;
+		for(;;)
+		{
+			const char* e = (const char*)memchr(b, '/', t.pEnd - b);
+			if(!e)
+				e = t.pEnd;
+			if(nFields == 0)
+			{
+				first.pBegin = b;
+				first.pEnd = e;
+			}
+			else if(nFields == 2)
+			{
+				third.pBegin = b;
+				third.pEnd = e;
+			}
+			nFields++;
+			if(e == t.pEnd || e + 1 == t.pEnd)
+				return nFields;
+			b = e + 1;
+		}
+	}
+
+	void ParseChunk(Chunk& chunk)
+	{
+		chunk.nLines = 0;
+		chunk.iErrorLine = 0;
+		chunk.cError = 0;
+
+		const char* p = chunk.pBegin;
+		while(p < chunk.pEnd)
+		{
+			const char* pLineEnd = (const char*)memchr(p, '\n', chunk.pEnd - p);
+			if(!pLineEnd)
+				pLineEnd = chunk.pEnd;
+			chunk.nLines++;
+
+			// The first four tokens, and how many there are
+			Token tokens[4];
+			int nTokens = 0;
+			for(const char* q = p; q < pLineEnd; )
+			{
+				while(q < pLineEnd && IsSpace(*q))
+					q++;
+				if(q == pLineEnd)
+					break;
+				const char* b = q;
+				while(q < pLineEnd && !IsSpace(*q))
+					q++;
+				if(nTokens < 4)
+				{
+					tokens[nTokens].pBegin = b;
+					tokens[nTokens].pEnd = q;
+				}
+				nTokens++;
+			}
+			p = pLineEnd + 1;
+			if(nTokens == 0)
+				continue;
+
+			char cError = 0;
+			if(TokenIs(tokens[0], "v") || TokenIs(tokens[0], "vn"))
+			{
+				const bool bNormal = tokens[0].pEnd - tokens[0].pBegin == 2;
+				if(nTokens != 4)
+				{
+					cError = bNormal ? 'B' : 'A';
+				}
+				else
+				{
+					D3DXVECTOR3 v((FLOAT)ParseDouble(tokens[1].pBegin, tokens[1].pEnd),
+						-(FLOAT)ParseDouble(tokens[3].pBegin, tokens[3].pEnd),
+						(FLOAT)ParseDouble(tokens[2].pBegin, tokens[2].pEnd));
+					if(bNormal)
+					{
+						D3DXVec3Normalize(&v, &v);
+						chunk.nml.push_back(v);
+					}
+					else
+					{
+						chunk.vtx.push_back(v);
+					}
+				}
+			}
+			else if(TokenIs(tokens[0], "f"))
+			{
+				Token first[3], third[3];
+				int nFields[3] = { 0, 0, 0 };
+				if(nTokens != 4)
+				{
+					cError = 'C';
+				}
+				else
+				{
+					for(int c = 0; c < 3; c++)
+						nFields[c] = SplitCorner(tokens[c + 1], first[c], third[c]);
+					if(nFields[0] != nFields[1] || nFields[1] != nFields[2])
+						cError = 'D';
+				}
+				if(!cError)
+				{
+					chunk.tgl.push_back(Tuple3ui(ParseInt(first[0].pBegin, first[0].pEnd) - 1,
+						ParseInt(first[1].pBegin, first[1].pEnd) - 1,
+						ParseInt(first[2].pBegin, first[2].pEnd) - 1));
+					if(nFields[0] > 2)
+						chunk.tNml.push_back(Tuple3ui(ParseInt(third[0].pBegin, third[0].pEnd) - 1,
+							ParseInt(third[1].pBegin, third[1].pEnd) - 1,
+							ParseInt(third[2].pBegin, third[2].pEnd) - 1));
+				}
+			}
+
+			if(cError)
+			{
+				chunk.cError = cError;
+				chunk.iErrorLine = chunk.nLines;
+				return;
+			}
+		}
+	}
+
+	template<class T>
+	void Concatenate(std::vector<Chunk>& chunks, std::vector<T> Chunk::* pArray, std::vector<T>& out)
+	{
+		const int nChunks = (int)chunks.size();
+		std::vector<size_t> offsets(nChunks + 1, 0);
+		for(int i = 0; i < nChunks; i++)
+			offsets[i + 1] = offsets[i] + (chunks[i].*pArray).size();
+		out.resize(offsets[nChunks]);
+		#pragma omp parallel for schedule(dynamic, 1)
+		for(int i = 0; i < nChunks; i++)
+		{
+			std::vector<T>& a = chunks[i].*pArray;
+			std::copy(a.begin(), a.end(), out.begin() + offsets[i]);
+			std::vector<T>().swap(a);
+		}
+	}
+}
+
+ObjParserCPU::ObjParserCPU() :
+	m_nLines(0),
+	m_nChunks(0)
+{
+}
+
+void ObjParserCPU::Clear()
+{
+	std::vector<D3DXVECTOR3>().swap(m_Vertices);
+	std::vector<D3DXVECTOR3>().swap(m_Normals);
+	std::vector<Tuple3ui>().swap(m_Triangles);
+	std::vector<Tuple3ui>().swap(m_NormalIndices);
+	m_nLines = 0;
+	m_nChunks = 0;
+}
+
+double ObjParserCPU::ParseNumber(const char* s, const char* end)
+{
+	return ParseDouble(s, end);
+}
+
+HRESULT ObjParserCPU::Parse(const char* strFile)
+{
+	MappedFileCPU file;
+	if(FAILED(file.Open(strFile)))
+		return E_FAIL;
+	return Parse((const char*)file.GetData(), file.GetSize());
+}
+
+HRESULT ObjParserCPU::Parse(const char* pText, size_t nSize)
+{
+	Clear();
+
+#ifdef _OPENMP
+	const size_t nThreads = (size_t)omp_get_max_threads();
+#else
+	const size_t nThreads = 1;
+#endif
+	size_t nChunkSize = min((size_t)OBJ_CHUNK_SIZE, nSize / (nThreads * OBJ_CHUNKS_PER_THREAD) + 1);
+	nChunkSize = max(nChunkSize, (size_t)OBJ_MIN_CHUNK_SIZE);
+
+	// Every chunk but the last ends just after a newline
+	std::vector<Chunk> chunks;
+	const char* pEnd = pText + nSize;
+	for(const char* p = pText; p < pEnd; )
+	{
+		const char* pChunkEnd = pEnd;
+		if((size_t)(pEnd - p) > nChunkSize)
+		{
+			const char* pNewline = (const char*)memchr(p + nChunkSize, '\n', pEnd - (p + nChunkSize));
+			if(pNewline)
+				pChunkEnd = pNewline + 1;
+		}
+		chunks.push_back(Chunk());
+		chunks.back().pBegin = p;
+		chunks.back().pEnd = pChunkEnd;
+		p = pChunkEnd;
+	}
+	const int nChunks = (int)chunks.size();
+	m_nChunks = nChunks;
+
+	#pragma omp parallel for schedule(dynamic, 1)
+	for(int i = 0; i < nChunks; i++)
+		ParseChunk(chunks[i]);
+
+	for(int i = 0; i < nChunks; i++)
+	{
+		if(chunks[i].cError)
+		{
+			const UINT iLine = m_nLines + chunks[i].iErrorLine;
+			if(chunks[i].cError == 'C')
+				printf("(C) Incorrect file format at Line %u (# of fields is larger than 3)\n", iLine);
+			else
+				printf("(%c) Incorrect file format at Line %u.\n", chunks[i].cError, iLine);
+			Clear();
+			return E_INVALIDARG;
+		}
+		m_nLines += chunks[i].nLines;
+	}
+
+	Concatenate(chunks, &Chunk::vtx, m_Vertices);
+	Concatenate(chunks, &Chunk::nml, m_Normals);
+	Concatenate(chunks, &Chunk::tgl, m_Triangles);
+	Concatenate(chunks, &Chunk::tNml, m_NormalIndices);
+	return S_OK;
+}
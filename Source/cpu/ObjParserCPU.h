@@ -0,0 +1,52 @@
+//--------------------------------------------------------------------------------------
+// File: ObjParserCPU.h
+//
+// Parallel parser for the subset of Wavefront OBJ MeshObjReader reads: v, vn and
+// triangular f lines. The file is mapped instead of read, cut into chunks that end at a
+// newline, and the chunks are parsed in parallel straight from the mapping; the numbers
+// are converted in place, without strings or streams, and the per chunk arrays are then
+// concatenated in file order. The values are the ones MeshObjReader::read(std::istream&)
+// produces, including the axis swap, the normalized vn and the 0-based indices.
+//--------------------------------------------------------------------------------------
+#ifndef CPU_OBJ_PARSER_H
+#define CPU_OBJ_PARSER_H
+
+#include <vector>
+#include "../geometry/Tuple3.h"
+
+class ObjParserCPU
+{
+public:
+	ObjParserCPU();
+
+	//! Map and parse strFile. E_FAIL if it cannot be mapped (missing or empty),
+	//! E_INVALIDARG after printing the line of the first malformed v, vn or f.
+	HRESULT Parse(const char* strFile);
+	//! Parse nSize bytes of OBJ text; the text does not need a terminating zero
+	HRESULT Parse(const char* pText, size_t nSize);
+	void Clear();
+
+	// Positions, normals, vertex and normal indices of the triangles, in file order
+	std::vector<D3DXVECTOR3>& GetVertices() { return m_Vertices; }
+	std::vector<D3DXVECTOR3>& GetNormals() { return m_Normals; }
+	std::vector<Tuple3ui>& GetTriangles() { return m_Triangles; }
+	std::vector<Tuple3ui>& GetNormalIndices() { return m_NormalIndices; }
+
+	//! Lines of the last parse, and the chunks it was parsed in
+	UINT GetNumLines() const { return m_nLines; }
+	UINT GetNumChunks() const { return m_nChunks; }
+
+	//! The number at the start of [s, end), as std::istream >> double reads it; for the
+	//! other text formats
+	static double ParseNumber(const char* s, const char* end);
+
+private:
+	std::vector<D3DXVECTOR3>	m_Vertices;
+	std::vector<D3DXVECTOR3>	m_Normals;
+	std::vector<Tuple3ui>		m_Triangles;
+	std::vector<Tuple3ui>		m_NormalIndices;
+	UINT						m_nLines;
+	UINT						m_nChunks;
+};
+
+#endif
@@ -0,0 +1,133 @@
+//--------------------------------------------------------------------------------------
+// File: ParticleStoreCPU.h
+//
+// Particle layouts the neighbor passes can read. The AoS layout is the D3DXVECTOR4 array
+// of the GPU buffers; the SoA layout keeps x, y, z and w in separate arrays that are
+// aligned to a cache line and padded to whole AVX-512 vectors, so the neighbor loops
+// only touch the coordinates they use and the SIMD kernels can load them directly.
+// The passes are templates over a layout with a Position(i) accessor.
+//--------------------------------------------------------------------------------------
+#ifndef CPU_PARTICLE_STORE_H
+#define CPU_PARTICLE_STORE_H
+
+#include <vector>
+#include <new>
+#include <stdlib.h>
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+
+#define PARTICLE_STORE_ALIGNMENT 64	// bytes
+#define PARTICLE_STORE_PADDING 16	// elements
+
+//! std::allocator with PARTICLE_STORE_ALIGNMENT aligned blocks
+template<class T>
+class AlignedAllocator
+{
+public:
+	typedef T value_type;
+
+	AlignedAllocator() {}
+	template<class U> AlignedAllocator(const AlignedAllocator<U>&) {}
+
+	T* allocate(size_t n)
+	{
+		void* p = NULL;
+#ifdef _WIN32
+		p = _aligned_malloc(n * sizeof(T), PARTICLE_STORE_ALIGNMENT);
+#else
+		if(posix_memalign(&p, PARTICLE_STORE_ALIGNMENT, n * sizeof(T)) != 0)
+			p = NULL;
+#endif
+		if(!p)
+			throw std::bad_alloc();
+		return (T*)p;
+	}
+
+	void deallocate(T* p, size_t)
+	{
+#ifdef _WIN32
+		_aligned_free(p);
+#else
+		free(p);
+#endif
+	}
+
+	template<class U> struct rebind { typedef AlignedAllocator<U> other; };
+};
+
+template<class T, class U>
+inline bool operator==(const AlignedAllocator<T>&, const AlignedAllocator<U>&) { return true; }
+template<class T, class U>
+inline bool operator!=(const AlignedAllocator<T>&, const AlignedAllocator<U>&) { return false; }
+
+typedef std::vector<FLOAT, AlignedAllocator<FLOAT> > AlignedFloatVector;
+
+//! Size rounded up to whole PARTICLE_STORE_PADDING vectors
+inline size_t PaddedParticleCount(size_t n)
+{
+	return (n + PARTICLE_STORE_PADDING - 1) / PARTICLE_STORE_PADDING * PARTICLE_STORE_PADDING;
+}
+
+//! Read-only AoS view of a D3DXVECTOR4 array
+class ParticleViewAoS
+{
+public:
+	explicit ParticleViewAoS(const std::vector<D3DXVECTOR4>& particles) :
+		m_pParticles(particles.empty() ? NULL : &particles[0]) {}
+
+	D3DXVECTOR3 Position(UINT i) const
+	{
+		const D3DXVECTOR4& p = m_pParticles[i];
+		return D3DXVECTOR3(p.x, p.y, p.z);
+	}
+
+private:
+	const D3DXVECTOR4*	m_pParticles;
+};
+
+//! SoA particles; the padding past Size() is zero
+class ParticleStoreSoA
+{
+public:
+	ParticleStoreSoA() : m_iSize(0) {}
+
+	void Resize(UINT n)
+	{
+		const size_t nPadded = PaddedParticleCount(n);
+		m_iSize = n;
+		m_X.assign(nPadded, 0.0f);
+		m_Y.assign(nPadded, 0.0f);
+		m_Z.assign(nPadded, 0.0f);
+		m_W.assign(nPadded, 0.0f);
+	}
+
+	UINT Size() const { return m_iSize; }
+
+	void Set(UINT i, const D3DXVECTOR4& p)
+	{
+		m_X[i] = p.x;
+		m_Y[i] = p.y;
+		m_Z[i] = p.z;
+		m_W[i] = p.w;
+	}
+
+	D3DXVECTOR3 Position(UINT i) const { return D3DXVECTOR3(m_X[i], m_Y[i], m_Z[i]); }
+	D3DXVECTOR4 Get(UINT i) const { return D3DXVECTOR4(m_X[i], m_Y[i], m_Z[i], m_W[i]); }
+
+	const FLOAT* X() const { return m_X.empty() ? NULL : &m_X[0]; }
+	const FLOAT* Y() const { return m_Y.empty() ? NULL : &m_Y[0]; }
+	const FLOAT* Z() const { return m_Z.empty() ? NULL : &m_Z[0]; }
+	const FLOAT* W() const { return m_W.empty() ? NULL : &m_W[0]; }
+
+	size_t GetMemorySize() const { return (m_X.size() + m_Y.size() + m_Z.size() + m_W.size()) * sizeof(FLOAT); }
+
+private:
+	UINT				m_iSize;
+	AlignedFloatVector	m_X;
+	AlignedFloatVector	m_Y;
+	AlignedFloatVector	m_Z;
+	AlignedFloatVector	m_W;
+};
+
+#endif
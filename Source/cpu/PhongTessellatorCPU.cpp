@@ -0,0 +1,234 @@
+#include "DXUT.h"
+#include <algorithm>
+#include <unordered_set>
+#include "../geometry/Tuple3.h"
+#include "../geometry/TriangleMesh.h"
+#include "PhongTessellatorCPU.h"
+
+// Each level halves the edges, so 8 levels are a tessellation factor of 256
+#define PHONG_MAX_LEVELS 8
+
+namespace
+{
+	const UINT PHONG_NO_SPLIT = 0xFFFFFFFF;
+
+	inline FLOAT Dot(const D3DXVECTOR3& a, const D3DXVECTOR3& b)
+	{
+		return a.x * b.x + a.y * b.y + a.z * b.z;
+	}
+
+	inline D3DXVECTOR3 project(const D3DXVECTOR3& p, const D3DXVECTOR3& c, const D3DXVECTOR3& n)
+	{
+		return p - Dot(p - c, n) * n;
+	}
+
+	inline UINT64 EdgeKey(UINT a, UINT b)
+	{
+		return a < b ? ((UINT64)a << 32) | b : ((UINT64)b << 32) | a;
+	}
+
+	// Part of an input triangle, with its corners also given as barycentric coordinates
+	// (w, u, v) of the input triangle, which is the patch the Phong surface is taken from
+	struct Fragment
+	{
+		UINT		v[3];
+		UINT		iPatch;
+		D3DXVECTOR3	vBary[3];
+	};
+
+	struct EdgeRef
+	{
+		UINT64	iKey;
+		UINT	iFragment;
+		UINT	iEdge;	// from corner iEdge to corner (iEdge + 1) % 3
+
+		bool operator<(const EdgeRef& r) const { return iKey < r.iKey; }
+	};
+}
+
+PhongTessellatorCPU::PhongTessellatorCPU() :
+	m_iMaxLevels(PHONG_MAX_LEVELS),
+	m_iLevels(0),
+	m_fMaxChordError(0)
+{
+}
+
+D3DXVECTOR3 PhongTessellatorCPU::PhongGeometry(const D3DXVECTOR3& vBary, const D3DXVECTOR3 b[3], const D3DXVECTOR3 n[3])
+{
+	const FLOAT w = vBary.x, u = vBary.y, v = vBary.z;
+	// Find local space point
+	const D3DXVECTOR3 p = w * b[0] + u * b[1] + v * b[2];
+	// Find projected vectors
+	const D3DXVECTOR3 c0 = project(p, b[0], n[0]);
+	const D3DXVECTOR3 c1 = project(p, b[1], n[1]);
+	const D3DXVECTOR3 c2 = project(p, b[2], n[2]);
+	// Interpolate
+	return w * c0 + u * c1 + v * c2;
+}
+
+D3DXVECTOR3 PhongTessellatorCPU::PhongNormal(const D3DXVECTOR3& vBary, const D3DXVECTOR3 n[3])
+{
+	D3DXVECTOR3 r, s = vBary.x * n[0] + vBary.y * n[1] + vBary.z * n[2];
+	D3DXVec3Normalize(&r, &s);
+	return r;
+}
+
+void PhongTessellatorCPU::Tessellate(const TriangleMesh& mesh, FLOAT fTolerance, TriangleMesh& out)
+{
+	const int nTris = mesh.num_triangles();
+	m_iLevels = 0;
+	m_fMaxChordError = 0;
+
+	// The patches read the normals as given, like the vertex buffer the hull shader gets
+	std::vector<D3DXVECTOR3> positions(mesh.vertices());
+	std::vector<D3DXVECTOR3> normals(mesh.num_vertices());
+	for(int i = 0; i < mesh.num_vertices(); i++)
+		D3DXVec3Normalize(&normals[i], &mesh.normal(i));
+
+	std::vector<Fragment> active(nTris), next, done;
+	for(int t = 0; t < nTris; t++)
+	{
+		const Tuple3ui& tri = mesh.triangle_ids(t);
+		Fragment& f = active[t];
+		f.v[0] = tri.x;
+		f.v[1] = tri.y;
+		f.v[2] = tri.z;
+		f.iPatch = t;
+		f.vBary[0] = D3DXVECTOR3(1, 0, 0);
+		f.vBary[1] = D3DXVECTOR3(0, 1, 0);
+		f.vBary[2] = D3DXVECTOR3(0, 0, 1);
+	}
+
+	// Edges already found flat enough; they stay whole whichever side looks at them later
+	std::unordered_set<UINT64> kept;
+	std::vector<EdgeRef> edges;
+	std::vector<UINT> midpoints;
+
+	for(UINT iLevel = 0; iLevel < m_iMaxLevels && !active.empty(); iLevel++)
+	{
+		edges.clear();
+		for(UINT i = 0; i < (UINT)active.size(); i++)
+			for(UINT e = 0; e < 3; e++)
+			{
+				EdgeRef ref;
+				ref.iKey = EdgeKey(active[i].v[e], active[i].v[(e + 1) % 3]);
+				ref.iFragment = i;
+				ref.iEdge = e;
+				if(kept.find(ref.iKey) == kept.end())
+					edges.push_back(ref);
+			}
+		std::sort(edges.begin(), edges.end());
+		edges.erase(std::unique(edges.begin(), edges.end(),
+			[](const EdgeRef& a, const EdgeRef& b) { return a.iKey == b.iKey; }), edges.end());
+
+		// Phong midpoint of every edge, from the patch of the first fragment that has it;
+		// both sides of an input edge give the same curve
+		const int nEdges = (int)edges.size();
+		std::vector<D3DXVECTOR3> midPositions(nEdges), midNormals(nEdges);
+		std::vector<FLOAT> errors(nEdges);
+		#pragma omp parallel for schedule(static)
+		for(int i = 0; i < nEdges; i++)
+		{
+			const Fragment& f = active[edges[i].iFragment];
+			const UINT e0 = edges[i].iEdge, e1 = (e0 + 1) % 3;
+			const Tuple3ui& tri = mesh.triangle_ids(f.iPatch);
+			const D3DXVECTOR3 b[3] = { mesh.vertex(tri.x), mesh.vertex(tri.y), mesh.vertex(tri.z) };
+			const D3DXVECTOR3 n[3] = { normals[tri.x], normals[tri.y], normals[tri.z] };
+			const D3DXVECTOR3 vBary = (f.vBary[e0] + f.vBary[e1]) * 0.5f;
+			midPositions[i] = PhongGeometry(vBary, b, n);
+			midNormals[i] = PhongNormal(vBary, n);
+			const D3DXVECTOR3 d = midPositions[i] - (positions[f.v[e0]] + positions[f.v[e1]]) * 0.5f;
+			errors[i] = sqrtf(Dot(d, d));
+		}
+
+		midpoints.resize(nEdges);
+		UINT nSplit = 0;
+		for(int i = 0; i < nEdges; i++)
+		{
+			if(fTolerance < 0 || errors[i] > fTolerance)
+			{
+				midpoints[i] = (UINT)positions.size();
+				positions.push_back(midPositions[i]);
+				normals.push_back(midNormals[i]);
+				nSplit++;
+			}
+			else
+			{
+				midpoints[i] = PHONG_NO_SPLIT;
+				kept.insert(edges[i].iKey);
+				m_fMaxChordError = max(m_fMaxChordError, errors[i]);
+			}
+		}
+		if(nSplit == 0)
+			break;
+		m_iLevels = iLevel + 1;
+
+		next.clear();
+		for(UINT i = 0; i < (UINT)active.size(); i++)
+		{
+			const Fragment& f = active[i];
+			UINT mid[3];
+			int nMid = 0;
+			for(UINT e = 0; e < 3; e++)
+			{
+				EdgeRef ref;
+				ref.iKey = EdgeKey(f.v[e], f.v[(e + 1) % 3]);
+				std::vector<EdgeRef>::const_iterator it = std::lower_bound(edges.begin(), edges.end(), ref);
+				mid[e] = (it != edges.end() && it->iKey == ref.iKey) ? midpoints[it - edges.begin()] : PHONG_NO_SPLIT;
+				if(mid[e] != PHONG_NO_SPLIT)
+					nMid++;
+			}
+			if(nMid == 0)
+			{
+				done.push_back(f);
+				continue;
+			}
+
+			// Rotate the corners so the split edges come first: edge 0 for one, edges 0
+			// and 1 for two
+			UINT r = 0;
+			if(nMid == 1)
+				r = mid[0] != PHONG_NO_SPLIT ? 0 : (mid[1] != PHONG_NO_SPLIT ? 1 : 2);
+			else if(nMid == 2)
+				r = mid[2] == PHONG_NO_SPLIT ? 0 : (mid[0] == PHONG_NO_SPLIT ? 1 : 2);
+			UINT v[6];
+			D3DXVECTOR3 vBary[6];
+			for(UINT c = 0; c < 3; c++)
+			{
+				const UINT k = (c + r) % 3;
+				v[c] = f.v[k];
+				vBary[c] = f.vBary[k];
+				v[c + 3] = mid[k];
+				vBary[c + 3] = (f.vBary[k] + f.vBary[(k + 1) % 3]) * 0.5f;
+			}
+
+			// Children as corner indices into v[]: 0..2 the corners, 3..5 the midpoints of
+			// the edges 01, 12, 20; all keep the winding of the parent
+			static const UINT s_Children[3][4][3] =
+			{
+				{ { 0, 3, 2 }, { 3, 1, 2 } },
+				{ { 0, 3, 4 }, { 0, 4, 2 }, { 3, 1, 4 } },
+				{ { 0, 3, 5 }, { 3, 1, 4 }, { 5, 4, 2 }, { 3, 4, 5 } },
+			};
+			for(int c = 0; c <= nMid; c++)
+			{
+				Fragment child;
+				for(int k = 0; k < 3; k++)
+				{
+					child.v[k] = v[s_Children[nMid - 1][c][k]];
+					child.vBary[k] = vBary[s_Children[nMid - 1][c][k]];
+				}
+				child.iPatch = f.iPatch;
+				next.push_back(child);
+			}
+		}
+		active.swap(next);
+	}
+	done.insert(done.end(), active.begin(), active.end());
+
+	out.clear();
+	for(size_t i = 0; i < positions.size(); i++)
+		out.add_vertex_normal(positions[i], normals[i]);
+	for(size_t i = 0; i < done.size(); i++)
+		out.add_triangle(done[i].v[0], done[i].v[1], done[i].v[2]);
+}
@@ -0,0 +1,50 @@
+//--------------------------------------------------------------------------------------
+// File: PhongTessellatorCPU.h
+//
+// CPU counterpart of HS_PNTriangles/DS_PNTriangles: Phong tessellation (Boubekeur and
+// Alexa) of a mesh with vertex normals, refined adaptively instead of with one factor per
+// triangle. An edge is halved while the Phong surface at its midpoint is farther than a
+// tolerance from the chord; the triangles are then split 1:2, 1:3 or 1:4 by the number of
+// halved edges. The decision is made once per edge and the midpoint is shared, so the
+// result has no cracks, and flat or finely meshed parts are left as they are.
+//--------------------------------------------------------------------------------------
+#ifndef CPU_PHONG_TESSELLATOR_H
+#define CPU_PHONG_TESSELLATOR_H
+
+#include <vector>
+
+class TriangleMesh;
+
+class PhongTessellatorCPU
+{
+public:
+	PhongTessellatorCPU();
+
+	//! Edges are halved at most iMaxLevels times (default PHONG_MAX_LEVELS)
+	void SetMaxLevels(UINT iMaxLevels) { m_iMaxLevels = iMaxLevels; }
+
+	/*!
+	 * Refine mesh into out (cleared first) until no edge has a chord error above
+	 * fTolerance; a negative tolerance halves every edge iMaxLevels times, like a uniform
+	 * tessellation factor of 2^iMaxLevels. The normals of out are the PhongNormal ones.
+	 */
+	void Tessellate(const TriangleMesh& mesh, FLOAT fTolerance, TriangleMesh& out);
+
+	//! Levels the last Tessellate split edges on
+	UINT GetNumLevels() const { return m_iLevels; }
+	//! Largest chord error of an edge the last Tessellate kept
+	FLOAT GetMaxChordError() const { return m_fMaxChordError; }
+
+	//! PhongGeometry of Mesh2Points.hlsl: the point at barycentric (w, u, v) of the patch
+	//! with corners b[] and normals n[]
+	static D3DXVECTOR3 PhongGeometry(const D3DXVECTOR3& vBary, const D3DXVECTOR3 b[3], const D3DXVECTOR3 n[3]);
+	//! PhongNormal of Mesh2Points.hlsl
+	static D3DXVECTOR3 PhongNormal(const D3DXVECTOR3& vBary, const D3DXVECTOR3 n[3]);
+
+private:
+	UINT	m_iMaxLevels;
+	UINT	m_iLevels;
+	FLOAT	m_fMaxChordError;
+};
+
+#endif
@@ -0,0 +1,400 @@
+#include "DXUT.h"
+#include <string.h>
+#include "BufferedFileCPU.h"
+#include "ObjParserCPU.h"
+#include "PlyReaderCPU.h"
+
+// Tokens of a header line
+#define PLY_MAX_TOKENS 8
+
+namespace
+{
+	enum PlyFormat
+	{
+		PLY_ASCII,
+		PLY_BINARY_LE,
+		PLY_BINARY_BE,
+	};
+
+	enum PlyType
+	{
+		PLY_INT8, PLY_UINT8, PLY_INT16, PLY_UINT16, PLY_INT32, PLY_UINT32, PLY_FLOAT32, PLY_FLOAT64,
+		PLY_NO_TYPE,
+	};
+
+	// What a property is read into
+	enum PlySlot
+	{
+		PLY_X, PLY_Y, PLY_Z, PLY_NX, PLY_NY, PLY_NZ, PLY_INDICES,
+		PLY_UNUSED,
+	};
+
+	const UINT s_TypeSizes[PLY_NO_TYPE] = { 1, 1, 2, 2, 4, 4, 4, 8 };
+
+	struct Property
+	{
+		PlyType	eType;		// of the items, for a list
+		PlyType	eCountType;	// PLY_NO_TYPE unless a list
+		PlySlot	eSlot;
+		UINT	iOffset;	// in the record of an element without lists
+	};
+
+	struct Element
+	{
+		bool					bVertex;
+		bool					bFace;
+		UINT					nCount;
+		UINT					nRecordSize;	// 0 if the element has lists
+		std::vector<Property>	props;
+	};
+
+	struct Token
+	{
+		const char*	pBegin;
+		const char*	pEnd;
+
+		bool Is(const char* str) const
+		{
+			const size_t n = strlen(str);
+			return (size_t)(pEnd - pBegin) == n && memcmp(pBegin, str, n) == 0;
+		}
+	};
+
+	int SplitLine(const char* p, const char* pEnd, Token tokens[PLY_MAX_TOKENS])
+	{
+		int n = 0;
+		while(n < PLY_MAX_TOKENS)
+		{
+			while(p < pEnd && (*p == ' ' || *p == '\t' || *p == '\r'))
+				p++;
+			if(p == pEnd)
+				break;
+			tokens[n].pBegin = p;
+			while(p < pEnd && *p != ' ' && *p != '\t' && *p != '\r')
+				p++;
+			tokens[n++].pEnd = p;
+		}
+		return n;
+	}
+
+	PlyType ParseType(const Token& token)
+	{
+		static const char* s_Names[PLY_NO_TYPE][2] =
+		{
+			{ "char", "int8" }, { "uchar", "uint8" }, { "short", "int16" }, { "ushort", "uint16" },
+			{ "int", "int32" }, { "uint", "uint32" }, { "float", "float32" }, { "double", "float64" },
+		};
+		for(int t = 0; t < PLY_NO_TYPE; t++)
+			if(token.Is(s_Names[t][0]) || token.Is(s_Names[t][1]))
+				return (PlyType)t;
+		return PLY_NO_TYPE;
+	}
+
+	PlySlot ParseSlot(const Token& token, bool bVertex, bool bFace, bool bList)
+	{
+		static const char* s_Names[PLY_INDICES] = { "x", "y", "z", "nx", "ny", "nz" };
+		if(bVertex && !bList)
+			for(int s = 0; s < PLY_INDICES; s++)
+				if(token.Is(s_Names[s]))
+					return (PlySlot)s;
+		if(bFace && bList && (token.Is("vertex_indices") || token.Is("vertex_index")))
+			return PLY_INDICES;
+		return PLY_UNUSED;
+	}
+
+	template<class T> inline T Load(const BYTE* p, bool bSwap)
+	{
+		T v;
+		if(bSwap)
+		{
+			BYTE b[sizeof(T)];
+			for(size_t i = 0; i < sizeof(T); i++)
+				b[i] = p[sizeof(T) - 1 - i];
+			memcpy(&v, b, sizeof(T));
+		}
+		else
+		{
+			memcpy(&v, p, sizeof(T));
+		}
+		return v;
+	}
+
+	//! The value of type eType at p, in file byte order
+	inline double Decode(const BYTE* p, PlyType eType, bool bSwap)
+	{
+		switch(eType)
+		{
+		case PLY_INT8:		return (double)(signed char)p[0];
+		case PLY_UINT8:		return (double)p[0];
+		case PLY_INT16:		return Load<short>(p, bSwap);
+		case PLY_UINT16:	return Load<unsigned short>(p, bSwap);
+		case PLY_INT32:		return Load<int>(p, bSwap);
+		case PLY_UINT32:	return Load<UINT>(p, bSwap);
+		case PLY_FLOAT32:	return Load<FLOAT>(p, bSwap);
+		default:			return Load<double>(p, bSwap);
+		}
+	}
+
+	//! The next value of type eType, false at the end of the file or a token that is not a number
+	inline bool ReadValue(BufferedFileCPU& file, PlyFormat eFormat, PlyType eType, double& r)
+	{
+		if(eFormat == PLY_ASCII)
+		{
+			const char *pBegin, *pEnd;
+			if(!file.ReadToken(pBegin, pEnd))
+				return false;
+			const char c = *pBegin;
+			if(!((c >= '0' && c <= '9') || c == '-' || c == '+' || c == '.'))
+				return false;
+			r = ObjParserCPU::ParseNumber(pBegin, pEnd);
+			return true;
+		}
+		const BYTE* p = file.Read(s_TypeSizes[eType]);
+		if(!p)
+			return false;
+		r = Decode(p, eType, eFormat == PLY_BINARY_BE);
+		return true;
+	}
+}
+
+PlyReaderCPU::PlyReaderCPU() :
+	m_iFileSize(0),
+	m_nDegenerate(0),
+	m_bBinary(false)
+{
+}
+
+void PlyReaderCPU::Clear()
+{
+	std::vector<D3DXVECTOR3>().swap(m_Vertices);
+	std::vector<D3DXVECTOR3>().swap(m_Normals);
+	std::vector<Tuple3ui>().swap(m_Triangles);
+	m_iFileSize = 0;
+	m_nDegenerate = 0;
+	m_bBinary = false;
+}
+
+HRESULT PlyReaderCPU::Read(const char* strFile)
+{
+	Clear();
+
+	BufferedFileCPU file;
+	if(FAILED(file.Open(strFile)))
+		return E_FAIL;
+	m_iFileSize = file.GetSize();
+
+	// Header
+	PlyFormat eFormat = PLY_ASCII;
+	std::vector<Element> elements;
+	const char *pBegin, *pEnd;
+	Token tokens[PLY_MAX_TOKENS];
+	bool bMagic = false, bFormat = false;
+	for(;;)
+	{
+		if(!file.ReadLine(pBegin, pEnd))
+		{
+			printf("The PLY header has no end_header.\n");
+			return E_INVALIDARG;
+		}
+		const int n = SplitLine(pBegin, pEnd, tokens);
+		bool bValid = true;
+		if(!bMagic)
+		{
+			bValid = n == 1 && tokens[0].Is("ply");
+			bMagic = true;
+		}
+		else if(n == 0 || tokens[0].Is("comment") || tokens[0].Is("obj_info"))
+		{
+		}
+		else if(tokens[0].Is("format") && n == 3)
+		{
+			bFormat = true;
+			if(tokens[1].Is("ascii"))
+				eFormat = PLY_ASCII;
+			else if(tokens[1].Is("binary_little_endian"))
+				eFormat = PLY_BINARY_LE;
+			else if(tokens[1].Is("binary_big_endian"))
+				eFormat = PLY_BINARY_BE;
+			else
+				bValid = false;
+		}
+		else if(tokens[0].Is("element") && n == 3)
+		{
+			Element element;
+			element.bVertex = tokens[1].Is("vertex");
+			element.bFace = tokens[1].Is("face");
+			element.nCount = (UINT)ObjParserCPU::ParseNumber(tokens[2].pBegin, tokens[2].pEnd);
+			element.nRecordSize = 0;
+			elements.push_back(element);
+		}
+		else if(tokens[0].Is("property") && !elements.empty() && (n == 3 || (n == 5 && tokens[1].Is("list"))))
+		{
+			Element& element = elements.back();
+			const bool bList = n == 5;
+			Property prop;
+			prop.eCountType = bList ? ParseType(tokens[2]) : PLY_NO_TYPE;
+			prop.eType = ParseType(tokens[n - 2]);
+			prop.eSlot = ParseSlot(tokens[n - 1], element.bVertex, element.bFace, bList);
+			prop.iOffset = 0;
+			bValid = prop.eType != PLY_NO_TYPE && (!bList || prop.eCountType != PLY_NO_TYPE);
+			element.props.push_back(prop);
+		}
+		else if(tokens[0].Is("end_header") && n == 1)
+		{
+			break;
+		}
+		else
+		{
+			bValid = false;
+		}
+		if(!bValid)
+		{
+			printf("Incorrect PLY header at Line %u.\n", file.GetLine());
+			return E_INVALIDARG;
+		}
+	}
+	if(!bFormat)
+	{
+		printf("The PLY header has no format.\n");
+		return E_INVALIDARG;
+	}
+	m_bBinary = eFormat != PLY_ASCII;
+
+	// Records of elements without lists are read whole in binary files
+	UINT nVertices = 0;
+	bool bNormals = false;
+	for(size_t e = 0; e < elements.size(); e++)
+	{
+		Element& element = elements[e];
+		UINT iOffset = 0;
+		bool bFixed = true;
+		UINT iSlots = 0;
+		for(size_t p = 0; p < element.props.size(); p++)
+		{
+			Property& prop = element.props[p];
+			prop.iOffset = iOffset;
+			iOffset += s_TypeSizes[prop.eType];
+			bFixed = bFixed && prop.eCountType == PLY_NO_TYPE;
+			if(prop.eSlot != PLY_UNUSED)
+				iSlots |= 1 << prop.eSlot;
+		}
+		element.nRecordSize = bFixed ? iOffset : 0;
+		if(element.bVertex)
+		{
+			if((iSlots & 7) != 7)
+			{
+				printf("The PLY vertices have no x, y and z.\n");
+				return E_INVALIDARG;
+			}
+			nVertices = element.nCount;
+			bNormals = (iSlots & 0x38) == 0x38;
+		}
+	}
+
+	// Body; the counts come from the file, so the reservations are capped by its size
+	const UINT nReserve = (UINT)min((UINT64)nVertices, m_iFileSize);
+	m_Vertices.reserve(nReserve);
+	if(bNormals)
+		m_Normals.reserve(nReserve);
+	const bool bSwap = eFormat == PLY_BINARY_BE;
+	for(size_t e = 0; e < elements.size(); e++)
+	{
+		const Element& element = elements[e];
+		if(element.bFace)
+			m_Triangles.reserve(m_Triangles.size() + (size_t)min((UINT64)element.nCount, m_iFileSize));
+		for(UINT i = 0; i < element.nCount; i++)
+		{
+			double values[PLY_INDICES] = { 0, 0, 0, 0, 0, 0 };
+			bool bValid = true;
+			if(m_bBinary && element.nRecordSize)
+			{
+				const BYTE* pRecord = file.Read(element.nRecordSize);
+				bValid = pRecord != NULL;
+				for(size_t p = 0; bValid && p < element.props.size(); p++)
+				{
+					const Property& prop = element.props[p];
+					if(prop.eSlot != PLY_UNUSED)
+						values[prop.eSlot] = Decode(pRecord + prop.iOffset, prop.eType, bSwap);
+				}
+			}
+			else
+			{
+				for(size_t p = 0; bValid && p < element.props.size(); p++)
+				{
+					const Property& prop = element.props[p];
+					double r;
+					if(prop.eCountType == PLY_NO_TYPE)
+					{
+						bValid = ReadValue(file, eFormat, prop.eType, r);
+						if(prop.eSlot != PLY_UNUSED)
+							values[prop.eSlot] = r;
+						continue;
+					}
+
+					// A binary list is read whole after its count
+					double count;
+					bValid = ReadValue(file, eFormat, prop.eCountType, count);
+					const UINT nItems = bValid ? (UINT)count : 0;
+					const UINT nItemSize = s_TypeSizes[prop.eType];
+					const BYTE* pItems = NULL;
+					if(bValid && m_bBinary)
+						bValid = (pItems = file.Read(nItems * nItemSize)) != NULL;
+					UINT iFirst = 0, iPrev = 0;
+					for(UINT k = 0; bValid && k < nItems; k++)
+					{
+						// The int and uint indices every exporter writes skip the double
+						INT iIndex;
+						if(pItems && (prop.eType == PLY_INT32 || prop.eType == PLY_UINT32))
+						{
+							iIndex = Load<INT>(pItems + k * nItemSize, bSwap);
+						}
+						else
+						{
+							if(pItems)
+								r = Decode(pItems + k * nItemSize, prop.eType, bSwap);
+							else
+								bValid = ReadValue(file, eFormat, prop.eType, r);
+							iIndex = r < 0 ? -1 : (INT)min(r, 2147483647.0);
+						}
+						if(prop.eSlot != PLY_INDICES || !bValid)
+							continue;
+						const UINT iVertex = (UINT)iIndex;
+						if(iIndex < 0 || iVertex >= nVertices)
+						{
+							printf("Vertex index %d out of range in PLY face %u.\n", iIndex, i);
+							return E_INVALIDARG;
+						}
+						// Fan around the first corner, without the triangles that repeat one
+						if(k == 0)
+							iFirst = iVertex;
+						else if(k >= 2 && iVertex != iFirst && iVertex != iPrev && iPrev != iFirst)
+							m_Triangles.push_back(Tuple3ui(iFirst, iPrev, iVertex));
+						else if(k >= 2)
+							m_nDegenerate++;
+						iPrev = iVertex;
+					}
+				}
+			}
+			if(!bValid)
+			{
+				if(m_bBinary)
+					printf("Unexpected end of the PLY file.\n");
+				else
+					printf("Incorrect PLY file format at Line %u.\n", file.GetLine());
+				return E_INVALIDARG;
+			}
+
+			if(element.bVertex)
+			{
+				m_Vertices.push_back(D3DXVECTOR3((FLOAT)values[PLY_X], -(FLOAT)values[PLY_Z], (FLOAT)values[PLY_Y]));
+				if(bNormals)
+				{
+					D3DXVECTOR3 n((FLOAT)values[PLY_NX], -(FLOAT)values[PLY_NZ], (FLOAT)values[PLY_NY]);
+					D3DXVec3Normalize(&n, &n);
+					m_Normals.push_back(n);
+				}
+			}
+		}
+	}
+	return S_OK;
+}
@@ -0,0 +1,48 @@
+//--------------------------------------------------------------------------------------
+// File: PlyReaderCPU.h
+//
+// Streaming reader of PLY files, ASCII and binary in either byte order. The header is
+// parsed into the layout of each element; the vertex element gives x, y, z and, if all
+// three are there, nx, ny, nz, the face element its vertex_indices list (vertex_index
+// too), split into a fan of triangles without the
+// ones that repeat a vertex. Any other property or element is read over and
+// dropped. The body goes through BufferedFileCPU in one pass, a fixed size vertex record
+// in one read. Positions and normals get the axis swap of MeshObjReader and the normals
+// are normalized, as vn lines are.
+//--------------------------------------------------------------------------------------
+#ifndef CPU_PLY_READER_H
+#define CPU_PLY_READER_H
+
+#include <vector>
+#include "../geometry/Tuple3.h"
+
+class PlyReaderCPU
+{
+public:
+	PlyReaderCPU();
+
+	//! Read strFile. E_FAIL if it cannot be opened, E_INVALIDARG after printing what is
+	//! wrong with it.
+	HRESULT Read(const char* strFile);
+	void Clear();
+
+	// Positions, the normals of the positions if the file has them, and the triangles
+	std::vector<D3DXVECTOR3>& GetVertices() { return m_Vertices; }
+	std::vector<D3DXVECTOR3>& GetNormals() { return m_Normals; }
+	std::vector<Tuple3ui>& GetTriangles() { return m_Triangles; }
+
+	bool IsBinary() const { return m_bBinary; }
+	UINT64 GetFileSize() const { return m_iFileSize; }
+	//! Triangles of the fans dropped for repeating a vertex
+	UINT GetNumDegenerate() const { return m_nDegenerate; }
+
+private:
+	std::vector<D3DXVECTOR3>	m_Vertices;
+	std::vector<D3DXVECTOR3>	m_Normals;
+	std::vector<Tuple3ui>		m_Triangles;
+	UINT64						m_iFileSize;
+	UINT						m_nDegenerate;
+	bool						m_bBinary;
+};
+
+#endif
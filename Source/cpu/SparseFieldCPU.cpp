@@ -0,0 +1,401 @@
+#include "DXUT.h"
+#include <float.h>
+#include <string.h>
+#include "../geometry/Tuple3.h"
+#include "../geometry/TriangleMesh.h"
+#include "TriangleBVHCPU.h"
+#include "BoundaryFieldCPU.h"
+#include "SparseFieldCPU.h"
+
+namespace
+{
+	inline int WrapIndex(int i, int n)
+	{
+		i %= n;
+		return i < 0 ? i + n : i;
+	}
+
+	inline D3DXVECTOR4 Lerp(const D3DXVECTOR4& a, const D3DXVECTOR4& b, FLOAT t)
+	{
+		return a + (b - a) * t;
+	}
+
+	inline bool HasNormal(const D3DXVECTOR4& v)
+	{
+		return v.x != 0 || v.y != 0 || v.z != 0;
+	}
+
+	//! Bricks along one axis holding the voxels lo..hi, where lo >= -1 and hi <= n wrap
+	//! around; returns their number, duplicates included
+	int BrickRange(int lo, int hi, int n, int bricks[])
+	{
+		int nBricks = 0;
+		for(int b = max(lo, 0) >> FIELD_BRICK_SHIFT; b <= min(hi, n - 1) >> FIELD_BRICK_SHIFT; b++)
+			bricks[nBricks++] = b;
+		if(lo < 0)
+			bricks[nBricks++] = (n - 1) >> FIELD_BRICK_SHIFT;
+		if(hi >= n)
+			bricks[nBricks++] = 0;
+		return nBricks;
+	}
+}
+
+SparseFieldCPU::SparseFieldCPU()
+{
+	m_iSize[0] = m_iSize[1] = m_iSize[2] = 0;
+	m_iBricks[0] = m_iBricks[1] = m_iBricks[2] = 0;
+}
+
+void SparseFieldCPU::Clear()
+{
+	m_iSize[0] = m_iSize[1] = m_iSize[2] = 0;
+	m_iBricks[0] = m_iBricks[1] = m_iBricks[2] = 0;
+	std::vector<UINT>().swap(m_BrickSlots);
+	std::vector<D3DXVECTOR4>().swap(m_Constants);
+	std::vector<D3DXVECTOR4>().swap(m_Voxels);
+}
+
+void SparseFieldCPU::Allocate(const UINT iFieldSize[3], const std::vector<BYTE>& dense,
+	const std::vector<D3DXVECTOR4>& values)
+{
+	for(int a = 0; a < 3; a++)
+	{
+		m_iSize[a] = iFieldSize[a];
+		m_iBricks[a] = (iFieldSize[a] + FIELD_BRICK_SIZE - 1) >> FIELD_BRICK_SHIFT;
+	}
+	const UINT nBricks = m_iBricks[0] * m_iBricks[1] * m_iBricks[2];
+
+	UINT nDense = 0;
+	for(UINT b = 0; b < nBricks; b++)
+		nDense += dense[b] ? 1 : 0;
+
+	m_BrickSlots.resize(nBricks);
+	m_Constants.clear();
+	m_Constants.reserve(nBricks - nDense);
+	m_Voxels.assign((size_t)nDense * FIELD_BRICK_VOXELS, D3DXVECTOR4(0, 0, 0, 0));
+	UINT iDense = 0;
+	for(UINT b = 0; b < nBricks; b++)
+	{
+		if(dense[b])
+		{
+			m_BrickSlots[b] = iDense++;
+		}
+		else
+		{
+			m_BrickSlots[b] = CONSTANT_BRICK | (UINT)m_Constants.size();
+			m_Constants.push_back(values[b]);
+		}
+	}
+}
+
+void SparseFieldCPU::Compress(const BoundaryFieldCPU& field)
+{
+	const UINT* iSize = field.GetSize();
+	const D3DXVECTOR4* data = field.GetData();
+	const int NX = (int)iSize[0];
+	const int NY = (int)iSize[1];
+	const int NZ = (int)iSize[2];
+	const int BX = (NX + FIELD_BRICK_SIZE - 1) >> FIELD_BRICK_SHIFT;
+	const int BY = (NY + FIELD_BRICK_SIZE - 1) >> FIELD_BRICK_SHIFT;
+	const int BZ = (NZ + FIELD_BRICK_SIZE - 1) >> FIELD_BRICK_SHIFT;
+	const int nBricks = BX * BY * BZ;
+
+	std::vector<BYTE> dense(nBricks, 0);
+	std::vector<D3DXVECTOR4> values(nBricks);
+
+	#pragma omp parallel for schedule(dynamic, 16)
+	for(int b = 0; b < nBricks; b++)
+	{
+		const int x0 = (b % BX) << FIELD_BRICK_SHIFT, x1 = min(x0 + FIELD_BRICK_SIZE, NX);
+		const int y0 = ((b / BX) % BY) << FIELD_BRICK_SHIFT, y1 = min(y0 + FIELD_BRICK_SIZE, NY);
+		const int z0 = (b / (BX * BY)) << FIELD_BRICK_SHIFT, z1 = min(z0 + FIELD_BRICK_SIZE, NZ);
+
+		// Any normal within one voxel of the brick, which a lookup may blend with its voxels
+		bool bDense = false;
+		for(int z = z0 - 1; z <= z1 && !bDense; z++)
+			for(int y = y0 - 1; y <= y1 && !bDense; y++)
+			{
+				const size_t row = ((size_t)WrapIndex(z, NZ) * NY + WrapIndex(y, NY)) * NX;
+				for(int x = x0 - 1; x <= x1; x++)
+				{
+					if(HasNormal(data[row + WrapIndex(x, NX)]))
+					{
+						bDense = true;
+						break;
+					}
+				}
+			}
+		dense[b] = bDense ? 1 : 0;
+
+		double fSum = 0;
+		for(int z = z0; z < z1; z++)
+			for(int y = y0; y < y1; y++)
+				for(int x = x0; x < x1; x++)
+					fSum += data[((size_t)z * NY + y) * NX + x].w;
+		values[b] = D3DXVECTOR4(0, 0, 0, (FLOAT)(fSum / ((x1 - x0) * (y1 - y0) * (z1 - z0))));
+	}
+
+	Allocate(iSize, dense, values);
+
+	#pragma omp parallel for schedule(dynamic, 16)
+	for(int b = 0; b < nBricks; b++)
+	{
+		if(!dense[b])
+			continue;
+		const int x0 = (b % BX) << FIELD_BRICK_SHIFT, x1 = min(x0 + FIELD_BRICK_SIZE, NX);
+		const int y0 = ((b / BX) % BY) << FIELD_BRICK_SHIFT, y1 = min(y0 + FIELD_BRICK_SIZE, NY);
+		const int z0 = (b / (BX * BY)) << FIELD_BRICK_SHIFT, z1 = min(z0 + FIELD_BRICK_SIZE, NZ);
+		D3DXVECTOR4* pBrick = &m_Voxels[(size_t)m_BrickSlots[b] * FIELD_BRICK_VOXELS];
+		for(int z = z0; z < z1; z++)
+			for(int y = y0; y < y1; y++)
+				for(int x = x0; x < x1; x++)
+					pBrick[VoxelInBrick(x, y, z)] = data[((size_t)z * NY + y) * NX + x];
+	}
+}
+
+void SparseFieldCPU::BuildExact(const TriangleMesh& mesh, const D3DXVECTOR3& vBoxMin,
+	const D3DXVECTOR3& vBoxMax, const UINT iFieldSize[3])
+{
+	const int N[3] = { (int)iFieldSize[0], (int)iFieldSize[1], (int)iFieldSize[2] };
+	const int BX = (N[0] + FIELD_BRICK_SIZE - 1) >> FIELD_BRICK_SHIFT;
+	const int BY = (N[1] + FIELD_BRICK_SIZE - 1) >> FIELD_BRICK_SHIFT;
+	const int BZ = (N[2] + FIELD_BRICK_SIZE - 1) >> FIELD_BRICK_SHIFT;
+	const int nBricks = BX * BY * BZ;
+	const FLOAT fBoxMin[3] = { vBoxMin.x, vBoxMin.y, vBoxMin.z };
+	const FLOAT fVoxel[3] = { (vBoxMax.x - vBoxMin.x) / N[0], (vBoxMax.y - vBoxMin.y) / N[1],
+		(vBoxMax.z - vBoxMin.z) / N[2] };
+	const D3DXVECTOR3 vVoxel(fVoxel[0], fVoxel[1], fVoxel[2]);
+
+	// The distances of the constant bricks, from a field with one voxel per brick
+	BoundaryFieldCPU coarse;
+	const UINT iCoarseSize[3] = { (UINT)BX, (UINT)BY, (UINT)BZ };
+	coarse.Create(iCoarseSize);
+	coarse.BuildSweep(mesh, vBoxMin, vBoxMax);
+	std::vector<D3DXVECTOR4> values(coarse.GetData(), coarse.GetData() + coarse.GetNumVoxels());
+	for(int b = 0; b < nBricks; b++)
+		values[b].x = values[b].y = values[b].z = 0;
+
+	TriangleBVHCPU bvh;
+	bvh.Build(mesh);
+
+	// Voxels that can get a normal are at most FIELD_BAND_VOXELS voxel diagonals from a
+	// triangle; the bricks within one more voxel of those are dense
+	const FLOAT fRadius = FIELD_BAND_VOXELS * D3DXVec3Length(&vVoxel) * 1.01f;
+	std::vector<BYTE> dense(nBricks, 0);
+	const int B[3] = { BX, BY, BZ };
+	std::vector<int> bricks[3];
+	for(int a = 0; a < 3; a++)
+		bricks[a].resize(B[a] + 2);
+	const int nTris = bvh.IsEmpty() ? 0 : mesh.num_triangles();
+	for(int t = 0; t < nTris; t++)
+	{
+		const Tuple3ui& tri = mesh.triangle_ids(t);
+		const D3DXVECTOR3& p0 = mesh.vertex(tri.x);
+		const D3DXVECTOR3& p1 = mesh.vertex(tri.y);
+		const D3DXVECTOR3& p2 = mesh.vertex(tri.z);
+		const FLOAT fMin[3] = { min(p0.x, min(p1.x, p2.x)), min(p0.y, min(p1.y, p2.y)), min(p0.z, min(p1.z, p2.z)) };
+		const FLOAT fMax[3] = { max(p0.x, max(p1.x, p2.x)), max(p0.y, max(p1.y, p2.y)), max(p0.z, max(p1.z, p2.z)) };
+
+		int nBricksAxis[3];
+		bool bEmpty = false;
+		for(int a = 0; a < 3; a++)
+		{
+			int lo = (int)floorf((fMin[a] - fRadius - fBoxMin[a]) / fVoxel[a] - 0.5f);
+			int hi = (int)ceilf((fMax[a] + fRadius - fBoxMin[a]) / fVoxel[a] - 0.5f);
+			lo = max(lo, 0) - 1;
+			hi = min(hi, N[a] - 1) + 1;
+			bEmpty |= hi < lo;
+			nBricksAxis[a] = bEmpty ? 0 : BrickRange(lo, hi, N[a], &bricks[a][0]);
+		}
+		for(int k = 0; k < nBricksAxis[2]; k++)
+			for(int j = 0; j < nBricksAxis[1]; j++)
+				for(int i = 0; i < nBricksAxis[0]; i++)
+					dense[(bricks[2][k] * BY + bricks[1][j]) * BX + bricks[0][i]] = 1;
+	}
+
+	// The boxes of large triangles cover bricks far from them; keep the bricks whose
+	// center is close enough to the mesh for a voxel within one voxel of them to be in
+	// the band. The bricks on the border also blend with the opposite one and stay.
+	const FLOAT fHalfBrick = (0.5f * FIELD_BRICK_SIZE + 1.0f) * D3DXVec3Length(&vVoxel);
+	#pragma omp parallel for schedule(dynamic, 64)
+	for(int b = 0; b < nBricks; b++)
+	{
+		if(!dense[b])
+			continue;
+		const int x0 = (b % BX) << FIELD_BRICK_SHIFT, x1 = min(x0 + FIELD_BRICK_SIZE, N[0]);
+		const int y0 = ((b / BX) % BY) << FIELD_BRICK_SHIFT, y1 = min(y0 + FIELD_BRICK_SIZE, N[1]);
+		const int z0 = (b / (BX * BY)) << FIELD_BRICK_SHIFT, z1 = min(z0 + FIELD_BRICK_SIZE, N[2]);
+		if(x0 == 0 || y0 == 0 || z0 == 0 || x1 == N[0] || y1 == N[1] || z1 == N[2])
+			continue;
+		const D3DXVECTOR3 vCenter(vBoxMin.x + 0.5f * (x0 + x1) * vVoxel.x, vBoxMin.y + 0.5f * (y0 + y1) * vVoxel.y,
+			vBoxMin.z + 0.5f * (z0 + z1) * vVoxel.z);
+		const FLOAT fBound = fHalfBrick + fRadius;
+		TriangleBVHHit hit;
+		if(!bvh.ClosestPoint(vCenter, fBound * fBound, hit))
+			dense[b] = 0;
+	}
+	Allocate(iFieldSize, dense, values);
+
+	std::vector<int> denseBricks;
+	denseBricks.reserve(GetNumDenseBricks());
+	for(int b = 0; b < nBricks; b++)
+		if(dense[b])
+			denseBricks.push_back(b);
+
+	// A voxel is at most half a brick diagonal from the brick center, whose distance the
+	// coarse field has; one more voxel covers the coarse error
+	const FLOAT fBrickRadius = (0.5f * FIELD_BRICK_SIZE + 1.0f) * D3DXVec3Length(&vVoxel);
+
+	#pragma omp parallel for schedule(dynamic, 1)
+	for(int i = 0; i < (int)denseBricks.size(); i++)
+	{
+		const int b = denseBricks[i];
+		const int x0 = (b % BX) << FIELD_BRICK_SHIFT, x1 = min(x0 + FIELD_BRICK_SIZE, N[0]);
+		const int y0 = ((b / BX) % BY) << FIELD_BRICK_SHIFT, y1 = min(y0 + FIELD_BRICK_SIZE, N[1]);
+		const int z0 = (b / (BX * BY)) << FIELD_BRICK_SHIFT, z1 = min(z0 + FIELD_BRICK_SIZE, N[2]);
+		D3DXVECTOR4* pBrick = &m_Voxels[(size_t)m_BrickSlots[b] * FIELD_BRICK_VOXELS];
+		const FLOAT fBrickBound = fabsf(values[b].w) + fBrickRadius;
+
+		for(int z = z0; z < z1; z++)
+			for(int y = y0; y < y1; y++)
+			{
+				// As in BoundaryFieldCPU::BuildExact, the previous voxel bounds the search
+				FLOAT fPrevDist = FLT_MAX;
+				for(int x = x0; x < x1; x++)
+				{
+					const D3DXVECTOR3 p(vBoxMin.x + (x + 0.5f) * vVoxel.x, vBoxMin.y + (y + 0.5f) * vVoxel.y,
+						vBoxMin.z + (z + 0.5f) * vVoxel.z);
+					FLOAT fBound = fBrickBound;
+					if(fPrevDist < FLT_MAX)
+						fBound = min(fBound, (fPrevDist + vVoxel.x) * 1.001f + 1e-6f);
+					TriangleBVHHit hit;
+					if(!bvh.ClosestPoint(p, fBound * fBound, hit))
+						bvh.ClosestPoint(p, FLT_MAX, hit);
+
+					fPrevDist = sqrtf(hit.fDistSq);
+					pBrick[VoxelInBrick(x, y, z)] = BoundaryFieldCPU::ClosestPointValue(mesh, bvh, p, hit, vVoxel);
+				}
+			}
+	}
+
+	DropEmptyBricks();
+}
+
+void SparseFieldCPU::DropEmptyBricks()
+{
+	const int NX = (int)m_iSize[0];
+	const int NY = (int)m_iSize[1];
+	const int NZ = (int)m_iSize[2];
+	const int BX = (int)m_iBricks[0];
+	const int BY = (int)m_iBricks[1];
+	const int nBricks = (int)m_BrickSlots.size();
+
+	std::vector<BYTE> keep(nBricks, 0);
+	std::vector<D3DXVECTOR4> values(nBricks);
+
+	#pragma omp parallel for schedule(dynamic, 16)
+	for(int b = 0; b < nBricks; b++)
+	{
+		const UINT slot = m_BrickSlots[b];
+		if(slot & CONSTANT_BRICK)
+		{
+			values[b] = m_Constants[slot & ~CONSTANT_BRICK];
+			continue;
+		}
+		const int x0 = (b % BX) << FIELD_BRICK_SHIFT, x1 = min(x0 + FIELD_BRICK_SIZE, NX);
+		const int y0 = ((b / BX) % BY) << FIELD_BRICK_SHIFT, y1 = min(y0 + FIELD_BRICK_SIZE, NY);
+		const int z0 = (b / (BX * BY)) << FIELD_BRICK_SHIFT, z1 = min(z0 + FIELD_BRICK_SIZE, NZ);
+
+		// The test of Compress, on the neighbor bricks as they are now
+		bool bDense = false;
+		for(int z = z0 - 1; z <= z1 && !bDense; z++)
+			for(int y = y0 - 1; y <= y1 && !bDense; y++)
+				for(int x = x0 - 1; x <= x1; x++)
+				{
+					if(HasNormal(Voxel(WrapIndex(x, NX), WrapIndex(y, NY), WrapIndex(z, NZ))))
+					{
+						bDense = true;
+						break;
+					}
+				}
+		keep[b] = bDense ? 1 : 0;
+
+		double fSum = 0;
+		for(int z = z0; z < z1; z++)
+			for(int y = y0; y < y1; y++)
+				for(int x = x0; x < x1; x++)
+					fSum += Voxel(x, y, z).w;
+		values[b] = D3DXVECTOR4(0, 0, 0, (FLOAT)(fSum / ((x1 - x0) * (y1 - y0) * (z1 - z0))));
+	}
+
+	std::vector<UINT> oldSlots;
+	std::vector<D3DXVECTOR4> oldVoxels;
+	oldSlots.swap(m_BrickSlots);
+	oldVoxels.swap(m_Voxels);
+	const UINT iSize[3] = { m_iSize[0], m_iSize[1], m_iSize[2] };
+	Allocate(iSize, keep, values);
+
+	#pragma omp parallel for schedule(static)
+	for(int b = 0; b < nBricks; b++)
+	{
+		if(keep[b])
+			memcpy(&m_Voxels[(size_t)m_BrickSlots[b] * FIELD_BRICK_VOXELS],
+				&oldVoxels[(size_t)oldSlots[b] * FIELD_BRICK_VOXELS], FIELD_BRICK_VOXELS * sizeof(D3DXVECTOR4));
+	}
+}
+
+D3DXVECTOR4 SparseFieldCPU::SampleLinear(const D3DXVECTOR3& vUnitPos) const
+{
+	const int NX = (int)m_iSize[0];
+	const int NY = (int)m_iSize[1];
+	const int NZ = (int)m_iSize[2];
+
+	FLOAT fx = vUnitPos.x * NX - 0.5f;
+	FLOAT fy = vUnitPos.y * NY - 0.5f;
+	FLOAT fz = vUnitPos.z * NZ - 0.5f;
+	FLOAT flx = floorf(fx), fly = floorf(fy), flz = floorf(fz);
+	FLOAT tx = fx - flx, ty = fy - fly, tz = fz - flz;
+
+	int x0 = WrapIndex((int)flx, NX), x1 = WrapIndex((int)flx + 1, NX);
+	int y0 = WrapIndex((int)fly, NY), y1 = WrapIndex((int)fly + 1, NY);
+	int z0 = WrapIndex((int)flz, NZ), z1 = WrapIndex((int)flz + 1, NZ);
+
+	// Corners in the order of BoundaryFieldCPU::SampleLinear, so the blend is the same
+	D3DXVECTOR4 v[8];
+	if(((x0 ^ x1) | (y0 ^ y1) | (z0 ^ z1)) >> FIELD_BRICK_SHIFT)
+	{
+		v[0] = Voxel(x0, y0, z0); v[1] = Voxel(x1, y0, z0);
+		v[2] = Voxel(x0, y1, z0); v[3] = Voxel(x1, y1, z0);
+		v[4] = Voxel(x0, y0, z1); v[5] = Voxel(x1, y0, z1);
+		v[6] = Voxel(x0, y1, z1); v[7] = Voxel(x1, y1, z1);
+	}
+	else
+	{
+		// All in one brick; a constant one blends to its value
+		const UINT slot = m_BrickSlots[BrickIndex(x0 >> FIELD_BRICK_SHIFT, y0 >> FIELD_BRICK_SHIFT, z0 >> FIELD_BRICK_SHIFT)];
+		if(slot & CONSTANT_BRICK)
+			return m_Constants[slot & ~CONSTANT_BRICK];
+		const D3DXVECTOR4* pBrick = &m_Voxels[(size_t)slot * FIELD_BRICK_VOXELS];
+		v[0] = pBrick[VoxelInBrick(x0, y0, z0)]; v[1] = pBrick[VoxelInBrick(x1, y0, z0)];
+		v[2] = pBrick[VoxelInBrick(x0, y1, z0)]; v[3] = pBrick[VoxelInBrick(x1, y1, z0)];
+		v[4] = pBrick[VoxelInBrick(x0, y0, z1)]; v[5] = pBrick[VoxelInBrick(x1, y0, z1)];
+		v[6] = pBrick[VoxelInBrick(x0, y1, z1)]; v[7] = pBrick[VoxelInBrick(x1, y1, z1)];
+	}
+
+	D3DXVECTOR4 c00 = Lerp(v[0], v[1], tx);
+	D3DXVECTOR4 c10 = Lerp(v[2], v[3], tx);
+	D3DXVECTOR4 c01 = Lerp(v[4], v[5], tx);
+	D3DXVECTOR4 c11 = Lerp(v[6], v[7], tx);
+
+	return Lerp(Lerp(c00, c10, ty), Lerp(c01, c11, ty), tz);
+}
+
+size_t SparseFieldCPU::GetMemorySize() const
+{
+	return m_BrickSlots.size() * sizeof(UINT) + (m_Constants.size() + m_Voxels.size()) * sizeof(D3DXVECTOR4);
+}
+
+size_t SparseFieldCPU::GetDenseMemorySize() const
+{
+	return (size_t)m_iSize[0] * m_iSize[1] * m_iSize[2] * sizeof(D3DXVECTOR4);
+}
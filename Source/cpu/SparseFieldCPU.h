@@ -0,0 +1,91 @@
+//--------------------------------------------------------------------------------------
+// File: SparseFieldCPU.h
+//
+// Block-sparse boundary field. The volume is split into FIELD_BRICK_SIZE^3 bricks; the
+// bricks around the surface band keep every voxel, all others are a single constant
+// value with a zero normal. A brick is dense if it has a voxel with a normal within one
+// voxel of it (with the wrap addressing of g_SampleLinear), so every trilinear lookup
+// VelocityCS would see a normal in reads dense bricks only and returns exactly what the
+// dense BoundaryFieldCPU returns. Away from the band the normal is zero either way and
+// only the distance differs.
+//--------------------------------------------------------------------------------------
+#ifndef CPU_SPARSE_FIELD_H
+#define CPU_SPARSE_FIELD_H
+
+#include <vector>
+
+#define FIELD_BRICK_SHIFT 3
+#define FIELD_BRICK_SIZE (1 << FIELD_BRICK_SHIFT)	// voxels per axis
+#define FIELD_BRICK_VOXELS (FIELD_BRICK_SIZE * FIELD_BRICK_SIZE * FIELD_BRICK_SIZE)
+
+class TriangleMesh;
+class BoundaryFieldCPU;
+
+class SparseFieldCPU
+{
+public:
+	SparseFieldCPU();
+
+	//! Release the bricks
+	void Clear();
+
+	/*!
+	 * Bricks of field; the constant bricks take the average distance of their voxels.
+	 */
+	void Compress(const BoundaryFieldCPU& field);
+
+	/*!
+	 * The BoundaryFieldCPU::BuildExact field at iFieldSize without the dense volume: only
+	 * the bricks within the band of a triangle are computed voxel by voxel. The constant
+	 * bricks take the distance of a BuildSweep field with one voxel per brick.
+	 */
+	void BuildExact(const TriangleMesh& mesh, const D3DXVECTOR3& vBoxMin, const D3DXVECTOR3& vBoxMax,
+		const UINT iFieldSize[3]);
+
+	//! Same lookup as BoundaryFieldCPU::SampleLinear
+	D3DXVECTOR4 SampleLinear(const D3DXVECTOR3& vUnitPos) const;
+
+	D3DXVECTOR4 Voxel(UINT x, UINT y, UINT z) const
+	{
+		const UINT slot = m_BrickSlots[BrickIndex(x >> FIELD_BRICK_SHIFT, y >> FIELD_BRICK_SHIFT, z >> FIELD_BRICK_SHIFT)];
+		if(slot & CONSTANT_BRICK)
+			return m_Constants[slot & ~CONSTANT_BRICK];
+		return m_Voxels[(size_t)slot * FIELD_BRICK_VOXELS + VoxelInBrick(x, y, z)];
+	}
+
+	const UINT* GetSize() const { return m_iSize; }
+	UINT GetNumBricks() const { return (UINT)m_BrickSlots.size(); }
+	UINT GetNumDenseBricks() const { return (UINT)(m_Voxels.size() / FIELD_BRICK_VOXELS); }
+	size_t GetMemorySize() const;
+	//! Size of the dense BoundaryFieldCPU of the same resolution
+	size_t GetDenseMemorySize() const;
+
+private:
+	// Set in the slot of a constant brick, the rest indexes m_Constants
+	static const UINT CONSTANT_BRICK = 0x80000000;
+
+	UINT BrickIndex(UINT bx, UINT by, UINT bz) const
+	{
+		return (bz * m_iBricks[1] + by) * m_iBricks[0] + bx;
+	}
+	static UINT VoxelInBrick(UINT x, UINT y, UINT z)
+	{
+		const UINT m = FIELD_BRICK_SIZE - 1;
+		return ((((z & m) << FIELD_BRICK_SHIFT) + (y & m)) << FIELD_BRICK_SHIFT) + (x & m);
+	}
+
+	//! Size the brick grid for iFieldSize and give the bricks with dense[] set voxel
+	//! storage, the others the constant values[] (indexed by brick)
+	void Allocate(const UINT iFieldSize[3], const std::vector<BYTE>& dense, const std::vector<D3DXVECTOR4>& values);
+
+	//! Turn the dense bricks without a normal within one voxel into constant ones
+	void DropEmptyBricks();
+
+	UINT						m_iSize[3];
+	UINT						m_iBricks[3];
+	std::vector<UINT>			m_BrickSlots;	// dense brick index or CONSTANT_BRICK | constant index
+	std::vector<D3DXVECTOR4>	m_Constants;
+	std::vector<D3DXVECTOR4>	m_Voxels;		// FIELD_BRICK_VOXELS per dense brick, x fastest
+};
+
+#endif
@@ -0,0 +1,214 @@
+#include "DXUT.h"
+#include <string.h>
+#include "BufferedFileCPU.h"
+#include "ObjParserCPU.h"
+#include "StlReaderCPU.h"
+
+#define STL_HEADER_SIZE 80
+// Normal, three corners and the attribute byte count
+#define STL_TRIANGLE_SIZE 50
+
+namespace
+{
+	const UINT STL_EMPTY_SLOT = 0xFFFFFFFF;
+
+	inline UINT FloatBits(FLOAT f)
+	{
+		UINT i;
+		memcpy(&i, &f, sizeof(i));
+		return i;
+	}
+
+	inline UINT HashPosition(const D3DXVECTOR3& p)
+	{
+		// Murmur3 finalizer over the three bit patterns
+		UINT h = FloatBits(p.x) * 0x9E3779B1u ^ FloatBits(p.y) * 0x85EBCA77u ^ FloatBits(p.z) * 0xC2B2AE3Du;
+		h ^= h >> 16;
+		h *= 0x85EBCA6Bu;
+		h ^= h >> 13;
+		h *= 0xC2B2AE35u;
+		h ^= h >> 16;
+		return h;
+	}
+
+	inline bool SamePosition(const D3DXVECTOR3& a, const D3DXVECTOR3& b)
+	{
+		return memcmp(&a, &b, sizeof(D3DXVECTOR3)) == 0;
+	}
+
+	inline bool IsKeyword(const char* pBegin, const char* pEnd, const char* strKeyword)
+	{
+		const size_t n = strlen(strKeyword);
+		return (size_t)(pEnd - pBegin) == n && memcmp(pBegin, strKeyword, n) == 0;
+	}
+
+	inline bool IsNumber(const char* pBegin, const char* pEnd)
+	{
+		return pBegin < pEnd && ((*pBegin >= '0' && *pBegin <= '9') || *pBegin == '-' || *pBegin == '+' ||
+			*pBegin == '.');
+	}
+}
+
+StlReaderCPU::StlReaderCPU() :
+	m_iFileSize(0),
+	m_nDegenerate(0),
+	m_bBinary(false)
+{
+}
+
+void StlReaderCPU::Clear()
+{
+	std::vector<D3DXVECTOR3>().swap(m_Vertices);
+	std::vector<Tuple3ui>().swap(m_Triangles);
+	std::vector<Slot>().swap(m_Table);
+	m_iFileSize = 0;
+	m_nDegenerate = 0;
+	m_bBinary = false;
+}
+
+HRESULT StlReaderCPU::Read(const char* strFile)
+{
+	Clear();
+
+	BufferedFileCPU file;
+	if(FAILED(file.Open(strFile)))
+		return E_FAIL;
+	m_iFileSize = file.GetSize();
+
+	// Binary files may start with "solid" too, so the size decides: the header, the
+	// triangle count and exactly that many triangles
+	const BYTE* pHeader = file.Read(STL_HEADER_SIZE + sizeof(UINT));
+	UINT nTriangles = 0;
+	if(pHeader)
+		memcpy(&nTriangles, pHeader + STL_HEADER_SIZE, sizeof(UINT));
+	m_bBinary = pHeader && m_iFileSize == STL_HEADER_SIZE + sizeof(UINT) + (UINT64)nTriangles * STL_TRIANGLE_SIZE;
+	if(m_bBinary)
+		return ReadBinary(file, nTriangles);
+
+	file.Close();
+	file.Open(strFile);
+	return ReadText(file);
+}
+
+HRESULT StlReaderCPU::ReadBinary(BufferedFileCPU& file, UINT nTriangles)
+{
+	m_Triangles.reserve(nTriangles);
+	m_Vertices.reserve(nTriangles / 2 + 3);
+	// A closed mesh has about half as many vertices as triangles
+	size_t nSize = 64;
+	while(nSize < (size_t)nTriangles)
+		nSize *= 2;
+	GrowTable(nSize);
+
+	for(UINT t = 0; t < nTriangles; t++)
+	{
+		const BYTE* p = file.Read(STL_TRIANGLE_SIZE);
+		if(!p)
+		{
+			printf("Unexpected end of the STL file at triangle %u.\n", t);
+			return E_INVALIDARG;
+		}
+		FLOAT v[9];
+		memcpy(v, p + 3 * sizeof(FLOAT), sizeof(v));
+		AddTriangle(Weld(v[0], v[1], v[2]), Weld(v[3], v[4], v[5]), Weld(v[6], v[7], v[8]));
+	}
+	return S_OK;
+}
+
+HRESULT StlReaderCPU::ReadText(BufferedFileCPU& file)
+{
+	GrowTable(1024);
+
+	const char *pBegin, *pEnd;
+	if(!file.ReadToken(pBegin, pEnd) || !IsKeyword(pBegin, pEnd, "solid"))
+	{
+		printf("Incorrect STL file format at Line %u.\n", file.GetLine());
+		return E_INVALIDARG;
+	}
+	// The name of the solid may contain anything
+	file.ReadLine(pBegin, pEnd);
+
+	UINT iCorner = 0;
+	UINT corners[3];
+	while(file.ReadToken(pBegin, pEnd))
+	{
+		if(IsKeyword(pBegin, pEnd, "vertex"))
+		{
+			FLOAT v[3];
+			for(int k = 0; k < 3; k++)
+			{
+				if(!file.ReadToken(pBegin, pEnd) || !IsNumber(pBegin, pEnd))
+				{
+					printf("Incorrect STL file format at Line %u.\n", file.GetLine());
+					return E_INVALIDARG;
+				}
+				v[k] = (FLOAT)ObjParserCPU::ParseNumber(pBegin, pEnd);
+			}
+			corners[iCorner++] = Weld(v[0], v[1], v[2]);
+			if(iCorner == 3)
+			{
+				AddTriangle(corners[0], corners[1], corners[2]);
+				iCorner = 0;
+			}
+		}
+		else if(IsKeyword(pBegin, pEnd, "endloop"))
+		{
+			if(iCorner != 0)
+			{
+				printf("Incorrect STL file format at Line %u.\n", file.GetLine());
+				return E_INVALIDARG;
+			}
+		}
+		else if(IsKeyword(pBegin, pEnd, "solid") || IsKeyword(pBegin, pEnd, "endsolid"))
+		{
+			file.ReadLine(pBegin, pEnd);
+		}
+	}
+	return S_OK;
+}
+
+void StlReaderCPU::AddTriangle(UINT a, UINT b, UINT c)
+{
+	// Corners closer than a float apart become one, which leaves no triangle
+	if(a == b || b == c || c == a)
+		m_nDegenerate++;
+	else
+		m_Triangles.push_back(Tuple3ui(a, b, c));
+}
+
+UINT StlReaderCPU::Weld(FLOAT x, FLOAT y, FLOAT z)
+{
+	// Adding zero turns -0 into 0, so both weld
+	const D3DXVECTOR3 p(x + 0.0f, -z + 0.0f, y + 0.0f);
+	const UINT iMask = (UINT)m_Table.size() - 1;
+	UINT h = HashPosition(p) & iMask;
+	for(; m_Table[h].iVertex != STL_EMPTY_SLOT; h = (h + 1) & iMask)
+		if(SamePosition(m_Table[h].vPosition, p))
+			return m_Table[h].iVertex;
+
+	const UINT iVertex = (UINT)m_Vertices.size();
+	m_Vertices.push_back(p);
+	m_Table[h].vPosition = p;
+	m_Table[h].iVertex = iVertex;
+	// At most half full, so the probes stay short
+	if(m_Vertices.size() * 2 > m_Table.size())
+		GrowTable(m_Table.size() * 2);
+	return iVertex;
+}
+
+void StlReaderCPU::GrowTable(size_t nSize)
+{
+	Slot empty;
+	empty.vPosition = D3DXVECTOR3(0, 0, 0);
+	empty.iVertex = STL_EMPTY_SLOT;
+	m_Table.assign(nSize, empty);
+	const UINT iMask = (UINT)m_Table.size() - 1;
+	for(UINT i = 0; i < (UINT)m_Vertices.size(); i++)
+	{
+		UINT h = HashPosition(m_Vertices[i]) & iMask;
+		while(m_Table[h].iVertex != STL_EMPTY_SLOT)
+			h = (h + 1) & iMask;
+		m_Table[h].vPosition = m_Vertices[i];
+		m_Table[h].iVertex = i;
+	}
+}
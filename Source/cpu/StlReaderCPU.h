@@ -0,0 +1,61 @@
+//--------------------------------------------------------------------------------------
+// File: StlReaderCPU.h
+//
+// Streaming reader of binary and ASCII STL files. STL stores each triangle with its own
+// three corners, so the corners are welded into shared vertices as they are read: a hash
+// table of the vertices keyed on the exact position, grown by doubling. Triangles
+// that lose a corner to the welding are dropped. The file
+// goes through BufferedFileCPU in one pass and the facet normals are ignored. Positions
+// get the axis swap of MeshObjReader, so an STL and an OBJ export of the same model end
+// up the same way up.
+//--------------------------------------------------------------------------------------
+#ifndef CPU_STL_READER_H
+#define CPU_STL_READER_H
+
+#include <vector>
+#include "../geometry/Tuple3.h"
+
+class BufferedFileCPU;
+
+class StlReaderCPU
+{
+public:
+	StlReaderCPU();
+
+	//! Read strFile. E_FAIL if it cannot be opened, E_INVALIDARG after printing what is
+	//! wrong with it.
+	HRESULT Read(const char* strFile);
+	void Clear();
+
+	// Welded positions in the order they first appear, and the triangles
+	std::vector<D3DXVECTOR3>& GetVertices() { return m_Vertices; }
+	std::vector<Tuple3ui>& GetTriangles() { return m_Triangles; }
+
+	bool IsBinary() const { return m_bBinary; }
+	//! Triangles dropped because welding merged two of their corners
+	UINT GetNumDegenerate() const { return m_nDegenerate; }
+	UINT64 GetFileSize() const { return m_iFileSize; }
+
+private:
+	HRESULT ReadBinary(BufferedFileCPU& file, UINT nTriangles);
+	HRESULT ReadText(BufferedFileCPU& file);
+	UINT Weld(FLOAT x, FLOAT y, FLOAT z);
+	void AddTriangle(UINT a, UINT b, UINT c);
+	void GrowTable(size_t nSize);
+
+	// The position is kept with the index, so a probe reads no other memory
+	struct Slot
+	{
+		D3DXVECTOR3	vPosition;
+		UINT		iVertex;
+	};
+
+	std::vector<D3DXVECTOR3>	m_Vertices;
+	std::vector<Tuple3ui>		m_Triangles;
+	std::vector<Slot>			m_Table;	// by hash of the position, open addressing
+	UINT64						m_iFileSize;
+	UINT						m_nDegenerate;
+	bool						m_bBinary;
+};
+
+#endif
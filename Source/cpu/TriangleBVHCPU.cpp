@@ -0,0 +1,669 @@
+#include "DXUT.h"
+#include <algorithm>
+#include <unordered_map>
+#include <float.h>
+#include "../geometry/Tuple3.h"
+#include "../geometry/TriangleMesh.h"
+#include "TriangleBVHCPU.h"
+
+// Triangles per leaf; the SAH may stop at up to BVH_MAX_LEAF_SIZE if that is cheaper
+#define BVH_LEAF_SIZE 4
+#define BVH_MAX_LEAF_SIZE 8
+#define BVH_MAX_DEPTH 64
+// Bins per axis of the SAH, and the cost of visiting a node relative to testing a triangle
+#define BVH_SAH_BINS 16
+#define BVH_SAH_NODE_COST 1.0f
+
+namespace
+{
+	inline FLOAT Dot(const D3DXVECTOR3& a, const D3DXVECTOR3& b)
+	{
+		return a.x * b.x + a.y * b.y + a.z * b.z;
+	}
+
+	inline D3DXVECTOR3 SafeNormalize(const D3DXVECTOR3& v)
+	{
+		FLOAT l = sqrtf(Dot(v, v));
+		return l > 0 ? v / l : D3DXVECTOR3(0, 0, 0);
+	}
+
+	//! Angle of the corner at b, robust for short edges
+	inline FLOAT CornerAngle(const D3DXVECTOR3& a, const D3DXVECTOR3& b, const D3DXVECTOR3& c)
+	{
+		D3DXVECTOR3 u = a - b, v = c - b, n;
+		D3DXVec3Cross(&n, &u, &v);
+		return atan2f(sqrtf(Dot(n, n)), Dot(u, v));
+	}
+
+	//! Half the surface area of the box
+	inline FLOAT HalfArea(const D3DXVECTOR3& vMin, const D3DXVECTOR3& vMax)
+	{
+		const D3DXVECTOR3 e = vMax - vMin;
+		return e.x * e.y + e.y * e.z + e.z * e.x;
+	}
+
+	inline UINT64 EdgeKey(UINT a, UINT b)
+	{
+		return a < b ? ((UINT64)a << 32) | b : ((UINT64)b << 32) | a;
+	}
+
+	/*!
+	 * Closest point to p on the triangle abc (Ericson, "Real-Time Collision Detection",
+	 * 5.1.5), with the feature it lies on and its barycentric coordinates
+	 */
+	D3DXVECTOR3 ClosestPointOnTriangle(const D3DXVECTOR3& p, const D3DXVECTOR3& a, const D3DXVECTOR3& b,
+		const D3DXVECTOR3& c, TriangleFeature& eFeature, FLOAT fBary[3])
+	{
+		const D3DXVECTOR3 ab = b - a;
+		const D3DXVECTOR3 ac = c - a;
+		const D3DXVECTOR3 ap = p - a;
+		const FLOAT d1 = Dot(ab, ap);
+		const FLOAT d2 = Dot(ac, ap);
+		if(d1 <= 0 && d2 <= 0)
+		{
+			eFeature = TRIANGLE_VERTEX0;
+			fBary[0] = 1; fBary[1] = 0; fBary[2] = 0;
+			return a;
+		}
+
+		const D3DXVECTOR3 bp = p - b;
+		const FLOAT d3 = Dot(ab, bp);
+		const FLOAT d4 = Dot(ac, bp);
+		if(d3 >= 0 && d4 <= d3)
+		{
+			eFeature = TRIANGLE_VERTEX1;
+			fBary[0] = 0; fBary[1] = 1; fBary[2] = 0;
+			return b;
+		}
+
+		const FLOAT vc = d1 * d4 - d3 * d2;
+		if(vc <= 0 && d1 >= 0 && d3 <= 0)
+		{
+			const FLOAT v = d1 / (d1 - d3);
+			eFeature = TRIANGLE_EDGE01;
+			fBary[0] = 1 - v; fBary[1] = v; fBary[2] = 0;
+			return a + v * ab;
+		}
+
+		const D3DXVECTOR3 cp = p - c;
+		const FLOAT d5 = Dot(ab, cp);
+		const FLOAT d6 = Dot(ac, cp);
+		if(d6 >= 0 && d5 <= d6)
+		{
+			eFeature = TRIANGLE_VERTEX2;
+			fBary[0] = 0; fBary[1] = 0; fBary[2] = 1;
+			return c;
+		}
+
+		const FLOAT vb = d5 * d2 - d1 * d6;
+		if(vb <= 0 && d2 >= 0 && d6 <= 0)
+		{
+			const FLOAT w = d2 / (d2 - d6);
+			eFeature = TRIANGLE_EDGE20;
+			fBary[0] = 1 - w; fBary[1] = 0; fBary[2] = w;
+			return a + w * ac;
+		}
+
+		const FLOAT va = d3 * d6 - d5 * d4;
+		if(va <= 0 && (d4 - d3) >= 0 && (d5 - d6) >= 0)
+		{
+			const FLOAT w = (d4 - d3) / ((d4 - d3) + (d5 - d6));
+			eFeature = TRIANGLE_EDGE12;
+			fBary[0] = 0; fBary[1] = 1 - w; fBary[2] = w;
+			return b + w * (c - b);
+		}
+
+		const FLOAT fSum = va + vb + vc;
+		if(!(fSum > 0))
+		{
+			// Degenerate triangle that none of the tests above caught
+			eFeature = TRIANGLE_VERTEX0;
+			fBary[0] = 1; fBary[1] = 0; fBary[2] = 0;
+			return a;
+		}
+		const FLOAT v = vb / fSum;
+		const FLOAT w = vc / fSum;
+		eFeature = TRIANGLE_FACE;
+		fBary[0] = 1 - v - w; fBary[1] = v; fBary[2] = w;
+		return a + ab * v + ac * w;
+	}
+}
+
+TriangleBVHCPU::TriangleBVHCPU() :
+	m_iDepth(0)
+{
+}
+
+void TriangleBVHCPU::Build(const TriangleMesh& mesh, TriangleBVHSplit eSplit)
+{
+	const int nTris = mesh.num_triangles();
+	const int nVerts = mesh.num_vertices();
+
+	m_Nodes.clear();
+	m_Triangles.clear();
+	m_TriangleVertices.resize((size_t)nTris * 3);
+	m_FaceNormals.resize(nTris);
+	m_EdgeNormals.resize((size_t)nTris * 3);
+	m_VertexNormals.assign(nVerts, D3DXVECTOR3(0, 0, 0));
+	m_iDepth = 0;
+	if(nTris == 0)
+		return;
+
+	BuildInput input;
+	input.eSplit = eSplit;
+	input.centroids.resize(nTris);
+	input.boxMin.resize(nTris);
+	input.boxMax.resize(nTris);
+	std::vector<D3DXVECTOR3>& centroids = input.centroids;
+	#pragma omp parallel for schedule(static)
+	for(int t = 0; t < nTris; t++)
+	{
+		const Tuple3ui& tri = mesh.triangle_ids(t);
+		const D3DXVECTOR3& a = mesh.vertex(tri.x);
+		const D3DXVECTOR3& b = mesh.vertex(tri.y);
+		const D3DXVECTOR3& c = mesh.vertex(tri.z);
+		D3DXVECTOR3 e0 = b - a, e1 = c - a, n;
+		D3DXVec3Cross(&n, &e0, &e1);
+		m_FaceNormals[t] = SafeNormalize(n);
+		m_TriangleVertices[t * 3] = tri.x;
+		m_TriangleVertices[t * 3 + 1] = tri.y;
+		m_TriangleVertices[t * 3 + 2] = tri.z;
+		centroids[t] = (a + b + c) * (1.0f / 3.0f);
+		D3DXVec3Minimize(&input.boxMin[t], &a, &b);
+		D3DXVec3Minimize(&input.boxMin[t], &input.boxMin[t], &c);
+		D3DXVec3Maximize(&input.boxMax[t], &a, &b);
+		D3DXVec3Maximize(&input.boxMax[t], &input.boxMax[t], &c);
+	}
+
+	// Pseudonormals: angle weighted face normals at the vertices, the sum of the (usually
+	// two) face normals at the edges
+	std::unordered_map<UINT64, D3DXVECTOR3> edges;
+	edges.reserve((size_t)nTris * 2);
+	for(int t = 0; t < nTris; t++)
+	{
+		const UINT* v = &m_TriangleVertices[t * 3];
+		const D3DXVECTOR3& n = m_FaceNormals[t];
+		for(int i = 0; i < 3; i++)
+		{
+			const UINT i0 = v[i], i1 = v[(i + 1) % 3], i2 = v[(i + 2) % 3];
+			m_VertexNormals[i0] += n * CornerAngle(mesh.vertex(i2), mesh.vertex(i0), mesh.vertex(i1));
+			std::unordered_map<UINT64, D3DXVECTOR3>::iterator it = edges.find(EdgeKey(i0, i1));
+			if(it == edges.end())
+				edges[EdgeKey(i0, i1)] = n;
+			else
+				it->second += n;
+		}
+	}
+	#pragma omp parallel for schedule(static)
+	for(int t = 0; t < nTris; t++)
+	{
+		const UINT* v = &m_TriangleVertices[t * 3];
+		for(int i = 0; i < 3; i++)
+			m_EdgeNormals[t * 3 + i] = edges.find(EdgeKey(v[i], v[(i + 1) % 3]))->second;
+	}
+
+	std::vector<UINT>& order = input.order;
+	order.resize(nTris);
+	for(int t = 0; t < nTris; t++)
+		order[t] = t;
+	m_Nodes.reserve(2 * (nTris / BVH_LEAF_SIZE + 1));
+	BuildNode(input, 0, nTris, 1);
+
+	m_Triangles.resize(nTris);
+	#pragma omp parallel for schedule(static)
+	for(int i = 0; i < nTris; i++)
+	{
+		const UINT t = order[i];
+		LeafTriangle& leaf = m_Triangles[i];
+		for(int c = 0; c < 3; c++)
+			leaf.v[c] = mesh.vertex(m_TriangleVertices[t * 3 + c]);
+		leaf.iTriangle = t;
+	}
+
+	// Children come after their parent
+	for(int i = (int)m_Nodes.size() - 1; i >= 0; i--)
+	{
+		Node& node = m_Nodes[i];
+		D3DXVECTOR3 vMin(FLT_MAX, FLT_MAX, FLT_MAX), vMax(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+		if(node.nTriangles)
+		{
+			for(UINT t = node.iFirst; t < node.iFirst + node.nTriangles; t++)
+				for(int c = 0; c < 3; c++)
+				{
+					D3DXVec3Minimize(&vMin, &vMin, &m_Triangles[t].v[c]);
+					D3DXVec3Maximize(&vMax, &vMax, &m_Triangles[t].v[c]);
+				}
+		}
+		else
+		{
+			const Node& left = m_Nodes[i + 1];
+			const Node& right = m_Nodes[node.iFirst];
+			for(int c = 0; c < 3; c++)
+			{
+				vMin[c] = min(left.fMin[c], right.fMin[c]);
+				vMax[c] = max(left.fMax[c], right.fMax[c]);
+			}
+		}
+		for(int c = 0; c < 3; c++)
+		{
+			node.fMin[c] = vMin[c];
+			node.fMax[c] = vMax[c];
+		}
+	}
+}
+
+UINT TriangleBVHCPU::BuildNode(BuildInput& input, UINT begin, UINT end, UINT iDepth)
+{
+	const UINT iNode = (UINT)m_Nodes.size();
+	m_Nodes.push_back(Node());
+	m_iDepth = max(m_iDepth, iDepth);
+
+	// Split on the centroid bounds; the node bounds are computed bottom up once the
+	// triangles are in leaf order
+	std::vector<UINT>& order = input.order;
+	const std::vector<D3DXVECTOR3>& centroids = input.centroids;
+	D3DXVECTOR3 vCMin(FLT_MAX, FLT_MAX, FLT_MAX), vCMax(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+	for(UINT i = begin; i < end; i++)
+	{
+		D3DXVec3Minimize(&vCMin, &vCMin, &centroids[order[i]]);
+		D3DXVec3Maximize(&vCMax, &vCMax, &centroids[order[i]]);
+	}
+
+	const D3DXVECTOR3 vExt = vCMax - vCMin;
+	UINT mid = begin;
+	if(input.eSplit != BVH_SPLIT_NONE && end - begin > BVH_LEAF_SIZE && max(vExt.x, max(vExt.y, vExt.z)) > 0)
+	{
+		// Past half the depth the halving median split keeps the stack of the queries
+		// from overflowing
+		if(input.eSplit == BVH_SPLIT_SAH && iDepth < BVH_MAX_DEPTH / 2)
+		{
+			mid = SplitSAH(input, begin, end, vCMin, vCMax);
+			if(mid == end && end - begin > BVH_MAX_LEAF_SIZE)
+				mid = begin;
+		}
+		if(mid == begin)
+		{
+			// Median split along the longest axis of the centroids
+			const int axis = (vExt.x >= vExt.y && vExt.x >= vExt.z) ? 0 : (vExt.y >= vExt.z ? 1 : 2);
+			mid = (begin + end) / 2;
+			std::nth_element(order.begin() + begin, order.begin() + mid, order.begin() + end,
+				[&centroids, axis](UINT a, UINT b) { return centroids[a][axis] < centroids[b][axis]; });
+		}
+	}
+	else
+	{
+		mid = end;
+	}
+
+	if(mid == end)
+	{
+		Node& node = m_Nodes[iNode];
+		node.iFirst = begin;
+		node.nTriangles = end - begin;
+		return iNode;
+	}
+
+	BuildNode(input, begin, mid, iDepth + 1);
+	const UINT iRight = BuildNode(input, mid, end, iDepth + 1);
+	m_Nodes[iNode].iFirst = iRight;
+	m_Nodes[iNode].nTriangles = 0;
+	return iNode;
+}
+
+UINT TriangleBVHCPU::SplitSAH(BuildInput& input, UINT begin, UINT end, const D3DXVECTOR3& vCMin,
+	const D3DXVECTOR3& vCMax)
+{
+	struct Bin
+	{
+		D3DXVECTOR3	vMin;
+		D3DXVECTOR3	vMax;
+		UINT		n;
+	};
+
+	std::vector<UINT>& order = input.order;
+	const std::vector<D3DXVECTOR3>& centroids = input.centroids;
+	const UINT n = end - begin;
+	FLOAT fBestCost = FLT_MAX;
+	int iBestAxis = -1, iBestBin = 0;
+	D3DXVECTOR3 vMin(FLT_MAX, FLT_MAX, FLT_MAX), vMax(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+	for(int axis = 0; axis < 3; axis++)
+	{
+		const FLOAT fExt = vCMax[axis] - vCMin[axis];
+		if(fExt <= 0)
+			continue;
+		const FLOAT fScale = BVH_SAH_BINS / fExt;
+
+		Bin bins[BVH_SAH_BINS];
+		for(int b = 0; b < BVH_SAH_BINS; b++)
+		{
+			bins[b].vMin = D3DXVECTOR3(FLT_MAX, FLT_MAX, FLT_MAX);
+			bins[b].vMax = D3DXVECTOR3(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+			bins[b].n = 0;
+		}
+		for(UINT i = begin; i < end; i++)
+		{
+			const UINT t = order[i];
+			const int b = min((int)((centroids[t][axis] - vCMin[axis]) * fScale), BVH_SAH_BINS - 1);
+			D3DXVec3Minimize(&bins[b].vMin, &bins[b].vMin, &input.boxMin[t]);
+			D3DXVec3Maximize(&bins[b].vMax, &bins[b].vMax, &input.boxMax[t]);
+			bins[b].n++;
+		}
+
+		// Sweep the planes between the bins from the right, then from the left
+		FLOAT fRightCost[BVH_SAH_BINS];
+		D3DXVECTOR3 vRMin(FLT_MAX, FLT_MAX, FLT_MAX), vRMax(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+		UINT nRight = 0;
+		for(int b = BVH_SAH_BINS - 1; b > 0; b--)
+		{
+			D3DXVec3Minimize(&vRMin, &vRMin, &bins[b].vMin);
+			D3DXVec3Maximize(&vRMax, &vRMax, &bins[b].vMax);
+			nRight += bins[b].n;
+			fRightCost[b] = nRight ? HalfArea(vRMin, vRMax) * nRight : 0;
+		}
+		D3DXVECTOR3 vLMin(FLT_MAX, FLT_MAX, FLT_MAX), vLMax(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+		UINT nLeft = 0;
+		for(int b = 0; b < BVH_SAH_BINS - 1; b++)
+		{
+			D3DXVec3Minimize(&vLMin, &vLMin, &bins[b].vMin);
+			D3DXVec3Maximize(&vLMax, &vLMax, &bins[b].vMax);
+			nLeft += bins[b].n;
+			if(nLeft == 0 || nLeft == n)
+				continue;
+			const FLOAT fCost = HalfArea(vLMin, vLMax) * nLeft + fRightCost[b + 1];
+			if(fCost < fBestCost)
+			{
+				fBestCost = fCost;
+				iBestAxis = axis;
+				iBestBin = b;
+			}
+		}
+		D3DXVec3Minimize(&vMin, &vMin, &vLMin);
+		D3DXVec3Minimize(&vMin, &vMin, &bins[BVH_SAH_BINS - 1].vMin);
+		D3DXVec3Maximize(&vMax, &vMax, &vLMax);
+		D3DXVec3Maximize(&vMax, &vMax, &bins[BVH_SAH_BINS - 1].vMax);
+	}
+	if(iBestAxis < 0)
+		return begin;
+
+	// Relative to a leaf with all the triangles
+	const FLOAT fArea = HalfArea(vMin, vMax);
+	if(fArea > 0 && BVH_SAH_NODE_COST + fBestCost / fArea >= (FLOAT)n)
+		return end;
+
+	const FLOAT fScale = BVH_SAH_BINS / (vCMax[iBestAxis] - vCMin[iBestAxis]);
+	const FLOAT fCMin = vCMin[iBestAxis];
+	const int axis = iBestAxis, iBin = iBestBin;
+	return (UINT)(std::partition(order.begin() + begin, order.begin() + end,
+		[&centroids, axis, fScale, fCMin, iBin](UINT t)
+		{
+			return min((int)((centroids[t][axis] - fCMin) * fScale), BVH_SAH_BINS - 1) <= iBin;
+		}) - order.begin());
+}
+
+FLOAT TriangleBVHCPU::BoxDistSq(const Node& node, const D3DXVECTOR3& p)
+{
+	FLOAT d = 0;
+	for(int c = 0; c < 3; c++)
+	{
+		FLOAT e = max(node.fMin[c] - p[c], max(p[c] - node.fMax[c], 0.0f));
+		d += e * e;
+	}
+	return d;
+}
+
+bool TriangleBVHCPU::ClosestPoint(const D3DXVECTOR3& p, FLOAT fMaxDistSq, TriangleBVHHit& hit) const
+{
+	if(m_Nodes.empty() || BoxDistSq(m_Nodes[0], p) >= fMaxDistSq)
+		return false;
+
+	FLOAT fBestDistSq = fMaxDistSq;
+	bool bFound = false;
+	UINT stack[BVH_MAX_DEPTH];
+	int nStack = 0;
+	UINT iNode = 0;
+	for(;;)
+	{
+		const Node& node = m_Nodes[iNode];
+		if(node.nTriangles)
+		{
+			for(UINT t = node.iFirst; t < node.iFirst + node.nTriangles; t++)
+			{
+				const LeafTriangle& tri = m_Triangles[t];
+				TriangleFeature eFeature;
+				FLOAT fBary[3];
+				D3DXVECTOR3 q = ClosestPointOnTriangle(p, tri.v[0], tri.v[1], tri.v[2], eFeature, fBary);
+				D3DXVECTOR3 d = p - q;
+				FLOAT fDistSq = Dot(d, d);
+				if(fDistSq < fBestDistSq)
+				{
+					fBestDistSq = fDistSq;
+					bFound = true;
+					hit.iTriangle = tri.iTriangle;
+					hit.eFeature = eFeature;
+					hit.fDistSq = fDistSq;
+					hit.vPoint = q;
+					hit.fBary[0] = fBary[0];
+					hit.fBary[1] = fBary[1];
+					hit.fBary[2] = fBary[2];
+				}
+			}
+		}
+		else
+		{
+			// Descend into the nearer child first; the other one waits on the stack
+			UINT iNear = iNode + 1, iFar = node.iFirst;
+			FLOAT fNear = BoxDistSq(m_Nodes[iNear], p);
+			FLOAT fFar = BoxDistSq(m_Nodes[iFar], p);
+			if(fFar < fNear)
+			{
+				std::swap(iNear, iFar);
+				std::swap(fNear, fFar);
+			}
+			if(fNear < fBestDistSq)
+			{
+				if(fFar < fBestDistSq)
+					stack[nStack++] = iFar;
+				iNode = iNear;
+				continue;
+			}
+		}
+
+		// Pop the next node that can still hold a closer point
+		for(;;)
+		{
+			if(nStack == 0)
+				return bFound;
+			iNode = stack[--nStack];
+			if(BoxDistSq(m_Nodes[iNode], p) < fBestDistSq)
+				break;
+		}
+	}
+}
+
+UINT TriangleBVHCPU::ClosestPoints(const D3DXVECTOR3* pPoints, UINT n, FLOAT fMaxDistSq, TriangleBVHHit* pHits) const
+{
+	int nHits = 0;
+	#pragma omp parallel for schedule(dynamic, 64) reduction(+:nHits)
+	for(int i = 0; i < (int)n; i++)
+	{
+		if(ClosestPoint(pPoints[i], fMaxDistSq, pHits[i]))
+			nHits++;
+		else
+			pHits[i].iTriangle = BVH_NO_HIT;
+	}
+	return (UINT)nHits;
+}
+
+FLOAT TriangleBVHCPU::SignedDistance(const D3DXVECTOR3& p) const
+{
+	TriangleBVHHit hit;
+	if(!ClosestPoint(p, FLT_MAX, hit))
+		return FLT_MAX;
+	const FLOAT fDist = sqrtf(hit.fDistSq);
+	return Dot(p - hit.vPoint, PseudoNormal(hit)) < 0 ? -fDist : fDist;
+}
+
+void TriangleBVHCPU::SignedDistances(const D3DXVECTOR3* pPoints, UINT n, FLOAT* pDist) const
+{
+	#pragma omp parallel for schedule(dynamic, 64)
+	for(int i = 0; i < (int)n; i++)
+		pDist[i] = SignedDistance(pPoints[i]);
+}
+
+FLOAT TriangleBVHCPU::BoxRayEntry(const Node& node, const D3DXVECTOR3& vOrigin, const D3DXVECTOR3& vInvDir,
+	FLOAT fMaxT)
+{
+	FLOAT t0 = 0, t1 = fMaxT;
+	for(int c = 0; c < 3; c++)
+	{
+		FLOAT tNear = (node.fMin[c] - vOrigin[c]) * vInvDir[c];
+		FLOAT tFar = (node.fMax[c] - vOrigin[c]) * vInvDir[c];
+		if(tNear > tFar)
+			std::swap(tNear, tFar);
+		t0 = max(t0, tNear);
+		t1 = min(t1, tFar);
+		if(t0 > t1)
+			return FLT_MAX;
+	}
+	return t0;
+}
+
+bool TriangleBVHCPU::Raycast(const D3DXVECTOR3& vOrigin, const D3DXVECTOR3& vDir, FLOAT fMaxT,
+	TriangleBVHRayHit& hit) const
+{
+	// A zero component gets a huge inverse, so the slab of that axis is all or nothing
+	D3DXVECTOR3 vInvDir;
+	for(int c = 0; c < 3; c++)
+		vInvDir[c] = vDir[c] != 0 ? 1.0f / vDir[c] : 1e30f;
+	if(m_Nodes.empty() || BoxRayEntry(m_Nodes[0], vOrigin, vInvDir, fMaxT) == FLT_MAX)
+		return false;
+
+	FLOAT fBestT = fMaxT;
+	bool bFound = false;
+	UINT stack[BVH_MAX_DEPTH];
+	int nStack = 0;
+	UINT iNode = 0;
+	for(;;)
+	{
+		const Node& node = m_Nodes[iNode];
+		if(node.nTriangles)
+		{
+			for(UINT t = node.iFirst; t < node.iFirst + node.nTriangles; t++)
+			{
+				// Moeller and Trumbore, from either side
+				const LeafTriangle& tri = m_Triangles[t];
+				const D3DXVECTOR3 e1 = tri.v[1] - tri.v[0], e2 = tri.v[2] - tri.v[0];
+				D3DXVECTOR3 pv, qv;
+				D3DXVec3Cross(&pv, &vDir, &e2);
+				const FLOAT fDet = Dot(e1, pv);
+				if(fDet == 0)
+					continue;
+				const FLOAT fInvDet = 1.0f / fDet;
+				const D3DXVECTOR3 tv = vOrigin - tri.v[0];
+				const FLOAT u = Dot(tv, pv) * fInvDet;
+				if(u < 0 || u > 1)
+					continue;
+				D3DXVec3Cross(&qv, &tv, &e1);
+				const FLOAT v = Dot(vDir, qv) * fInvDet;
+				if(v < 0 || u + v > 1)
+					continue;
+				const FLOAT fT = Dot(e2, qv) * fInvDet;
+				if(fT >= 0 && fT < fBestT)
+				{
+					fBestT = fT;
+					bFound = true;
+					hit.iTriangle = tri.iTriangle;
+					hit.fT = fT;
+					hit.fBary[0] = 1 - u - v;
+					hit.fBary[1] = u;
+					hit.fBary[2] = v;
+				}
+			}
+		}
+		else
+		{
+			// Descend into the child the ray enters first
+			UINT iNear = iNode + 1, iFar = node.iFirst;
+			FLOAT fNear = BoxRayEntry(m_Nodes[iNear], vOrigin, vInvDir, fBestT);
+			FLOAT fFar = BoxRayEntry(m_Nodes[iFar], vOrigin, vInvDir, fBestT);
+			if(fFar < fNear)
+			{
+				std::swap(iNear, iFar);
+				std::swap(fNear, fFar);
+			}
+			if(fNear != FLT_MAX)
+			{
+				if(fFar != FLT_MAX)
+					stack[nStack++] = iFar;
+				iNode = iNear;
+				continue;
+			}
+		}
+
+		// Pop the next node the ray still enters before the best hit
+		for(;;)
+		{
+			if(nStack == 0)
+				return bFound;
+			iNode = stack[--nStack];
+			if(BoxRayEntry(m_Nodes[iNode], vOrigin, vInvDir, fBestT) != FLT_MAX)
+				break;
+		}
+	}
+}
+
+UINT TriangleBVHCPU::Raycasts(const D3DXVECTOR3* pOrigins, const D3DXVECTOR3* pDirs, UINT n, FLOAT fMaxT,
+	TriangleBVHRayHit* pHits) const
+{
+	int nHits = 0;
+	#pragma omp parallel for schedule(dynamic, 64) reduction(+:nHits)
+	for(int i = 0; i < (int)n; i++)
+	{
+		if(Raycast(pOrigins[i], pDirs[i], fMaxT, pHits[i]))
+			nHits++;
+		else
+			pHits[i].iTriangle = BVH_NO_HIT;
+	}
+	return (UINT)nHits;
+}
+
+D3DXVECTOR3 TriangleBVHCPU::PseudoNormal(const TriangleBVHHit& hit) const
+{
+	const UINT t = hit.iTriangle;
+	switch(hit.eFeature)
+	{
+	case TRIANGLE_VERTEX0: return m_VertexNormals[m_TriangleVertices[t * 3]];
+	case TRIANGLE_VERTEX1: return m_VertexNormals[m_TriangleVertices[t * 3 + 1]];
+	case TRIANGLE_VERTEX2: return m_VertexNormals[m_TriangleVertices[t * 3 + 2]];
+	case TRIANGLE_EDGE01: return m_EdgeNormals[t * 3];
+	case TRIANGLE_EDGE12: return m_EdgeNormals[t * 3 + 1];
+	case TRIANGLE_EDGE20: return m_EdgeNormals[t * 3 + 2];
+	default: return m_FaceNormals[t];
+	}
+}
+
+FLOAT TriangleBVHCPU::GetSAHCost() const
+{
+	if(m_Nodes.empty())
+		return 0;
+
+	const D3DXVECTOR3 vRootMin(m_Nodes[0].fMin), vRootMax(m_Nodes[0].fMax);
+	const FLOAT fRootArea = HalfArea(vRootMin, vRootMax);
+	if(fRootArea <= 0)
+		return 0;
+	double fCost = 0;
+	for(size_t i = 0; i < m_Nodes.size(); i++)
+	{
+		const Node& node = m_Nodes[i];
+		const FLOAT fArea = HalfArea(D3DXVECTOR3(node.fMin), D3DXVECTOR3(node.fMax));
+		fCost += fArea * (node.nTriangles ? (FLOAT)node.nTriangles : BVH_SAH_NODE_COST);
+	}
+	return (FLOAT)(fCost / fRootArea);
+}
+
+size_t TriangleBVHCPU::GetMemorySize() const
+{
+	return m_Nodes.size() * sizeof(Node) + m_Triangles.size() * sizeof(LeafTriangle) +
+		m_TriangleVertices.size() * sizeof(UINT) +
+		(m_FaceNormals.size() + m_EdgeNormals.size() + m_VertexNormals.size()) * sizeof(D3DXVECTOR3);
+}
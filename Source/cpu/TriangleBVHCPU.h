@@ -0,0 +1,146 @@
+//--------------------------------------------------------------------------------------
+// File: TriangleBVHCPU.h
+//
+// Bounding volume hierarchy over the triangles of a TriangleMesh for exact closest point,
+// signed distance and ray queries. The nodes are split by the surface area heuristic
+// (or at the median) and flattened depth first (the left child follows its parent), and
+// the leaves point into a copy of the triangle corners in the same order, so a query
+// reads both mostly sequentially. The angle-weighted pseudonormals of the faces, edges
+// and vertices give the sign of the distance on closed meshes (Baerentzen and Aanaes,
+// "Signed distance computation using the angle weighted pseudonormal").
+//--------------------------------------------------------------------------------------
+#ifndef CPU_TRIANGLE_BVH_H
+#define CPU_TRIANGLE_BVH_H
+
+#include <vector>
+
+class TriangleMesh;
+
+// Part of a triangle a closest point lies on
+enum TriangleFeature
+{
+	TRIANGLE_FACE,
+	TRIANGLE_VERTEX0,
+	TRIANGLE_VERTEX1,
+	TRIANGLE_VERTEX2,
+	TRIANGLE_EDGE01,
+	TRIANGLE_EDGE12,
+	TRIANGLE_EDGE20,
+};
+
+// How BuildNode divides the triangles of a node
+enum TriangleBVHSplit
+{
+	BVH_SPLIT_MEDIAN,	// halves along the longest axis of the centroids
+	BVH_SPLIT_SAH,		// binned surface area heuristic
+	BVH_SPLIT_NONE,		// a single leaf, so every query tests every triangle
+};
+
+// iTriangle of the batch queries that found nothing
+#define BVH_NO_HIT 0xFFFFFFFF
+
+struct TriangleBVHHit
+{
+	UINT			iTriangle;	// index into TriangleMesh::triangles()
+	TriangleFeature	eFeature;
+	FLOAT			fDistSq;
+	D3DXVECTOR3		vPoint;		// closest point on the mesh
+	FLOAT			fBary[3];	// of vPoint, with respect to the corners of iTriangle
+};
+
+struct TriangleBVHRayHit
+{
+	UINT			iTriangle;	// index into TriangleMesh::triangles()
+	FLOAT			fT;			// the hit is at origin + fT * direction
+	FLOAT			fBary[3];	// of the hit, with respect to the corners of iTriangle
+};
+
+class TriangleBVHCPU
+{
+public:
+	TriangleBVHCPU();
+
+	//! Build over all the triangles of mesh; the mesh is not referenced afterwards
+	void Build(const TriangleMesh& mesh, TriangleBVHSplit eSplit = BVH_SPLIT_SAH);
+
+	/*!
+	 * Closest point of the mesh to p among the points closer than sqrt(fMaxDistSq).
+	 * Returns false (and leaves hit alone) if there is none.
+	 */
+	bool ClosestPoint(const D3DXVECTOR3& p, FLOAT fMaxDistSq, TriangleBVHHit& hit) const;
+	//! ClosestPoint of n points in parallel; the hits of the points with none get
+	//! BVH_NO_HIT. Returns the number of points with a hit.
+	UINT ClosestPoints(const D3DXVECTOR3* pPoints, UINT n, FLOAT fMaxDistSq, TriangleBVHHit* pHits) const;
+
+	//! Pseudonormal of the feature hit lies on; p - hit.vPoint points outwards if the dot
+	//! product with it is positive
+	D3DXVECTOR3 PseudoNormal(const TriangleBVHHit& hit) const;
+
+	//! Distance from p to the mesh, negative inside by the pseudonormal test; FLT_MAX for
+	//! an empty tree
+	FLOAT SignedDistance(const D3DXVECTOR3& p) const;
+	//! SignedDistance of n points in parallel
+	void SignedDistances(const D3DXVECTOR3* pPoints, UINT n, FLOAT* pDist) const;
+
+	/*!
+	 * First triangle the ray from vOrigin along vDir (not necessarily normalized) crosses
+	 * at a t in [0, fMaxT), from either side. Returns false (and leaves hit alone) if
+	 * there is none.
+	 */
+	bool Raycast(const D3DXVECTOR3& vOrigin, const D3DXVECTOR3& vDir, FLOAT fMaxT, TriangleBVHRayHit& hit) const;
+	//! Raycast of n rays in parallel; the hits of the rays that miss get BVH_NO_HIT.
+	//! Returns the number of rays with a hit.
+	UINT Raycasts(const D3DXVECTOR3* pOrigins, const D3DXVECTOR3* pDirs, UINT n, FLOAT fMaxT,
+		TriangleBVHRayHit* pHits) const;
+
+	bool IsEmpty() const { return m_Nodes.empty(); }
+	UINT GetNumNodes() const { return (UINT)m_Nodes.size(); }
+	//! Longest path from the root to a leaf, in nodes
+	UINT GetDepth() const { return m_iDepth; }
+	//! Surface area heuristic cost of the tree: the expected number of node and triangle
+	//! tests of a ray through the root box
+	FLOAT GetSAHCost() const;
+	size_t GetMemorySize() const;
+
+private:
+	struct Node
+	{
+		FLOAT	fMin[3];
+		UINT	iFirst;		// leaf: first triangle, inner node: right child
+		FLOAT	fMax[3];
+		UINT	nTriangles;	// 0 for inner nodes
+	};
+
+	struct LeafTriangle
+	{
+		D3DXVECTOR3	v[3];
+		UINT		iTriangle;
+	};
+
+	struct BuildInput
+	{
+		TriangleBVHSplit			eSplit;
+		std::vector<UINT>			order;
+		std::vector<D3DXVECTOR3>	centroids;
+		std::vector<D3DXVECTOR3>	boxMin;		// per mesh triangle
+		std::vector<D3DXVECTOR3>	boxMax;
+	};
+
+	UINT BuildNode(BuildInput& input, UINT begin, UINT end, UINT iDepth);
+	//! Position of the SAH split of [begin, end) along its best axis, with order
+	//! partitioned around it; end if splitting costs more than a leaf
+	UINT SplitSAH(BuildInput& input, UINT begin, UINT end, const D3DXVECTOR3& vCMin, const D3DXVECTOR3& vCMax);
+	static FLOAT BoxDistSq(const Node& node, const D3DXVECTOR3& p);
+	//! Entry distance of the ray into the node box, or FLT_MAX if it misses it before fMaxT
+	static FLOAT BoxRayEntry(const Node& node, const D3DXVECTOR3& vOrigin, const D3DXVECTOR3& vInvDir, FLOAT fMaxT);
+
+	std::vector<Node>			m_Nodes;
+	std::vector<LeafTriangle>	m_Triangles;	// in leaf order
+	std::vector<UINT>			m_TriangleVertices;	// 3 per mesh triangle
+	std::vector<D3DXVECTOR3>	m_FaceNormals;		// per mesh triangle
+	std::vector<D3DXVECTOR3>	m_EdgeNormals;		// 3 per mesh triangle, edges 01, 12, 20
+	std::vector<D3DXVECTOR3>	m_VertexNormals;
+	UINT						m_iDepth;
+};
+
+#endif
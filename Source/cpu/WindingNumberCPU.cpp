@@ -0,0 +1,263 @@
+#include "DXUT.h"
+#include <algorithm>
+#include <float.h>
+#include "../geometry/Tuple3.h"
+#include "../geometry/TriangleMesh.h"
+#include "WindingNumberCPU.h"
+
+// Triangles per leaf
+#define WINDING_LEAF_SIZE 4
+#define WINDING_MAX_DEPTH 64
+// A cluster is replaced by its dipole beyond WINDING_BETA times its radius; 2 keeps the
+// error well below the 0.5 threshold (Barill et al. use the same)
+#define WINDING_BETA 2.0f
+
+namespace
+{
+	const FLOAT INV_FOUR_PI = 0.25f / D3DX_PI;
+
+	inline FLOAT Dot(const D3DXVECTOR3& a, const D3DXVECTOR3& b)
+	{
+		return a.x * b.x + a.y * b.y + a.z * b.z;
+	}
+
+	/*!
+	 * Signed solid angle of the triangle abc seen from p (Van Oosterom and Strackee),
+	 * positive if p is behind the counterclockwise side
+	 */
+	inline FLOAT SolidAngle(const D3DXVECTOR3& p, const D3DXVECTOR3& a, const D3DXVECTOR3& b, const D3DXVECTOR3& c)
+	{
+		const D3DXVECTOR3 va = a - p, vb = b - p, vc = c - p;
+		const FLOAT la = sqrtf(Dot(va, va));
+		const FLOAT lb = sqrtf(Dot(vb, vb));
+		const FLOAT lc = sqrtf(Dot(vc, vc));
+		D3DXVECTOR3 bc;
+		D3DXVec3Cross(&bc, &vb, &vc);
+		const FLOAT fDet = Dot(va, bc);
+		const FLOAT fDiv = la * lb * lc + Dot(va, vb) * lc + Dot(vb, vc) * la + Dot(vc, va) * lb;
+		return 2.0f * atan2f(fDet, fDiv);
+	}
+}
+
+WindingNumberCPU::WindingNumberCPU()
+{
+}
+
+void WindingNumberCPU::Clear()
+{
+	std::vector<Node>().swap(m_Nodes);
+	std::vector<LeafTriangle>().swap(m_Triangles);
+}
+
+void WindingNumberCPU::Build(const TriangleMesh& mesh)
+{
+	const int nTris = mesh.num_triangles();
+
+	m_Nodes.clear();
+	m_Triangles.clear();
+	if(nTris == 0)
+		return;
+
+	std::vector<D3DXVECTOR3> centroids(nTris);
+	#pragma omp parallel for schedule(static)
+	for(int t = 0; t < nTris; t++)
+	{
+		const Tuple3ui& tri = mesh.triangle_ids(t);
+		centroids[t] = (mesh.vertex(tri.x) + mesh.vertex(tri.y) + mesh.vertex(tri.z)) * (1.0f / 3.0f);
+	}
+
+	std::vector<UINT> order(nTris);
+	for(int t = 0; t < nTris; t++)
+		order[t] = t;
+	m_Nodes.reserve(2 * (nTris / WINDING_LEAF_SIZE + 1));
+	BuildNode(order, centroids, 0, nTris);
+
+	m_Triangles.resize(nTris);
+	#pragma omp parallel for schedule(static)
+	for(int i = 0; i < nTris; i++)
+	{
+		const Tuple3ui& tri = mesh.triangle_ids(order[i]);
+		m_Triangles[i].v[0] = mesh.vertex(tri.x);
+		m_Triangles[i].v[1] = mesh.vertex(tri.y);
+		m_Triangles[i].v[2] = mesh.vertex(tri.z);
+	}
+
+	// Children come after their parent. The radius of an inner node bounds the spheres of
+	// its children rather than its triangles, which only makes it slightly larger.
+	std::vector<FLOAT> areas(m_Nodes.size());
+	for(int i = (int)m_Nodes.size() - 1; i >= 0; i--)
+	{
+		Node& node = m_Nodes[i];
+		if(node.nTriangles)
+		{
+			D3DXVECTOR3 vNormal(0, 0, 0), vWeighted(0, 0, 0), vMean(0, 0, 0);
+			FLOAT fArea = 0;
+			for(UINT t = node.iFirst; t < node.iFirst + node.nTriangles; t++)
+			{
+				const LeafTriangle& tri = m_Triangles[t];
+				D3DXVECTOR3 e0 = tri.v[1] - tri.v[0], e1 = tri.v[2] - tri.v[0], n;
+				D3DXVec3Cross(&n, &e0, &e1);
+				n *= 0.5f;
+				const FLOAT a = sqrtf(Dot(n, n));
+				const D3DXVECTOR3 c = (tri.v[0] + tri.v[1] + tri.v[2]) * (1.0f / 3.0f);
+				vNormal += n;
+				vWeighted += c * a;
+				vMean += c;
+				fArea += a;
+			}
+			node.vCenter = fArea > 0 ? vWeighted / fArea : vMean / (FLOAT)node.nTriangles;
+			node.vAreaNormal = vNormal;
+			FLOAT fRadiusSq = 0;
+			for(UINT t = node.iFirst; t < node.iFirst + node.nTriangles; t++)
+				for(int c = 0; c < 3; c++)
+				{
+					const D3DXVECTOR3 d = m_Triangles[t].v[c] - node.vCenter;
+					fRadiusSq = max(fRadiusSq, Dot(d, d));
+				}
+			node.fRadius = sqrtf(fRadiusSq);
+			areas[i] = fArea;
+		}
+		else
+		{
+			const UINT iLeft = i + 1, iRight = node.iFirst;
+			const Node& left = m_Nodes[iLeft];
+			const Node& right = m_Nodes[iRight];
+			const FLOAT fArea = areas[iLeft] + areas[iRight];
+			node.vCenter = fArea > 0 ? (left.vCenter * areas[iLeft] + right.vCenter * areas[iRight]) / fArea :
+				(left.vCenter + right.vCenter) * 0.5f;
+			node.vAreaNormal = left.vAreaNormal + right.vAreaNormal;
+			const D3DXVECTOR3 dl = left.vCenter - node.vCenter, dr = right.vCenter - node.vCenter;
+			node.fRadius = max(sqrtf(Dot(dl, dl)) + left.fRadius, sqrtf(Dot(dr, dr)) + right.fRadius);
+			areas[i] = fArea;
+		}
+	}
+}
+
+UINT WindingNumberCPU::BuildNode(std::vector<UINT>& order, const std::vector<D3DXVECTOR3>& centroids,
+	UINT begin, UINT end)
+{
+	const UINT iNode = (UINT)m_Nodes.size();
+	m_Nodes.push_back(Node());
+
+	D3DXVECTOR3 vCMin(FLT_MAX, FLT_MAX, FLT_MAX), vCMax(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+	for(UINT i = begin; i < end; i++)
+	{
+		D3DXVec3Minimize(&vCMin, &vCMin, &centroids[order[i]]);
+		D3DXVec3Maximize(&vCMax, &vCMax, &centroids[order[i]]);
+	}
+
+	const D3DXVECTOR3 vExt = vCMax - vCMin;
+	if(end - begin <= WINDING_LEAF_SIZE || max(vExt.x, max(vExt.y, vExt.z)) <= 0)
+	{
+		Node& node = m_Nodes[iNode];
+		node.iFirst = begin;
+		node.nTriangles = end - begin;
+		return iNode;
+	}
+
+	// Median split along the longest axis of the centroids, as BVH_SPLIT_MEDIAN of
+	// TriangleBVHCPU; compact clusters are what lets the dipoles take over early
+	const int axis = (vExt.x >= vExt.y && vExt.x >= vExt.z) ? 0 : (vExt.y >= vExt.z ? 1 : 2);
+	const UINT mid = (begin + end) / 2;
+	std::nth_element(order.begin() + begin, order.begin() + mid, order.begin() + end,
+		[&centroids, axis](UINT a, UINT b) { return centroids[a][axis] < centroids[b][axis]; });
+
+	BuildNode(order, centroids, begin, mid);
+	const UINT iRight = BuildNode(order, centroids, mid, end);
+	m_Nodes[iNode].iFirst = iRight;
+	m_Nodes[iNode].nTriangles = 0;
+	return iNode;
+}
+
+FLOAT WindingNumberCPU::Evaluate(const D3DXVECTOR3& p) const
+{
+	if(m_Nodes.empty())
+		return 0;
+
+	const FLOAT fBetaSq = WINDING_BETA * WINDING_BETA;
+	FLOAT fSum = 0;
+	UINT stack[WINDING_MAX_DEPTH];
+	int nStack = 0;
+	UINT iNode = 0;
+	for(;;)
+	{
+		const Node& node = m_Nodes[iNode];
+		const D3DXVECTOR3 r = node.vCenter - p;
+		const FLOAT fDistSq = Dot(r, r);
+		if(fDistSq > fBetaSq * node.fRadius * node.fRadius)
+		{
+			// Solid angle of a small patch with area vector N at distance r: N.r / |r|^3
+			fSum += Dot(r, node.vAreaNormal) / (fDistSq * sqrtf(fDistSq));
+		}
+		else if(node.nTriangles)
+		{
+			for(UINT t = node.iFirst; t < node.iFirst + node.nTriangles; t++)
+			{
+				const LeafTriangle& tri = m_Triangles[t];
+				fSum += SolidAngle(p, tri.v[0], tri.v[1], tri.v[2]);
+			}
+		}
+		else
+		{
+			stack[nStack++] = node.iFirst;
+			iNode = iNode + 1;
+			continue;
+		}
+
+		if(nStack == 0)
+			break;
+		iNode = stack[--nStack];
+	}
+	return fSum * INV_FOUR_PI;
+}
+
+void WindingNumberCPU::Evaluate(const D3DXVECTOR3* pPoints, UINT n, FLOAT* pWinding) const
+{
+	#pragma omp parallel for schedule(dynamic, 256)
+	for(int i = 0; i < (int)n; i++)
+		pWinding[i] = Evaluate(pPoints[i]);
+}
+
+FLOAT WindingNumberCPU::EvaluateExact(const D3DXVECTOR3& p) const
+{
+	double fSum = 0;
+	for(size_t t = 0; t < m_Triangles.size(); t++)
+	{
+		const LeafTriangle& tri = m_Triangles[t];
+		fSum += SolidAngle(p, tri.v[0], tri.v[1], tri.v[2]);
+	}
+	return (FLOAT)(fSum * INV_FOUR_PI);
+}
+
+D3DXVECTOR4 WindingNumberCPU::ClassifyValue(const D3DXVECTOR3& p, FLOAT fWinding, const D3DXVECTOR4& value,
+	FLOAT fVoxel) const
+{
+	D3DXVECTOR4 r = value;
+	r.w = IsInside(fWinding) ? -fabsf(value.w) : fabsf(value.w);
+
+	const D3DXVECTOR3 n(value.x, value.y, value.z);
+	const FLOAT fLength = sqrtf(Dot(n, n));
+	if(fLength > 0)
+	{
+		// The step reaches the surface point the normal belongs to from either side
+		const D3DXVECTOR3 vStep = n * ((fabsf(value.w) + fVoxel) / fLength);
+		const FLOAT fFront = fabsf(Evaluate(p + vStep));
+		const FLOAT fBack = fabsf(Evaluate(p - vStep));
+		if(IsInside(fFront) && IsInside(fBack))
+		{
+			r.x = r.y = r.z = 0;
+		}
+		else if(fFront > fBack + 0.01f)
+		{
+			r.x = -r.x;
+			r.y = -r.y;
+			r.z = -r.z;
+		}
+	}
+	return r;
+}
+
+size_t WindingNumberCPU::GetMemorySize() const
+{
+	return m_Nodes.size() * sizeof(Node) + m_Triangles.size() * sizeof(LeafTriangle);
+}
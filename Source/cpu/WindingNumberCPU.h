@@ -0,0 +1,75 @@
+//--------------------------------------------------------------------------------------
+// File: WindingNumberCPU.h
+//
+// Generalized winding number of a triangle soup (Jacobson et al., "Robust inside-outside
+// segmentation using generalized winding numbers"): the signed solid angle the triangles
+// subtend at a point over 4 pi. It is 1 inside and 0 outside a closed, consistently
+// oriented mesh and degrades gracefully with holes, flipped or self-intersecting parts.
+// Far clusters of triangles are approximated by a dipole at their area weighted center
+// (Barill et al., "Fast winding numbers for soups and clouds"), so a query costs about
+// the log of the triangle count.
+//--------------------------------------------------------------------------------------
+#ifndef CPU_WINDING_NUMBER_H
+#define CPU_WINDING_NUMBER_H
+
+#include <vector>
+
+class TriangleMesh;
+
+class WindingNumberCPU
+{
+public:
+	WindingNumberCPU();
+
+	//! Build the tree over all the triangles of mesh; the mesh is not referenced afterwards
+	void Build(const TriangleMesh& mesh);
+	void Clear();
+
+	//! Winding number at p, with the dipole approximation for the far clusters
+	FLOAT Evaluate(const D3DXVECTOR3& p) const;
+	//! Winding numbers of n points, in parallel
+	void Evaluate(const D3DXVECTOR3* pPoints, UINT n, FLOAT* pWinding) const;
+	//! Sum of the exact solid angles of every triangle; the reference for Evaluate
+	FLOAT EvaluateExact(const D3DXVECTOR3& p) const;
+
+	//! Inside if the magnitude is at least one half, so a mesh oriented inwards as a
+	//! whole classifies the same as one oriented outwards
+	static bool IsInside(FLOAT fWinding) { return fabsf(fWinding) >= 0.5f; }
+	bool IsInside(const D3DXVECTOR3& p) const { return IsInside(Evaluate(p)); }
+
+	/*!
+	 * Field value at p, whose winding number is fWinding, with the sign of the distance
+	 * in w taken from it (negative inside). A normal in xyz is turned to point out of the
+	 * mesh by comparing the winding numbers a step before and behind the surface along
+	 * it, and dropped if both are inside: that part of the surface is a wall a
+	 * self-intersection left within the volume. fVoxel is the voxel size, the step is |w|
+	 * plus one voxel.
+	 */
+	D3DXVECTOR4 ClassifyValue(const D3DXVECTOR3& p, FLOAT fWinding, const D3DXVECTOR4& value, FLOAT fVoxel) const;
+
+	bool IsEmpty() const { return m_Nodes.empty(); }
+	UINT GetNumNodes() const { return (UINT)m_Nodes.size(); }
+	size_t GetMemorySize() const;
+
+private:
+	struct Node
+	{
+		D3DXVECTOR3	vCenter;	// area weighted centroid of the triangles below
+		FLOAT		fRadius;	// of the sphere around vCenter holding them
+		D3DXVECTOR3	vAreaNormal;	// sum of the area weighted normals, the dipole moment
+		UINT		iFirst;		// leaf: first triangle, inner node: right child
+		UINT		nTriangles;	// 0 for inner nodes
+	};
+
+	struct LeafTriangle
+	{
+		D3DXVECTOR3	v[3];
+	};
+
+	UINT BuildNode(std::vector<UINT>& order, const std::vector<D3DXVECTOR3>& centroids, UINT begin, UINT end);
+
+	std::vector<Node>			m_Nodes;
+	std::vector<LeafTriangle>	m_Triangles;	// in leaf order
+};
+
+#endif
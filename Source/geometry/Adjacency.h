@@ -0,0 +1,198 @@
+#ifndef GEOMETRY_ADJACENCY_HPP
+#   define GEOMETRY_ADJACENCY_HPP
+
+#include <algorithm>
+#include <vector>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+/*!
+ * Adjacency lists in compressed sparse row form: the ids of row r are
+ * ids_[offsets_[r]] .. ids_[offsets_[r+1]-1], in ascending order. That is two arrays
+ * for the whole table, against one tree, and one allocation per entry, for a
+ * std::vector< std::set<int> >.
+ *
+ * build() is a counting sort done in parallel: the entries are cut into one share per
+ * thread, the rows of each share are counted on their own, the counts are turned into
+ * offsets by prefix sums, and each share is then written from its own place in every
+ * row. The shares are consecutive, so each row ends up in the order of the entries and
+ * the table is the same with any number of threads. There are at most as many shares as
+ * entries per row, so the counts take no more memory than the ids or the row offsets.
+ */
+class Adjacency
+{
+    public:
+        void clear()
+        {
+            offsets_.clear();
+            ids_.clear();
+        }
+
+        /*!
+         * Set the table of nrows rows from the entries 0 .. n-1, entry i going to row
+         * row(i) with the id id(i). The ids of a row are in the order of the entries,
+         * which is ascending if id(i) is.
+         */
+        template <typename R, typename I>
+        void build(size_t nrows, size_t n, R row, I id);
+
+        size_t num_rows() const
+        {  return offsets_.empty() ? 0 : offsets_.size() - 1; }
+
+        //! Total number of ids in the table
+        size_t size() const
+        {  return ids_.size(); }
+
+        unsigned int count(size_t r) const
+        {  return offsets_[r + 1] - offsets_[r]; }
+
+        const unsigned int* begin(size_t r) const
+        {  return ids_.empty() ? NULL : &ids_[0] + offsets_[r]; }
+
+        const unsigned int* end(size_t r) const
+        {  return ids_.empty() ? NULL : &ids_[0] + offsets_[r + 1]; }
+
+        //! Whether row r lists id; as std::set::count, the ids being sorted
+        bool contains(size_t r, unsigned int id) const
+        {  return std::binary_search(begin(r), end(r), id); }
+
+        //! Bytes taken by the two arrays
+        size_t memory_size() const
+        {
+            return offsets_.capacity() * sizeof(unsigned int) +
+                   ids_.capacity() * sizeof(unsigned int);
+        }
+
+        //! Replace the offsets of num_rows() rows by offsets[0] = 0 and offsets[r+1] =
+        //! offsets[r] + counts[r], given counts[r] in offsets[r+1]
+        static void prefix_sum(std::vector<unsigned int>& offsets);
+
+        std::vector<unsigned int>& offsets()
+        {  return offsets_; }
+        std::vector<unsigned int>& ids()
+        {  return ids_; }
+
+    private:
+        std::vector<unsigned int>   offsets_;   // num_rows() + 1
+        std::vector<unsigned int>   ids_;
+};
+
+// ---------------------------------------------------------------------------------
+
+inline void Adjacency::prefix_sum(std::vector<unsigned int>& offsets)
+{
+    const int n = (int)offsets.size();
+    if ( n == 0 ) return;
+    offsets[0] = 0;
+#ifdef _OPENMP
+    const int nblocks = n < 100000 ? 1 : omp_get_max_threads();
+#else
+    const int nblocks = 1;
+#endif
+    if ( nblocks == 1 )
+    {
+        for(int i = 1;i < n;++ i)
+            offsets[i] += offsets[i - 1];
+        return;
+    }
+
+    // Each block is summed on its own, then offset by the totals of the blocks before it
+    std::vector<unsigned int> totals(nblocks + 1, 0);
+#ifdef USE_OPENMP
+    #pragma omp parallel for schedule(static, 1)
+#endif
+    for(int b = 0;b < nblocks;++ b)
+    {
+        const int first = 1 + (int)((long long)(n - 1) * b / nblocks);
+        const int last = 1 + (int)((long long)(n - 1) * (b + 1) / nblocks);
+        for(int i = first + 1;i < last;++ i)
+            offsets[i] += offsets[i - 1];
+        totals[b + 1] = last > first ? offsets[last - 1] : 0;
+    }
+    for(int b = 0;b < nblocks;++ b)
+        totals[b + 1] += totals[b];
+#ifdef USE_OPENMP
+    #pragma omp parallel for schedule(static, 1)
+#endif
+    for(int b = 1;b < nblocks;++ b)
+    {
+        const int first = 1 + (int)((long long)(n - 1) * b / nblocks);
+        const int last = 1 + (int)((long long)(n - 1) * (b + 1) / nblocks);
+        for(int i = first;i < last;++ i)
+            offsets[i] += totals[b];
+    }
+}
+
+
+template <typename R, typename I>
+inline void Adjacency::build(size_t nrows, size_t n, R row, I id)
+{
+    offsets_.assign(nrows + 1, 0);
+    ids_.resize(n);
+    const int nentries = (int)n;
+#ifdef _OPENMP
+    // No more shares than entries per row, so counts is no larger than ids_ or the offsets
+    const size_t per_row = std::max(n / std::max(nrows, (size_t)1), (size_t)1);
+    const int nshares = (int)std::min((size_t)omp_get_max_threads(), per_row);
+#else
+    const int nshares = 1;
+#endif
+    if ( nshares == 1 )
+    {
+        for(int i = 0;i < nentries;++ i)
+            ++ offsets_[row(i) + 1];
+        prefix_sum(offsets_);
+        std::vector<unsigned int> next(offsets_.begin(), offsets_.end() - 1);
+        for(int i = 0;i < nentries;++ i)
+            ids_[next[row(i)] ++] = id(i);
+        return;
+    }
+
+    // counts[s * nrows + r]: entries of share s in row r, then the first place of share
+    // s in row r. This is nshares <= max(n / nrows, 1) integers per row, given back at the end.
+    const int rows = (int)nrows;
+    std::vector<unsigned int> counts((size_t)nshares * nrows, 0);
+#ifdef USE_OPENMP
+    #pragma omp parallel for schedule(static, 1)
+#endif
+    for(int s = 0;s < nshares;++ s)
+    {
+        const int last = (int)((long long)nentries * (s + 1) / nshares);
+        unsigned int* mine = &counts[0] + (size_t)s * nrows;
+        for(int i = (int)((long long)nentries * s / nshares);i < last;++ i)
+            ++ mine[row(i)];
+    }
+
+#ifdef USE_OPENMP
+    #pragma omp parallel for schedule(static)
+#endif
+    for(int r = 0;r < rows;++ r)
+    {
+        unsigned int sum = 0;
+        for(int s = 0;s < nshares;++ s)
+        {
+            const unsigned int c = counts[(size_t)s * nrows + r];
+            counts[(size_t)s * nrows + r] = sum;
+            sum += c;
+        }
+        offsets_[r + 1] = sum;
+    }
+    prefix_sum(offsets_);
+
+#ifdef USE_OPENMP
+    #pragma omp parallel for schedule(static, 1)
+#endif
+    for(int s = 0;s < nshares;++ s)
+    {
+        const int last = (int)((long long)nentries * (s + 1) / nshares);
+        unsigned int* mine = &counts[0] + (size_t)s * nrows;
+        for(int i = (int)((long long)nentries * s / nshares);i < last;++ i)
+        {
+            const unsigned int r = row(i);
+            ids_[offsets_[r] + mine[r] ++] = id(i);
+        }
+    }
+}
+
+#endif
@@ -8,12 +8,12 @@
 #include <valarray>
 #include <limits>
 #include <vector>
-#include <set>
-#include <unordered_map>
 
 #include "Triangle.h"
 
 #define USE_OPENMP
+#include "Adjacency.h"
+#include "VertexNormals.h"
 //! Mesh made by a group of triangles
 
 class TriangleMesh
@@ -74,6 +74,9 @@ class TriangleMesh
         std::vector<Tuple3ui>& triangles()
         {  return triangles_; }
 
+        std::vector< D3DXVECTOR3 >& normals()
+        {  return normals_; }
+
         const std::vector< D3DXVECTOR3 >& vertices() const
         {  return vertices_; }
 
@@ -151,12 +154,12 @@ class TriangleMesh
         void translate_z(float dz);
 
         //! Get the triangle face neighbors; for each triangle, return
-        //  a list of its neighbor triangles
+        //  a list of its neighbor triangles, across the edges xy, yz and zx
         void get_face_neighborship(std::vector<NeighborRec>&) const;
-        //! Get the table of neighbors of all vertices
-        void get_vtx_neighborship(std::vector< std::set<int> >&) const;
-        //! Get the adjacent triangles of each vertex
-        void get_vtx_tgls(std::vector< std::set<int> >&) const;
+        //! Get the table of neighbors of all vertices, in ascending order
+        void get_vtx_neighborship(Adjacency&) const;
+        //! Get the adjacent triangles of each vertex, in ascending order
+        void get_vtx_tgls(Adjacency&) const;
 
     private:
         float                           totalArea_;
@@ -168,7 +171,7 @@ class TriangleMesh
 
 // ---------------------------------------------------------------------------------
 
-void TriangleMesh::translate_x(float dx)
+inline void TriangleMesh::translate_x(float dx)
 {
 #ifdef USE_OPENMP
     #pragma omp parallel for default(none) schedule(dynamic, 20000) shared(dx)
@@ -180,7 +183,7 @@ void TriangleMesh::translate_x(float dx)
 }
 
 
-void TriangleMesh::translate_y(float dy)
+inline void TriangleMesh::translate_y(float dy)
 {
 #ifdef USE_OPENMP
     #pragma omp parallel for default(none) schedule(dynamic, 20000) shared(dy)
@@ -192,7 +195,7 @@ void TriangleMesh::translate_y(float dy)
 }
 
 
-void TriangleMesh::translate_z(float dz)
+inline void TriangleMesh::translate_z(float dz)
 {
 #ifdef USE_OPENMP
     #pragma omp parallel for default(none) schedule(dynamic, 20000) shared(dz)
@@ -204,65 +207,43 @@ void TriangleMesh::translate_z(float dz)
 }
 
 
-void TriangleMesh::get_face_neighborship(std::vector<NeighborRec>& neighbors) const
+inline void TriangleMesh::get_face_neighborship(std::vector<NeighborRec>& neighbors) const
 {
-    std::unordered_map< int, std::unordered_map<int, int> > hash;
-    int v0, v1;
+    // Across edge k the neighbor is the first other triangle at vertex k that also has
+    // the other end of the edge
+    Adjacency vtxtgls;
+    get_vtx_tgls(vtxtgls);
 
     neighbors.resize(triangles_.size());
 #ifdef USE_OPENMP
-    #pragma omp parallel for default(none) schedule(dynamic, 20000) shared(neighbors)
+    #pragma omp parallel for default(none) schedule(dynamic, 20000) shared(neighbors, vtxtgls)
     for(int i = 0;i < (int)triangles_.size();++ i)
 #else
     for(size_t i = 0;i < triangles_.size();++ i)
 #endif
-        neighbors[i].num = 0;
-
-    for(size_t i = 0;i < triangles_.size();++ i)
     {
-        // edge 0
-        v0 = triangles_[i].x;
-        v1 = triangles_[i].y;
-        if ( v0 > v1 ) std::swap(v0, v1);   // v0 < v1
-        if ( hash.count(v0) && hash[v0].count(v1) )
+        NeighborRec& rec = neighbors[i];
+        rec.num = 0;
+        for(int k = 0;k < 3;++ k)
         {
-            int fid = hash[v0][v1];
-            neighbors[i].id[neighbors[i].num ++] = fid;
-            neighbors[fid].id[neighbors[fid].num ++] = i;
+            const unsigned int v0 = triangles_[i][k];
+            const unsigned int v1 = triangles_[i][(k + 1) % 3];
+            const unsigned int* end = vtxtgls.end(v0);
+            for(const unsigned int* it = vtxtgls.begin(v0);it != end;++ it)
+            {
+                const Tuple3ui& t = triangles_[*it];
+                if ( *it != (unsigned int)i && (t.x == v1 || t.y == v1 || t.z == v1) )
+                {
+                    rec.id[rec.num ++] = *it;
+                    break;
+                }
+            }
         }
-        else
-            hash[v0][v1] = i;
-
-        // edge 1
-        v0 = triangles_[i].y;
-        v1 = triangles_[i].z;
-        if ( v0 > v1 ) std::swap(v0, v1);
-        if ( hash.count(v0) && hash[v0].count(v1) )
-        {
-            int fid = hash[v0][v1];
-            neighbors[i].id[neighbors[i].num ++] = fid;
-            neighbors[fid].id[neighbors[fid].num ++] = i;
-        }
-        else
-            hash[v0][v1] = i;
-
-        // edge 2
-        v0 = triangles_[i].z;
-        v1 = triangles_[i].x;
-        if ( v0 > v1 ) std::swap(v0, v1);
-        if ( hash.count(v0) && hash[v0].count(v1) )
-        {
-            int fid = hash[v0][v1];
-            neighbors[i].id[neighbors[i].num ++] = fid;
-            neighbors[fid].id[neighbors[fid].num ++] = i;
-        }
-        else
-            hash[v0][v1] = i;
     }
 }
 
 
-void TriangleMesh::update_vertex_areas()
+inline void TriangleMesh::update_vertex_areas()
 {
     const float s = (float)1 / (float)3;
     totalArea_ = 0;
@@ -282,74 +263,57 @@ void TriangleMesh::update_vertex_areas()
 }
 
 
-void TriangleMesh::generate_pseudo_normals()
+inline void TriangleMesh::generate_pseudo_normals()
 {
-    std::vector< D3DXVECTOR3 > tglnmls(triangles_.size());
-    for(size_t i = 0;i < triangles_.size();++ i)
+    // The first triangle with zero area is reported, as the serial loop did
+    int bad = (int)triangles_.size();
+#ifdef USE_OPENMP
+    #pragma omp parallel for default(none) schedule(static) shared(bad)
+#endif
+    for(int i = 0;i < (int)triangles_.size();++ i)
     {
-        tglnmls[i] = Triangle::normal(
+        D3DXVECTOR3 nml = Triangle::normal(
                 vertices_[triangles_[i].x],
                 vertices_[triangles_[i].y],
                 vertices_[triangles_[i].z]);
-        if ( D3DXVec3LengthSq(&tglnmls[i]) < 1E-18 )
+        if ( D3DXVec3LengthSq(&nml) < 1E-18 )
         {
-            fprintf(stderr, "ERROR: triangle has zero area: %.18g\n",
-                    D3DXVec3LengthSq(&tglnmls[i]));
-            exit(1);
+#ifdef USE_OPENMP
+            #pragma omp critical
+#endif
+            bad = min(bad, i);
         }
-		D3DXVec3Normalize(&tglnmls[i], &tglnmls[i]);
     }
-
-    normals_.resize(vertices_.size());
-    memset(&normals_[0], 0, sizeof(D3DXVECTOR3)*vertices_.size());
-    for(size_t i = 0;i < triangles_.size();++ i)
+    if ( bad < (int)triangles_.size() )
     {
-        const D3DXVECTOR3& nml = tglnmls[i];
-        normals_[triangles_[i].x] += nml * Triangle::angle(
-                vertices_[triangles_[i].z],
-                vertices_[triangles_[i].x],
-                vertices_[triangles_[i].y]);
-        normals_[triangles_[i].y] += nml * Triangle::angle(
-                vertices_[triangles_[i].x],
-                vertices_[triangles_[i].y],
-                vertices_[triangles_[i].z]);
-        normals_[triangles_[i].z] += nml * Triangle::angle(
-                vertices_[triangles_[i].y],
-                vertices_[triangles_[i].z],
-                vertices_[triangles_[i].x]);
+        D3DXVECTOR3 nml = Triangle::normal(
+                vertices_[triangles_[bad].x],
+                vertices_[triangles_[bad].y],
+                vertices_[triangles_[bad].z]);
+        fprintf(stderr, "ERROR: triangle has zero area: %.18g\n",
+                D3DXVec3LengthSq(&nml));
+        exit(1);
     }
 
-    for(size_t i = 0;i < vertices_.size();++ i)
+    VertexNormals gen;
+    gen.build(triangles_, vertices_.size());
+    gen.accumulate(vertices_, VertexNormals::ANGLE_WEIGHTED, normals_);
+
+#ifdef USE_OPENMP
+    #pragma omp parallel for default(none) schedule(static)
+#endif
+    for(int i = 0;i < (int)vertices_.size();++ i)
 		D3DXVec3Normalize(&normals_[i], &normals_[i]);
 }
 
 
-void TriangleMesh::generate_normals()
+inline void TriangleMesh::generate_normals()
 {
-    vtxAreas_.resize(vertices_.size(), (float)0);
-    normals_.resize(vertices_.size());
-    memset(&normals_[0], 0, sizeof(D3DXVECTOR3)*vertices_.size());
-    totalArea_ = 0;
-
-    for(int i = 0;i < (int)triangles_.size();++ i)
-    {
-        D3DXVECTOR3& p0 = vertices_[triangles_[i].x];
-        D3DXVECTOR3& p1 = vertices_[triangles_[i].y];
-        D3DXVECTOR3& p2 = vertices_[triangles_[i].z];
-		D3DXVECTOR3 p1p0 = p1 - p0;
-		D3DXVECTOR3 p2p0 = p2 - p0;
-        D3DXVECTOR3 nml;
-		D3DXVec3Cross(&nml, &p1p0, &p2p0);
-		nml *= 0.5f;
-		float area = D3DXVec3Length(&nml);
-        totalArea_ += area;
-
-        for(int j = 0;j < 3;++ j)
-        {
-            vtxAreas_[triangles_[i][j]] += area;
-            normals_[triangles_[i][j]] += nml;
-        }
-    }
+    vtxAreas_.resize(vertices_.size());
+    VertexNormals gen;
+    gen.build(triangles_, vertices_.size());
+    gen.accumulate(vertices_, VertexNormals::AREA_WEIGHTED, normals_,
+            vertices_.empty() ? NULL : &vtxAreas_[0], &totalArea_);
 
     const float alpha = (float)1 / (float)3;
 #ifdef USE_OPENMP
@@ -375,7 +339,7 @@ void TriangleMesh::generate_normals()
  * ......
  */
 
-int TriangleMesh::save_mesh_txt(const char* file) const
+inline int TriangleMesh::save_mesh_txt(const char* file) const
 {
     using namespace std;
 
@@ -419,7 +383,7 @@ int TriangleMesh::save_mesh_txt(const char* file) const
 }
 
 
-int TriangleMesh::load_mesh_txt(const char* file)
+inline int TriangleMesh::load_mesh_txt(const char* file)
 {
     using namespace std;
 
@@ -459,7 +423,7 @@ int TriangleMesh::load_mesh_txt(const char* file)
 }
 
 
-void TriangleMesh::bounding_box(D3DXVECTOR3& low, D3DXVECTOR3& up) const
+inline void TriangleMesh::bounding_box(D3DXVECTOR3& low, D3DXVECTOR3& up) const
 {
     const float inf = std::numeric_limits<float>::infinity();
     low = D3DXVECTOR3(inf, inf, inf);
@@ -480,34 +444,54 @@ void TriangleMesh::bounding_box(D3DXVECTOR3& low, D3DXVECTOR3& up) const
 }
 
 
-void TriangleMesh::get_vtx_neighborship(std::vector< std::set<int> >& tbl) const
+inline void TriangleMesh::get_vtx_neighborship(Adjacency& tbl) const
 {
-    tbl.resize(vertices_.size());
-    for(size_t i = 0;i < vertices_.size();++ i) tbl[i].clear();
-
-    const std::vector<Tuple3ui>::const_iterator end = triangles_.end();
-    for(std::vector<Tuple3ui>::const_iterator it = triangles_.begin();
-            it != end;++ it)
+    Adjacency vtxtgls;
+    get_vtx_tgls(vtxtgls);
+    const std::vector<unsigned int>& tgloffsets = vtxtgls.offsets();
+
+    // The two other corners of every triangle at a vertex, sorted in place and made
+    // unique; then packed into the table
+    std::vector<unsigned int> others(vtxtgls.size() * 2);
+    std::vector<unsigned int>& offsets = tbl.offsets();
+    offsets.assign(vertices_.size() + 1, 0);
+#ifdef USE_OPENMP
+    #pragma omp parallel for default(none) schedule(dynamic, 20000) shared(vtxtgls, tgloffsets, others, offsets)
+#endif
+    for(int i = 0;i < (int)vertices_.size();++ i)
     {
-        tbl[it->x].insert(it->y); tbl[it->x].insert(it->z);
-        tbl[it->y].insert(it->x); tbl[it->y].insert(it->z);
-        tbl[it->z].insert(it->x); tbl[it->z].insert(it->y);
+        unsigned int* first = others.empty() ? NULL : &others[2 * tgloffsets[i]];
+        unsigned int* last = first;
+        for(const unsigned int* it = vtxtgls.begin(i);it != vtxtgls.end(i);++ it)
+            for(int k = 0;k < 3;++ k)
+                if ( triangles_[*it][k] != (unsigned int)i )
+                    *last ++ = triangles_[*it][k];
+        std::sort(first, last);
+        offsets[i + 1] = (unsigned int)(std::unique(first, last) - first);
     }
+    Adjacency::prefix_sum(offsets);
+
+    std::vector<unsigned int>& ids = tbl.ids();
+    ids.resize(offsets.back());
+#ifdef USE_OPENMP
+    #pragma omp parallel for default(none) schedule(dynamic, 20000) shared(tgloffsets, others, offsets, ids)
+#endif
+    for(int i = 0;i < (int)vertices_.size();++ i)
+        if ( offsets[i + 1] > offsets[i] )
+            memcpy(&ids[offsets[i]], &others[2 * tgloffsets[i]],
+                    (offsets[i + 1] - offsets[i]) * sizeof(unsigned int));
 }
 
 /*
  * Return a list of triangles adjacent to each vertex
  */
 
-void TriangleMesh::get_vtx_tgls(std::vector< std::set<int> >& vtx_ts) const
+inline void TriangleMesh::get_vtx_tgls(Adjacency& vtx_ts) const
 {
-    vtx_ts.resize(vertices_.size());
-    for(size_t i = 0;i < triangles_.size();++ i)
-    {
-        vtx_ts[ triangles_[i].x ].insert(i);
-        vtx_ts[ triangles_[i].y ].insert(i);
-        vtx_ts[ triangles_[i].z ].insert(i);
-    }
+    const std::vector<Tuple3ui>& tgls = triangles_;
+    vtx_ts.build(vertices_.size(), triangles_.size() * 3,
+            [&tgls](int c) { return tgls[c / 3][c % 3]; },
+            [](int c) { return (unsigned int)(c / 3); });
 }
 
 
@@ -0,0 +1,202 @@
+#ifndef GEOMETRY_VERTEX_NORMALS_HPP
+#   define GEOMETRY_VERTEX_NORMALS_HPP
+
+#include <string.h>
+#include <vector>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#include "Tuple3.h"
+#include "Triangle.h"
+#include "Adjacency.h"
+
+/*!
+ * Vertex normals summed from the triangles around each vertex. The corners of the
+ * triangles are indexed by vertex (an Adjacency whose row v lists the corners
+ * 3 * triangle + k at vertex v, in triangle order), so every
+ * vertex gathers its own sum and the vertices are done in parallel without any two
+ * threads writing the same one. The order of the additions is the one of a serial
+ * scatter over the triangles, so the sums are the same bit for bit. With one thread
+ * there is nothing to gain from the index and that scatter is done instead.
+ */
+class VertexNormals
+{
+    public:
+        enum Weighting
+        {
+            AREA_WEIGHTED,      // half the cross product of each triangle
+            ANGLE_WEIGHTED      // unit normal times the angle of the corner
+        };
+
+        VertexNormals() : tgls_(NULL), nvtx_(0) { }
+
+        //! Index the corners of tgls by their vertex, of which there are nvtx; tgls
+        //! is referenced until the next build
+        void build(const std::vector<Tuple3ui>& tgls, size_t nvtx);
+
+        //! Set out[v] to zero plus value(c) of each corner c at vertex v, for the
+        //! num_vertices() values of out
+        template <typename T, typename F>
+        void gather(F value, const T& zero, T* out) const;
+
+        /*!
+         * Set nmls[v] to the sum of the weighted normals of the triangles at v, not
+         * normalized, with vtx the positions of the vertices. vtxAreas, if given, gets
+         * the sum of the areas of the triangles at each of the num_vertices() vertices
+         * and totalArea that of all of them.
+         */
+        void accumulate(const std::vector<D3DXVECTOR3>& vtx, Weighting weighting,
+                std::vector<D3DXVECTOR3>& nmls, float* vtxAreas = NULL,
+                float* totalArea = NULL) const;
+
+        size_t num_vertices() const
+        {  return nvtx_; }
+
+    private:
+        //! accumulate with corners(i, c) setting the contributions c[3] of the corners
+        //! of triangle i, the same three if shared, and returning its area
+        template <typename F>
+        void sum_corners(F corners, bool shared, std::vector<D3DXVECTOR3>& nmls,
+                float* vtxAreas, float* totalArea) const;
+
+        const std::vector<Tuple3ui>* tgls_;
+        size_t                      nvtx_;
+        Adjacency                   corners_;    // empty when scattering
+};
+
+// ---------------------------------------------------------------------------------
+
+inline void VertexNormals::build(const std::vector<Tuple3ui>& tgls, size_t nvtx)
+{
+    tgls_ = &tgls;
+    nvtx_ = nvtx;
+    corners_.clear();
+#ifdef _OPENMP
+    if ( omp_get_max_threads() == 1 ) return;
+#else
+    return;
+#endif
+
+    corners_.build(nvtx, tgls.size() * 3,
+            [&tgls](int c) { return tgls[c / 3][c % 3]; },
+            [](int c) { return (unsigned int)c; });
+}
+
+
+template <typename T, typename F>
+inline void VertexNormals::gather(F value, const T& zero, T* out) const
+{
+    const int nvtx = (int)nvtx_;
+    if ( corners_.num_rows() == 0 )
+    {
+        const std::vector<Tuple3ui>& tgls = *tgls_;
+        for(int i = 0;i < nvtx;++ i)
+            out[i] = zero;
+        for(size_t i = 0;i < tgls.size();++ i)
+            for(int j = 0;j < 3;++ j)
+                out[tgls[i][j]] += value((unsigned int)(i * 3 + j));
+        return;
+    }
+
+#ifdef USE_OPENMP
+    #pragma omp parallel for schedule(dynamic, 10000)
+#endif
+    for(int i = 0;i < nvtx;++ i)
+    {
+        T sum = zero;
+        const unsigned int* end = corners_.end(i);
+        for(const unsigned int* it = corners_.begin(i);it != end;++ it)
+            sum += value(*it);
+        out[i] = sum;
+    }
+}
+
+
+template <typename F>
+inline void VertexNormals::sum_corners(F corners, bool shared, std::vector<D3DXVECTOR3>& nmls,
+        float* vtxAreas, float* totalArea) const
+{
+    const std::vector<Tuple3ui>& tgls = *tgls_;
+    const int ntgl = (int)tgls.size();
+    float total = 0;
+
+    if ( corners_.num_rows() == 0 )
+    {
+        nmls.assign(nvtx_, D3DXVECTOR3(0, 0, 0));
+        if ( vtxAreas ) memset(vtxAreas, 0, nvtx_ * sizeof(float));
+        for(int i = 0;i < ntgl;++ i)
+        {
+            D3DXVECTOR3 c[3];
+            const float area = corners(i, c);
+            total += area;
+            for(int j = 0;j < 3;++ j)
+                nmls[tgls[i][j]] += c[j];
+            if ( vtxAreas )
+                for(int j = 0;j < 3;++ j)
+                    vtxAreas[tgls[i][j]] += area;
+        }
+        if ( totalArea ) *totalArea = total;
+        return;
+    }
+
+    // A contribution shared by the three corners is kept once per triangle
+    const int stride = shared ? 1 : 3;
+    std::vector<D3DXVECTOR3> cornernmls(ntgl * stride);
+    std::vector<float> areas(ntgl);
+#ifdef USE_OPENMP
+    #pragma omp parallel for schedule(static)
+#endif
+    for(int i = 0;i < ntgl;++ i)
+    {
+        D3DXVECTOR3 c[3];
+        areas[i] = corners(i, c);
+        for(int j = 0;j < stride;++ j)
+            cornernmls[i * stride + j] = c[j];
+    }
+    nmls.resize(nvtx_);
+    if ( nvtx_ && shared )
+        gather([&cornernmls](unsigned int c) { return cornernmls[c / 3]; }, D3DXVECTOR3(0, 0, 0), &nmls[0]);
+    else if ( nvtx_ )
+        gather([&cornernmls](unsigned int c) { return cornernmls[c]; }, D3DXVECTOR3(0, 0, 0), &nmls[0]);
+    if ( vtxAreas )
+        gather([&areas](unsigned int c) { return areas[c / 3]; }, 0.0f, vtxAreas);
+    if ( totalArea )
+    {
+        // In triangle order too
+        for(int i = 0;i < ntgl;++ i)
+            total += areas[i];
+        *totalArea = total;
+    }
+}
+
+
+inline void VertexNormals::accumulate(const std::vector<D3DXVECTOR3>& vtx, Weighting weighting,
+        std::vector<D3DXVECTOR3>& nmls, float* vtxAreas, float* totalArea) const
+{
+    const std::vector<Tuple3ui>& tgls = *tgls_;
+    if ( weighting == AREA_WEIGHTED )
+    {
+        sum_corners([&vtx, &tgls](int i, D3DXVECTOR3 c[3])
+        {
+            c[0] = c[1] = c[2] = Triangle::weighted_normal(vtx[tgls[i].x], vtx[tgls[i].y], vtx[tgls[i].z]);
+            return D3DXVec3Length(&c[0]);
+        }, true, nmls, vtxAreas, totalArea);
+        return;
+    }
+
+    sum_corners([&vtx, &tgls](int i, D3DXVECTOR3 c[3])
+    {
+        const D3DXVECTOR3& p0 = vtx[tgls[i].x];
+        const D3DXVECTOR3& p1 = vtx[tgls[i].y];
+        const D3DXVECTOR3& p2 = vtx[tgls[i].z];
+        D3DXVECTOR3 nml = Triangle::normal(p0, p1, p2);
+        const float area = 0.5f * D3DXVec3Length(&nml);
+        D3DXVec3Normalize(&nml, &nml);
+        c[0] = nml * Triangle::angle(p2, p0, p1);
+        c[1] = nml * Triangle::angle(p0, p1, p2);
+        c[2] = nml * Triangle::angle(p1, p2, p0);
+        return area;
+    }, false, nmls, vtxAreas, totalArea);
+}
+
+#endif
@@ -0,0 +1,198 @@
+//--------------------------------------------------------------------------------------
+// File: headless/DXUT.h
+//
+// Stand-in for DXUT.h used by the headless (non-Windows) build. It provides the small
+// subset of Win32 types and D3DX math that the mesh reader, the geometry headers and
+// the CPU simulation use, so those sources compile unchanged against either header.
+// The Makefile puts this directory ahead of DXUT/Core on the include path.
+//--------------------------------------------------------------------------------------
+#pragma once
+#ifndef DXUT_H
+#define DXUT_H
+
+#define MESH2POINTS_HEADLESS
+
+#include <assert.h>
+#include <math.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wchar.h>
+#include <algorithm>
+#include <limits>
+
+//--------------------------------------------------------------------------------------
+// Win32 types and macros
+//--------------------------------------------------------------------------------------
+typedef unsigned int        UINT;
+typedef int                 INT;
+typedef float               FLOAT;
+typedef int                 BOOL;
+typedef unsigned char       BYTE;
+typedef unsigned long long  UINT64;
+typedef long long           INT64;
+typedef int                 HRESULT;	// 32 bits as on Win32, so the error codes are negative
+typedef wchar_t             WCHAR;
+#define VOID                void
+
+#ifndef TRUE
+#define TRUE                1
+#endif
+#ifndef FALSE
+#define FALSE               0
+#endif
+#ifndef MAX_PATH
+#define MAX_PATH            260
+#endif
+
+#define S_OK                ((HRESULT)0L)
+#define E_FAIL              ((HRESULT)0x80004005L)
+#define E_OUTOFMEMORY       ((HRESULT)0x8007000EL)
+#define E_INVALIDARG        ((HRESULT)0x80070057L)
+#define SUCCEEDED(hr)       (((HRESULT)(hr)) >= 0)
+#define FAILED(hr)          (((HRESULT)(hr)) < 0)
+
+#define ARRAYSIZE(a)        (sizeof(a) / sizeof(a[0]))
+
+#ifndef V_RETURN
+#define V_RETURN(x)         { hr = (x); if( FAILED(hr) ) { return hr; } }
+#endif
+#ifndef SAFE_DELETE
+#define SAFE_DELETE(p)       { if (p) { delete (p);     (p)=NULL; } }
+#endif
+#ifndef SAFE_DELETE_ARRAY
+#define SAFE_DELETE_ARRAY(p) { if (p) { delete[] (p);   (p)=NULL; } }
+#endif
+
+// windows.h exposes min/max at global scope; the shared sources rely on that
+using std::min;
+using std::max;
+
+//--------------------------------------------------------------------------------------
+// D3DX math subset
+//--------------------------------------------------------------------------------------
+#define D3DX_PI    (3.14159265358979323846f)
+
+struct D3DXVECTOR2
+{
+    FLOAT x, y;
+
+    D3DXVECTOR2() {}
+    D3DXVECTOR2( FLOAT fx, FLOAT fy ) : x(fx), y(fy) {}
+
+    operator FLOAT* () { return &x; }
+    operator const FLOAT* () const { return &x; }
+};
+
+struct D3DXVECTOR3
+{
+    FLOAT x, y, z;
+
+    D3DXVECTOR3() {}
+    D3DXVECTOR3( const FLOAT* pf ) : x(pf[0]), y(pf[1]), z(pf[2]) {}
+    D3DXVECTOR3( FLOAT fx, FLOAT fy, FLOAT fz ) : x(fx), y(fy), z(fz) {}
+
+    operator FLOAT* () { return &x; }
+    operator const FLOAT* () const { return &x; }
+
+    D3DXVECTOR3& operator += ( const D3DXVECTOR3& v ) { x += v.x; y += v.y; z += v.z; return *this; }
+    D3DXVECTOR3& operator -= ( const D3DXVECTOR3& v ) { x -= v.x; y -= v.y; z -= v.z; return *this; }
+    D3DXVECTOR3& operator *= ( FLOAT f ) { x *= f; y *= f; z *= f; return *this; }
+    D3DXVECTOR3& operator /= ( FLOAT f ) { FLOAT fInv = 1.0f / f; x *= fInv; y *= fInv; z *= fInv; return *this; }
+
+    D3DXVECTOR3 operator + () const { return *this; }
+    D3DXVECTOR3 operator - () const { return D3DXVECTOR3(-x, -y, -z); }
+
+    D3DXVECTOR3 operator + ( const D3DXVECTOR3& v ) const { return D3DXVECTOR3(x + v.x, y + v.y, z + v.z); }
+    D3DXVECTOR3 operator - ( const D3DXVECTOR3& v ) const { return D3DXVECTOR3(x - v.x, y - v.y, z - v.z); }
+    D3DXVECTOR3 operator * ( FLOAT f ) const { return D3DXVECTOR3(x * f, y * f, z * f); }
+    D3DXVECTOR3 operator / ( FLOAT f ) const { FLOAT fInv = 1.0f / f; return D3DXVECTOR3(x * fInv, y * fInv, z * fInv); }
+
+    friend D3DXVECTOR3 operator * ( FLOAT f, const D3DXVECTOR3& v ) { return D3DXVECTOR3(f * v.x, f * v.y, f * v.z); }
+
+    bool operator == ( const D3DXVECTOR3& v ) const { return x == v.x && y == v.y && z == v.z; }
+    bool operator != ( const D3DXVECTOR3& v ) const { return x != v.x || y != v.y || z != v.z; }
+};
+
+struct D3DXVECTOR4
+{
+    FLOAT x, y, z, w;
+
+    D3DXVECTOR4() {}
+    D3DXVECTOR4( const FLOAT* pf ) : x(pf[0]), y(pf[1]), z(pf[2]), w(pf[3]) {}
+    D3DXVECTOR4( const D3DXVECTOR3& v, FLOAT f ) : x(v.x), y(v.y), z(v.z), w(f) {}
+    D3DXVECTOR4( FLOAT fx, FLOAT fy, FLOAT fz, FLOAT fw ) : x(fx), y(fy), z(fz), w(fw) {}
+
+    operator FLOAT* () { return &x; }
+    operator const FLOAT* () const { return &x; }
+
+    D3DXVECTOR4& operator += ( const D3DXVECTOR4& v ) { x += v.x; y += v.y; z += v.z; w += v.w; return *this; }
+    D3DXVECTOR4& operator -= ( const D3DXVECTOR4& v ) { x -= v.x; y -= v.y; z -= v.z; w -= v.w; return *this; }
+    D3DXVECTOR4& operator *= ( FLOAT f ) { x *= f; y *= f; z *= f; w *= f; return *this; }
+    D3DXVECTOR4& operator /= ( FLOAT f ) { FLOAT fInv = 1.0f / f; x *= fInv; y *= fInv; z *= fInv; w *= fInv; return *this; }
+
+    D3DXVECTOR4 operator + () const { return *this; }
+    D3DXVECTOR4 operator - () const { return D3DXVECTOR4(-x, -y, -z, -w); }
+
+    D3DXVECTOR4 operator + ( const D3DXVECTOR4& v ) const { return D3DXVECTOR4(x + v.x, y + v.y, z + v.z, w + v.w); }
+    D3DXVECTOR4 operator - ( const D3DXVECTOR4& v ) const { return D3DXVECTOR4(x - v.x, y - v.y, z - v.z, w - v.w); }
+    D3DXVECTOR4 operator * ( FLOAT f ) const { return D3DXVECTOR4(x * f, y * f, z * f, w * f); }
+    D3DXVECTOR4 operator / ( FLOAT f ) const { FLOAT fInv = 1.0f / f; return D3DXVECTOR4(x * fInv, y * fInv, z * fInv, w * fInv); }
+
+    friend D3DXVECTOR4 operator * ( FLOAT f, const D3DXVECTOR4& v ) { return D3DXVECTOR4(f * v.x, f * v.y, f * v.z, f * v.w); }
+
+    bool operator == ( const D3DXVECTOR4& v ) const { return x == v.x && y == v.y && z == v.z && w == v.w; }
+    bool operator != ( const D3DXVECTOR4& v ) const { return x != v.x || y != v.y || z != v.z || w != v.w; }
+};
+
+inline FLOAT D3DXVec3Dot( const D3DXVECTOR3* pV1, const D3DXVECTOR3* pV2 )
+{
+    return pV1->x * pV2->x + pV1->y * pV2->y + pV1->z * pV2->z;
+}
+
+inline FLOAT D3DXVec3LengthSq( const D3DXVECTOR3* pV )
+{
+    return pV->x * pV->x + pV->y * pV->y + pV->z * pV->z;
+}
+
+inline FLOAT D3DXVec3Length( const D3DXVECTOR3* pV )
+{
+    return sqrtf( D3DXVec3LengthSq( pV ) );
+}
+
+inline D3DXVECTOR3* D3DXVec3Cross( D3DXVECTOR3* pOut, const D3DXVECTOR3* pV1, const D3DXVECTOR3* pV2 )
+{
+    D3DXVECTOR3 v( pV1->y * pV2->z - pV1->z * pV2->y,
+                   pV1->z * pV2->x - pV1->x * pV2->z,
+                   pV1->x * pV2->y - pV1->y * pV2->x );
+    *pOut = v;
+    return pOut;
+}
+
+// Like D3DX, a zero-length input yields a zero vector instead of NaNs
+inline D3DXVECTOR3* D3DXVec3Normalize( D3DXVECTOR3* pOut, const D3DXVECTOR3* pV )
+{
+    FLOAT fLen = D3DXVec3Length( pV );
+    if( fLen > 0.0f ) *pOut = *pV / fLen;
+    else *pOut = D3DXVECTOR3( 0, 0, 0 );
+    return pOut;
+}
+
+inline D3DXVECTOR3* D3DXVec3Minimize( D3DXVECTOR3* pOut, const D3DXVECTOR3* pV1, const D3DXVECTOR3* pV2 )
+{
+    pOut->x = pV1->x < pV2->x ? pV1->x : pV2->x;
+    pOut->y = pV1->y < pV2->y ? pV1->y : pV2->y;
+    pOut->z = pV1->z < pV2->z ? pV1->z : pV2->z;
+    return pOut;
+}
+
+inline D3DXVECTOR3* D3DXVec3Maximize( D3DXVECTOR3* pOut, const D3DXVECTOR3* pV1, const D3DXVECTOR3* pV2 )
+{
+    pOut->x = pV1->x > pV2->x ? pV1->x : pV2->x;
+    pOut->y = pV1->y > pV2->y ? pV1->y : pV2->y;
+    pOut->z = pV1->z > pV2->z ? pV1->z : pV2->z;
+    return pOut;
+}
+
+#endif